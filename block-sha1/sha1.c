@@ -11,6 +11,29 @@
 
 #include "sha1.h"
 
+/*
+ * The SHA-1 instructions of x86 (the "SHA extensions") and of ARMv8
+ * (the "crypto extensions") are used when the CPU has them.  Their
+ * intrinsics are compiled for the functions using them only, so the
+ * build does not depend on the CPU it runs on.
+ */
+#if !defined(NO_HW_SHA1) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || \
+     (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define BLK_SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if !defined(NO_HW_SHA1) && defined(__aarch64__) && defined(__linux__) && \
+    (defined(__ARM_FEATURE_CRYPTO) || \
+     (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8))
+#define BLK_SHA1_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
 /*
@@ -223,8 +246,435 @@ static void blk_SHA1_Block(blk_SHA_CTX *ctx, const void *block)
 	ctx->H[4] += E;
 }
 
+static void blk_SHA1_Blocks(blk_SHA_CTX *ctx, const unsigned char *data,
+			    unsigned long nr)
+{
+	while (nr--) {
+		blk_SHA1_Block(ctx, data);
+		data += 64;
+	}
+}
+
+#ifdef BLK_SHA1_X86
+static int blk_SHA1_x86_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!(ecx & (1 << 9)) || !(ecx & (1 << 19)))
+		return 0;	/* SSSE3 and SSE4.1 */
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return !!(ebx & (1 << 29));	/* SHA */
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void blk_SHA1_x86_Blocks(blk_SHA_CTX *ctx, const unsigned char *data,
+				unsigned long nr)
+{
+	__m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+
+	ABCD = _mm_loadu_si128((const __m128i *)ctx->H);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1b);
+	E0 = _mm_set_epi32(ctx->H[4], 0, 0, 0);
+
+	while (nr--) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		/* Rounds 0-3 */
+		MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+		E0 = _mm_add_epi32(E0, MSG0);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+		/* Rounds 4-7 */
+		MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+		/* Rounds 8-11 */
+		MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 12-15 */
+		MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 16-19 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 20-23 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 24-27 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 28-31 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 32-35 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 36-39 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 40-43 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 44-47 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 48-51 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 52-55 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 56-59 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 60-63 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 64-67 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 68-71 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 72-75 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+		/* Rounds 76-79 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+		data += 64;
+	}
+
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1b);
+	_mm_storeu_si128((__m128i *)ctx->H, ABCD);
+	ctx->H[4] = _mm_extract_epi32(E0, 3);
+}
+#endif
+
+#ifdef BLK_SHA1_ARMV8
+static int blk_SHA1_armv8_supported(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_SHA1);
+}
+
+#ifndef __ARM_FEATURE_CRYPTO
+__attribute__((target("+crypto")))
+#endif
+static void blk_SHA1_armv8_Blocks(blk_SHA_CTX *ctx, const unsigned char *data,
+				  unsigned long nr)
+{
+	uint32x4_t ABCD, ABCD_SAVE;
+	uint32_t E0, E0_SAVE, E1;
+	uint32x4_t MSG0, MSG1, MSG2, MSG3, TMP0, TMP1;
+	const uint32x4_t K0 = vdupq_n_u32(0x5a827999);
+	const uint32x4_t K1 = vdupq_n_u32(0x6ed9eba1);
+	const uint32x4_t K2 = vdupq_n_u32(0x8f1bbcdc);
+	const uint32x4_t K3 = vdupq_n_u32(0xca62c1d6);
+
+	ABCD = vld1q_u32(ctx->H);
+	E0 = ctx->H[4];
+
+	while (nr--) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		MSG0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data)));
+		MSG1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+		MSG2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+		MSG3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+		TMP0 = vaddq_u32(MSG0, K0);
+		TMP1 = vaddq_u32(MSG1, K0);
+
+		/* Rounds 0-3 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1cq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG2, K0);
+		MSG0 = vsha1su0q_u32(MSG0, MSG1, MSG2);
+
+		/* Rounds 4-7 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1cq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG3, K0);
+		MSG0 = vsha1su1q_u32(MSG0, MSG3);
+		MSG1 = vsha1su0q_u32(MSG1, MSG2, MSG3);
+
+		/* Rounds 8-11 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1cq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG0, K0);
+		MSG1 = vsha1su1q_u32(MSG1, MSG0);
+		MSG2 = vsha1su0q_u32(MSG2, MSG3, MSG0);
+
+		/* Rounds 12-15 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1cq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG1, K1);
+		MSG2 = vsha1su1q_u32(MSG2, MSG1);
+		MSG3 = vsha1su0q_u32(MSG3, MSG0, MSG1);
+
+		/* Rounds 16-19 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1cq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG2, K1);
+		MSG3 = vsha1su1q_u32(MSG3, MSG2);
+		MSG0 = vsha1su0q_u32(MSG0, MSG1, MSG2);
+
+		/* Rounds 20-23 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG3, K1);
+		MSG0 = vsha1su1q_u32(MSG0, MSG3);
+		MSG1 = vsha1su0q_u32(MSG1, MSG2, MSG3);
+
+		/* Rounds 24-27 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG0, K1);
+		MSG1 = vsha1su1q_u32(MSG1, MSG0);
+		MSG2 = vsha1su0q_u32(MSG2, MSG3, MSG0);
+
+		/* Rounds 28-31 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG1, K1);
+		MSG2 = vsha1su1q_u32(MSG2, MSG1);
+		MSG3 = vsha1su0q_u32(MSG3, MSG0, MSG1);
+
+		/* Rounds 32-35 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG2, K2);
+		MSG3 = vsha1su1q_u32(MSG3, MSG2);
+		MSG0 = vsha1su0q_u32(MSG0, MSG1, MSG2);
+
+		/* Rounds 36-39 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG3, K2);
+		MSG0 = vsha1su1q_u32(MSG0, MSG3);
+		MSG1 = vsha1su0q_u32(MSG1, MSG2, MSG3);
+
+		/* Rounds 40-43 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1mq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG0, K2);
+		MSG1 = vsha1su1q_u32(MSG1, MSG0);
+		MSG2 = vsha1su0q_u32(MSG2, MSG3, MSG0);
+
+		/* Rounds 44-47 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1mq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG1, K2);
+		MSG2 = vsha1su1q_u32(MSG2, MSG1);
+		MSG3 = vsha1su0q_u32(MSG3, MSG0, MSG1);
+
+		/* Rounds 48-51 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1mq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG2, K2);
+		MSG3 = vsha1su1q_u32(MSG3, MSG2);
+		MSG0 = vsha1su0q_u32(MSG0, MSG1, MSG2);
+
+		/* Rounds 52-55 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1mq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG3, K3);
+		MSG0 = vsha1su1q_u32(MSG0, MSG3);
+		MSG1 = vsha1su0q_u32(MSG1, MSG2, MSG3);
+
+		/* Rounds 56-59 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1mq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG0, K3);
+		MSG1 = vsha1su1q_u32(MSG1, MSG0);
+		MSG2 = vsha1su0q_u32(MSG2, MSG3, MSG0);
+
+		/* Rounds 60-63 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG1, K3);
+		MSG2 = vsha1su1q_u32(MSG2, MSG1);
+		MSG3 = vsha1su0q_u32(MSG3, MSG0, MSG1);
+
+		/* Rounds 64-67 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E0, TMP0);
+		TMP0 = vaddq_u32(MSG2, K3);
+		MSG3 = vsha1su1q_u32(MSG3, MSG2);
+
+		/* Rounds 68-71 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E1, TMP1);
+		TMP1 = vaddq_u32(MSG3, K3);
+
+		/* Rounds 72-75 */
+		E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E0, TMP0);
+
+		/* Rounds 76-79 */
+		E0 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+		ABCD = vsha1pq_u32(ABCD, E1, TMP1);
+		E0 += E0_SAVE;
+		ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+		data += 64;
+	}
+
+	vst1q_u32(ctx->H, ABCD);
+	ctx->H[4] = E0;
+}
+#endif
+
+static int blk_SHA1_always_supported(void)
+{
+	return 1;
+}
+
+static const struct blk_SHA1_impl {
+	const char *name;
+	int (*supported)(void);
+	void (*blocks)(blk_SHA_CTX *, const unsigned char *, unsigned long);
+} blk_SHA1_impls[] = {
+#ifdef BLK_SHA1_X86
+	{ "x86-sha", blk_SHA1_x86_supported, blk_SHA1_x86_Blocks },
+#endif
+#ifdef BLK_SHA1_ARMV8
+	{ "armv8-crypto", blk_SHA1_armv8_supported, blk_SHA1_armv8_Blocks },
+#endif
+	{ "portable", blk_SHA1_always_supported, blk_SHA1_Blocks },
+};
+
+static const struct blk_SHA1_impl *blk_SHA1_impl;
+
+static void blk_SHA1_pick(void)
+{
+	int i;
+
+	for (i = 0; !blk_SHA1_impl; i++)
+		if (blk_SHA1_impls[i].supported())
+			blk_SHA1_impl = &blk_SHA1_impls[i];
+}
+
+int blk_SHA1_Select(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(blk_SHA1_impls); i++) {
+		if (strcmp(blk_SHA1_impls[i].name, name))
+			continue;
+		if (!blk_SHA1_impls[i].supported())
+			return -1;
+		blk_SHA1_impl = &blk_SHA1_impls[i];
+		return 0;
+	}
+	return -1;
+}
+
+const char *blk_SHA1_Name(void)
+{
+	blk_SHA1_pick();
+	return blk_SHA1_impl->name;
+}
+
 void blk_SHA1_Init(blk_SHA_CTX *ctx)
 {
+	blk_SHA1_pick();
 	ctx->size = 0;
 
 	/* Initialize H with the magic constants (see FIPS180 for constants) */
@@ -252,12 +702,12 @@ void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return;
-		blk_SHA1_Block(ctx, ctx->W);
+		blk_SHA1_impl->blocks(ctx, (const unsigned char *)ctx->W, 1);
 	}
-	while (len >= 64) {
-		blk_SHA1_Block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		blk_SHA1_impl->blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~63UL));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -12,6 +12,16 @@ typedef struct {
 	unsigned int W[16];
 } blk_SHA_CTX;
 
+/*
+ * Blocks are hashed with the SHA-1 instructions of the CPU when it has
+ * them, and with portable C code otherwise; the choice is made by the
+ * first blk_SHA1_Init().  blk_SHA1_Select() forces an implementation
+ * ("x86-sha", "armv8-crypto" or "portable") and returns -1 if it cannot
+ * be used here; blk_SHA1_Name() tells which one is in use.
+ */
+int blk_SHA1_Select(const char *name);
+const char *blk_SHA1_Name(void);
+
 void blk_SHA1_Init(blk_SHA_CTX *ctx);
 void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
 void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
@@ -20,3 +30,5 @@ void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
 #define git_SHA1_Init	blk_SHA1_Init
 #define git_SHA1_Update	blk_SHA1_Update
 #define git_SHA1_Final	blk_SHA1_Final
+#define git_SHA1_Select	blk_SHA1_Select
+#define git_SHA1_Name	blk_SHA1_Name
@@ -15,6 +15,7 @@
 #include "diffcore.h"
 #include "revision.h"
 #include "bulk-checkin.h"
+#include "thread-utils.h"
 
 static const char * const builtin_add_usage[] = {
 	N_("git add [options] [--] <pathspec>..."),
@@ -22,6 +23,59 @@ static const char * const builtin_add_usage[] = {
 };
 static int patch_interactive, add_interactive, edit_interactive;
 static int take_worktree_changes;
+static int pack_limit, nr_threads;
+
+/*
+ * With add.packLimit paths or more to add, their contents are indexed
+ * all at once first, by index_bulk_checkin_files() in threads and
+ * into one pack, and add_path() then only adds the results in turn.
+ */
+struct hashed_paths {
+	struct bulk_checkin_file *files;
+	int nr, next;
+};
+
+static void hash_paths(struct hashed_paths *hashed, const char **paths,
+		       int nr, int flags)
+{
+	int i;
+
+	memset(hashed, 0, sizeof(*hashed));
+	if (!pack_limit || nr < pack_limit ||
+	    (flags & (ADD_CACHE_INTENT | ADD_CACHE_PRETEND)))
+		return;
+
+	hashed->files = xcalloc(nr, sizeof(*hashed->files));
+	for (i = 0; i < nr; i++) {
+		hashed->files[i].path = paths[i];
+		if (lstat(paths[i], &hashed->files[i].st))
+			die_errno("unable to stat '%s'", paths[i]);
+	}
+	hashed->nr = nr;
+	index_bulk_checkin_files(hashed->files, nr, HASH_WRITE_OBJECT,
+				 nr_threads);
+}
+
+static int add_path(struct hashed_paths *hashed, const char *path, int flags)
+{
+	struct bulk_checkin_file *file;
+
+	if (hashed->next >= hashed->nr)
+		return add_file_to_index(&the_index, path, flags);
+	file = &hashed->files[hashed->next++];
+	if (strcmp(file->path, path))
+		die("BUG: %s added out of order", path);
+	if (file->ret)
+		return error("unable to index file %s", path);
+	return add_hashed_to_index(&the_index, path, &file->st, file->sha1,
+				   flags);
+}
+
+static void clear_hashed_paths(struct hashed_paths *hashed)
+{
+	free(hashed->files);
+	memset(hashed, 0, sizeof(*hashed));
+}
 
 struct update_callback_data {
 	int flags;
@@ -117,10 +171,29 @@ static void warn_add_would_remove(const char *path)
 static void update_callback(struct diff_queue_struct *q,
 			    struct diff_options *opt, void *cbdata)
 {
-	int i;
+	int i, nr = 0, alloc = 0;
 	struct update_callback_data *data = cbdata;
 	const char *implicit_dot = data->implicit_dot;
 	size_t implicit_dot_len = data->implicit_dot_len;
+	struct hashed_paths hashed;
+	const char **paths = NULL;
+
+	for (i = 0; pack_limit && i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		int status;
+
+		if (implicit_dot &&
+		    strncmp_icase(p->one->path, implicit_dot, implicit_dot_len))
+			continue;
+		status = fix_unmerged_status(p, data);
+		if (status != DIFF_STATUS_MODIFIED &&
+		    status != DIFF_STATUS_TYPE_CHANGED)
+			continue;
+		ALLOC_GROW(paths, nr + 1, alloc);
+		paths[nr++] = p->one->path;
+	}
+	hash_paths(&hashed, paths, nr, data->flags);
+	free(paths);
 
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
@@ -144,7 +217,7 @@ static void update_callback(struct diff_queue_struct *q,
 			die(_("unexpected diff status %c"), p->status);
 		case DIFF_STATUS_MODIFIED:
 		case DIFF_STATUS_TYPE_CHANGED:
-			if (add_file_to_index(&the_index, path, data->flags)) {
+			if (add_path(&hashed, path, data->flags)) {
 				if (!(data->flags & ADD_CACHE_IGNORE_ERRORS))
 					die(_("updating files failed"));
 				data->add_errors++;
@@ -164,6 +237,7 @@ static void update_callback(struct diff_queue_struct *q,
 			break;
 		}
 	}
+	clear_hashed_paths(&hashed);
 }
 
 static void update_files_in_cache(const char *prefix, const char **pathspec,
@@ -417,12 +491,25 @@ static int add_config(const char *var, const char *value, void *cb)
 		ignore_add_errors = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "add.packlimit")) {
+		pack_limit = git_config_int(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "pack.threads")) {
+		nr_threads = git_config_int(var, value);
+		if (nr_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    nr_threads);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
 static int add_files(struct dir_struct *dir, int flags)
 {
 	int i, exit_status = 0;
+	struct hashed_paths hashed;
+	const char **paths;
 
 	if (dir->ignored_nr) {
 		fprintf(stderr, _(ignore_error));
@@ -432,12 +519,19 @@ static int add_files(struct dir_struct *dir, int flags)
 		die(_("no files added"));
 	}
 
+	paths = xmalloc(dir->nr * sizeof(*paths));
+	for (i = 0; i < dir->nr; i++)
+		paths[i] = dir->entries[i]->name;
+	hash_paths(&hashed, paths, dir->nr, flags);
+	free(paths);
+
 	for (i = 0; i < dir->nr; i++)
-		if (add_file_to_cache(dir->entries[i]->name, flags)) {
+		if (add_path(&hashed, dir->entries[i]->name, flags)) {
 			if (!ignore_add_errors)
 				die(_("adding files failed"));
 			exit_status = 1;
 		}
+	clear_hashed_paths(&hashed);
 	return exit_status;
 }
 
@@ -454,7 +548,14 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	int implicit_dot = 0;
 	struct update_callback_data update_data;
 
+	pack_limit = 1000;
 	git_config(add_config, NULL);
+#ifndef NO_PTHREADS
+	if (!nr_threads)
+		nr_threads = online_cpus();
+#else
+	nr_threads = 0;
+#endif
 
 	argc = parse_options(argc, argv, prefix, builtin_add_options,
 			  builtin_add_usage, PARSE_OPT_KEEP_ARGV0);
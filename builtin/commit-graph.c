@@ -0,0 +1,94 @@
+/*
+ * Builtin "git commit-graph"
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "commit-graph.h"
+#include "parse-options.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph [--object-dir <objdir>] read"),
+	N_("git commit-graph [--object-dir <objdir>] write [--[no-]progress]"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_read_usage[] = {
+	N_("git commit-graph [--object-dir <objdir>] read"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_write_usage[] = {
+	N_("git commit-graph [--object-dir <objdir>] write [--[no-]progress]"),
+	NULL
+};
+
+static const char *object_dir;
+
+static int graph_read(int argc, const char **argv)
+{
+	static struct option builtin_commit_graph_read_options[] = {
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_commit_graph_read_options,
+			     builtin_commit_graph_read_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_read_usage,
+				   builtin_commit_graph_read_options);
+
+	return read_commit_graph_summary(object_dir);
+}
+
+static int graph_write(int argc, const char **argv)
+{
+	int progress = isatty(2);
+	struct option builtin_commit_graph_write_options[] = {
+		OPT_BOOL(0, "progress", &progress, N_("show progress")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_commit_graph_write_options,
+			     builtin_commit_graph_write_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_write_usage,
+				   builtin_commit_graph_write_options);
+
+	return write_commit_graph_reachable(object_dir, progress);
+}
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	struct option builtin_commit_graph_options[] = {
+		OPT_STRING(0, "object-dir", &object_dir, N_("dir"),
+			   N_("the object directory to store the graph")),
+		OPT_END(),
+	};
+	int result = 0;
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix,
+			     builtin_commit_graph_options,
+			     builtin_commit_graph_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (argc < 1)
+		usage_with_options(builtin_commit_graph_usage,
+				   builtin_commit_graph_options);
+
+	if (!strcmp(argv[0], "read"))
+		result = graph_read(argc, argv);
+	else if (!strcmp(argv[0], "write"))
+		result = graph_write(argc, argv);
+	else {
+		error(_("Unknown subcommand: %s"), argv[0]);
+		usage_with_options(builtin_commit_graph_usage,
+				   builtin_commit_graph_options);
+	}
+
+	return result ? 1 : 0;
+}
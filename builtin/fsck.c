@@ -13,9 +13,11 @@
 #include "dir.h"
 #include "progress.h"
 #include "streaming.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
+#define CHECKED   0x0004 /* fsck_check_buffer() already looked at it */
 
 static int show_root;
 static int show_tags;
@@ -31,6 +33,7 @@ static int write_lost_and_found;
 static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
+static int nr_threads, use_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -73,6 +76,52 @@ static int fsck_error_func(struct object *obj, int type, const char *err, ...)
 	return (type == FSCK_WARN) ? 0 : 1;
 }
 
+/*
+ * The structure checks for trees only need the object's contents, so
+ * they are done by fsck_check_buffer() on the thread that read the
+ * object, without touching the object table.  What they have to say
+ * is collected and printed when the object is checked in order.
+ */
+struct checked_tree {
+	struct tree tree;
+	struct strbuf *out;
+};
+
+__attribute__((format (printf, 3, 4)))
+static int fsck_buffered_error_func(struct object *obj, int type,
+				    const char *err, ...)
+{
+	struct checked_tree *item = (struct checked_tree *)obj;
+	char hex[41];
+	va_list params;
+
+	strbuf_addf(item->out, "%s in %s %s: ",
+		    (type == FSCK_WARN) ? "warning" : "error",
+		    typename(obj->type), sha1_to_hex_r(hex, obj->sha1));
+	va_start(params, err);
+	strbuf_vaddf(item->out, err, params);
+	va_end(params);
+	strbuf_addch(item->out, '\n');
+	return (type == FSCK_WARN) ? 0 : 1;
+}
+
+static void fsck_check_buffer(const unsigned char *sha1, enum object_type type,
+			      unsigned long size, void *buffer,
+			      struct strbuf *out)
+{
+	struct checked_tree item;
+
+	if (type != OBJ_TREE)
+		return;
+	memset(&item, 0, sizeof(item));
+	hashcpy(item.tree.object.sha1, sha1);
+	item.tree.object.type = OBJ_TREE;
+	item.tree.buffer = buffer;
+	item.tree.size = size;
+	item.out = out;
+	fsck_object(&item.tree.object, check_strict, fsck_buffered_error_func);
+}
+
 static struct object_array pending;
 
 static int mark_object(struct object *obj, int type, void *data)
@@ -300,7 +349,8 @@ static int fsck_obj(struct object *obj)
 
 	if (fsck_walk(obj, mark_used, NULL))
 		objerror(obj, "broken links");
-	if (fsck_object(obj, check_strict, fsck_error_func))
+	if (!(obj->flags & CHECKED) &&
+	    fsck_object(obj, check_strict, fsck_error_func))
 		return -1;
 
 	if (obj->type == OBJ_TREE) {
@@ -352,6 +402,9 @@ static int fsck_obj_buffer(const unsigned char *sha1, enum object_type type,
 		errors_found |= ERROR_OBJECT;
 		return error("%s: object corrupt or missing", sha1_to_hex(sha1));
 	}
+	/* verify_pack() has run fsck_check_buffer() on it */
+	if (obj->type == OBJ_TREE)
+		obj->flags |= CHECKED;
 	return fsck_obj(obj);
 }
 
@@ -364,8 +417,19 @@ static int fsck_obj_buffer(const unsigned char *sha1, enum object_type type,
 struct sha1_entry {
 	unsigned long ino;
 	unsigned char sha1[20];
+
+	/* filled in by check_loose_object() */
+	int status;
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+	struct strbuf out;
 };
 
+#define LOOSE_UNCHECKED 0
+#define LOOSE_OK 1
+#define LOOSE_BAD 2
+
 static struct {
 	unsigned long nr;
 	struct sha1_entry *entry[MAX_SHA1_ENTRIES];
@@ -378,6 +442,123 @@ static int ino_compare(const void *_a, const void *_b)
 	return ino1 < ino2 ? -1 : ino1 > ino2 ? 1 : 0;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * Read and hash a loose object, which is what parse_object() spends
+ * its time on, so that fsck_loose_entry() only has to parse it.
+ * Objects that cannot be read are left for fsck_sha1() to report.
+ */
+static void check_loose_object(struct sha1_entry *entry)
+{
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+	int ret;
+
+	type = sha1_object_info(entry->sha1, &size);
+	if (type == OBJ_BLOB && size > big_file_threshold) {
+		/* streaming is not thread-safe */
+		obj_read_lock();
+		ret = check_sha1_signature(entry->sha1, NULL, 0, NULL);
+		obj_read_unlock();
+	} else {
+		buffer = read_sha1_file(entry->sha1, &type, &size);
+		if (!buffer)
+			return;
+		ret = check_sha1_signature(entry->sha1, buffer, size,
+					   typename(type));
+		if (ret < 0 || type == OBJ_BLOB)
+			free(buffer);
+		else {
+			fsck_check_buffer(entry->sha1, type, size, buffer,
+					  &entry->out);
+			entry->buffer = buffer;
+		}
+	}
+	entry->type = type;
+	entry->size = size;
+	entry->status = ret < 0 ? LOOSE_BAD : LOOSE_OK;
+}
+
+static pthread_mutex_t sha1_list_mutex;
+static unsigned long sha1_list_next;
+
+static void *check_loose_objects_thread(void *data)
+{
+	for (;;) {
+		unsigned long i;
+
+		pthread_mutex_lock(&sha1_list_mutex);
+		i = sha1_list_next++;
+		pthread_mutex_unlock(&sha1_list_mutex);
+		if (i >= sha1_list.nr)
+			return NULL;
+		check_loose_object(sha1_list.entry[i]);
+	}
+}
+
+static void check_loose_objects(void)
+{
+	pthread_t *threads = xmalloc(nr_threads * sizeof(*threads));
+	int i;
+
+	sha1_list_next = 0;
+	pthread_mutex_init(&sha1_list_mutex, NULL);
+	enable_obj_read_lock();
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL,
+				   check_loose_objects_thread, NULL))
+			die("unable to create thread");
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&sha1_list_mutex);
+	free(threads);
+}
+#endif
+
+/*
+ * The same as fsck_sha1(), for an object check_loose_object() has
+ * already read and hashed.
+ */
+static int fsck_loose_entry(struct sha1_entry *entry)
+{
+	const unsigned char *sha1 = entry->sha1;
+	struct object *obj = lookup_object(sha1);
+	int eaten = 0;
+
+	if ((obj && obj->parsed) || entry->status == LOOSE_UNCHECKED) {
+		free(entry->buffer);
+		return fsck_sha1(sha1);
+	}
+	if (entry->status == LOOSE_BAD) {
+		error("sha1 mismatch %s", sha1_to_hex(sha1));
+		errors_found |= ERROR_OBJECT;
+		return error("%s: object corrupt or missing",
+			     sha1_to_hex(sha1));
+	}
+
+	if (entry->out.len)
+		fputs(entry->out.buf, stderr);
+	if (entry->type == OBJ_BLOB) {
+		parse_blob_buffer(lookup_blob(sha1), NULL, 0);
+		obj = lookup_object(sha1);
+	} else {
+		obj = parse_object_buffer(sha1, entry->type, entry->size,
+					  entry->buffer, &eaten);
+		if (!eaten)
+			free(entry->buffer);
+	}
+	if (!obj) {
+		errors_found |= ERROR_OBJECT;
+		return error("%s: object corrupt or missing",
+			     sha1_to_hex(sha1));
+	}
+	if (obj->type == OBJ_TREE)
+		obj->flags |= CHECKED;
+	return fsck_obj(obj);
+}
+
 static void fsck_sha1_list(void)
 {
 	int i, nr = sha1_list.nr;
@@ -385,12 +566,19 @@ static void fsck_sha1_list(void)
 	if (SORT_DIRENT)
 		qsort(sha1_list.entry, nr,
 		      sizeof(struct sha1_entry *), ino_compare);
+#ifndef NO_PTHREADS
+	if (use_threads)
+		check_loose_objects();
+#endif
 	for (i = 0; i < nr; i++) {
 		struct sha1_entry *entry = sha1_list.entry[i];
-		unsigned char *sha1 = entry->sha1;
 
 		sha1_list.entry[i] = NULL;
-		fsck_sha1(sha1);
+		if (use_threads)
+			fsck_loose_entry(entry);
+		else
+			fsck_sha1(entry->sha1);
+		strbuf_release(&entry->out);
 		free(entry);
 	}
 	sha1_list.nr = 0;
@@ -398,11 +586,12 @@ static void fsck_sha1_list(void)
 
 static void add_sha1_list(unsigned char *sha1, unsigned long ino)
 {
-	struct sha1_entry *entry = xmalloc(sizeof(*entry));
+	struct sha1_entry *entry = xcalloc(1, sizeof(*entry));
 	int nr;
 
 	entry->ino = ino;
 	hashcpy(entry->sha1, sha1);
+	strbuf_init(&entry->out, 0);
 	nr = sha1_list.nr;
 	if (nr == MAX_SHA1_ENTRIES) {
 		fsck_sha1_list();
@@ -622,9 +811,20 @@ static struct option fsck_opts[] = {
 	OPT_BOOLEAN(0, "lost-found", &write_lost_and_found,
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
+	OPT_INTEGER(0, "threads", &nr_threads,
+		    N_("verify objects in <n> threads")),
 	OPT_END(),
 };
 
+static int fsck_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "pack.threads")) {
+		nr_threads = git_config_int(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_fsck(int argc, const char **argv, const char *prefix)
 {
 	int i, heads;
@@ -633,8 +833,21 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	errors_found = 0;
 	read_replace_refs = 0;
 
+	git_config(fsck_config, NULL);
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
 
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+#ifndef NO_PTHREADS
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))
+		use_threads = 1;
+#else
+	if (nr_threads > 1)
+		warning(_("no threads support, ignoring --threads"));
+#endif
+
 	if (show_progress == -1)
 		show_progress = isatty(2);
 	if (verbose)
@@ -675,7 +888,8 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 		}
 		for (p = packed_git; p; p = p->next) {
 			/* verify gives error messages itself */
-			if (verify_pack(p, fsck_obj_buffer,
+			if (verify_pack(p, fsck_obj_buffer, fsck_check_buffer,
+					use_threads ? nr_threads : 0,
 					progress, count))
 				errors_found |= ERROR_PACK;
 			count += p->num_objects;
@@ -9,6 +9,7 @@
 #include "quote.h"
 #include "parse-options.h"
 #include "exec_cmd.h"
+#include "sha1-batch.h"
 
 static void hash_fd(int fd, const char *type, int write_object, const char *path)
 {
@@ -38,20 +39,108 @@ static void hash_object(const char *path, const char *type, int write_object,
 
 static int no_filters;
 
+/*
+ * Files that are only hashed are opened SHA1_BATCH_NR at a time and
+ * handed to index_fds(), so that small ones are hashed together.  Only
+ * the paths that have already arrived on stdin are batched: callers
+ * write a path and wait for its hash, so the batch is flushed before
+ * every read that could block.
+ */
+static struct index_fd_item stdin_batch[SHA1_BATCH_NR];
+static char *stdin_batch_names[SHA1_BATCH_NR];
+static int stdin_batch_nr;
+
+static void flush_stdin_batch(const char *type)
+{
+	int i;
+
+	index_fds(stdin_batch, stdin_batch_nr, type_from_string(type),
+		  HASH_FORMAT_CHECK);
+	for (i = 0; i < stdin_batch_nr; i++) {
+		struct index_fd_item *item = &stdin_batch[i];
+
+		if (item->ret)
+			die("Unable to hash %s", stdin_batch_names[i]);
+		printf("%s\n", sha1_to_hex(item->sha1));
+		free(stdin_batch_names[i]);
+	}
+	maybe_flush_or_die(stdout, "hash to stdout");
+	stdin_batch_nr = 0;
+}
+
+static void batch_object(const char *path, const char *type)
+{
+	struct index_fd_item *item = &stdin_batch[stdin_batch_nr];
+
+	item->fd = open(path, O_RDONLY);
+	if (item->fd < 0 || fstat(item->fd, &item->st) < 0) {
+		/* report the earlier paths first */
+		int saved_errno = errno;
+		flush_stdin_batch(type);
+		errno = saved_errno;
+		if (item->fd < 0)
+			die_errno("Cannot open '%s'", path);
+		die("Unable to hash %s", path);
+	}
+	stdin_batch_names[stdin_batch_nr] = xstrdup(path);
+	item->path = no_filters ? NULL : stdin_batch_names[stdin_batch_nr];
+	if (++stdin_batch_nr == SHA1_BATCH_NR)
+		flush_stdin_batch(type);
+}
+
+static void hash_stdin_path(struct strbuf *buf, struct strbuf *nbuf,
+			    const char *type, int write_objects)
+{
+	if (buf->buf[0] == '"') {
+		strbuf_reset(nbuf);
+		if (unquote_c_style(nbuf, buf->buf, NULL))
+			die("line is badly quoted");
+		strbuf_swap(buf, nbuf);
+	}
+	if (write_objects)
+		hash_object(buf->buf, type, write_objects,
+		    no_filters ? NULL : buf->buf);
+	else
+		batch_object(buf->buf, type);
+}
+
 static void hash_stdin_paths(const char *type, int write_objects)
 {
+	struct strbuf in = STRBUF_INIT;
 	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
-	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
-		if (buf.buf[0] == '"') {
-			strbuf_reset(&nbuf);
-			if (unquote_c_style(&nbuf, buf.buf, NULL))
-				die("line is badly quoted");
-			strbuf_swap(&buf, &nbuf);
+	for (;;) {
+		char *line, *eol;
+		ssize_t len;
+
+		strbuf_grow(&in, 8192);
+		len = xread(0, in.buf + in.len, 8192);
+		if (len < 0)
+			die_errno("read error on stdin");
+		if (!len)
+			break;
+		strbuf_setlen(&in, in.len + len);
+
+		line = in.buf;
+		while ((eol = memchr(line, '\n', in.buf + in.len - line))) {
+			strbuf_reset(&buf);
+			strbuf_add(&buf, line, eol - line);
+			hash_stdin_path(&buf, &nbuf, type, write_objects);
+			line = eol + 1;
 		}
-		hash_object(buf.buf, type, write_objects,
-		    no_filters ? NULL : buf.buf);
+		strbuf_remove(&in, 0, line - in.buf);
+
+		/* the next read may wait for the caller to read these */
+		if (stdin_batch_nr)
+			flush_stdin_batch(type);
+	}
+	if (in.len) {
+		strbuf_swap(&buf, &in);
+		hash_stdin_path(&buf, &nbuf, type, write_objects);
 	}
+	if (stdin_batch_nr)
+		flush_stdin_batch(type);
+	strbuf_release(&in);
 	strbuf_release(&buf);
 	strbuf_release(&nbuf);
 }
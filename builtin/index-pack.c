@@ -11,6 +11,7 @@
 #include "exec_cmd.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "sha1-batch.h"
 
 static const char index_pack_usage[] =
 "git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
@@ -220,13 +221,108 @@ static unsigned check_objects(void)
 }
 
 
+#ifndef NO_PTHREADS
+/*
+ * When the pack is already on disk, the pack checksum is computed by a
+ * thread of its own that reads back what flush() has let go of, so that
+ * the first pass does not hash the pack stream itself.  flush() only
+ * moves checksum_limit, in steps of CHECKSUM_STEP bytes.
+ */
+#define CHECKSUM_STEP (1024 * 1024)
+
+static int checksum_thread_active;
+static pthread_t checksum_thread;
+static pthread_mutex_t checksum_mutex;
+static pthread_cond_t checksum_cond;
+static off_t checksum_start, checksum_limit, checksum_pending;
+static int checksum_final;
+
+static void *threaded_checksum(void *unused)
+{
+	unsigned char *buf = xmalloc(CHECKSUM_STEP);
+	off_t offset = checksum_start;
+
+	pthread_mutex_lock(&checksum_mutex);
+	for (;;) {
+		off_t limit;
+
+		while (offset == checksum_limit && !checksum_final)
+			pthread_cond_wait(&checksum_cond, &checksum_mutex);
+		limit = checksum_limit;
+		if (offset == limit)
+			break;
+		pthread_mutex_unlock(&checksum_mutex);
+		while (offset < limit) {
+			ssize_t n = limit - offset < CHECKSUM_STEP ?
+				    limit - offset : CHECKSUM_STEP;
+			n = pread(pack_fd, buf, n, offset);
+			if (n <= 0)
+				die_errno(_("cannot pread pack file"));
+			git_SHA1_Update(&input_ctx, buf, n);
+			offset += n;
+		}
+		pthread_mutex_lock(&checksum_mutex);
+	}
+	pthread_mutex_unlock(&checksum_mutex);
+	free(buf);
+	return NULL;
+}
+
+static void start_checksum_thread(void)
+{
+	int ret;
+
+	pthread_mutex_init(&checksum_mutex, NULL);
+	pthread_cond_init(&checksum_cond, NULL);
+	/* what flush() has already hashed */
+	checksum_start = checksum_limit = consumed_bytes - input_offset;
+	checksum_pending = 0;
+	checksum_final = 0;
+	ret = pthread_create(&checksum_thread, NULL, threaded_checksum, NULL);
+	if (ret)
+		die(_("unable to create thread: %s"), strerror(ret));
+	checksum_thread_active = 1;
+}
+
+static void queue_checksum(unsigned int len, int final)
+{
+	checksum_pending += len;
+	if (!final && checksum_pending < CHECKSUM_STEP)
+		return;
+	pthread_mutex_lock(&checksum_mutex);
+	checksum_limit += checksum_pending;
+	checksum_final = final;
+	pthread_cond_signal(&checksum_cond);
+	pthread_mutex_unlock(&checksum_mutex);
+	checksum_pending = 0;
+}
+
+static void finish_checksum_thread(void)
+{
+	if (!checksum_thread_active)
+		return;
+	queue_checksum(0, 1);
+	pthread_join(checksum_thread, NULL);
+	pthread_cond_destroy(&checksum_cond);
+	pthread_mutex_destroy(&checksum_mutex);
+	checksum_thread_active = 0;
+}
+#else
+#define checksum_thread_active 0
+#define queue_checksum(len, final)	(void)0
+#define finish_checksum_thread()	(void)0
+#endif
+
 /* Discard current buffer used content. */
 static void flush(void)
 {
 	if (input_offset) {
 		if (output_fd >= 0)
 			write_or_die(output_fd, input_buffer, input_offset);
-		git_SHA1_Update(&input_ctx, input_buffer, input_offset);
+		if (checksum_thread_active)
+			queue_checksum(input_offset, 0);
+		else
+			git_SHA1_Update(&input_ctx, input_buffer, input_offset);
 		memmove(input_buffer, input_buffer + input_offset, input_len);
 		input_offset = 0;
 	}
@@ -407,6 +503,12 @@ static int is_delta_type(enum object_type type)
 	return (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA);
 }
 
+/*
+ * Inflate the object data at the current position of the input.  Large
+ * blobs are not kept in memory; their name is computed into "sha1" as
+ * they stream by and NULL is returned.  The data of other objects is
+ * returned, and it is up to the caller to hash it.
+ */
 static void *unpack_entry_data(unsigned long offset, unsigned long size,
 			       enum object_type type, unsigned char *sha1)
 {
@@ -418,16 +520,15 @@ static void *unpack_entry_data(unsigned long offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	if (type == OBJ_BLOB && size > big_file_threshold) {
+		buf = fixed_buf;
 		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
 		git_SHA1_Init(&c);
 		git_SHA1_Update(&c, hdr, hdrlen);
-	} else
-		sha1 = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
-		buf = fixed_buf;
-	else
+	} else {
 		buf = xmalloc(size);
+		sha1 = NULL;
+	}
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
@@ -992,6 +1093,169 @@ static void *threaded_second_pass(void *data)
 }
 #endif
 
+/* A non-delta object of the first pass, waiting for its name. */
+struct first_pass_job {
+	struct object_entry *obj;
+	void *data;
+};
+
+/* Name and check non-delta objects of the first pass, and free their data. */
+static void first_pass_objects(struct first_pass_job *jobs, int nr)
+{
+	struct sha1_batch_item items[SHA1_BATCH_NR];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		items[i].buf = jobs[i].data;
+		items[i].len = jobs[i].obj->size;
+		items[i].type = typename(jobs[i].obj->type);
+	}
+	hash_sha1_batch(items, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_entry *obj = jobs[i].obj;
+
+		hashcpy(obj->idx.sha1, items[i].sha1);
+		sha1_object(jobs[i].data, NULL, obj->size, obj->type,
+			    obj->idx.sha1);
+		free(jobs[i].data);
+	}
+}
+
+/*
+ * Without threads, objects are collected here so that they are hashed
+ * together, up to SHA1_BATCH_NR objects or SHA1_BATCH_SIZE bytes.
+ */
+static struct first_pass_job first_pass_batch[SHA1_BATCH_NR];
+static int first_pass_batch_nr;
+static unsigned long first_pass_batch_size;
+
+static void flush_first_pass_batch(void)
+{
+	first_pass_objects(first_pass_batch, first_pass_batch_nr);
+	first_pass_batch_nr = 0;
+	first_pass_batch_size = 0;
+}
+
+static void first_pass_object(struct object_entry *obj, void *data)
+{
+	if (first_pass_batch_nr &&
+	    first_pass_batch_size + obj->size > SHA1_BATCH_SIZE)
+		flush_first_pass_batch();
+	first_pass_batch[first_pass_batch_nr].obj = obj;
+	first_pass_batch[first_pass_batch_nr].data = data;
+	first_pass_batch_nr++;
+	first_pass_batch_size += obj->size;
+	if (first_pass_batch_nr == SHA1_BATCH_NR)
+		flush_first_pass_batch();
+}
+
+#ifndef NO_PTHREADS
+/*
+ * With threads, the main thread only reads the pack, hashes the pack
+ * stream and inflates each object to find where the next one starts;
+ * the inflated non-delta objects are queued for the threads, which
+ * take up to SHA1_BATCH_NR of them at a time to compute their names
+ * together and check them with sha1_object().  The queue holds at
+ * most first_pass_queue_alloc objects and, unless it holds a single
+ * one, first_pass_queue_limit bytes.
+ */
+static struct first_pass_job *first_pass_queue;
+static unsigned int first_pass_queue_alloc;
+static unsigned int first_pass_queue_first, first_pass_queue_nr;
+static unsigned long first_pass_queue_size;
+static unsigned long first_pass_queue_limit = 32 * 1024 * 1024;
+static int first_pass_queue_closed;
+static pthread_cond_t first_pass_cond;
+
+static void *threaded_first_pass(void *unused)
+{
+	work_lock();
+	for (;;) {
+		struct first_pass_job jobs[SHA1_BATCH_NR];
+		int nr = 0;
+
+		while (!first_pass_queue_nr && !first_pass_queue_closed)
+			pthread_cond_wait(&first_pass_cond, &work_mutex);
+		if (!first_pass_queue_nr)
+			break;
+		while (first_pass_queue_nr && nr < SHA1_BATCH_NR) {
+			jobs[nr] = first_pass_queue[first_pass_queue_first];
+			first_pass_queue_first = (first_pass_queue_first + 1) %
+						 first_pass_queue_alloc;
+			first_pass_queue_nr--;
+			first_pass_queue_size -= jobs[nr].obj->size;
+			nr++;
+		}
+		pthread_cond_broadcast(&first_pass_cond);
+		work_unlock();
+
+		first_pass_objects(jobs, nr);
+
+		work_lock();
+	}
+	work_unlock();
+	return NULL;
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_thread();
+	pthread_cond_init(&first_pass_cond, NULL);
+	first_pass_queue_alloc = 64 * nr_threads;
+	first_pass_queue = xcalloc(first_pass_queue_alloc,
+				   sizeof(*first_pass_queue));
+	first_pass_queue_first = first_pass_queue_nr = 0;
+	first_pass_queue_size = 0;
+	first_pass_queue_closed = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void queue_first_pass_object(struct object_entry *obj, void *data)
+{
+	unsigned int pos;
+
+	work_lock();
+	while (first_pass_queue_nr == first_pass_queue_alloc ||
+	       (first_pass_queue_nr &&
+		first_pass_queue_size + obj->size > first_pass_queue_limit))
+		pthread_cond_wait(&first_pass_cond, &work_mutex);
+	pos = (first_pass_queue_first + first_pass_queue_nr) %
+	      first_pass_queue_alloc;
+	first_pass_queue[pos].obj = obj;
+	first_pass_queue[pos].data = data;
+	first_pass_queue_nr++;
+	first_pass_queue_size += obj->size;
+	pthread_cond_broadcast(&first_pass_cond);
+	work_unlock();
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	work_lock();
+	first_pass_queue_closed = 1;
+	pthread_cond_broadcast(&first_pass_cond);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	free(first_pass_queue);
+	first_pass_queue = NULL;
+	pthread_cond_destroy(&first_pass_cond);
+	cleanup_thread();
+}
+#else
+#define queue_first_pass_object(obj, data)	first_pass_object((obj), (data))
+#define finish_first_pass_threads()	(void)0
+#endif
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -1000,10 +1264,19 @@ static void *threaded_second_pass(void *data)
  */
 static void parse_pack_objects(unsigned char *sha1)
 {
-	int i, nr_delays = 0;
+	int i, nr_delays = 0, use_threads = 0;
 	struct delta_entry *delta = deltas;
 	struct stat st;
 
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		use_threads = 1;
+		start_first_pass_threads();
+		if (!from_stdin)
+			start_checksum_thread();
+	}
+#endif
+
 	if (verbose)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
@@ -1016,20 +1289,27 @@ static void parse_pack_objects(unsigned char *sha1)
 			nr_deltas++;
 			delta->obj_no = i;
 			delta++;
+			free(data);
 		} else if (!data) {
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
-		free(data);
+		} else if (use_threads)
+			queue_first_pass_object(obj, data);
+		else
+			first_pass_object(obj, data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	if (use_threads)
+		finish_first_pass_threads();
+	else
+		flush_first_pass_batch();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
 	flush();
+	finish_checksum_thread();
 	git_SHA1_Final(sha1, &input_ctx);
 	if (hashcmp(fill(20), sha1))
 		die(_("pack is corrupted (SHA1 mismatch)"));
@@ -1263,6 +1543,8 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
+		  const char *final_bloom_name, const char *curr_bloom_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -1314,6 +1596,32 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	/* before the .idx, so that whoever sees the pack sees it too */
+	if (curr_rev_name) {
+		if (final_rev_name != curr_rev_name) {
+			if (!final_rev_name) {
+				snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+					 get_object_directory(), sha1_to_hex(sha1));
+				final_rev_name = name;
+			}
+			if (move_temp_to_file(curr_rev_name, final_rev_name))
+				die(_("cannot store reverse index file"));
+		} else
+			chmod(final_rev_name, 0444);
+	}
+	if (curr_bloom_name) {
+		if (final_bloom_name != curr_bloom_name) {
+			if (!final_bloom_name) {
+				snprintf(name, sizeof(name), "%s/pack/pack-%s.bloom",
+					 get_object_directory(), sha1_to_hex(sha1));
+				final_bloom_name = name;
+			}
+			if (move_temp_to_file(curr_bloom_name, final_bloom_name))
+				die(_("cannot store bloom filter file"));
+		} else
+			chmod(final_bloom_name, 0444);
+	}
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.idx",
@@ -1357,6 +1665,20 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebloomfilter")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_BLOOM;
+		else
+			opts->flags &= ~WRITE_BLOOM;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1489,13 +1811,15 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_pack, *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	const char *curr_pack, *curr_index, *curr_rev, *curr_bloom;
+	const char *index_name = NULL, *pack_name = NULL, *rev_name = NULL;
+	const char *bloom_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
-	char *index_name_buf = NULL, *keep_name_buf = NULL;
+	char *index_name_buf = NULL, *keep_name_buf = NULL, *rev_name_buf = NULL;
+	char *bloom_name_buf = NULL;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
-	unsigned char pack_sha1[20];
+	unsigned char pack_sha1[20], pack_checksum[20];
 	unsigned foreign_nr = 1;	/* zero is a "good" value, assume bad */
 
 	if (argc == 2 && !strcmp(argv[1], "-h"))
@@ -1504,6 +1828,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	read_replace_refs = 0;
 
 	reset_pack_idx_option(&opts);
+	opts.flags |= WRITE_REV;
 	git_config(git_index_pack_config, &opts);
 	if (prefix && chdir(prefix))
 		die(_("Cannot come back to cwd"));
@@ -1598,6 +1923,26 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		strcpy(index_name_buf + len - 5, ".idx");
 		index_name = index_name_buf;
 	}
+	if (index_name && (opts.flags & WRITE_REV)) {
+		int len = strlen(index_name);
+		if (has_extension(index_name, ".idx")) {
+			rev_name_buf = xmalloc(len + 1);
+			memcpy(rev_name_buf, index_name, len - 4);
+			strcpy(rev_name_buf + len - 4, ".rev");
+			rev_name = rev_name_buf;
+		} else
+			opts.flags &= ~WRITE_REV;
+	}
+	if (index_name && (opts.flags & WRITE_BLOOM)) {
+		int len = strlen(index_name);
+		if (has_extension(index_name, ".idx")) {
+			bloom_name_buf = xmalloc(len + 3);
+			memcpy(bloom_name_buf, index_name, len - 4);
+			strcpy(bloom_name_buf + len - 4, ".bloom");
+			bloom_name = bloom_name_buf;
+		} else
+			opts.flags &= ~WRITE_BLOOM;
+	}
 	if (keep_msg && !keep_name && pack_name) {
 		int len = strlen(pack_name);
 		if (!has_extension(pack_name, ".pack"))
@@ -1643,12 +1988,19 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	idx_objects = xmalloc((nr_objects) * sizeof(struct pack_idx_entry *));
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
+	hashcpy(pack_checksum, pack_sha1);
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	curr_rev = write_rev_file(rev_name, idx_objects, nr_objects,
+				  pack_checksum, &opts);
+	curr_bloom = write_bloom_file(bloom_name, idx_objects, nr_objects,
+				      pack_sha1, &opts);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_name, curr_rev,
+		      bloom_name, curr_bloom,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
@@ -1656,10 +2008,16 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	free(objects);
 	free(index_name_buf);
 	free(keep_name_buf);
+	free(rev_name_buf);
+	free(bloom_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_name == NULL)
+		free((void *) curr_rev);
+	if (bloom_name == NULL)
+		free((void *) curr_bloom);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -0,0 +1,95 @@
+/*
+ * Builtin "git multi-pack-index"
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "midx.h"
+#include "parse-options.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir <objdir>] read"),
+	N_("git multi-pack-index [--object-dir <objdir>] write [--preferred-pack=<pack>]"),
+	NULL
+};
+
+static const char * const builtin_multi_pack_index_read_usage[] = {
+	N_("git multi-pack-index [--object-dir <objdir>] read"),
+	NULL
+};
+
+static const char * const builtin_multi_pack_index_write_usage[] = {
+	N_("git multi-pack-index [--object-dir <objdir>] write [--preferred-pack=<pack>]"),
+	NULL
+};
+
+static const char *object_dir;
+
+static int midx_read(int argc, const char **argv)
+{
+	static struct option builtin_multi_pack_index_read_options[] = {
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_multi_pack_index_read_options,
+			     builtin_multi_pack_index_read_usage, 0);
+	if (argc)
+		usage_with_options(builtin_multi_pack_index_read_usage,
+				   builtin_multi_pack_index_read_options);
+
+	return read_midx_summary(object_dir);
+}
+
+static int midx_write(int argc, const char **argv)
+{
+	const char *preferred_pack = NULL;
+	struct option builtin_multi_pack_index_write_options[] = {
+		OPT_STRING(0, "preferred-pack", &preferred_pack, N_("pack"),
+			   N_("pack to take objects from when they are in several packs")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_multi_pack_index_write_options,
+			     builtin_multi_pack_index_write_usage, 0);
+	if (argc)
+		usage_with_options(builtin_multi_pack_index_write_usage,
+				   builtin_multi_pack_index_write_options);
+
+	return write_midx_file(object_dir, preferred_pack);
+}
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	struct option builtin_multi_pack_index_options[] = {
+		OPT_STRING(0, "object-dir", &object_dir, N_("dir"),
+			   N_("the object directory containing the packs")),
+		OPT_END(),
+	};
+	int result = 0;
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix,
+			     builtin_multi_pack_index_options,
+			     builtin_multi_pack_index_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (argc < 1)
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+
+	if (!strcmp(argv[0], "read"))
+		result = midx_read(argc, argv);
+	else if (!strcmp(argv[0], "write"))
+		result = midx_write(argc, argv);
+	else {
+		error(_("Unknown subcommand: %s"), argv[0]);
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+	}
+
+	return result ? 1 : 0;
+}
@@ -18,6 +18,10 @@
 #include "refs.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "pack-bitmap.h"
+#include "delta-islands.h"
+#include "string-list.h"
+#include "pack-mtimes.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -49,6 +53,7 @@ struct object_entry {
 	unsigned char no_try_delta;
 	unsigned char tagged; /* near the very tip of refs */
 	unsigned char filled; /* assigned write-order */
+	unsigned char write_ahead; /* claimed for write-ahead deflating */
 };
 
 /*
@@ -65,6 +70,17 @@ static int non_empty;
 static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static unsigned long unpack_unreachable_expiration;
+
+/*
+ * --cruft: pack the objects that are neither in a kept pack nor in an
+ * alternate, and record when each of them was last written (from the
+ * loose object, the .mtimes of a cruft pack or the pack itself) in
+ * cruft_mtime[], indexed like objects[].
+ */
+static int cruft;
+static unsigned long cruft_expiration;
+static uint32_t *cruft_mtime;
+static uint32_t cruft_mtime_alloc;
 static int local;
 static int incremental;
 static int ignore_packed_keep;
@@ -88,6 +104,44 @@ static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
 
+/*
+ * Reachability bitmaps: use an existing .bitmap to enumerate the
+ * objects to send, and/or write one for the pack we create.
+ */
+static int use_bitmap_index = 1;
+static int write_bitmap_index;
+static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
+
+/* packs named with --keep-pack are treated as if they had a .keep file */
+static struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
+
+/*
+ * Objects of the bitmapped pack that are sent by copying their bytes
+ * out of it (see reuse_partial_packfile_from_bitmap()).  They are not
+ * in objects[] and are written before everything else.
+ */
+static int allow_pack_reuse = 1;
+static struct packed_git *reuse_packfile;
+static uint32_t reuse_packfile_objects;
+static struct bitmap *reuse_packfile_bitmap;
+
+/*
+ * Delta islands: never use a base that is missing from an island
+ * the object to be deltified is in.
+ */
+static int use_delta_islands;
+
+static struct commit **indexed_commits;
+static unsigned int indexed_commits_nr;
+static unsigned int indexed_commits_alloc;
+
+static void index_commit_for_bitmap(struct commit *commit)
+{
+	ALLOC_GROW(indexed_commits, indexed_commits_nr + 1,
+		   indexed_commits_alloc);
+	indexed_commits[indexed_commits_nr++] = commit;
+}
+
 /*
  * The object names in objects array are hashed with this hashtable,
  * to help looking up the entry by object name.
@@ -104,6 +158,15 @@ static uint32_t written, written_delta;
 static uint32_t reused, reused_delta;
 
 
+#ifndef NO_PTHREADS
+/* the object store's own lock, see enable_obj_read_lock() */
+#define read_lock()		obj_read_lock()
+#define read_unlock()		obj_read_unlock()
+#else
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#endif
+
 static void *get_delta(struct object_entry *entry)
 {
 	unsigned long size, base_size, delta_size;
@@ -240,6 +303,322 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+/*
+ * Can the data of "entry" be copied as is from the pack it is in?
+ * "usable_delta" tells whether it is to be written as a delta.
+ */
+static int reuse_entry_data(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	if (entry->type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	return 1;		/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * Streaming reads the packs without taking the object store's lock,
+ * so hold it for as long as the stream is open.
+ */
+static struct git_istream *open_locked_istream(const unsigned char *sha1,
+					       enum object_type *type,
+					       unsigned long *size)
+{
+	struct git_istream *st;
+
+	read_lock();
+	st = open_istream(sha1, type, size, NULL);
+	if (!st)
+		read_unlock();
+	return st;
+}
+
+static void close_locked_istream(struct git_istream *st)
+{
+	close_istream(st);
+	read_unlock();
+}
+
+/*
+ * Write-ahead deflating: when several threads are available, the
+ * objects that are not copied from an existing pack are read, deltified
+ * if need be, and deflated by worker threads running a little ahead of
+ * the writer in write order.  The writer still writes every object
+ * itself, in order, and only picks up the result from the worker, so
+ * the offsets and the pack are the same as with a single thread.
+ *
+ * The workers take the positions of write_order[] in turn and keep
+ * their result in a ring of slots, at most write_ahead_window
+ * positions and max_write_ahead_size bytes ahead of the writer.
+ * Whoever, worker or writer, first gets to an object sets its
+ * write_ahead flag; the other one leaves it alone.
+ */
+#ifndef NO_PTHREADS
+
+enum write_ahead_state {
+	WRITE_AHEAD_SKIPPED = 0,
+	WRITE_AHEAD_BUSY,
+	WRITE_AHEAD_DONE,
+	WRITE_AHEAD_TAKEN
+};
+
+struct write_ahead_slot {
+	struct object_entry *entry;
+	enum write_ahead_state state;
+	int usable_delta;	/* delta or full object? */
+	enum object_type type;
+	void *buf;		/* deflated data */
+	unsigned long size;	/* uncompressed size */
+	unsigned long datalen;	/* compressed size */
+};
+
+static struct object_entry **write_ahead_order;
+static uint32_t write_ahead_nr;
+static uint32_t write_ahead_next;	/* next position for a worker */
+static uint32_t write_ahead_retired;	/* the writer is done before this */
+static uint32_t write_ahead_window;
+static struct write_ahead_slot *write_ahead_slots;
+static unsigned long write_ahead_size;
+static unsigned long max_write_ahead_size = 32 * 1024 * 1024;
+static int write_ahead_threads;
+static pthread_t *write_ahead_workers;
+
+static pthread_mutex_t write_ahead_mutex;
+static pthread_cond_t write_ahead_cond;
+#define write_ahead_lock()	pthread_mutex_lock(&write_ahead_mutex)
+#define write_ahead_unlock()	pthread_mutex_unlock(&write_ahead_mutex)
+
+/* Mirrors the decisions of write_object() for an unlimited pack. */
+static int want_write_ahead(struct object_entry *entry)
+{
+	int usable_delta = !!entry->delta;
+
+	if (entry->preferred_base || reuse_entry_data(entry, usable_delta))
+		return 0;
+	if (!usable_delta)	/* big blobs are streamed by the writer */
+		return !(entry->type == OBJ_BLOB &&
+			 entry->size > big_file_threshold);
+	/* cached deltas may have been deflated already */
+	return !(entry->delta_data && entry->z_delta_size);
+}
+
+static void deflate_ahead(struct write_ahead_slot *slot)
+{
+	struct object_entry *entry = slot->entry;
+	unsigned long size;
+	void *buf;
+
+	if (!slot->usable_delta) {
+		buf = read_sha1_file(entry->idx.sha1, &slot->type, &size);
+		if (!buf)
+			die(_("unable to read %s"), sha1_to_hex(entry->idx.sha1));
+	} else {
+		/* the writer decides between ofs- and ref-delta */
+		size = entry->delta_size;
+		if (entry->delta_data) {
+			buf = entry->delta_data;
+			entry->delta_data = NULL;
+		} else
+			buf = get_delta(entry);
+	}
+	slot->datalen = do_compress(&buf, size);
+	slot->buf = buf;
+	slot->size = size;
+}
+
+static void *write_ahead_worker(void *unused)
+{
+	write_ahead_lock();
+	for (;;) {
+		struct write_ahead_slot *slot;
+		struct object_entry *entry;
+
+		while (write_ahead_next < write_ahead_nr &&
+		       (write_ahead_next >= write_ahead_retired + write_ahead_window ||
+			write_ahead_size >= max_write_ahead_size))
+			pthread_cond_wait(&write_ahead_cond, &write_ahead_mutex);
+		if (write_ahead_next >= write_ahead_nr)
+			break;
+
+		entry = write_ahead_order[write_ahead_next];
+		slot = &write_ahead_slots[write_ahead_next % write_ahead_window];
+		write_ahead_next++;
+		memset(slot, 0, sizeof(*slot));
+		slot->entry = entry;
+		if (entry->write_ahead || !want_write_ahead(entry))
+			continue;
+		entry->write_ahead = 1;
+		slot->usable_delta = !!entry->delta;
+		slot->state = WRITE_AHEAD_BUSY;
+
+		write_ahead_unlock();
+		deflate_ahead(slot);
+		write_ahead_lock();
+
+		slot->state = WRITE_AHEAD_DONE;
+		write_ahead_size += slot->datalen;
+		pthread_cond_broadcast(&write_ahead_cond);
+	}
+	write_ahead_unlock();
+	return NULL;
+}
+
+static struct write_ahead_slot *find_write_ahead_slot(struct object_entry *entry)
+{
+	uint32_t pos;
+
+	for (pos = write_ahead_retired; pos < write_ahead_next; pos++) {
+		struct write_ahead_slot *slot;
+
+		slot = &write_ahead_slots[pos % write_ahead_window];
+		if (slot->entry == entry)
+			return slot;
+	}
+	return NULL;
+}
+
+static void start_write_ahead(struct object_entry **write_order)
+{
+	int i, ret;
+
+	/*
+	 * A pack split changes what is written as a delta depending on
+	 * where the pack ends, which the workers cannot know in advance.
+	 */
+	if (delta_search_threads <= 1 || pack_size_limit || !nr_objects)
+		return;
+
+	write_ahead_order = write_order;
+	write_ahead_nr = nr_objects;
+	write_ahead_next = write_ahead_retired = 0;
+	write_ahead_size = 0;
+	write_ahead_threads = delta_search_threads;
+	write_ahead_window = 4 * write_ahead_threads;
+	write_ahead_slots = xcalloc(write_ahead_window,
+				    sizeof(*write_ahead_slots));
+	pthread_mutex_init(&write_ahead_mutex, NULL);
+	pthread_cond_init(&write_ahead_cond, NULL);
+
+	write_ahead_workers = xcalloc(write_ahead_threads,
+				      sizeof(*write_ahead_workers));
+	for (i = 0; i < write_ahead_threads; i++) {
+		ret = pthread_create(&write_ahead_workers[i], NULL,
+				     write_ahead_worker, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+/* The writer is done with write_order[pos]; let the workers move on. */
+static void retire_write_ahead(uint32_t pos)
+{
+	struct write_ahead_slot *slot;
+
+	if (!write_ahead_workers)
+		return;
+
+	write_ahead_lock();
+	if (pos < write_ahead_next) {
+		slot = &write_ahead_slots[pos % write_ahead_window];
+		while (slot->state == WRITE_AHEAD_BUSY)
+			pthread_cond_wait(&write_ahead_cond, &write_ahead_mutex);
+		if (slot->state == WRITE_AHEAD_DONE) {
+			/* the writer went another way after all */
+			free(slot->buf);
+			write_ahead_size -= slot->datalen;
+		}
+		slot->state = WRITE_AHEAD_SKIPPED;
+	}
+	write_ahead_retired = pos + 1;
+	if (write_ahead_next < write_ahead_retired)
+		write_ahead_next = write_ahead_retired;
+	pthread_cond_broadcast(&write_ahead_cond);
+	write_ahead_unlock();
+}
+
+static void stop_write_ahead(void)
+{
+	int i;
+
+	if (!write_ahead_workers)
+		return;
+
+	retire_write_ahead(write_ahead_nr - 1);
+	for (i = 0; i < write_ahead_threads; i++)
+		pthread_join(write_ahead_workers[i], NULL);
+	free(write_ahead_workers);
+	write_ahead_workers = NULL;
+	free(write_ahead_slots);
+	write_ahead_slots = NULL;
+	pthread_cond_destroy(&write_ahead_cond);
+	pthread_mutex_destroy(&write_ahead_mutex);
+}
+
+/*
+ * Get the deflated data of "entry" from the workers, waiting for it if
+ * one of them is at it.  Returns 0 if the writer has to produce the
+ * data itself; no worker will touch "entry" afterwards.
+ */
+static int take_write_ahead(struct object_entry *entry, int usable_delta,
+			    enum object_type *type, void **buf,
+			    unsigned long *size, unsigned long *datalen)
+{
+	struct write_ahead_slot *slot;
+	int ret = 0;
+
+	if (!write_ahead_workers)
+		return 0;
+
+	write_ahead_lock();
+	if (!entry->write_ahead) {
+		entry->write_ahead = 1;
+		goto out;
+	}
+	slot = find_write_ahead_slot(entry);
+	if (!slot)
+		goto out;
+	while (slot->state == WRITE_AHEAD_BUSY)
+		pthread_cond_wait(&write_ahead_cond, &write_ahead_mutex);
+	if (slot->state != WRITE_AHEAD_DONE)
+		goto out;
+
+	slot->state = WRITE_AHEAD_TAKEN;
+	write_ahead_size -= slot->datalen;
+	pthread_cond_broadcast(&write_ahead_cond);
+	if (slot->usable_delta != usable_delta) {
+		/* a recursive delta was broken up behind our back */
+		free(slot->buf);
+		goto out;
+	}
+	*type = slot->type;
+	*buf = slot->buf;
+	*size = slot->size;
+	*datalen = slot->datalen;
+	ret = 1;
+out:
+	write_ahead_unlock();
+	return ret;
+}
+
+#else
+
+#define start_write_ahead(write_order)	(void)0
+#define retire_write_ahead(pos)		(void)0
+#define stop_write_ahead()		(void)0
+#define take_write_ahead(entry, usable_delta, type, buf, size, datalen)	0
+
+#endif
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct sha1file *f, struct object_entry *entry,
 					   unsigned long limit, int usable_delta)
@@ -250,11 +629,18 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	enum object_type type;
 	void *buf;
 	struct git_istream *st = NULL;
-
-	if (!usable_delta) {
+	int deflated;
+
+	deflated = take_write_ahead(entry, usable_delta, &type, &buf,
+				    &size, &datalen);
+	if (deflated) {
+		if (usable_delta)
+			type = (allow_ofs_delta && entry->delta->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+	} else if (!usable_delta) {
 		if (entry->type == OBJ_BLOB &&
 		    entry->size > big_file_threshold &&
-		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
+		    (st = open_locked_istream(entry->idx.sha1, &type, &size)) != NULL)
 			buf = NULL;
 		else {
 			buf = read_sha1_file(entry->idx.sha1, &type, &size);
@@ -281,7 +667,9 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (deflated)
+		; /* deflated by a write-ahead worker */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -307,7 +695,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			dheader[--pos] = 128 | (--ofs & 127);
 		if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit) {
 			if (st)
-				close_istream(st);
+				close_locked_istream(st);
 			free(buf);
 			return 0;
 		}
@@ -321,7 +709,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		 */
 		if (limit && hdrlen + 20 + datalen + 20 >= limit) {
 			if (st)
-				close_istream(st);
+				close_locked_istream(st);
 			free(buf);
 			return 0;
 		}
@@ -331,7 +719,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	} else {
 		if (limit && hdrlen + datalen + 20 >= limit) {
 			if (st)
-				close_istream(st);
+				close_locked_istream(st);
 			free(buf);
 			return 0;
 		}
@@ -339,7 +727,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	}
 	if (st) {
 		datalen = write_large_blob_data(st, f, entry->idx.sha1);
-		close_istream(st);
+		close_locked_istream(st);
 	} else {
 		sha1write(f, buf, datalen);
 		free(buf);
@@ -354,7 +742,9 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 {
 	struct packed_git *p = entry->in_pack;
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	struct pack_revindex *revidx;
+	int pos;
+	uint32_t nr;
 	off_t offset;
 	enum object_type type = entry->type;
 	unsigned long datalen;
@@ -367,10 +757,14 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	hdrlen = encode_in_pack_object_header(type, entry->size, header);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	revidx = revindex_for_pack(p);
+	pos = find_revindex_position(revidx, offset);
+	if (pos < 0)
+		die("bad offset for %s", sha1_to_hex(entry->idx.sha1));
+	datalen = pack_pos_to_offset(revidx, pos + 1) - offset;
+	nr = pack_pos_to_index(revidx, pos);
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen, nr)) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
@@ -428,7 +822,7 @@ static unsigned long write_object(struct sha1file *f,
 				  off_t write_offset)
 {
 	unsigned long limit, len;
-	int usable_delta, to_reuse;
+	int usable_delta;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -456,27 +850,13 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
-
-	if (!to_reuse)
+	if (!reuse_entry_data(entry, usable_delta))
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
-	else
+	else {
+		read_lock();
 		len = write_reuse_object(f, entry, limit, usable_delta);
+		read_unlock();
+	}
 	if (!len)
 		return 0;
 
@@ -712,6 +1092,195 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
+/*
+ * Write the .bitmap for the pack we just finished; "sha1" is the name
+ * of the pack and "tmpname" the "<base>-" prefix its files use.
+ */
+static void write_bitmap_file(char *tmpname, const unsigned char *sha1)
+{
+	size_t len = strlen(tmpname);
+	uint32_t j;
+
+	for (j = 0; j < nr_written; j++) {
+		struct object_entry *entry = (struct object_entry *)written_list[j];
+		enum object_type type = entry->type;
+
+		if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA)
+			type = sha1_object_info(entry->idx.sha1, NULL);
+		bitmap_writer_add_object(entry->idx.sha1, entry->idx.offset,
+					 type, entry->hash);
+	}
+
+	stop_progress(&progress_state);
+	bitmap_writer_select_commits(indexed_commits, indexed_commits_nr);
+	if (!bitmap_writer_build()) {
+		snprintf(tmpname + len, PATH_MAX - len, "%s.bitmap",
+			 sha1_to_hex(sha1));
+		bitmap_writer_finish(tmpname, write_bitmap_options);
+	}
+	tmpname[len] = '\0';
+}
+
+/*
+ * Leaving out objects of the reused pack moves the ones after them up
+ * in ours: from "original" on (until the next chunk), objects are
+ * "difference" bytes before where they are in the reused pack.
+ */
+static struct reused_chunk {
+	off_t original;
+	off_t difference;
+} *reused_chunks;
+static int reused_chunks_nr, reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
+{
+	off_t difference = where - offset;
+
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == difference)
+		return;
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1, reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = difference;
+	reused_chunks_nr++;
+}
+
+/* "where" must be at or after the first reused object */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return reused_chunks[lo - 1].difference;
+}
+
+static void write_reused_pack_one(uint32_t pos, struct sha1file *f,
+				  off_t *offset, struct pack_window **w_curs)
+{
+	struct packed_git *p = reuse_packfile;
+	struct pack_revindex *revidx = revindex_for_pack(p);
+	off_t start = pack_pos_to_offset(revidx, pos);
+	off_t end = pack_pos_to_offset(revidx, pos + 1);
+	off_t cur = start;
+	unsigned long size;
+	int type;
+
+	type = unpack_object_header(p, w_curs, &cur, &size);
+	if (type < 0)
+		die("BUG: reused object at %"PRIuMAX" went bad",
+		    (uintmax_t)start);
+	record_reused_object(start, *offset);
+
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset = get_delta_base(p, w_curs, &cur, type, start);
+		off_t fixup = find_reused_offset(start) -
+			      find_reused_offset(base_offset);
+
+		if (fixup) {
+			/* the objects in between did not all come along */
+			unsigned char header[10], dheader[10];
+			unsigned hdrlen, dpos = sizeof(dheader) - 1;
+			off_t ofs = start - base_offset - fixup;
+
+			hdrlen = encode_in_pack_object_header(type, size, header);
+			dheader[dpos] = ofs & 127;
+			while (ofs >>= 7)
+				dheader[--dpos] = 128 | (--ofs & 127);
+			sha1write(f, header, hdrlen);
+			sha1write(f, dheader + dpos, sizeof(dheader) - dpos);
+			copy_pack_data(f, p, w_curs, cur, end - cur);
+			*offset += hdrlen + sizeof(dheader) - dpos + end - cur;
+			return;
+		}
+	}
+
+	copy_pack_data(f, p, w_curs, start, end - start);
+	*offset += end - start;
+}
+
+/*
+ * Stream the leading run of whole bitmap words of reused objects in
+ * one go, without looking at the objects; returns the number of words.
+ */
+static size_t write_reused_pack_verbatim(struct sha1file *f, off_t *offset,
+					 struct pack_window **w_curs)
+{
+	struct pack_revindex *revidx = revindex_for_pack(reuse_packfile);
+	size_t pos = 0;
+	off_t from, to;
+
+	while (pos < reuse_packfile_bitmap->word_alloc &&
+	       reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+		pos++;
+	if (!pos)
+		return 0;
+
+	from = sizeof(struct pack_header);
+	to = pack_pos_to_offset(revidx, pos * BITS_IN_EWORD);
+	record_reused_object(from, *offset);
+	copy_pack_data(f, reuse_packfile, w_curs, from, to - from);
+	*offset += to - from;
+	return pos;
+}
+
+static void write_reused_pack(struct sha1file *f, off_t *offset)
+{
+	struct pack_window *w_curs = NULL;
+	size_t i;
+
+	i = write_reused_pack_verbatim(f, offset, &w_curs);
+	for (; i < reuse_packfile_bitmap->word_alloc; i++) {
+		eword_t word = reuse_packfile_bitmap->words[i];
+		size_t pos = i * BITS_IN_EWORD;
+
+		while (word) {
+			write_reused_pack_one(pos + ewah_bit_ctz64(word),
+					      f, offset, &w_curs);
+			word &= word - 1;
+		}
+	}
+	unuse_pack(&w_curs);
+
+	written += reuse_packfile_objects;
+}
+
+static void write_cruft_mtimes(char *name_buffer,
+			       const unsigned char *pack_sha1,
+			       const unsigned char *sha1)
+{
+	char *end_of_name_prefix = strrchr(name_buffer, 0);
+	const char *mtimes_tmp_name;
+	uint32_t *mtimes;
+	uint32_t i;
+
+	/* finish_tmp_packfile() left written_list in .idx order */
+	mtimes = xmalloc(nr_written * sizeof(*mtimes));
+	for (i = 0; i < nr_written; i++) {
+		struct object_entry *e = (struct object_entry *)written_list[i];
+		mtimes[i] = cruft_mtime[e - objects];
+	}
+
+	mtimes_tmp_name = write_mtimes_file(NULL, mtimes, nr_written, pack_sha1);
+	if (adjust_shared_perm(mtimes_tmp_name))
+		die_errno("unable to make temporary mtimes file readable");
+	sprintf(end_of_name_prefix, "%s.mtimes", sha1_to_hex(sha1));
+	if (rename(mtimes_tmp_name, name_buffer))
+		die_errno("unable to rename temporary mtimes file");
+	*end_of_name_prefix = '\0';
+
+	free((void *)mtimes_tmp_name);
+	free(mtimes);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -725,6 +1294,7 @@ static void write_pack_file(void)
 		progress_state = start_progress("Writing objects", nr_result);
 	written_list = xmalloc(nr_objects * sizeof(*written_list));
 	write_order = compute_write_order();
+	start_write_ahead(write_order);
 
 	do {
 		unsigned char sha1[20];
@@ -739,10 +1309,20 @@ static void write_pack_file(void)
 		if (!offset)
 			die_errno("unable to write pack header");
 		nr_written = 0;
+
+		if (reuse_packfile) {
+			if (!pack_to_stdout)
+				die("BUG: pack reuse without --stdout");
+			read_lock();
+			write_reused_pack(f, &offset);
+			read_unlock();
+			display_progress(progress_state, written);
+		}
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			retire_write_ahead(i);
 			display_progress(progress_state, written);
 		}
 
@@ -759,11 +1339,17 @@ static void write_pack_file(void)
 			fixup_pack_header_footer(fd, sha1, pack_tmp_name,
 						 nr_written, sha1, offset);
 			close(fd);
+			if (write_bitmap_index) {
+				warning("pack split into several files; "
+					"not writing a bitmap index");
+				write_bitmap_index = 0;
+			}
 		}
 
 		if (!pack_to_stdout) {
 			struct stat st;
 			char tmpname[PATH_MAX];
+			unsigned char pack_sha1[20];
 
 			/*
 			 * Packs are runtime accessed in their mtime
@@ -790,9 +1376,21 @@ static void write_pack_file(void)
 			if (sizeof(tmpname) <= strlen(base_name) + 50)
 				die("pack base name '%s' too long", base_name);
 			snprintf(tmpname, sizeof(tmpname), "%s-", base_name);
+
+			if (write_bitmap_index)
+				bitmap_writer_set_checksum(sha1);
+			hashcpy(pack_sha1, sha1);
+
 			finish_tmp_packfile(tmpname, pack_tmp_name,
 					    written_list, nr_written,
 					    &pack_idx_opts, sha1);
+
+			if (cruft)
+				write_cruft_mtimes(tmpname, pack_sha1, sha1);
+
+			if (write_bitmap_index)
+				write_bitmap_file(tmpname, sha1);
+
 			free(pack_tmp_name);
 			puts(sha1_to_hex(sha1));
 		}
@@ -804,6 +1402,7 @@ static void write_pack_file(void)
 		nr_remaining -= nr_written;
 	} while (nr_remaining && i < nr_objects);
 
+	stop_write_ahead();
 	free(written_list);
 	free(write_order);
 	stop_progress(&progress_state);
@@ -859,26 +1458,6 @@ static void rehash_objects(void)
 	}
 }
 
-static unsigned name_hash(const char *name)
-{
-	unsigned c, hash = 0;
-
-	if (!name)
-		return 0;
-
-	/*
-	 * This effectively just creates a sortable number from the
-	 * last sixteen non-whitespace characters. Last characters
-	 * count "most", so things that end in ".c" sort together.
-	 */
-	while ((c = *name++) != 0) {
-		if (isspace(c))
-			continue;
-		hash = (hash >> 2) + (c << 24);
-	}
-	return hash;
-}
-
 static void setup_delta_attr_check(struct git_attr_check *check)
 {
 	static struct git_attr *attr_delta;
@@ -901,42 +1480,160 @@ static int no_try_delta(const char *path)
 	return 0;
 }
 
-static int add_object_entry(const unsigned char *sha1, enum object_type type,
-			    const char *name, int exclude)
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t cache_mutex;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+static pthread_cond_t progress_cond;
+
+/*
+ * Mutex and conditional variable can't be statically-initialized on Windows.
+ */
+static void init_threaded_search(void)
 {
-	struct object_entry *entry;
-	struct packed_git *p, *found_pack = NULL;
-	off_t found_offset = 0;
-	int ix;
-	unsigned hash = name_hash(name);
+	enable_obj_read_lock();
+	pthread_mutex_init(&cache_mutex, NULL);
+	pthread_mutex_init(&progress_mutex, NULL);
+	pthread_cond_init(&progress_cond, NULL);
+}
 
-	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
-	if (ix >= 0) {
-		if (exclude) {
-			entry = objects + object_ix[ix] - 1;
-			if (!entry->preferred_base)
-				nr_result--;
-			entry->preferred_base = 1;
-		}
-		return 0;
+static void cleanup_threaded_search(void)
+{
+	pthread_cond_destroy(&progress_cond);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&cache_mutex);
+	pthread_mutex_destroy(&progress_mutex);
+}
+
+#else
+
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#define init_threaded_search()	(void)0
+#define cleanup_threaded_search()	(void)0
+
+#endif
+
+/*
+ * Call "fn" on consecutive slices of [0, nr), one per thread, and wait
+ * for all of them.  Anything "fn" does to the object store, short of
+ * read_sha1_file() and friends which lock on their own, must be done
+ * under read_lock().
+ */
+typedef void (*object_range_fn)(void *data, uint32_t start, uint32_t end);
+
+#ifndef NO_PTHREADS
+
+struct object_range_params {
+	pthread_t thread;
+	object_range_fn fn;
+	void *data;
+	uint32_t start;
+	uint32_t end;
+};
+
+static void *threaded_object_range(void *arg)
+{
+	struct object_range_params *me = arg;
+
+	me->fn(me->data, me->start, me->end);
+	return NULL;
+}
+
+static void for_each_object_range(object_range_fn fn, void *data, uint32_t nr)
+{
+	struct object_range_params *p;
+	int i, ret, nr_threads = delta_search_threads;
+	uint32_t start = 0;
+
+	if (nr_threads > nr / 64)
+		nr_threads = nr / 64;
+	if (nr_threads <= 1) {
+		fn(data, 0, nr);
+		return;
+	}
+
+	p = xcalloc(nr_threads, sizeof(*p));
+	for (i = 0; i < nr_threads; i++) {
+		p[i].fn = fn;
+		p[i].data = data;
+		p[i].start = start;
+		start += (nr - start) / (nr_threads - i);
+		p[i].end = start;
+		ret = pthread_create(&p[i].thread, NULL,
+				     threaded_object_range, &p[i]);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	free(p);
+}
+
+#else
+#define for_each_object_range(fn, data, nr)	(fn)((data), 0, (nr))
+#endif
+
+/*
+ * Check whether we want the object in the pack (e.g., we do not want
+ * objects found in non-local stores if the "--local" option was used).
+ * If we do, and the object is packed, remember where we found it.
+ * This may be called from several threads at once.
+ */
+static int want_object_in_pack(const unsigned char *sha1,
+			       int exclude,
+			       struct packed_git **found_pack,
+			       off_t *found_offset)
+{
+	struct packed_git *p;
+
+	if (!exclude && local) {
+		int found;
+
+		read_lock();
+		found = has_loose_object_nonlocal(sha1);
+		read_unlock();
+		if (found)
+			return 0;
 	}
 
-	if (!exclude && local && has_loose_object_nonlocal(sha1))
-		return 0;
+	*found_pack = NULL;
+	*found_offset = 0;
 
 	for (p = packed_git; p; p = p->next) {
-		off_t offset = find_pack_entry_one(sha1, p);
+		off_t offset;
+
+		if (!p->index_data) {
+			read_lock();
+			offset = find_pack_entry_one(sha1, p);
+			read_unlock();
+		} else
+			offset = find_pack_entry_one(sha1, p);
 		if (offset) {
-			if (!found_pack) {
-				if (!is_pack_valid(p)) {
+			if (!*found_pack) {
+				int valid;
+
+				read_lock();
+				valid = is_pack_valid(p);
+				read_unlock();
+				if (!valid) {
 					warning("packfile %s cannot be accessed", p->pack_name);
 					continue;
 				}
-				found_offset = offset;
-				found_pack = p;
+				*found_offset = offset;
+				*found_pack = p;
 			}
 			if (exclude)
-				break;
+				return 1;
 			if (incremental)
 				return 0;
 			if (local && !p->pack_local)
@@ -946,6 +1643,20 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 		}
 	}
 
+	return 1;
+}
+
+static void create_object_entry(const unsigned char *sha1,
+				enum object_type type,
+				uint32_t hash,
+				int exclude,
+				int no_try_delta,
+				int ix,
+				struct packed_git *found_pack,
+				off_t found_offset)
+{
+	struct object_entry *entry;
+
 	if (nr_objects >= nr_alloc) {
 		nr_alloc = (nr_alloc  + 1024) * 3 / 2;
 		objects = xrealloc(objects, nr_alloc * sizeof(*entry));
@@ -971,14 +1682,142 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	else
 		object_ix[-1 - ix] = nr_objects;
 
-	display_progress(progress_state, nr_objects);
+	entry->no_try_delta = no_try_delta;
+}
+
+/*
+ * While the revision walk runs we only record the objects it shows us;
+ * looking each of them up in every pack is left to find_object_packs(),
+ * which does it for the whole list at once, and in parallel.  Entries
+ * from first_deferred onwards are still waiting for that.
+ */
+static int defer_pack_lookup;
+static uint32_t first_deferred;
+
+static int add_object_entry(const unsigned char *sha1, enum object_type type,
+			    const char *name, int exclude)
+{
+	struct object_entry *entry;
+	struct packed_git *found_pack = NULL;
+	off_t found_offset = 0;
+	int ix;
+
+	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
+	if (ix >= 0) {
+		if (exclude) {
+			entry = objects + object_ix[ix] - 1;
+			if (!entry->preferred_base)
+				nr_result--;
+			entry->preferred_base = 1;
+		}
+		return 0;
+	}
+
+	if (reuse_packfile_bitmap &&
+	    bitmap_walk_contains(reuse_packfile_bitmap, sha1))
+		return 0;
+
+	if (!defer_pack_lookup &&
+	    !want_object_in_pack(sha1, exclude, &found_pack, &found_offset))
+		return 0;
 
-	if (name && no_try_delta(name))
-		entry->no_try_delta = 1;
+	create_object_entry(sha1, type, pack_name_hash(name),
+			    exclude, name && no_try_delta(name),
+			    ix, found_pack, found_offset);
 
+	display_progress(progress_state, nr_objects);
 	return 1;
 }
 
+/*
+ * Objects enumerated from a reachability bitmap already come with
+ * their type, name hash and, if they are in the bitmapped pack, their
+ * location, so there is no need to look them up again.
+ */
+static void add_object_entry_from_bitmap(const unsigned char *sha1,
+					 enum object_type type,
+					 uint32_t name_hash,
+					 struct packed_git *pack,
+					 off_t offset)
+{
+	int ix;
+
+	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
+	if (ix >= 0)
+		return;
+
+	if (!pack && !want_object_in_pack(sha1, 0, &pack, &offset))
+		return;
+
+	create_object_entry(sha1, type, name_hash, 0, 0, ix, pack, offset);
+	display_progress(progress_state, nr_objects);
+}
+
+static void begin_deferred_pack_lookup(void)
+{
+	defer_pack_lookup = 1;
+	first_deferred = nr_objects;
+}
+
+static void find_object_packs_range(void *data, uint32_t start, uint32_t end)
+{
+	char *want = data;
+	uint32_t i;
+
+	for (i = start; i < end; i++) {
+		struct object_entry *entry = objects + first_deferred + i;
+		want[i] = want_object_in_pack(entry->idx.sha1,
+					      entry->preferred_base,
+					      &entry->in_pack,
+					      &entry->in_pack_offset);
+	}
+}
+
+/*
+ * Look up the objects recorded since begin_deferred_pack_lookup(), and
+ * drop those want_object_in_pack() would have turned away had we asked
+ * it straight away.  Survivors keep the order they were found in, so
+ * the result is the same however many threads did the lookups.
+ */
+static void find_object_packs(void)
+{
+	struct packed_git *p;
+	uint32_t i, j, nr;
+	char *want;
+
+	if (!defer_pack_lookup)
+		return;
+	defer_pack_lookup = 0;
+	nr = nr_objects - first_deferred;
+	if (!nr)
+		return;
+
+	/* the threads may only read the indexes, so map them all now */
+	for (p = packed_git; p; p = p->next)
+		open_pack_index(p);
+
+	want = xmalloc(nr);
+	for_each_object_range(find_object_packs_range, want, nr);
+
+	for (i = j = first_deferred; i < nr_objects; i++) {
+		if (!want[i - first_deferred]) {
+			/* preferred bases are always wanted */
+			nr_result--;
+			continue;
+		}
+		if (i != j)
+			objects[j] = objects[i];
+		j++;
+	}
+	free(want);
+
+	if (j != nr_objects) {
+		nr_objects = j;
+		rehash_objects();
+	}
+	display_progress(progress_state, nr_objects);
+}
+
 struct pbase_tree_cache {
 	unsigned char sha1[20];
 	int ref;
@@ -1176,7 +2015,7 @@ static void add_preferred_base_object(const char *name)
 {
 	struct pbase_tree *it;
 	int cmplen;
-	unsigned hash = name_hash(name);
+	unsigned hash = pack_name_hash(name);
 
 	if (!num_preferred_base || check_pbase_path(hash))
 		return;
@@ -1251,6 +2090,11 @@ static void cleanup_preferred_base(void)
 	done_pbase_paths_num = done_pbase_paths_alloc = 0;
 }
 
+/*
+ * Runs in several threads at once on disjoint entries (see
+ * get_object_details()), hence the locking around everything that
+ * touches the pack windows or the object store.
+ */
 static void check_object(struct object_entry *entry)
 {
 	if (entry->in_pack) {
@@ -1263,7 +2107,9 @@ static void check_object(struct object_entry *entry)
 		off_t ofs;
 		unsigned char *buf, c;
 
+		read_lock();
 		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		read_unlock();
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
@@ -1287,17 +2133,24 @@ static void check_object(struct object_entry *entry)
 			entry->in_pack_header_size = used;
 			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
 				goto give_up;
+			read_lock();
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		case OBJ_REF_DELTA:
-			if (reuse_delta && !entry->preferred_base)
+			if (reuse_delta && !entry->preferred_base) {
+				read_lock();
 				base_ref = use_pack(p, &w_curs,
 						entry->in_pack_offset + used, NULL);
+				read_unlock();
+			}
 			entry->in_pack_header_size = used + 20;
 			break;
 		case OBJ_OFS_DELTA:
+			read_lock();
 			buf = use_pack(p, &w_curs,
 				       entry->in_pack_offset + used, NULL);
+			read_unlock();
 			used_0 = 0;
 			c = buf[used_0++];
 			ofs = c & 127;
@@ -1318,17 +2171,24 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				struct pack_revindex *revidx;
+				int pos;
+				read_lock();
+				revidx = revindex_for_pack(p);
+				read_unlock();
+				pos = find_revindex_position(revidx, ofs);
+				if (pos < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(revidx, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = locate_object_entry(base_ref))) {
+		if (base_ref && (base_entry = locate_object_entry(base_ref)) &&
+		    (!use_delta_islands ||
+		     in_same_island(entry->idx.sha1, base_entry->idx.sha1))) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1338,13 +2198,16 @@ static void check_object(struct object_entry *entry)
 			 * never consider reused delta as the base object to
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
+			 *
+			 * Hooking it up in base_entry's list of children
+			 * is left to get_object_details().
 			 */
 			entry->type = entry->in_pack_type;
 			entry->delta = base_entry;
 			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			read_lock();
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		}
 
@@ -1354,11 +2217,15 @@ static void check_object(struct object_entry *entry)
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
+			read_lock();
 			entry->size = get_size_from_delta(p, &w_curs,
 					entry->in_pack_offset + entry->in_pack_header_size);
+			read_unlock();
 			if (entry->size == 0)
 				goto give_up;
+			read_lock();
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		}
 
@@ -1368,7 +2235,9 @@ static void check_object(struct object_entry *entry)
 		 * at this point...
 		 */
 		give_up:
+		read_lock();
 		unuse_pack(&w_curs);
+		read_unlock();
 	}
 
 	entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
@@ -1397,6 +2266,15 @@ static int pack_offset_sort(const void *_a, const void *_b)
 			(a->in_pack_offset > b->in_pack_offset);
 }
 
+static void check_object_range(void *data, uint32_t start, uint32_t end)
+{
+	struct object_entry **list = data;
+	uint32_t i;
+
+	for (i = start; i < end; i++)
+		check_object(list[i]);
+}
+
 static void get_object_details(void)
 {
 	uint32_t i;
@@ -1407,9 +2285,19 @@ static void get_object_details(void)
 		sorted_by_offset[i] = objects + i;
 	qsort(sorted_by_offset, nr_objects, sizeof(*sorted_by_offset), pack_offset_sort);
 
+	for_each_object_range(check_object_range, sorted_by_offset, nr_objects);
+
+	/*
+	 * Link reused deltas to their bases in offset order, so that the
+	 * lists of children do not depend on how the threads were
+	 * scheduled.
+	 */
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *entry = sorted_by_offset[i];
-		check_object(entry);
+		if (entry->delta) {
+			entry->delta_sibling = entry->delta->delta_child;
+			entry->delta->delta_child = entry;
+		}
 		if (big_file_threshold < entry->size)
 			entry->no_try_delta = 1;
 	}
@@ -1473,31 +2361,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifndef NO_PTHREADS
-
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1531,6 +2394,10 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (src->depth >= max_depth)
 		return 0;
 
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return 0;
+
 	/* Now some size filtering heuristics. */
 	trg_size = trg_entry->size;
 	if (!trg_entry->delta) {
@@ -1553,9 +2420,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 	/* Load data if not already done */
 	if (!trg->data) {
-		read_lock();
 		trg->data = read_sha1_file(trg_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!trg->data)
 			die("object %s cannot be read",
 			    sha1_to_hex(trg_entry->idx.sha1));
@@ -1565,9 +2430,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->data) {
-		read_lock();
 		src->data = read_sha1_file(src_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!src->data) {
 			if (src_entry->preferred_base) {
 				static int warned = 0;
@@ -1806,15 +2669,6 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 
 #ifndef NO_PTHREADS
 
-static void try_to_free_from_threads(size_t size)
-{
-	read_lock();
-	release_pack_memory(size, -1);
-	read_unlock();
-}
-
-static try_to_free_t old_try_to_free_routine;
-
 /*
  * The main thread waits on the condition that (at least) one of the workers
  * has stopped working (which is indicated in the .working member of
@@ -1838,29 +2692,6 @@ struct thread_params {
 	unsigned *processed;
 };
 
-static pthread_cond_t progress_cond;
-
-/*
- * Mutex and conditional variable can't be statically-initialized on Windows.
- */
-static void init_threaded_search(void)
-{
-	init_recursive_mutex(&read_mutex);
-	pthread_mutex_init(&cache_mutex, NULL);
-	pthread_mutex_init(&progress_mutex, NULL);
-	pthread_cond_init(&progress_cond, NULL);
-	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
-}
-
-static void cleanup_threaded_search(void)
-{
-	set_try_to_free_routine(old_try_to_free_routine);
-	pthread_cond_destroy(&progress_cond);
-	pthread_mutex_destroy(&read_mutex);
-	pthread_mutex_destroy(&cache_mutex);
-	pthread_mutex_destroy(&progress_mutex);
-}
-
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
@@ -1898,13 +2729,8 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	struct thread_params *p;
 	int i, ret, active_threads = 0;
 
-	init_threaded_search();
-
-	if (!delta_search_threads)	/* --threads=0 means autodetect */
-		delta_search_threads = online_cpus();
 	if (delta_search_threads <= 1) {
 		find_deltas(list, &list_size, window, depth, processed);
-		cleanup_threaded_search();
 		return;
 	}
 	if (progress > pack_to_stdout)
@@ -2019,7 +2845,6 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			active_threads--;
 		}
 	}
-	cleanup_threaded_search();
 	free(p);
 }
 
@@ -2159,6 +2984,34 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.usebitmaps")) {
+		use_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.allowpackreuse")) {
+		allow_pack_reuse = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebitmaps")) {
+		write_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
+	if (island_config(k, v))
+		return 0;
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebloomfilter")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_BLOOM;
+		else
+			pack_idx_opts.flags &= ~WRITE_BLOOM;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2167,6 +3020,7 @@ static void read_object_list_from_stdin(void)
 	char line[40 + 1 + PATH_MAX + 2];
 	unsigned char sha1[20];
 
+	begin_deferred_pack_lookup();
 	for (;;) {
 		if (!fgets(line, sizeof(line), stdin)) {
 			if (feof(stdin))
@@ -2191,6 +3045,7 @@ static void read_object_list_from_stdin(void)
 		add_preferred_base_object(line+41);
 		add_object_entry(sha1, 0, line+41, 0);
 	}
+	find_object_packs();
 }
 
 #define OBJECT_ADDED (1u<<20)
@@ -2199,6 +3054,12 @@ static void show_commit(struct commit *commit, void *data)
 {
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
+
+	if (write_bitmap_index)
+		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj,
@@ -2211,6 +3072,9 @@ static void show_object(struct object *obj,
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
 
+	if (use_delta_islands && obj->type == OBJ_TREE)
+		island_record_tree(obj, name);
+
 	/*
 	 * We will have generated the hash from the name,
 	 * but not saved a pointer to it - we can free it
@@ -2349,6 +3213,16 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 	}
 }
 
+/*
+ * Copying objects out of the bitmapped pack as they are only works if
+ * the receiver can take them as they are.
+ */
+static int pack_options_allow_reuse(void)
+{
+	return allow_pack_reuse && pack_to_stdout && allow_ofs_delta &&
+	       reuse_delta;
+}
+
 static void get_object_list(int ac, const char **av)
 {
 	struct rev_info revs;
@@ -2376,10 +3250,30 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	if (use_bitmap_index && !prepare_bitmap_walk(&revs)) {
+		if (pack_options_allow_reuse() &&
+		    !reuse_partial_packfile_from_bitmap(&reuse_packfile,
+							&reuse_packfile_objects,
+							&reuse_packfile_bitmap)) {
+			nr_result += reuse_packfile_objects;
+			display_progress(progress_state, nr_result);
+		}
+		traverse_bitmap_commit_list(add_object_entry_from_bitmap);
+		return;
+	}
+
+	if (use_delta_islands) {
+		/* island marks flow from children to parents */
+		revs.topo_order = 1;
+		load_delta_islands();
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
+	begin_deferred_pack_lookup();
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
+	find_object_packs();
 
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
@@ -2387,6 +3281,23 @@ static void get_object_list(int ac, const char **av)
 		loosen_unused_packed_objects(&revs);
 }
 
+static void mark_kept_packs(void)
+{
+	struct packed_git *p;
+
+	if (!keep_pack_list.nr)
+		return;
+	for (p = packed_git; p; p = p->next) {
+		const char *name = strrchr(p->pack_name, '/');
+
+		name = name ? name + 1 : p->pack_name;
+		if (p->pack_local &&
+		    unsorted_string_list_has_string(&keep_pack_list, name))
+			p->pack_keep = 1;
+	}
+	ignore_packed_keep = 1;
+}
+
 static int option_parse_index_version(const struct option *opt,
 				      const char *arg, int unset)
 {
@@ -2402,6 +3313,99 @@ static int option_parse_index_version(const struct option *opt,
 	return 0;
 }
 
+static void add_cruft_object(const unsigned char *sha1, uint32_t mtime,
+			     struct packed_git *pack, off_t offset)
+{
+	int ix;
+
+	if (cruft_expiration && mtime < cruft_expiration)
+		return;
+
+	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
+	if (ix >= 0) {
+		/* seen elsewhere already; the latest write wins */
+		uint32_t pos = object_ix[ix] - 1;
+		if (cruft_mtime[pos] < mtime)
+			cruft_mtime[pos] = mtime;
+		return;
+	}
+	if (has_sha1_pack_kept_or_nonlocal(sha1))
+		return;
+
+	/* check_object() will find out the type */
+	create_object_entry(sha1, 0, 0, 0, 0, ix, pack, offset);
+	ALLOC_GROW(cruft_mtime, nr_objects, cruft_mtime_alloc);
+	cruft_mtime[nr_objects - 1] = mtime;
+	display_progress(progress_state, nr_result);
+}
+
+static void add_cruft_packs(void)
+{
+	struct packed_git *p;
+	uint32_t i;
+
+	for (p = packed_git; p; p = p->next) {
+		int has_mtimes;
+
+		if (!p->pack_local || p->pack_keep)
+			continue;
+		if (open_pack_index(p))
+			die("cannot open pack index");
+		has_mtimes = !load_pack_mtimes(p);
+
+		for (i = 0; i < p->num_objects; i++)
+			add_cruft_object(nth_packed_object_sha1(p, i),
+					 has_mtimes ? nth_packed_mtime(p, i) :
+						      p->mtime,
+					 p, nth_packed_object_offset(p, i));
+	}
+}
+
+static void add_cruft_loose_objects(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t baselen;
+	int i;
+
+	strbuf_addstr(&path, get_object_directory());
+	baselen = path.len;
+	for (i = 0; i < 256; i++) {
+		struct dirent *de;
+		DIR *dir;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addf(&path, "/%02x/", i);
+		dir = opendir(path.buf);
+		if (!dir)
+			continue;
+		while ((de = readdir(dir)) != NULL) {
+			unsigned char sha1[20];
+			char hex[41];
+			struct stat st;
+
+			if (strlen(de->d_name) != 38)
+				continue;
+			sprintf(hex, "%02x%s", i, de->d_name);
+			if (get_sha1_hex(hex, sha1))
+				continue;
+			strbuf_setlen(&path, baselen + 4);
+			strbuf_addstr(&path, de->d_name);
+			if (stat(path.buf, &st))
+				continue;
+			add_cruft_object(sha1, st.st_mtime, NULL, 0);
+		}
+		closedir(dir);
+	}
+	strbuf_release(&path);
+}
+
+static int option_parse_cruft_expiration(const struct option *opt,
+					 const char *arg, int unset)
+{
+	cruft_expiration = unset ? 0 : approxidate(arg);
+	return 0;
+}
+
 static int option_parse_unpack_unreachable(const struct option *opt,
 					   const char *arg, int unset)
 {
@@ -2501,16 +3505,30 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("create thin packs")),
 		OPT_BOOL(0, "honor-pack-keep", &ignore_packed_keep,
 			 N_("ignore packs that have companion .keep file")),
+		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
+				N_("ignore this pack")),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("pack unreachable objects with their mtimes")),
+		{ OPTION_CALLBACK, 0, "cruft-expiration", NULL, N_("time"),
+		  N_("with --cruft, leave out objects older than <time>"),
+		  0, option_parse_cruft_expiration },
 		OPT_INTEGER(0, "compression", &pack_compression_level,
 			    N_("pack compression level")),
 		OPT_SET_INT(0, "keep-true-parents", &grafts_replace_parents,
 			    N_("do not hide commits by grafts"), 0),
+		OPT_BOOL(0, "use-bitmap-index", &use_bitmap_index,
+			 N_("use a bitmap index if available to speed up counting objects")),
+		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
+			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_END(),
 	};
 
 	read_replace_refs = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	pack_idx_opts.flags |= WRITE_REV;
 	git_config(git_pack_config, NULL);
 	if (!pack_compression_seen && core_compression_seen)
 		pack_compression_level = core_compression_level;
@@ -2555,6 +3573,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 #ifdef NO_PTHREADS
 	if (delta_search_threads != 1)
 		warning("no threads support, ignoring --threads");
+#else
+	if (!delta_search_threads)	/* --threads=0 means autodetect */
+		delta_search_threads = online_cpus();
 #endif
 	if (!pack_to_stdout && !pack_size_limit)
 		pack_size_limit = pack_size_limit_cfg;
@@ -2571,14 +3592,50 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
+	if (cruft) {
+		if (use_internal_rev_list)
+			die("--cruft cannot be used with --revs.");
+		if (pack_to_stdout)
+			die("--cruft cannot be used to build a pack for transfer.");
+		if (keep_unreachable || unpack_unreachable)
+			die("--cruft cannot be used with --keep-unreachable "
+			    "or --unpack-unreachable.");
+	}
+
 	if (progress && all_progress_implied)
 		progress = 2;
 
+	if (use_delta_islands && !use_internal_rev_list)
+		die("--delta-islands needs the internal rev-list (--revs)");
+
+	/*
+	 * A bitmap answers "everything reachable from these tips"; it
+	 * cannot honor options that leave reachable objects out of the
+	 * pack or that add unreachable ones to it.  Nor does it show
+	 * the commits that delta islands need to see.
+	 */
+	if (!use_internal_rev_list || !pack_to_stdout || local ||
+	    incremental || ignore_packed_keep || keep_pack_list.nr ||
+	    keep_unreachable || unpack_unreachable ||
+	    is_repository_shallow() || use_delta_islands)
+		use_bitmap_index = 0;
+
+	/* and we only know how to write one for a pack of everything */
+	if (pack_to_stdout || !rev_list_all || rev_list_unpacked || incremental ||
+	    keep_pack_list.nr)
+		write_bitmap_index = 0;
+	bitmap_writer_show_progress(progress);
+
 	prepare_packed_git();
+	mark_kept_packs();
+	init_threaded_search();
 
 	if (progress)
 		progress_state = start_progress("Counting objects", 0);
-	if (!use_internal_rev_list)
+	if (cruft) {
+		add_cruft_packs();
+		add_cruft_loose_objects();
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		rp_av[rp_ac] = NULL;
@@ -2589,14 +3646,20 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		for_each_ref(add_ref_tag, NULL);
 	stop_progress(&progress_state);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress);
+
 	if (non_empty && !nr_result)
 		return 0;
 	if (nr_result)
 		prepare_pack(window, depth);
 	write_pack_file();
+	cleanup_threaded_search();
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
-			" reused %"PRIu32" (delta %"PRIu32")\n",
-			written, written_delta, reused, reused_delta);
+			" reused %"PRIu32" (delta %"PRIu32"),"
+			" pack-reused %"PRIu32"\n",
+			written, written_delta, reused, reused_delta,
+			reuse_packfile_objects);
 	return 0;
 }
@@ -74,7 +74,8 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
 }
 
 static int contains_recurse(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	struct commit_list *p;
 
@@ -91,9 +92,15 @@ static int contains_recurse(struct commit *candidate,
 	if (parse_commit(candidate) < 0)
 		return 0;
 
+	/* too old (by generation) to have a want commit as an ancestor */
+	if (candidate->generation < cutoff) {
+		candidate->object.flags |= UNINTERESTING;
+		return 0;
+	}
+
 	/* Otherwise recurse and mark ourselves for future traversals. */
 	for (p = candidate->parents; p; p = p->next) {
-		if (contains_recurse(p->item, want)) {
+		if (contains_recurse(p->item, want, cutoff)) {
 			candidate->object.flags |= TMP_MARK;
 			return 1;
 		}
@@ -104,7 +111,17 @@ static int contains_recurse(struct commit *candidate,
 
 static int contains(struct commit *candidate, const struct commit_list *want)
 {
-	return contains_recurse(candidate, want);
+	const struct commit_list *w;
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+
+	for (w = want; w; w = w->next) {
+		struct commit *c = w->item;
+		if (parse_commit(c) < 0)
+			cutoff = 0;
+		else if (c->generation < cutoff)
+			cutoff = c->generation;
+	}
+	return contains_recurse(candidate, want, cutoff);
 }
 
 static void show_tag_lines(const unsigned char *sha1, int lines)
@@ -506,6 +523,9 @@ int cmd_tag(int argc, const char **argv, const char *prefix)
 	}
 	if (list) {
 		int ret;
+
+		/* --contains only needs the shape of the history */
+		save_commit_buffer = 0;
 		if (column_active(colopts)) {
 			struct column_options copts;
 			memset(&copts, 0, sizeof(copts));
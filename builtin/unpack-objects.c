@@ -11,9 +11,11 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "thread-utils.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
-static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] < pack-file";
+static int nr_threads, use_threads;
+static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] [--threads=<n>] < pack-file";
 
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
@@ -299,14 +301,357 @@ static void added_object(unsigned nr, enum object_type type,
 	}
 }
 
+#ifndef NO_PTHREADS
+/*
+ * With threads (and without --strict or -n), the main thread only
+ * reads the pack and inflates the objects.  Non-delta objects are
+ * queued for the threads, which name and write them; deltas are kept
+ * aside.  Once the whole pack is read, the threads resolve the deltas:
+ * each takes all the deltas against one base at a time and follows
+ * the deltas against their results in turn, so that independent delta
+ * families are resolved and written side by side.
+ */
+struct write_job {
+	unsigned nr;
+	enum object_type type;
+	void *buf;
+	unsigned long size;
+};
+
+static struct write_job *write_queue;
+static unsigned int write_queue_alloc;
+static unsigned int write_queue_first, write_queue_nr;
+static unsigned long write_queue_size;
+static unsigned long write_queue_limit = 32 * 1024 * 1024;
+static int write_queue_closed;
+
+struct threaded_delta {
+	unsigned nr;
+	enum object_type type;		/* OBJ_OFS_DELTA or OBJ_REF_DELTA */
+	unsigned base_nr;		/* OBJ_OFS_DELTA */
+	unsigned char base_sha1[20];	/* OBJ_REF_DELTA, and roots */
+	void *delta;
+	unsigned long size;
+	int done;
+};
+
+static struct threaded_delta *threaded_deltas;
+static int nr_threaded_deltas, threaded_deltas_alloc;
+static struct threaded_delta **ofs_deltas, **ref_deltas, **root_deltas;
+static int nr_ofs_deltas, nr_ref_deltas, nr_root_deltas;
+static int next_root_delta, nr_resolved_deltas;
+static struct progress *resolve_progress;
+
+static pthread_t *threads;
+static pthread_mutex_t work_mutex;
+static pthread_cond_t work_cond;
+
+static void *threaded_write(void *unused)
+{
+	pthread_mutex_lock(&work_mutex);
+	for (;;) {
+		struct write_job job;
+
+		while (!write_queue_nr && !write_queue_closed)
+			pthread_cond_wait(&work_cond, &work_mutex);
+		if (!write_queue_nr)
+			break;
+		job = write_queue[write_queue_first];
+		write_queue_first = (write_queue_first + 1) % write_queue_alloc;
+		write_queue_nr--;
+		write_queue_size -= job.size;
+		pthread_cond_broadcast(&work_cond);
+		pthread_mutex_unlock(&work_mutex);
+
+		if (write_sha1_file(job.buf, job.size, typename(job.type),
+				    obj_list[job.nr].sha1) < 0)
+			die("failed to write object");
+		free(job.buf);
+
+		pthread_mutex_lock(&work_mutex);
+	}
+	pthread_mutex_unlock(&work_mutex);
+	return NULL;
+}
+
+static void start_threads(void *(*fn)(void *))
+{
+	int i;
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL, fn, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+static void join_threads(void)
+{
+	int i;
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	threads = NULL;
+}
+
+static void start_threaded_unpack(void)
+{
+	pthread_mutex_init(&work_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	enable_obj_read_lock();
+	write_queue_alloc = 64 * nr_threads;
+	write_queue = xcalloc(write_queue_alloc, sizeof(*write_queue));
+	start_threads(threaded_write);
+}
+
+static void queue_write(unsigned nr, enum object_type type,
+			void *buf, unsigned long size)
+{
+	unsigned int pos;
+
+	pthread_mutex_lock(&work_mutex);
+	while (write_queue_nr == write_queue_alloc ||
+	       (write_queue_nr && write_queue_size + size > write_queue_limit))
+		pthread_cond_wait(&work_cond, &work_mutex);
+	pos = (write_queue_first + write_queue_nr) % write_queue_alloc;
+	write_queue[pos].nr = nr;
+	write_queue[pos].type = type;
+	write_queue[pos].buf = buf;
+	write_queue[pos].size = size;
+	write_queue_nr++;
+	write_queue_size += size;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&work_mutex);
+}
+
+static void queue_delta(unsigned nr, enum object_type type, unsigned base_nr,
+			const unsigned char *base_sha1,
+			void *delta, unsigned long size)
+{
+	struct threaded_delta *d;
+
+	ALLOC_GROW(threaded_deltas, nr_threaded_deltas + 1,
+		   threaded_deltas_alloc);
+	d = &threaded_deltas[nr_threaded_deltas++];
+	memset(d, 0, sizeof(*d));
+	d->nr = nr;
+	d->type = type;
+	d->base_nr = base_nr;
+	if (base_sha1)
+		hashcpy(d->base_sha1, base_sha1);
+	d->delta = delta;
+	d->size = size;
+}
+
+static int compare_ofs_delta(const void *a_, const void *b_)
+{
+	const struct threaded_delta *a = *(const struct threaded_delta **)a_;
+	const struct threaded_delta *b = *(const struct threaded_delta **)b_;
+
+	if (a->base_nr != b->base_nr)
+		return a->base_nr < b->base_nr ? -1 : 1;
+	return a->nr < b->nr ? -1 : a->nr > b->nr;
+}
+
+static int compare_ref_delta(const void *a_, const void *b_)
+{
+	const struct threaded_delta *a = *(const struct threaded_delta **)a_;
+	const struct threaded_delta *b = *(const struct threaded_delta **)b_;
+	int cmp = hashcmp(a->base_sha1, b->base_sha1);
+
+	if (cmp)
+		return cmp;
+	return a->nr < b->nr ? -1 : a->nr > b->nr;
+}
+
+/* The first of the deltas against the given base, in the sorted lists. */
+static int find_ofs_deltas(unsigned base_nr)
+{
+	int lo = 0, hi = nr_ofs_deltas;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (ofs_deltas[mid]->base_nr < base_nr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int find_ref_deltas(const unsigned char *base_sha1)
+{
+	int lo = 0, hi = nr_ref_deltas;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (hashcmp(ref_deltas[mid]->base_sha1, base_sha1) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void resolve_threaded_delta(struct threaded_delta *d,
+				   enum object_type type,
+				   void *base, unsigned long base_size)
+{
+	void *result;
+	unsigned long result_size;
+	unsigned char *sha1 = obj_list[d->nr].sha1;
+	int i;
+
+	/* a REF_DELTA may be reachable from two bases with the same name */
+	pthread_mutex_lock(&work_mutex);
+	if (d->done) {
+		pthread_mutex_unlock(&work_mutex);
+		return;
+	}
+	d->done = 1;
+	pthread_mutex_unlock(&work_mutex);
+
+	result = patch_delta(base, base_size, d->delta, d->size, &result_size);
+	if (!result)
+		die("failed to apply delta");
+	free(d->delta);
+	d->delta = NULL;
+	if (write_sha1_file(result, result_size, typename(type), sha1) < 0)
+		die("failed to write object");
+
+	pthread_mutex_lock(&work_mutex);
+	display_progress(resolve_progress, ++nr_resolved_deltas);
+	pthread_mutex_unlock(&work_mutex);
+
+	/* then the deltas against this one */
+	for (i = find_ofs_deltas(d->nr);
+	     i < nr_ofs_deltas && ofs_deltas[i]->base_nr == d->nr; i++)
+		resolve_threaded_delta(ofs_deltas[i], type, result, result_size);
+	for (i = find_ref_deltas(sha1);
+	     i < nr_ref_deltas && !hashcmp(ref_deltas[i]->base_sha1, sha1); i++)
+		resolve_threaded_delta(ref_deltas[i], type, result, result_size);
+	free(result);
+}
+
+static void *threaded_resolve(void *unused)
+{
+	for (;;) {
+		struct threaded_delta **group;
+		int i, nr = 0;
+		enum object_type type;
+		unsigned long size;
+		void *base;
+
+		/* take all the deltas against the next base */
+		pthread_mutex_lock(&work_mutex);
+		group = root_deltas + next_root_delta;
+		while (next_root_delta + nr < nr_root_deltas &&
+		       !hashcmp(group[nr]->base_sha1, group[0]->base_sha1))
+			nr++;
+		next_root_delta += nr;
+		pthread_mutex_unlock(&work_mutex);
+		if (!nr)
+			break;
+
+		base = read_sha1_file(group[0]->base_sha1, &type, &size);
+		if (!base) {
+			error("failed to read delta-pack base object %s",
+			      sha1_to_hex(group[0]->base_sha1));
+			if (!recover)
+				exit(1);
+			pthread_mutex_lock(&work_mutex);
+			has_errors = 1;
+			pthread_mutex_unlock(&work_mutex);
+			continue;
+		}
+		for (i = 0; i < nr; i++)
+			resolve_threaded_delta(group[i], type, base, size);
+		free(base);
+	}
+	return NULL;
+}
+
+static void finish_threaded_unpack(void)
+{
+	int i;
+
+	pthread_mutex_lock(&work_mutex);
+	write_queue_closed = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&work_mutex);
+	join_threads();
+	free(write_queue);
+	write_queue = NULL;
+
+	/*
+	 * Every non-delta object is written now.  The deltas against
+	 * one of them, or against an object we already had, start a
+	 * family; the others are found from their bases.
+	 */
+	ofs_deltas = xmalloc(nr_threaded_deltas * sizeof(*ofs_deltas));
+	ref_deltas = xmalloc(nr_threaded_deltas * sizeof(*ref_deltas));
+	root_deltas = xmalloc(nr_threaded_deltas * sizeof(*root_deltas));
+	for (i = 0; i < nr_threaded_deltas; i++) {
+		struct threaded_delta *d = &threaded_deltas[i];
+
+		if (d->type == OBJ_OFS_DELTA) {
+			ofs_deltas[nr_ofs_deltas++] = d;
+			if (is_null_sha1(obj_list[d->base_nr].sha1))
+				continue;
+			hashcpy(d->base_sha1, obj_list[d->base_nr].sha1);
+		} else {
+			ref_deltas[nr_ref_deltas++] = d;
+			if (!has_sha1_file(d->base_sha1))
+				continue;
+		}
+		root_deltas[nr_root_deltas++] = d;
+	}
+	qsort(ofs_deltas, nr_ofs_deltas, sizeof(*ofs_deltas), compare_ofs_delta);
+	qsort(ref_deltas, nr_ref_deltas, sizeof(*ref_deltas), compare_ref_delta);
+	qsort(root_deltas, nr_root_deltas, sizeof(*root_deltas),
+	      compare_ref_delta);
+
+	if (!quiet && nr_threaded_deltas)
+		resolve_progress = start_progress("Resolving deltas",
+						  nr_threaded_deltas);
+	start_threads(threaded_resolve);
+	join_threads();
+	stop_progress(&resolve_progress);
+
+	for (i = 0; i < nr_threaded_deltas; i++) {
+		if (!threaded_deltas[i].done)
+			die("unresolved deltas left after unpacking");
+	}
+	free(ofs_deltas);
+	free(ref_deltas);
+	free(root_deltas);
+	free(threaded_deltas);
+	threaded_deltas = NULL;
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&work_mutex);
+}
+#else
+#define queue_write(nr, type, buf, size)	write_object(nr, type, buf, size)
+#define queue_delta(nr, type, base_nr, base_sha1, delta, size)	(void)0
+#define start_threaded_unpack()	(void)0
+#define finish_threaded_unpack()	(void)0
+#endif
+
 static void unpack_non_delta_entry(enum object_type type, unsigned long size,
 				   unsigned nr)
 {
 	void *buf = get_data(size);
 
-	if (!dry_run && buf)
-		write_object(nr, type, buf, size);
-	else
+	if (!dry_run && buf) {
+		if (use_threads)
+			queue_write(nr, type, buf, size);
+		else
+			write_object(nr, type, buf, size);
+	} else
 		free(buf);
 }
 
@@ -341,6 +686,11 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			free(delta_data);
 			return;
 		}
+		if (use_threads) {
+			queue_delta(nr, OBJ_REF_DELTA, 0, base_sha1,
+				    delta_data, delta_size);
+			return;
+		}
 		if (has_sha1_file(base_sha1))
 			; /* Ok we have this one */
 		else if (resolve_against_held(nr, base_sha1,
@@ -388,6 +738,10 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 				hi = mid;
 			} else if (base_offset > obj_list[mid].offset) {
 				lo = mid + 1;
+			} else if (use_threads) {
+				queue_delta(nr, OBJ_OFS_DELTA, mid, NULL,
+					    delta_data, delta_size);
+				return;
 			} else {
 				hashcpy(base_sha1, obj_list[mid].sha1);
 				base_found = !is_null_sha1(base_sha1);
@@ -482,16 +836,37 @@ static void unpack_all(void)
 	if (!quiet)
 		progress = start_progress("Unpacking objects", nr_objects);
 	obj_list = xcalloc(nr_objects, sizeof(*obj_list));
+	if (use_threads)
+		start_threaded_unpack();
 	for (i = 0; i < nr_objects; i++) {
 		unpack_one(i);
 		display_progress(progress, i + 1);
 	}
 	stop_progress(&progress);
+	if (use_threads)
+		finish_threaded_unpack();
 
 	if (delta_list)
 		die("unresolved deltas left after unpacking");
 }
 
+static int unpack_objects_config(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.threads")) {
+		nr_threads = git_config_int(k, v);
+		if (nr_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    nr_threads);
+#ifdef NO_PTHREADS
+		if (nr_threads != 1)
+			warning("no threads support, ignoring %s", k);
+		nr_threads = 1;
+#endif
+		return 0;
+	}
+	return git_default_config(k, v, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 {
 	int i;
@@ -499,7 +874,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 
 	read_replace_refs = 0;
 
-	git_config(git_default_config, NULL);
+	git_config(unpack_objects_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -523,6 +898,19 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 				strict = 1;
 				continue;
 			}
+			if (!prefixcmp(arg, "--threads=")) {
+				char *end;
+				nr_threads = strtoul(arg + 10, &end, 0);
+				if (!arg[10] || *end || nr_threads < 0)
+					usage(unpack_usage);
+#ifdef NO_PTHREADS
+				if (nr_threads != 1)
+					warning("no threads support, ignoring %s",
+						arg);
+				nr_threads = 1;
+#endif
+				continue;
+			}
 			if (!prefixcmp(arg, "--pack_header=")) {
 				struct pack_header *hdr;
 				char *c;
@@ -544,6 +932,14 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 		/* We don't take any non-flag arguments now.. Maybe some day */
 		usage(unpack_usage);
 	}
+#ifndef NO_PTHREADS
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	/* --strict checks the objects in core, in order */
+	if (!strict && !dry_run &&
+	    (nr_threads > 1 || getenv("GIT_FORCE_THREADS")))
+		use_threads = 1;
+#endif
 	git_SHA1_Init(&ctx);
 	unpack_all();
 	git_SHA1_Update(&ctx, buffer, offset);
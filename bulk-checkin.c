@@ -4,9 +4,17 @@
 #include "bulk-checkin.h"
 #include "csum-file.h"
 #include "pack.h"
+#include "blob.h"
+#include "hash.h"
+#include "thread-utils.h"
 
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 
+struct written_object {
+	struct pack_idx_entry idx; /* first, for finish_tmp_packfile() */
+	struct written_object *next; /* with the same hash */
+};
+
 static struct bulk_checkin_state {
 	unsigned plugged:1;
 
@@ -18,8 +26,31 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	struct hash_table written_hash;
 } state;
 
+static unsigned int written_hash(const unsigned char *sha1)
+{
+	unsigned int hash;
+
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+static void add_written(struct bulk_checkin_state *state,
+			struct written_object *obj)
+{
+	void **pos;
+
+	ALLOC_GROW(state->written, state->nr_written + 1, state->alloc_written);
+	state->written[state->nr_written++] = &obj->idx;
+	pos = insert_hash(written_hash(obj->idx.sha1), obj, &state->written_hash);
+	if (pos) {
+		obj->next = *pos;
+		*pos = obj;
+	}
+}
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	unsigned char sha1[20];
@@ -52,23 +83,28 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 clear_exit:
 	free(state->written);
+	free_hash(&state->written_hash);
+	i = state->plugged;
 	memset(state, 0, sizeof(*state));
+	state->plugged = i;
 
 	/* Make objects we just wrote available to ourselves */
+	obj_read_lock();
 	reprepare_packed_git();
+	obj_read_unlock();
 }
 
-static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+static int already_written(struct bulk_checkin_state *state, const unsigned char *sha1)
 {
-	int i;
+	struct written_object *obj;
 
 	/* The object may already exist in the repository */
 	if (has_sha1_file(sha1))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (!hashcmp(state->written[i]->sha1, sha1))
+	obj = lookup_hash(written_hash(sha1), &state->written_hash);
+	for (; obj; obj = obj->next)
+		if (!hashcmp(obj->idx.sha1, sha1))
 			return 1;
 
 	/* This is a new object we need to keep */
@@ -192,6 +228,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	unsigned char obuf[16384];
 	unsigned header_len;
 	struct sha1file_checkpoint checkpoint;
+	struct written_object *obj = NULL;
 	struct pack_idx_entry *idx = NULL;
 
 	seekback = lseek(fd, 0, SEEK_CUR);
@@ -204,8 +241,10 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	git_SHA1_Update(&ctx, obuf, header_len);
 
 	/* Note: idx is non-NULL when we are writing */
-	if ((flags & HASH_WRITE_OBJECT) != 0)
-		idx = xcalloc(1, sizeof(*idx));
+	if ((flags & HASH_WRITE_OBJECT) != 0) {
+		obj = xcalloc(1, sizeof(*obj));
+		idx = &obj->idx;
+	}
 
 	already_hashed_to = 0;
 
@@ -240,13 +279,10 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	if (already_written(state, result_sha1)) {
 		sha1file_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
-		free(idx);
+		free(obj);
 	} else {
 		hashcpy(idx->sha1, result_sha1);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		add_written(state, obj);
 	}
 	return 0;
 }
@@ -262,6 +298,273 @@ int index_bulk_checkin(unsigned char *sha1,
 	return status;
 }
 
+/*
+ * index_bulk_checkin_files() hands the small regular files to the
+ * threads, which read, convert, hash and deflate each of them into a
+ * buffer of its own.  The calling thread appends the buffers to the
+ * pack in the order of the files, and indexes the other paths itself
+ * when their turn comes.  The threads work at most CHECKIN_WINDOW
+ * files and CHECKIN_WINDOW_SIZE bytes ahead of it.
+ */
+struct checkin_job {
+	void *data;		/* the pack entry, header included */
+	unsigned long len;
+	unsigned serial:1;	/* left to the appender */
+	unsigned done:1;
+};
+
+#define CHECKIN_WINDOW_SIZE (32 * 1024 * 1024)
+
+static struct bulk_checkin_file *checkin_files;
+static struct checkin_job *checkin_jobs;
+static int checkin_nr, checkin_next, checkin_appended, checkin_window;
+static unsigned long checkin_in_flight;
+static unsigned checkin_flags;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t checkin_mutex;
+static pthread_cond_t checkin_cond;
+/* attributes and filters are not safe to use from several threads */
+static pthread_mutex_t convert_mutex;
+static int checkin_threads_active;
+
+static void checkin_lock(pthread_mutex_t *mutex)
+{
+	if (checkin_threads_active)
+		pthread_mutex_lock(mutex);
+}
+
+static void checkin_unlock(pthread_mutex_t *mutex)
+{
+	if (checkin_threads_active)
+		pthread_mutex_unlock(mutex);
+}
+#else
+#define checkin_lock(mutex)	(void)0
+#define checkin_unlock(mutex)	(void)0
+#endif
+
+static unsigned long checkin_size(int i)
+{
+	return checkin_jobs[i].serial ? 0 : xsize_t(checkin_files[i].st.st_size);
+}
+
+static void deflate_checkin_job(struct checkin_job *job,
+				const void *buf, unsigned long size)
+{
+	git_zstream s;
+	unsigned char hdr[16], *out;
+	unsigned long bound;
+	unsigned hdrlen;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init(&s, pack_compression_level);
+	bound = git_deflate_bound(&s, size);
+	hdrlen = encode_in_pack_object_header(OBJ_BLOB, size, hdr);
+	out = xmalloc(hdrlen + bound);
+	memcpy(out, hdr, hdrlen);
+	s.next_in = (void *)buf;
+	s.avail_in = size;
+	s.next_out = out + hdrlen;
+	s.avail_out = bound;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	job->data = out;
+	job->len = hdrlen + s.total_out;
+}
+
+static void prepare_checkin_job(int i)
+{
+	struct bulk_checkin_file *file = &checkin_files[i];
+	struct checkin_job *job = &checkin_jobs[i];
+	struct strbuf nbuf = STRBUF_INIT;
+	size_t size = xsize_t(file->st.st_size);
+	void *buf;
+	int fd, converted;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd < 0) {
+		file->ret = error("open(\"%s\"): %s", file->path,
+				  strerror(errno));
+		return;
+	}
+	buf = xmalloc(size);
+	if (read_in_full(fd, buf, size) != size) {
+		file->ret = error("short read %s", strerror(errno));
+		close(fd);
+		free(buf);
+		return;
+	}
+	close(fd);
+
+	checkin_lock(&convert_mutex);
+	converted = convert_to_git(file->path, buf, size, &nbuf,
+				   (checkin_flags & HASH_WRITE_OBJECT) ?
+				   safe_crlf : SAFE_CRLF_FALSE);
+	checkin_unlock(&convert_mutex);
+	if (converted) {
+		free(buf);
+		buf = strbuf_detach(&nbuf, &size);
+	}
+
+	hash_sha1_file(buf, size, blob_type, file->sha1);
+	if ((checkin_flags & HASH_WRITE_OBJECT) && !has_sha1_file(file->sha1))
+		deflate_checkin_job(job, buf, size);
+	free(buf);
+	file->ret = 0;
+}
+
+static void append_checkin_job(struct bulk_checkin_state *state, int i)
+{
+	struct bulk_checkin_file *file = &checkin_files[i];
+	struct checkin_job *job = &checkin_jobs[i];
+	struct written_object *obj;
+
+	if (job->serial) {
+		checkin_lock(&convert_mutex);
+		file->ret = index_path(file->sha1, file->path, &file->st,
+				       checkin_flags);
+		checkin_unlock(&convert_mutex);
+		return;
+	}
+	if (!job->data || already_written(state, file->sha1))
+		goto out;
+
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + job->len) {
+		finish_bulk_checkin(state);
+		prepare_to_stream(state, HASH_WRITE_OBJECT);
+	}
+	obj = xcalloc(1, sizeof(*obj));
+	obj->idx.offset = state->offset;
+	crc32_begin(state->f);
+	sha1write(state->f, job->data, job->len);
+	obj->idx.crc32 = crc32_end(state->f);
+	state->offset += job->len;
+	hashcpy(obj->idx.sha1, file->sha1);
+	add_written(state, obj);
+out:
+	free(job->data);
+	job->data = NULL;
+}
+
+#ifndef NO_PTHREADS
+static void *checkin_thread(void *unused)
+{
+	pthread_mutex_lock(&checkin_mutex);
+	for (;;) {
+		int i;
+
+		while (checkin_next < checkin_nr &&
+		       (checkin_next >= checkin_appended + checkin_window ||
+			(checkin_in_flight &&
+			 checkin_in_flight + checkin_size(checkin_next) >
+			 CHECKIN_WINDOW_SIZE)))
+			pthread_cond_wait(&checkin_cond, &checkin_mutex);
+		if (checkin_next >= checkin_nr)
+			break;
+		i = checkin_next++;
+		checkin_in_flight += checkin_size(i);
+		pthread_mutex_unlock(&checkin_mutex);
+
+		if (!checkin_jobs[i].serial)
+			prepare_checkin_job(i);
+
+		pthread_mutex_lock(&checkin_mutex);
+		checkin_jobs[i].done = 1;
+		pthread_cond_broadcast(&checkin_cond);
+	}
+	pthread_mutex_unlock(&checkin_mutex);
+	return NULL;
+}
+
+static void run_checkin_threads(int nr_threads)
+{
+	pthread_t *threads = xcalloc(nr_threads, sizeof(*threads));
+	int i;
+
+	pthread_mutex_init(&checkin_mutex, NULL);
+	pthread_mutex_init(&convert_mutex, NULL);
+	pthread_cond_init(&checkin_cond, NULL);
+	enable_obj_read_lock();
+	checkin_threads_active = 1;
+	checkin_window = 64 * nr_threads;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL,
+					 checkin_thread, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+
+	pthread_mutex_lock(&checkin_mutex);
+	for (i = 0; i < checkin_nr; i++) {
+		while (!checkin_jobs[i].done)
+			pthread_cond_wait(&checkin_cond, &checkin_mutex);
+		pthread_mutex_unlock(&checkin_mutex);
+
+		append_checkin_job(&state, i);
+
+		pthread_mutex_lock(&checkin_mutex);
+		checkin_appended++;
+		checkin_in_flight -= checkin_size(i);
+		pthread_cond_broadcast(&checkin_cond);
+	}
+	pthread_mutex_unlock(&checkin_mutex);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	checkin_threads_active = 0;
+	disable_obj_read_lock();
+	pthread_cond_destroy(&checkin_cond);
+	pthread_mutex_destroy(&convert_mutex);
+	pthread_mutex_destroy(&checkin_mutex);
+}
+#endif
+
+void index_bulk_checkin_files(struct bulk_checkin_file *files, int nr,
+			      unsigned flags, int nr_threads)
+{
+	int i;
+
+	checkin_files = files;
+	checkin_nr = nr;
+	checkin_flags = flags;
+	checkin_next = checkin_appended = 0;
+	checkin_in_flight = 0;
+	checkin_jobs = xcalloc(nr, sizeof(*checkin_jobs));
+	for (i = 0; i < nr; i++) {
+		struct bulk_checkin_file *file = &files[i];
+
+		/* large blobs are streamed to the pack by the appender */
+		checkin_jobs[i].serial = !S_ISREG(file->st.st_mode) ||
+			xsize_t(file->st.st_size) > big_file_threshold;
+		file->ret = -1;
+	}
+
+#ifndef NO_PTHREADS
+	if (nr_threads > 0) {
+		run_checkin_threads(nr_threads);
+		goto out;
+	}
+#endif
+	for (i = 0; i < nr; i++) {
+		if (!checkin_jobs[i].serial)
+			prepare_checkin_job(i);
+		append_checkin_job(&state, i);
+	}
+#ifndef NO_PTHREADS
+out:
+#endif
+	free(checkin_jobs);
+	checkin_jobs = NULL;
+	checkin_files = NULL;
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
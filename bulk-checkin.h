@@ -10,6 +10,22 @@ extern int index_bulk_checkin(unsigned char sha1[],
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/*
+ * Index many paths at once, in turn as index_path() would, into the
+ * bulk-checkin pack when HASH_WRITE_OBJECT is given.  With nr_threads,
+ * the small regular files are read, converted, hashed and deflated by
+ * that many threads, and appended to the pack in order.
+ */
+struct bulk_checkin_file {
+	const char *path;
+	struct stat st;
+	unsigned char sha1[20];
+	int ret;	/* as index_path() */
+};
+
+extern void index_bulk_checkin_files(struct bulk_checkin_file *files, int nr,
+				     unsigned flags, int nr_threads);
+
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
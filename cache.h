@@ -470,6 +470,7 @@ extern int remove_file_from_index(struct index_state *, const char *path);
 #define ADD_CACHE_INTENT 16
 #define ADD_CACHE_IMPLICIT_DOT 32	/* internal to "git add -u/-A" */
 extern int add_to_index(struct index_state *, const char *path, struct stat *, int flags);
+extern int add_hashed_to_index(struct index_state *, const char *path, struct stat *, const unsigned char *sha1, int flags);
 extern int add_file_to_index(struct index_state *, const char *path, int flags);
 extern struct cache_entry *make_cache_entry(unsigned int mode, const unsigned char *sha1, const char *path, int stage, int refresh);
 extern int ce_same_name(struct cache_entry *a, struct cache_entry *b);
@@ -511,6 +512,16 @@ extern int limit_pathspec_to_literal(void);
 #define HASH_FORMAT_CHECK 2
 extern int index_fd(unsigned char *sha1, int fd, struct stat *st, enum object_type type, const char *path, unsigned flags);
 extern int index_path(unsigned char *sha1, const char *path, struct stat *st, unsigned flags);
+
+/* One file for index_fds(); "ret" is what index_fd() would have returned. */
+struct index_fd_item {
+	int fd;
+	struct stat st;
+	const char *path;
+	unsigned char sha1[20];
+	int ret;
+};
+extern void index_fds(struct index_fd_item *items, int nr, enum object_type type, unsigned flags);
 extern void fill_stat_cache_info(struct cache_entry *ce, struct stat *st);
 
 #define REFRESH_REALLY		0x0001	/* ignore_valid */
@@ -566,11 +577,16 @@ extern int core_compression_seen;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern unsigned int delta_base_cache_slots;
 extern unsigned long big_file_threshold;
+extern unsigned long delta_stream_window;
 extern unsigned long pack_size_limit_cfg;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_loose_object_cache;
 extern int core_apply_sparse_checkout;
 extern int precomposed_unicode;
 
@@ -784,6 +800,23 @@ extern int has_loose_object_nonlocal(const unsigned char *sha1);
 
 extern int has_pack_index(const unsigned char *sha1);
 
+/*
+ * read_sha1_file(), sha1_object_info(), has_sha1_file() and
+ * unpack_entry() may be called from several threads at once between
+ * enable_obj_read_lock() and disable_obj_read_lock(), and so may
+ * write_sha1_file(), which only needs the lock to look up and record
+ * the objects it writes.  The readers serialize on one lock, but drop
+ * it while inflating and applying deltas, which is where the time
+ * goes.  Code that uses the lower level pack functions (use_pack() and
+ * friends) directly must hold obj_read_lock() around them instead.
+ * While it is enabled, pack windows released to satisfy a failed
+ * allocation are released under the lock, whichever thread failed.
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+
 extern void assert_sha1_type(const unsigned char *sha1, enum object_type expect);
 
 extern const signed char hexval_table[256];
@@ -832,6 +865,7 @@ extern int for_each_abbrev(const char *prefix, each_abbrev_fn, void *);
 extern int get_sha1_hex(const char *hex, unsigned char *sha1);
 
 extern char *sha1_to_hex(const unsigned char *sha1);	/* static buffer result! */
+extern char *sha1_to_hex_r(char *out, const unsigned char *sha1); /* out needs 41 bytes */
 extern int read_ref_full(const char *refname, unsigned char *sha1,
 			 int reading, int *flags);
 extern int read_ref(const char *refname, unsigned char *sha1);
@@ -972,6 +1006,7 @@ extern void remove_scheduled_dirs(void);
 
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_objects; /* see core.looseObjectCache */
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -1004,12 +1039,22 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
-		 do_not_close:1;
+		 is_cruft:1, /* has a .mtimes file; see pack-mtimes.h */
+		 do_not_close:1,
+		 multi_pack_index:1, /* covered by the multi-pack-index */
+		 bloom_checked:1; /* looked for a .bloom; see pack-bloom.h */
+	const unsigned char *mtimes_map;
+	size_t mtimes_size;
+	const unsigned char *bloom_map;
+	size_t bloom_size;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 } *packed_git;
 
+/* The multi-pack-index of the local object directory, if any; see midx.h */
+extern struct multi_pack_index *multi_pack_index;
+
 struct pack_entry {
 	off_t offset;
 	unsigned char sha1[20];
@@ -1107,6 +1152,12 @@ extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsign
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
+/*
+ * Offset of the base of the delta of type "type" at "delta_obj_offset",
+ * whose header ends at "*curpos" (which is moved past the base reference);
+ * 0 if the base cannot be found.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs, off_t *curpos, enum object_type type, off_t delta_obj_offset);
 
 struct object_info {
 	/* Request */
@@ -0,0 +1,649 @@
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "csum-file.h"
+#include "refs.h"
+#include "progress.h"
+#include "sha1-lookup.h"
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_DATA_WIDTH (20 + 16)
+
+/* values of the parent fields of a CDAT record */
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			GRAPH_FANOUT_SIZE + 20)
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char num_chunks;
+	uint32_t num_commits;
+
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+	size_t large_edges_len;
+};
+
+static struct commit_graph *commit_graph;
+
+static char *get_commit_graph_filename(const char *obj_dir)
+{
+	return mkpathdup("%s/info/commit-graph", obj_dir);
+}
+
+static int has_replace_ref(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The commit-graph records the parents as found in the commit
+ * objects; grafts, shallow boundaries and replaced commits would make
+ * it lie about the history we are supposed to see.
+ */
+static int commit_graph_compatible(void)
+{
+	if (commit_grafts_in_effect())
+		return 0;
+	if (read_replace_refs && for_each_replace_ref(has_replace_ref, NULL))
+		return 0;
+	return 1;
+}
+
+int commit_graph_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0)
+		enabled = core_commit_graph && commit_graph_compatible();
+	return enabled;
+}
+
+static struct commit_graph *parse_commit_graph(const unsigned char *data,
+					       size_t data_len,
+					       const char *graph_file)
+{
+	const unsigned char *chunk_lookup;
+	struct commit_graph *g;
+	uint32_t i;
+
+	if (get_be32(data) != GRAPH_SIGNATURE) {
+		error("commit-graph signature %X does not match signature %X",
+		      get_be32(data), GRAPH_SIGNATURE);
+		return NULL;
+	}
+	if (data[4] != GRAPH_VERSION) {
+		error("commit-graph version %X does not match version %X",
+		      data[4], GRAPH_VERSION);
+		return NULL;
+	}
+	if (data[5] != GRAPH_OID_VERSION) {
+		error("commit-graph hash version %X does not match version %X",
+		      data[5], GRAPH_OID_VERSION);
+		return NULL;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = data_len;
+	g->num_chunks = data[6];
+
+	if (data_len < GRAPH_HEADER_SIZE +
+	    (g->num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH + 20)
+		goto corrupt;
+
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	for (i = 0; i < g->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t next_offset = get_be64(chunk_lookup + 4 +
+						GRAPH_CHUNKLOOKUP_WIDTH);
+		const unsigned char *chunk = data + chunk_offset;
+
+		if (chunk_offset > next_offset ||
+		    next_offset > data_len - 20)
+			goto corrupt;
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (next_offset - chunk_offset != GRAPH_FANOUT_SIZE)
+				goto corrupt;
+			g->chunk_oid_fanout = chunk;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			g->chunk_oid_lookup = chunk;
+			g->num_commits = (next_offset - chunk_offset) / 20;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			g->chunk_commit_data = chunk;
+			break;
+		case GRAPH_CHUNKID_LARGEEDGES:
+			g->chunk_large_edges = chunk;
+			g->large_edges_len = next_offset - chunk_offset;
+			break;
+		}
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup ||
+	    !g->chunk_commit_data ||
+	    get_be32(g->chunk_oid_fanout + 4 * 255) != g->num_commits ||
+	    g->chunk_commit_data + (size_t)g->num_commits * GRAPH_DATA_WIDTH >
+	    data + data_len - 20)
+		goto corrupt;
+	for (i = 1; i < 256; i++)
+		if (get_be32(g->chunk_oid_fanout + 4 * (i - 1)) >
+		    get_be32(g->chunk_oid_fanout + 4 * i))
+			goto corrupt;
+
+	return g;
+
+corrupt:
+	error("commit-graph file %s is corrupt", graph_file);
+	free(g);
+	return NULL;
+}
+
+static struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct commit_graph *g;
+	struct stat st;
+	size_t graph_size;
+	void *graph_map;
+	int fd;
+
+	fd = open(graph_file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	graph_size = xsize_t(st.st_size);
+	if (graph_size < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+	graph_map = xmmap(NULL, graph_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	g = parse_commit_graph(graph_map, graph_size, graph_file);
+	if (!g)
+		munmap(graph_map, graph_size);
+	return g;
+}
+
+static int prepare_commit_graph(void)
+{
+	static int prepared;
+	char *graph_name;
+
+	if (prepared)
+		return !!commit_graph;
+	prepared = 1;
+
+	if (!commit_graph_enabled())
+		return 0;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+	return !!commit_graph;
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? get_be32(g->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = get_be32(g->chunk_oid_fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->chunk_oid_lookup + 20 * mi);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32, pos);
+	c = lookup_commit(g->chunk_oid_lookup + 20 * pos);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + 20 * pos));
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_in_graph(struct commit *item,
+				 struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *data = g->chunk_commit_data +
+		(size_t)GRAPH_DATA_WIDTH * pos;
+	struct commit_list **pptr = &item->parents;
+	uint32_t edge, date_high;
+
+	item->object.parsed = 1;
+	item->graph_pos = pos;
+	item->tree = lookup_tree(data);
+
+	date_high = get_be32(data + 28);
+	item->generation = date_high >> 2;
+	item->date = (unsigned long)(((uint64_t)(date_high & 0x3) << 32) |
+				     get_be32(data + 32));
+
+	edge = get_be32(data + 20);
+	if (edge == GRAPH_PARENT_NONE)
+		return;
+	pptr = insert_parent_or_die(g, edge, pptr);
+
+	edge = get_be32(data + 24);
+	if (edge == GRAPH_PARENT_NONE)
+		return;
+	if (!(edge & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge, pptr);
+		return;
+	}
+
+	/* octopus merge: the other parents are in the EDGE chunk */
+	edge &= GRAPH_EDGE_LAST_MASK;
+	do {
+		const unsigned char *p;
+
+		if (!g->chunk_large_edges ||
+		    4 * (size_t)edge + 4 > g->large_edges_len)
+			die("commit-graph has an invalid octopus edge list");
+		p = g->chunk_large_edges + 4 * (size_t)edge++;
+		pptr = insert_parent_or_die(g, get_be32(p) & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+		if (get_be32(p) & GRAPH_LAST_EDGE)
+			break;
+	} while (1);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph())
+		return 0;
+	if (lookup_commit_graft(item->object.sha1))
+		return 0;
+	if (!bsearch_graph(commit_graph, item->object.sha1, &pos))
+		return 0;
+	fill_commit_in_graph(item, commit_graph, pos);
+	return 1;
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph())
+		return;
+	if (!bsearch_graph(commit_graph, item->object.sha1, &pos))
+		return;
+	item->graph_pos = pos;
+	item->generation = get_be32(commit_graph->chunk_commit_data +
+				    (size_t)GRAPH_DATA_WIDTH * pos + 28) >> 2;
+}
+
+int read_commit_graph_summary(const char *obj_dir)
+{
+	char *graph_name = get_commit_graph_filename(obj_dir);
+	struct commit_graph *g = load_commit_graph_one(graph_name);
+
+	if (!g) {
+		error("could not load commit-graph %s", graph_name);
+		free(graph_name);
+		return -1;
+	}
+	free(graph_name);
+
+	printf("header: %08x %d %d %d %d\n",
+	       get_be32(g->data), g->data[4], g->data[5], g->data[6],
+	       g->data[7]);
+	printf("num_commits: %"PRIu32"\n", g->num_commits);
+	printf("chunks:");
+	if (g->chunk_oid_fanout)
+		printf(" oid_fanout");
+	if (g->chunk_oid_lookup)
+		printf(" oid_lookup");
+	if (g->chunk_commit_data)
+		printf(" commit_metadata");
+	if (g->chunk_large_edges)
+		printf(" large_edges");
+	printf("\n");
+
+	munmap((void *)g->data, g->data_len);
+	free(g);
+	return 0;
+}
+
+/*
+ * Writing
+ */
+
+#define GRAPH_SEEN (1u<<14)
+
+struct graph_writer {
+	struct commit **commits;
+	int nr, alloc;
+	uint32_t *generations;
+	uint32_t num_large_edges;
+};
+
+static const unsigned char *commit_access(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.sha1;
+}
+
+static int commit_pos(struct graph_writer *w, struct commit *c)
+{
+	return sha1_pos(c->object.sha1, w->commits, w->nr, commit_access);
+}
+
+static void add_commit(struct graph_writer *w, struct commit *c)
+{
+	if (c->object.flags & GRAPH_SEEN)
+		return;
+	c->object.flags |= GRAPH_SEEN;
+	ALLOC_GROW(w->commits, w->nr + 1, w->alloc);
+	w->commits[w->nr++] = c;
+}
+
+static int add_ref_commit(const char *refname, const unsigned char *sha1,
+			  int flags, void *cb_data)
+{
+	struct commit *c = lookup_commit_reference_gently(sha1, 1);
+
+	if (c)
+		add_commit(cb_data, c);
+	return 0;
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	struct commit *a = *(struct commit **)a_;
+	struct commit *b = *(struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static void close_reachable(struct graph_writer *w, struct progress *progress)
+{
+	int i;
+
+	/* w->commits grows as we go: this is a breadth-first walk */
+	for (i = 0; i < w->nr; i++) {
+		struct commit *c = w->commits[i];
+		struct commit_list *parent;
+
+		if (parse_commit(c))
+			die("unable to parse commit %s",
+			    sha1_to_hex(c->object.sha1));
+		for (parent = c->parents; parent; parent = parent->next)
+			add_commit(w, parent->item);
+		display_progress(progress, i + 1);
+	}
+}
+
+/*
+ * The generation number of a commit is one more than the largest
+ * generation of its parents (1 for root commits), so it is always
+ * strictly larger than that of any of its ancestors.
+ */
+static void compute_generation_numbers(struct graph_writer *w)
+{
+	struct commit_list *stack = NULL;
+	int i;
+
+	w->generations = xcalloc(w->nr, sizeof(*w->generations));
+	for (i = 0; i < w->nr; i++) {
+		if (w->generations[i])
+			continue;
+		commit_list_insert(w->commits[i], &stack);
+		while (stack) {
+			struct commit *c = stack->item;
+			struct commit_list *parent;
+			uint32_t max_generation = 0;
+			int all_done = 1;
+
+			for (parent = c->parents; parent; parent = parent->next) {
+				uint32_t g = w->generations[commit_pos(w, parent->item)];
+				if (!g) {
+					commit_list_insert(parent->item, &stack);
+					all_done = 0;
+				} else if (g > max_generation)
+					max_generation = g;
+			}
+			if (!all_done)
+				continue;
+
+			if (max_generation < GENERATION_NUMBER_MAX)
+				max_generation++;
+			w->generations[commit_pos(w, c)] = max_generation;
+			pop_commit(&stack);
+		}
+	}
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f, struct graph_writer *w)
+{
+	int i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t v;
+
+		while (count < w->nr && w->commits[count]->object.sha1[0] == i)
+			count++;
+		v = htonl(count);
+		sha1write(f, &v, 4);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f, struct graph_writer *w)
+{
+	int i;
+
+	for (i = 0; i < w->nr; i++)
+		sha1write(f, w->commits[i]->object.sha1, 20);
+}
+
+static uint32_t parent_pos(struct graph_writer *w, struct commit *parent)
+{
+	int pos = commit_pos(w, parent);
+
+	if (pos < 0)
+		die("BUG: parent %s is not in the commit-graph",
+		    sha1_to_hex(parent->object.sha1));
+	return pos;
+}
+
+static void write_graph_chunk_data(struct sha1file *f, struct graph_writer *w)
+{
+	uint32_t num_extra_edges = 0;
+	int i;
+
+	for (i = 0; i < w->nr; i++) {
+		struct commit *c = w->commits[i];
+		struct commit_list *parent = c->parents;
+		unsigned char buf[16];
+		uint64_t date = c->date;
+
+		sha1write(f, c->tree->object.sha1, 20);
+
+		put_be32(buf, parent ? parent_pos(w, parent->item) :
+			 GRAPH_PARENT_NONE);
+		if (!parent || !parent->next)
+			put_be32(buf + 4, GRAPH_PARENT_NONE);
+		else if (!parent->next->next)
+			put_be32(buf + 4, parent_pos(w, parent->next->item));
+		else {
+			put_be32(buf + 4, GRAPH_OCTOPUS_EDGES_NEEDED |
+				 num_extra_edges);
+			for (parent = parent->next; parent; parent = parent->next)
+				num_extra_edges++;
+		}
+
+		put_be32(buf + 8, w->generations[i] << 2 |
+			 (uint32_t)((date >> 32) & 0x3));
+		put_be32(buf + 12, (uint32_t)date);
+		sha1write(f, buf, 16);
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct graph_writer *w)
+{
+	int i;
+
+	for (i = 0; i < w->nr; i++) {
+		struct commit_list *parent = w->commits[i]->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t v = parent_pos(w, parent->item);
+			if (!parent->next)
+				v |= GRAPH_LAST_EDGE;
+			v = htonl(v);
+			sha1write(f, &v, 4);
+		}
+	}
+}
+
+static void count_large_edges(struct graph_writer *w)
+{
+	int i;
+
+	for (i = 0; i < w->nr; i++) {
+		struct commit_list *parent = w->commits[i]->parents;
+		int nr = commit_list_count(parent);
+		if (nr > 2)
+			w->num_large_edges += nr - 1;
+	}
+}
+
+static void write_graph_file(const char *graph_name, struct graph_writer *w)
+{
+	static struct lock_file lock;
+	uint32_t chunk_ids[5];
+	uint64_t chunk_offsets[5];
+	unsigned char header[GRAPH_HEADER_SIZE];
+	struct sha1file *f;
+	int num_chunks, i, fd;
+
+	count_large_edges(w);
+	num_chunks = w->num_large_edges ? 4 : 3;
+
+	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	chunk_ids[3] = w->num_large_edges ? GRAPH_CHUNKID_LARGEEDGES : 0;
+	chunk_ids[4] = 0;
+
+	chunk_offsets[0] = GRAPH_HEADER_SIZE +
+		(num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
+	chunk_offsets[2] = chunk_offsets[1] + 20 * (uint64_t)w->nr;
+	chunk_offsets[3] = chunk_offsets[2] + GRAPH_DATA_WIDTH * (uint64_t)w->nr;
+	chunk_offsets[4] = chunk_offsets[3] + 4 * (uint64_t)w->num_large_edges;
+
+	if (safe_create_leading_directories_const(graph_name))
+		die_errno("unable to create leading directories of %s",
+			  graph_name);
+	fd = hold_lock_file_for_update(&lock, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	put_be32(header, GRAPH_SIGNATURE);
+	header[4] = GRAPH_VERSION;
+	header[5] = GRAPH_OID_VERSION;
+	header[6] = num_chunks;
+	header[7] = 0; /* reserved */
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i <= num_chunks; i++) {
+		unsigned char entry[GRAPH_CHUNKLOOKUP_WIDTH];
+		put_be32(entry, chunk_ids[i]);
+		put_be32(entry + 4, (uint32_t)(chunk_offsets[i] >> 32));
+		put_be32(entry + 8, (uint32_t)chunk_offsets[i]);
+		sha1write(f, entry, sizeof(entry));
+	}
+
+	write_graph_chunk_fanout(f, w);
+	write_graph_chunk_oids(f, w);
+	write_graph_chunk_data(f, w);
+	if (w->num_large_edges)
+		write_graph_chunk_large_edges(f, w);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		die_errno("unable to write commit-graph %s", graph_name);
+}
+
+int write_commit_graph_reachable(const char *obj_dir, int report_progress)
+{
+	struct graph_writer w;
+	struct progress *progress = NULL;
+	int saved_save_commit_buffer = save_commit_buffer;
+	char *graph_name;
+	int i;
+
+	if (!commit_graph_compatible())
+		return error("not writing a commit-graph: grafts, shallow "
+			     "history or replace refs are in use");
+
+	memset(&w, 0, sizeof(w));
+	head_ref(add_ref_commit, &w);
+	for_each_ref(add_ref_commit, &w);
+
+	if (report_progress)
+		progress = start_progress("Collecting commits for commit-graph", 0);
+	save_commit_buffer = 0;
+	close_reachable(&w, progress);
+	save_commit_buffer = saved_save_commit_buffer;
+	stop_progress(&progress);
+
+	for (i = 0; i < w.nr; i++)
+		w.commits[i]->object.flags &= ~GRAPH_SEEN;
+
+	qsort(w.commits, w.nr, sizeof(*w.commits), commit_sha1_cmp);
+	compute_generation_numbers(&w);
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	write_graph_file(graph_name, &w);
+	free(graph_name);
+
+	free(w.generations);
+	free(w.commits);
+	return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file ($GIT_OBJECT_DIRECTORY/info/commit-graph)
+ * records, for every commit reachable from the refs at the time it was
+ * written, the information parse_commit() needs for a history walk:
+ * the root tree, the parents, the commit date and a generation number.
+ * Reading a fixed-width record from it is much cheaper than inflating
+ * and parsing the commit object.  See
+ * Documentation/technical/commit-graph-format.txt.
+ */
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_OID_VERSION 1 /* SHA-1 */
+
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+
+struct commit;
+
+/* Is "core.commitGraph" on and usable with this repository? */
+int commit_graph_enabled(void);
+
+/*
+ * Fill "item" (tree, parents, date, generation) from the commit-graph
+ * without reading the object.  Returns 1 if the commit was found in
+ * the commit-graph, 0 if it must be parsed the usual way.
+ */
+int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the position and generation number of a commit that was
+ * parsed from its object but is also in the commit-graph.
+ */
+void load_commit_graph_info(struct commit *item);
+
+/*
+ * Write a commit-graph covering all commits reachable from the refs
+ * (and HEAD) of the repository into "obj_dir".  Returns 0 on success.
+ */
+int write_commit_graph_reachable(const char *obj_dir, int report_progress);
+
+/* Print a summary of the commit-graph in "obj_dir" to stdout. */
+int read_commit_graph_summary(const char *obj_dir);
+
+#endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "tag.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "pkt-line.h"
 #include "utf8.h"
 #include "diff.h"
@@ -55,13 +56,24 @@ struct commit *lookup_commit_or_die(const unsigned char *sha1, const char *ref_n
 	return c;
 }
 
+static void init_commit_node(struct commit *c)
+{
+	c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+	c->generation = GENERATION_NUMBER_INFINITY;
+}
+
 struct commit *lookup_commit(const unsigned char *sha1)
 {
 	struct object *obj = lookup_object(sha1);
-	if (!obj)
-		return create_object(sha1, OBJ_COMMIT, alloc_commit_node());
-	if (!obj->type)
+	if (!obj) {
+		struct commit *c = alloc_commit_node();
+		init_commit_node(c);
+		return create_object(sha1, OBJ_COMMIT, c);
+	}
+	if (!obj->type) {
 		obj->type = OBJ_COMMIT;
+		init_commit_node((struct commit *)obj);
+	}
 	return check_commit(obj, sha1, 0);
 }
 
@@ -230,6 +242,12 @@ struct commit_graft *lookup_commit_graft(const unsigned char *sha1)
 	return commit_graft[pos];
 }
 
+int commit_grafts_in_effect(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr > 0;
+}
+
 int for_each_commit_graft(each_commit_graft_fn fn, void *cb_data)
 {
 	int i, ret;
@@ -303,6 +321,9 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 	}
 	item->date = parse_commit_date(bufptr, tail);
 
+	if (item->generation == GENERATION_NUMBER_INFINITY)
+		load_commit_graph_info(item);
+
 	return 0;
 }
 
@@ -317,6 +338,8 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	if (!save_commit_buffer && parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -618,20 +641,50 @@ static struct commit *interesting(struct commit_list *list)
 	return NULL;
 }
 
-/* all input commits in one and twos[] must have been parsed! */
-static struct commit_list *paint_down_to_common(struct commit *one, int n, struct commit **twos)
+/*
+ * Order commits by decreasing generation number, then by decreasing
+ * date.  Unlike dates, generation numbers never lie: a commit always
+ * comes before all of its ancestors.
+ */
+static struct commit_list *insert_by_generation(struct commit *item,
+						struct commit_list **list)
+{
+	struct commit_list **pp = list;
+	struct commit_list *p;
+
+	while ((p = *pp) != NULL) {
+		if (p->item->generation < item->generation ||
+		    (p->item->generation == item->generation &&
+		     p->item->date < item->date))
+			break;
+		pp = &p->next;
+	}
+	return commit_list_insert(item, pp);
+}
+
+/*
+ * All input commits in one and twos[] must have been parsed!
+ *
+ * If min_generation is not zero, the caller is only interested in
+ * whether "one" is reachable from twos[]; commits with a smaller
+ * generation number than that cannot reach it, so the walk stops when
+ * it gets there.
+ */
+static struct commit_list *paint_down_to_common(struct commit *one, int n,
+						struct commit **twos,
+						uint32_t min_generation)
 {
 	struct commit_list *list = NULL;
 	struct commit_list *result = NULL;
 	int i;
 
 	one->object.flags |= PARENT1;
-	commit_list_insert_by_date(one, &list);
+	insert_by_generation(one, &list);
 	if (!n)
 		return list;
 	for (i = 0; i < n; i++) {
 		twos[i]->object.flags |= PARENT2;
-		commit_list_insert_by_date(twos[i], &list);
+		insert_by_generation(twos[i], &list);
 	}
 
 	while (interesting(list)) {
@@ -641,6 +694,8 @@ static struct commit_list *paint_down_to_common(struct commit *one, int n, struc
 		int flags;
 
 		commit = list->item;
+		if (commit->generation < min_generation)
+			break;
 		next = list->next;
 		free(list);
 		list = next;
@@ -663,7 +718,7 @@ static struct commit_list *paint_down_to_common(struct commit *one, int n, struc
 			if (parse_commit(p))
 				return NULL;
 			p->object.flags |= flags;
-			commit_list_insert_by_date(p, &list);
+			insert_by_generation(p, &list);
 		}
 	}
 
@@ -693,7 +748,7 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 			return NULL;
 	}
 
-	list = paint_down_to_common(one, n, twos);
+	list = paint_down_to_common(one, n, twos, 0);
 
 	while (list) {
 		struct commit_list *next = list->next;
@@ -762,7 +817,7 @@ static int remove_redundant(struct commit **array, int cnt)
 			filled_index[filled] = j;
 			work[filled++] = array[j];
 		}
-		common = paint_down_to_common(array[i], filled, work);
+		common = paint_down_to_common(array[i], filled, work, 0);
 		if (array[i]->object.flags & PARENT2)
 			redundant[i] = 1;
 		for (j = 0; j < filled; j++)
@@ -865,14 +920,23 @@ int in_merge_bases_many(struct commit *commit, int nr_reference, struct commit *
 {
 	struct commit_list *bases;
 	int ret = 0, i;
+	uint32_t max_generation = 0;
 
 	if (parse_commit(commit))
 		return ret;
-	for (i = 0; i < nr_reference; i++)
+	for (i = 0; i < nr_reference; i++) {
 		if (parse_commit(reference[i]))
 			return ret;
+		if (reference[i]->generation > max_generation)
+			max_generation = reference[i]->generation;
+	}
+
+	/* an ancestor always has a smaller generation number */
+	if (commit->generation > max_generation)
+		return ret;
 
-	bases = paint_down_to_common(commit, nr_reference, reference);
+	bases = paint_down_to_common(commit, nr_reference, reference,
+				     commit->generation);
 	if (commit->object.flags & PARENT2)
 		ret = 1;
 	clear_commit_marks(commit, all_flags);
@@ -12,6 +12,10 @@ struct commit_list {
 	struct commit_list *next;
 };
 
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
 struct commit {
 	struct object object;
 	void *util;
@@ -20,6 +24,13 @@ struct commit {
 	struct commit_list *parents;
 	struct tree *tree;
 	char *buffer;
+	/*
+	 * Position in the commit-graph and generation number, for
+	 * commits that are in the commit-graph; see commit-graph.h.
+	 * The generation is GENERATION_NUMBER_INFINITY otherwise.
+	 */
+	uint32_t graph_pos;
+	uint32_t generation;
 };
 
 extern int save_commit_buffer;
@@ -47,6 +58,13 @@ struct commit *lookup_commit_reference_by_name(const char *name);
 struct commit *lookup_commit_or_die(const unsigned char *sha1, const char *ref_name);
 
 int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long size);
+
+/*
+ * Parse the commit object, unless it has already been.  When
+ * save_commit_buffer is off (i.e. the caller is only interested in
+ * the shape of the history), the commit may be filled from the
+ * commit-graph without reading the object at all.
+ */
 int parse_commit(struct commit *item);
 
 /* Find beginning and length of commit subject. */
@@ -162,6 +180,8 @@ typedef int (*each_commit_graft_fn)(const struct commit_graft *, void *);
 struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
+/* Are there any grafts (including shallow boundaries)? */
+int commit_grafts_in_effect(void);
 
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2, int cleanup);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos, int cleanup);
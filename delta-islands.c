@@ -0,0 +1,318 @@
+#include "cache.h"
+#include "delta-islands.h"
+#include "commit.h"
+#include "tree.h"
+#include "blob.h"
+#include "tag.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "decorate.h"
+#include "progress.h"
+#include "string-list.h"
+
+static regex_t *island_regexes;
+static int island_regexes_nr, island_regexes_alloc;
+
+/* island names; the util field holds the index of the island */
+static struct string_list island_names = STRING_LIST_INIT_DUP;
+
+/*
+ * The set of islands an object is reachable from.  Many objects share
+ * the same set, so bitmaps are reference counted and copied only when
+ * one of their users needs to grow it.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static uint32_t island_bitmap_size;
+static struct decoration island_marks;
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) +
+		      island_bitmap_size * sizeof(uint32_t);
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+	b->refcount = 1;
+	return b;
+}
+
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_or(struct island_bitmap *self,
+			     const struct island_bitmap *other)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		self->bits[i] |= other->bits[i];
+}
+
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b = lookup_decoration(&island_marks, obj);
+
+	if (!b) {
+		marks->refcount++;
+		add_decoration(&island_marks, obj, marks);
+		return;
+	}
+	if (island_bitmap_is_subset(marks, b))
+		return;
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		add_decoration(&island_marks, obj, b);
+	}
+	island_bitmap_or(b, marks);
+}
+
+int island_config(const char *k, const char *v)
+{
+	regex_t *re;
+
+	if (strcmp(k, "pack.island"))
+		return 0;
+	if (!v)
+		return config_error_nonbool(k);
+
+	ALLOC_GROW(island_regexes, island_regexes_nr + 1, island_regexes_alloc);
+	re = &island_regexes[island_regexes_nr];
+	if (regcomp(re, v, REG_EXTENDED))
+		die("failed to load island regex for '%s': %s", k, v);
+	island_regexes_nr++;
+	return 1;
+}
+
+struct island_ref {
+	unsigned char sha1[20];
+	int island;
+};
+
+static struct island_ref *island_refs;
+static int island_refs_nr, island_refs_alloc;
+
+static int find_island_for_ref(const char *refname, const unsigned char *sha1,
+			       int flags, void *data)
+{
+	regmatch_t matches[16];
+	struct strbuf name = STRBUF_INIT;
+	struct string_list_item *item;
+	int i, m;
+
+	/* the last matching regex wins */
+	for (i = island_regexes_nr - 1; i >= 0; i--)
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	if (i < 0)
+		return 0;
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (name.len)
+			strbuf_addch(&name, '-');
+		strbuf_add(&name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	item = string_list_lookup(&island_names, name.buf);
+	if (!item) {
+		item = string_list_insert(&island_names, name.buf);
+		item->util = (void *)(intptr_t)(island_names.nr - 1);
+	}
+	strbuf_release(&name);
+
+	ALLOC_GROW(island_refs, island_refs_nr + 1, island_refs_alloc);
+	hashcpy(island_refs[island_refs_nr].sha1, sha1);
+	island_refs[island_refs_nr].island = (intptr_t)item->util;
+	island_refs_nr++;
+	return 0;
+}
+
+void load_delta_islands(void)
+{
+	struct island_bitmap **islands;
+	int i;
+
+	for_each_ref(find_island_for_ref, NULL);
+
+	island_bitmap_size = (island_names.nr + 31) / 32;
+	islands = xcalloc(island_names.nr, sizeof(*islands));
+	for (i = 0; i < island_names.nr; i++) {
+		islands[i] = island_bitmap_new(NULL);
+		islands[i]->bits[i / 32] |= 1u << (i % 32);
+	}
+
+	for (i = 0; i < island_refs_nr; i++) {
+		struct island_bitmap *marks = islands[island_refs[i].island];
+		struct object *obj = parse_object(island_refs[i].sha1);
+
+		while (obj) {
+			set_island_marks(obj, marks);
+			if (obj->type != OBJ_TAG)
+				break;
+			obj = parse_object(((struct tag *)obj)->tagged->sha1);
+		}
+	}
+
+	/* every object marked holds its own reference now */
+	for (i = 0; i < island_names.nr; i++)
+		if (!--islands[i]->refcount)
+			free(islands[i]);
+	free(islands);
+	free(island_refs);
+	island_refs = NULL;
+	island_refs_nr = island_refs_alloc = 0;
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks;
+	struct commit_list *p;
+
+	marks = lookup_decoration(&island_marks, &commit->object);
+	if (!marks)
+		return;
+
+	parse_commit(commit);
+	if (commit->tree)
+		set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+struct island_tree {
+	struct object *tree;
+	unsigned int depth;
+	uint32_t order;
+};
+
+static struct island_tree *island_trees;
+static uint32_t island_trees_nr, island_trees_alloc;
+
+void island_record_tree(struct object *tree, const char *path)
+{
+	struct island_tree *it;
+
+	ALLOC_GROW(island_trees, island_trees_nr + 1, island_trees_alloc);
+	it = &island_trees[island_trees_nr];
+	it->tree = tree;
+	it->depth = 0;
+	if (path && *path) {
+		it->depth = 1;
+		while ((path = strchr(path, '/')) != NULL) {
+			path++;
+			it->depth++;
+		}
+	}
+	it->order = island_trees_nr++;
+}
+
+static int tree_depth_compare(const void *a_, const void *b_)
+{
+	const struct island_tree *a = a_;
+	const struct island_tree *b = b_;
+
+	if (a->depth != b->depth)
+		return a->depth < b->depth ? -1 : 1;
+	return a->order < b->order ? -1 : a->order > b->order;
+}
+
+/*
+ * Hand the marks of each tree down to its entries.  Going through
+ * the trees from the shallowest ones makes sure that a tree has all
+ * its marks by the time we look at it, except in the rare case of a
+ * tree found at different depths.
+ */
+void resolve_tree_islands(int progress)
+{
+	struct progress *progress_state = NULL;
+	uint32_t i;
+
+	if (!island_names.nr)
+		goto out;
+
+	qsort(island_trees, island_trees_nr, sizeof(*island_trees),
+	      tree_depth_compare);
+
+	if (progress)
+		progress_state = start_progress("Propagating island marks",
+						island_trees_nr);
+	for (i = 0; i < island_trees_nr; i++) {
+		struct object *tree = island_trees[i].tree;
+		struct island_bitmap *marks;
+		struct tree_desc desc;
+		struct name_entry entry;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		display_progress(progress_state, i + 1);
+		marks = lookup_decoration(&island_marks, tree);
+		if (!marks)
+			continue;
+
+		buf = read_sha1_file(tree->sha1, &type, &size);
+		if (!buf || type != OBJ_TREE)
+			die("unable to read tree %s", sha1_to_hex(tree->sha1));
+		init_tree_desc(&desc, buf, size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			if (S_ISDIR(entry.mode))
+				obj = &lookup_tree(entry.sha1)->object;
+			else
+				obj = &lookup_blob(entry.sha1)->object;
+			if (obj)
+				set_island_marks(obj, marks);
+		}
+		free(buf);
+	}
+	stop_progress(&progress_state);
+
+out:
+	free(island_trees);
+	island_trees = NULL;
+	island_trees_nr = island_trees_alloc = 0;
+}
+
+int in_same_island(const unsigned char *trg_sha1,
+		   const unsigned char *src_sha1)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+	struct object *obj;
+
+	obj = lookup_object(trg_sha1);
+	trg_marks = obj ? lookup_decoration(&island_marks, obj) : NULL;
+	/* an object in no island can use any base */
+	if (!trg_marks)
+		return 1;
+
+	obj = lookup_object(src_sha1);
+	src_marks = obj ? lookup_decoration(&island_marks, obj) : NULL;
+	if (!src_marks)
+		return 0;
+
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
@@ -0,0 +1,48 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+/*
+ * Delta islands split the refs of a repository into groups ("islands"),
+ * typically one per fork of a project sharing an object store, so
+ * that pack-objects never stores an object as a delta against a base
+ * that is not reachable from every island the object itself is
+ * reachable from.  A clone of any one island can then reuse every
+ * delta as is.
+ *
+ * Islands are defined by "pack.island" regexes matched against the
+ * full ref names; the text of the capture groups of the regex, joined
+ * by '-', names the island of a matching ref (so one regex can define
+ * many islands).  If several regexes match a ref, the last one wins.
+ */
+
+struct commit;
+struct object;
+
+/* config callback for "pack.island"; returns 1 if it handled "k" */
+int island_config(const char *k, const char *v);
+
+/* Mark the tips of each island; call before walking. */
+void load_delta_islands(void);
+
+/*
+ * Hand the marks of "commit" down to its parents and its tree; the
+ * walk must show children before parents (i.e. use topo order).
+ */
+void propagate_island_marks(struct commit *commit);
+
+/*
+ * Remember "tree", found at "path" during the walk, so that
+ * resolve_tree_islands() can hand its marks down to its entries.
+ */
+void island_record_tree(struct object *tree, const char *path);
+void resolve_tree_islands(int progress);
+
+/*
+ * Can the object "trg_sha1" be stored as a delta against "src_sha1",
+ * that is, is the base in every island the target is in?  Safe to
+ * call from several threads once the marks are resolved.
+ */
+int in_same_island(const unsigned char *trg_sha1,
+		   const unsigned char *src_sha1);
+
+#endif
@@ -79,6 +79,20 @@ extern void *patch_delta(const void *src_buf, unsigned long src_size,
 			 const void *delta_buf, unsigned long delta_size,
 			 unsigned long *dst_size);
 
+/*
+ * patch_delta_chain: recreate a buffer from a source and a chain of deltas
+ *
+ * delta_bufs[0] applies to the source, delta_bufs[1] to the result of
+ * delta_bufs[0], and so on up to delta_bufs[nr - 1].  The deltas are
+ * first merged into a single list of copies and inserts against the
+ * source, so that the intermediate buffers are never built.  Returns
+ * the final buffer and stores its size in *dst_size, or NULL if one of
+ * the deltas does not apply; nothing is reported in that case.
+ */
+extern void *patch_delta_chain(const void *src_buf, unsigned long src_size,
+			       void **delta_bufs, unsigned long *delta_sizes,
+			       int nr, unsigned long *dst_size);
+
 /* the smallest possible delta size is 4 bytes */
 #define DELTA_SIZE_MIN	4
 
@@ -14,6 +14,10 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
 
@@ -112,9 +116,14 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * An index entry is the Rabin value of a block of the source buffer,
+ * and the offset just past that block.  Offsets fit in 32 bits (see
+ * create_delta_index()), which keeps eight entries in a cache line.
+ */
 struct index_entry {
-	const unsigned char *ptr;
 	unsigned int val;
+	unsigned int offset;
 };
 
 struct unpacked_index_entry {
@@ -122,12 +131,17 @@ struct unpacked_index_entry {
 	struct unpacked_index_entry *next;
 };
 
+/*
+ * The entries of bucket i are entries[hash[i]] to entries[hash[i+1]-1],
+ * all in one array right after hash[].
+ */
 struct delta_index {
 	unsigned long memsize;
 	const void *src_buf;
 	unsigned long src_size;
 	unsigned int hash_mask;
-	struct index_entry *hash[FLEX_ARRAY];
+	struct index_entry *entries;
+	unsigned int hash[FLEX_ARRAY];
 };
 
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
@@ -136,7 +150,8 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	const unsigned char *data, *buffer = buf;
 	struct delta_index *index;
 	struct unpacked_index_entry *entry, **hash;
-	struct index_entry *packed_entry, **packed_hash;
+	struct index_entry *packed_entry;
+	unsigned int *packed_hash;
 	void *mem;
 	unsigned long memsize;
 
@@ -188,12 +203,12 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
-			entry[-1].entry.ptr = data + RABIN_WINDOW;
+			entry[-1].entry.offset = data + RABIN_WINDOW - buffer;
 			--entries;
 		} else {
 			prev_val = val;
 			i = val & hmask;
-			entry->entry.ptr = data + RABIN_WINDOW;
+			entry->entry.offset = data + RABIN_WINDOW - buffer;
 			entry->entry.val = val;
 			entry->next = hash[i];
 			hash[i] = entry++;
@@ -276,20 +291,22 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	mem = packed_hash + (hsize+1);
 	packed_entry = mem;
 
+	index->entries = packed_entry;
+
 	for (i = 0; i < hsize; i++) {
 		/*
 		 * Coalesce all entries belonging to one linked list
 		 * into consecutive array entries.
 		 */
-		packed_hash[i] = packed_entry;
+		packed_hash[i] = packed_entry - index->entries;
 		for (entry = hash[i]; entry; entry = entry->next)
 			*packed_entry++ = entry->entry;
 	}
 
 	/* Sentinel value to indicate the length of the last hash bucket */
-	packed_hash[hsize] = packed_entry;
+	packed_hash[hsize] = packed_entry - index->entries;
 
-	assert(packed_entry - (struct index_entry *)mem == entries);
+	assert(packed_entry - index->entries == entries);
 	free(hash);
 
 	return index;
@@ -308,6 +325,72 @@ unsigned long sizeof_delta_index(struct delta_index *index)
 		return 0;
 }
 
+/*
+ * Count the bytes that are the same at the start of "a" and "b", up to
+ * "max".  Matches are often thousands of bytes long, so they are
+ * compared 16 bytes at a time when the CPU can, 8 otherwise.
+ */
+static inline unsigned int match_forward(const unsigned char *a,
+					 const unsigned char *b,
+					 unsigned int max)
+{
+	unsigned int n = 0;
+
+#ifdef __SSE2__
+	while (max - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + n));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + n));
+		unsigned int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff)
+			return n + __builtin_ctz(diff);
+		n += 16;
+	}
+#else
+	while (max - n >= 8) {
+		uint64_t x, y;
+		memcpy(&x, a + n, 8);
+		memcpy(&y, b + n, 8);
+		if (x != y)
+			break;
+		n += 8;
+	}
+#endif
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+
+/* The same, for the bytes right before "a" and "b". */
+static inline unsigned int match_backward(const unsigned char *a,
+					  const unsigned char *b,
+					  unsigned int max)
+{
+	unsigned int n = 0;
+
+#ifdef __SSE2__
+	while (max - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a - n - 16));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b - n - 16));
+		unsigned int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff)
+			return n + __builtin_clz(diff) - 16;
+		n += 16;
+	}
+#else
+	while (max - n >= 8) {
+		uint64_t x, y;
+		memcpy(&x, a - n - 8, 8);
+		memcpy(&y, b - n - 8, 8);
+		if (x != y)
+			break;
+		n += 8;
+	}
+#endif
+	while (n < max && a[-1 - (int)n] == b[-1 - (int)n])
+		n++;
+	return n;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus Rabin window plus biggest copy.
@@ -368,26 +451,26 @@ create_delta(const struct delta_index *index,
 	msize = 0;
 	while (data < top) {
 		if (msize < 4096) {
-			struct index_entry *entry;
+			const struct index_entry *entry, *end;
 			val ^= U[data[-RABIN_WINDOW]];
 			val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
 			i = val & index->hash_mask;
-			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
-				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
-				unsigned int ref_size = ref_top - ref;
+			entry = index->entries + index->hash[i];
+			end = index->entries + index->hash[i+1];
+			for (; entry < end; entry++) {
+				const unsigned char *ref = ref_data + entry->offset;
+				unsigned int ref_size = ref_top - ref, len;
 				if (entry->val != val)
 					continue;
-				if (ref_size > top - src)
-					ref_size = top - src;
+				if (ref_size > top - data)
+					ref_size = top - data;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				len = match_forward(data, ref, ref_size);
+				if (msize < len) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
-					moff = entry->ptr - ref_data;
+					msize = len;
+					moff = entry->offset;
 					if (msize >= 4096) /* good enough */
 						break;
 				}
@@ -409,17 +492,18 @@ create_delta(const struct delta_index *index,
 			unsigned char *op;
 
 			if (inscnt) {
-				while (moff && ref_data[moff-1] == data[-1]) {
-					/* we can match one byte back */
-					msize++;
-					moff--;
-					data--;
-					outpos--;
-					if (--inscnt)
-						continue;
+				/* take back what we can of the pending insert */
+				unsigned int back;
+				back = match_backward(data, ref_data + moff,
+						      moff < (unsigned int)inscnt ? moff : inscnt);
+				msize += back;
+				moff -= back;
+				data -= back;
+				outpos -= back;
+				inscnt -= back;
+				if (!inscnt) {
 					outpos--;  /* remove count slot */
 					inscnt--;  /* make it -1 */
-					break;
 				}
 				out[outpos - inscnt - 1] = inscnt;
 				inscnt = 0;
@@ -36,7 +36,9 @@ int fsync_object_files;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 16 * 1024 * 1024;
+unsigned int delta_base_cache_slots = 256;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
+unsigned long delta_stream_window = 4 * 1024 * 1024;
 const char *pager_program;
 int pager_use_color = 1;
 const char *editor_program;
@@ -71,6 +73,15 @@ char comment_line_char = '#';
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Use the commit-graph file, if there is one? */
+int core_commit_graph = 1;
+
+/* Use the multi-pack-index file, if there is one? */
+int core_multi_pack_index = 1;
+
+/* List loose object directories instead of probing for each object? */
+int core_loose_object_cache;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
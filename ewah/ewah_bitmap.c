@@ -0,0 +1,248 @@
+/*
+ * Compressed bitmaps in the EWAH format; see ewok.h.
+ */
+#include "cache.h"
+#include "ewok.h"
+#include "ewok_rlw.h"
+
+static void buffer_grow(struct ewah_bitmap *self, size_t nr)
+{
+	size_t rlw_offset = self->rlw - self->buffer;
+
+	ALLOC_GROW(self->buffer, nr, self->alloc_size);
+	self->rlw = self->buffer + rlw_offset;
+}
+
+static inline void buffer_push(struct ewah_bitmap *self, eword_t value)
+{
+	buffer_grow(self, self->buffer_size + 1);
+	self->buffer[self->buffer_size++] = value;
+}
+
+static void buffer_push_rlw(struct ewah_bitmap *self, eword_t value)
+{
+	buffer_push(self, value);
+	self->rlw = self->buffer + self->buffer_size - 1;
+}
+
+/*
+ * Append "number" clean words whose bits are all "v".
+ */
+static void add_empty_words(struct ewah_bitmap *self, int v, size_t number)
+{
+	eword_t runlen, can_add;
+
+	if (rlw_get_run_bit(self->rlw) != v && rlw_size(self->rlw) == 0) {
+		rlw_set_run_bit(self->rlw, v);
+	} else if (rlw_get_literal_words(self->rlw) != 0 ||
+		   rlw_get_run_bit(self->rlw) != v) {
+		buffer_push_rlw(self, 0);
+		rlw_set_run_bit(self->rlw, v);
+	}
+
+	runlen = rlw_get_running_len(self->rlw);
+	can_add = RLW_LARGEST_RUNNING_COUNT - runlen;
+	if (can_add > number)
+		can_add = number;
+	rlw_set_running_len(self->rlw, runlen + can_add);
+	number -= can_add;
+
+	while (number) {
+		can_add = number < RLW_LARGEST_RUNNING_COUNT ?
+			number : RLW_LARGEST_RUNNING_COUNT;
+		buffer_push_rlw(self, 0);
+		rlw_set_run_bit(self->rlw, v);
+		rlw_set_running_len(self->rlw, can_add);
+		number -= can_add;
+	}
+}
+
+/*
+ * Append a single literal (dirty) word.
+ */
+static void add_literal(struct ewah_bitmap *self, eword_t word)
+{
+	eword_t current_num = rlw_get_literal_words(self->rlw);
+
+	if (current_num >= RLW_LARGEST_LITERAL_COUNT) {
+		buffer_push_rlw(self, 0);
+		current_num = 0;
+	}
+	rlw_set_literal_words(self->rlw, current_num + 1);
+	buffer_push(self, word);
+}
+
+void ewah_add(struct ewah_bitmap *self, eword_t word)
+{
+	size_t words = (self->bit_size + BITS_IN_EWORD - 1) / BITS_IN_EWORD;
+
+	self->bit_size = (words + 1) * BITS_IN_EWORD;
+	if (word == 0)
+		add_empty_words(self, 0, 1);
+	else if (word == (eword_t)(~0))
+		add_empty_words(self, 1, 1);
+	else
+		add_literal(self, word);
+}
+
+void ewah_set(struct ewah_bitmap *self, size_t i)
+{
+	size_t dist;
+	eword_t mask = (eword_t)1 << (i % BITS_IN_EWORD);
+
+	assert(i >= self->bit_size);
+	dist = (i + BITS_IN_EWORD) / BITS_IN_EWORD -
+		(self->bit_size + BITS_IN_EWORD - 1) / BITS_IN_EWORD;
+	self->bit_size = i + 1;
+
+	if (dist > 0) {
+		if (dist > 1)
+			add_empty_words(self, 0, dist - 1);
+		add_literal(self, mask);
+		return;
+	}
+
+	/*
+	 * The bit falls in the last word we have; if that word is the
+	 * tail of a run of zeroes, turn it into a literal.
+	 */
+	if (rlw_get_literal_words(self->rlw) == 0) {
+		rlw_set_running_len(self->rlw,
+				    rlw_get_running_len(self->rlw) - 1);
+		add_literal(self, mask);
+		return;
+	}
+
+	self->buffer[self->buffer_size - 1] |= mask;
+
+	/* did we just complete a word full of ones? */
+	if (self->buffer[self->buffer_size - 1] == (eword_t)(~0)) {
+		self->buffer[--self->buffer_size] = 0;
+		rlw_set_literal_words(self->rlw,
+				      rlw_get_literal_words(self->rlw) - 1);
+		add_empty_words(self, 1, 1);
+	}
+}
+
+static void read_new_rlw(struct ewah_iterator *it)
+{
+	while (it->pointer < it->buffer_size) {
+		const eword_t *word = &it->buffer[it->pointer];
+
+		it->compressed = 0;
+		it->literals = 0;
+		it->rl = rlw_get_running_len(word);
+		it->lw = rlw_get_literal_words(word);
+		it->b = rlw_get_run_bit(word);
+
+		if (it->rl || it->lw)
+			return;
+		it->pointer++;
+	}
+}
+
+void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
+{
+	it->buffer = parent->buffer;
+	it->buffer_size = parent->buffer_size;
+	it->pointer = 0;
+	it->rl = it->lw = 0;
+	it->compressed = it->literals = 0;
+	it->b = 0;
+
+	read_new_rlw(it);
+}
+
+int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
+{
+	if (it->pointer >= it->buffer_size)
+		return 0;
+
+	if (it->compressed < it->rl) {
+		it->compressed++;
+		*next = it->b ? (eword_t)(~0) : 0;
+	} else {
+		it->literals++;
+		*next = it->buffer[it->pointer + it->literals];
+	}
+
+	if (it->compressed == it->rl && it->literals == it->lw) {
+		it->pointer += 1 + it->lw;
+		read_new_rlw(it);
+	}
+	return 1;
+}
+
+size_t ewah_popcount(struct ewah_bitmap *self)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t count = 0;
+
+	ewah_iterator_init(&it, self);
+	while (ewah_iterator_next(&word, &it))
+		count += ewah_bit_popcount64(word);
+	return count;
+}
+
+void ewah_each_bit(struct ewah_bitmap *self,
+		   void (*callback)(size_t pos, void *data), void *data)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t pos = 0;
+
+	ewah_iterator_init(&it, self);
+	while (ewah_iterator_next(&word, &it)) {
+		while (word) {
+			int offset = ewah_bit_ctz64(word);
+			callback(pos + offset, data);
+			word &= word - 1;
+		}
+		pos += BITS_IN_EWORD;
+	}
+}
+
+void ewah_xor(struct ewah_bitmap *a, struct ewah_bitmap *b,
+	      struct ewah_bitmap *out)
+{
+	struct ewah_iterator it_a, it_b;
+	eword_t word_a, word_b;
+	int more_a, more_b;
+
+	ewah_iterator_init(&it_a, a);
+	ewah_iterator_init(&it_b, b);
+
+	for (;;) {
+		more_a = ewah_iterator_next(&word_a, &it_a);
+		more_b = ewah_iterator_next(&word_b, &it_b);
+		if (!more_a && !more_b)
+			break;
+		ewah_add(out, (more_a ? word_a : 0) ^ (more_b ? word_b : 0));
+	}
+	out->bit_size = a->bit_size > b->bit_size ? a->bit_size : b->bit_size;
+}
+
+struct ewah_bitmap *ewah_new(void)
+{
+	struct ewah_bitmap *self = xcalloc(1, sizeof(*self));
+
+	ewah_clear(self);
+	return self;
+}
+
+void ewah_clear(struct ewah_bitmap *self)
+{
+	self->buffer_size = 0;
+	self->bit_size = 0;
+	self->rlw = self->buffer;
+	buffer_push_rlw(self, 0);
+}
+
+void ewah_free(struct ewah_bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->buffer);
+	free(self);
+}
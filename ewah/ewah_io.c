@@ -0,0 +1,100 @@
+/*
+ * Serialization of EWAH compressed bitmaps; see ewok.h for the format.
+ */
+#include "cache.h"
+#include "ewok.h"
+
+static uint32_t read_be32(const unsigned char *ptr)
+{
+	uint32_t v;
+	memcpy(&v, ptr, sizeof(v));
+	return ntohl(v);
+}
+
+ssize_t ewah_serialized_size(struct ewah_bitmap *self)
+{
+	return sizeof(uint32_t) * 3 + self->buffer_size * sizeof(eword_t);
+}
+
+int ewah_serialize_to(struct ewah_bitmap *self,
+		      int (*write_fun)(void *, const void *, size_t),
+		      void *place)
+{
+	size_t i;
+	eword_t dump[2048];
+	const size_t words_per_dump = ARRAY_SIZE(dump);
+	uint32_t bitsize, word_count, rlw_pos;
+	const eword_t *buffer;
+	size_t words_left;
+
+	bitsize = htonl((uint32_t)self->bit_size);
+	if (write_fun(place, &bitsize, 4) != 4)
+		return -1;
+
+	word_count = htonl((uint32_t)self->buffer_size);
+	if (write_fun(place, &word_count, 4) != 4)
+		return -1;
+
+	buffer = self->buffer;
+	words_left = self->buffer_size;
+
+	while (words_left >= words_per_dump) {
+		for (i = 0; i < words_per_dump; ++i, ++buffer)
+			dump[i] = htonll(*buffer);
+		if (write_fun(place, dump, sizeof(dump)) != sizeof(dump))
+			return -1;
+		words_left -= words_per_dump;
+	}
+
+	if (words_left) {
+		for (i = 0; i < words_left; ++i, ++buffer)
+			dump[i] = htonll(*buffer);
+		if (write_fun(place, dump, words_left * 8) != words_left * 8)
+			return -1;
+	}
+
+	rlw_pos = htonl((uint32_t)(self->rlw - self->buffer));
+	if (write_fun(place, &rlw_pos, 4) != 4)
+		return -1;
+
+	return ewah_serialized_size(self);
+}
+
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len)
+{
+	const unsigned char *ptr = map;
+	size_t i, buffer_size;
+	uint32_t rlw_pos;
+
+	if (len < sizeof(uint32_t) * 2)
+		return -1;
+
+	self->bit_size = read_be32(ptr);
+	ptr += sizeof(uint32_t);
+
+	buffer_size = read_be32(ptr);
+	ptr += sizeof(uint32_t);
+
+	if ((len - sizeof(uint32_t) * 2) / sizeof(eword_t) < buffer_size ||
+	    len - sizeof(uint32_t) * 2 - buffer_size * sizeof(eword_t) <
+	    sizeof(uint32_t) || !buffer_size)
+		return -1;
+
+	self->buffer_size = 0;
+	ALLOC_GROW(self->buffer, buffer_size, self->alloc_size);
+	self->buffer_size = buffer_size;
+
+	for (i = 0; i < buffer_size; ++i) {
+		eword_t word;
+		memcpy(&word, ptr, sizeof(word));
+		self->buffer[i] = ntohll(word);
+		ptr += sizeof(eword_t);
+	}
+
+	rlw_pos = read_be32(ptr);
+	if (rlw_pos >= buffer_size)
+		return -1;
+	self->rlw = self->buffer + rlw_pos;
+
+	return ewah_serialized_size(self);
+}
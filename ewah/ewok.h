@@ -0,0 +1,135 @@
+/*
+ * EWAH compressed bitmaps
+ *
+ * An EWAH ("Enhanced Word-Aligned Hybrid") bitmap is a sequence of
+ * 64-bit words.  Each "running length word" (RLW) describes a run of
+ * identical clean words (all zeroes or all ones) followed by a number
+ * of literal ("dirty") words that are stored verbatim right after it.
+ *
+ * Compressed bitmaps can only be built by appending bits in increasing
+ * order; to set arbitrary bits, use the uncompressed "struct bitmap"
+ * below and convert it with bitmap_to_ewah() when done.
+ */
+#ifndef EWOK_H
+#define EWOK_H
+
+typedef uint64_t eword_t;
+#define BITS_IN_EWORD (sizeof(eword_t) * 8)
+
+static inline int ewah_bit_popcount64(uint64_t x)
+{
+	x = (x & 0x5555555555555555ULL) + ((x >>  1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >>  2) & 0x3333333333333333ULL);
+	x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >>  4) & 0x0F0F0F0F0F0F0F0FULL);
+	return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/* Index of the lowest set bit; "n" must not be zero. */
+#if defined(__GNUC__)
+#define ewah_bit_ctz64(n) __builtin_ctzll(n)
+#else
+static inline int ewah_bit_ctz64(uint64_t n)
+{
+	int pos = 0;
+	while (!(n & 1)) {
+		n >>= 1;
+		pos++;
+	}
+	return pos;
+}
+#endif
+
+struct ewah_bitmap {
+	eword_t *buffer;
+	size_t buffer_size;
+	size_t alloc_size;
+	size_t bit_size;
+	eword_t *rlw;
+};
+
+struct ewah_bitmap *ewah_new(void);
+void ewah_free(struct ewah_bitmap *self);
+void ewah_clear(struct ewah_bitmap *self);
+
+/*
+ * Set the bit at position "i".  Bits must be set in strictly
+ * increasing order.
+ */
+void ewah_set(struct ewah_bitmap *self, size_t i);
+
+/* Append one uncompressed word of 64 bits to the bitmap. */
+void ewah_add(struct ewah_bitmap *self, eword_t word);
+
+/* Number of set bits in the bitmap. */
+size_t ewah_popcount(struct ewah_bitmap *self);
+
+/* Call "callback" for the position of every set bit, in order. */
+void ewah_each_bit(struct ewah_bitmap *self,
+		   void (*callback)(size_t pos, void *data), void *data);
+
+/*
+ * out = a ^ b; "out" must be a freshly created (or cleared) bitmap
+ * distinct from both inputs.
+ */
+void ewah_xor(struct ewah_bitmap *a, struct ewah_bitmap *b,
+	      struct ewah_bitmap *out);
+
+/*
+ * Iterate over the uncompressed words of a bitmap, expanding the
+ * runs of clean words on the fly.
+ */
+struct ewah_iterator {
+	const eword_t *buffer;
+	size_t buffer_size;
+
+	size_t pointer;		/* position of the current RLW */
+	eword_t rl, lw;		/* run length and literal words of the RLW */
+	eword_t compressed, literals;
+	int b;			/* running bit of the current RLW */
+};
+
+void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
+int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
+
+/*
+ * Serialization: a bitmap is stored as its bit size, the number of
+ * words in the buffer, the words themselves and the position of the
+ * last RLW, all in network byte order.
+ */
+int ewah_serialize_to(struct ewah_bitmap *self,
+		      int (*write_fun)(void *out, const void *buf, size_t len),
+		      void *out);
+ssize_t ewah_serialized_size(struct ewah_bitmap *self);
+
+/*
+ * Read a serialized bitmap from "map", which is "len" bytes long.
+ * Returns the number of bytes consumed, or -1 if the data is not a
+ * valid bitmap.
+ */
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len);
+
+/*
+ * Uncompressed bitmaps, which grow as needed to accommodate set bits.
+ */
+struct bitmap {
+	eword_t *words;
+	size_t word_alloc;
+};
+
+struct bitmap *bitmap_new(void);
+void bitmap_free(struct bitmap *self);
+void bitmap_set(struct bitmap *self, size_t pos);
+void bitmap_clear(struct bitmap *self, size_t pos);
+int bitmap_get(struct bitmap *self, size_t pos);
+void bitmap_reset(struct bitmap *self);
+int bitmap_equals(struct bitmap *self, struct bitmap *other);
+size_t bitmap_popcount(struct bitmap *self);
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other);
+void bitmap_and_not(struct bitmap *self, struct bitmap *other);
+void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah);
+struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap);
+
+#endif
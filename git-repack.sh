@@ -15,7 +15,12 @@ F               pass --no-reuse-object to git-pack-objects
 n               do not run git-update-server-info
 q,quiet         be quiet
 l               pass --local to git-pack-objects
+b,write-bitmap-index  write bitmap index
+i,delta-islands pass --delta-islands to git-pack-objects
+g,geometric=    roll up only the packs that break a geometric progression
 unpack-unreachable=  with -A, do not loosen objects older than this
+cruft           same as -a, and pack unreachable objects into a cruft pack
+cruft-expiration=  with --cruft, drop unreachable objects older than this
  Packing constraints
 window=         size of the window used for delta compression
 window-memory=  same as the above, but limit memory size instead of entries count
@@ -26,7 +31,8 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= no_reuse= extra=
+local= no_reuse= extra= write_bitmap= delta_islands= geometric=
+cruft= cruft_expiration=
 while test $# != 0
 do
 	case "$1" in
@@ -36,11 +42,24 @@ do
 		unpack_unreachable=--unpack-unreachable ;;
 	--unpack-unreachable)
 		unpack_unreachable="--unpack-unreachable=$2"; shift ;;
+	--cruft)
+		all_into_one=t cruft=t ;;
+	--cruft-expiration)
+		# protect the approxidate against whitespace splitting,
+		# like --unpack-unreachable below
+		cruft_expiration="--cruft-expiration=$(echo "$2" | tr ' ' .)"
+		shift ;;
 	-d)	remove_redundant=t ;;
 	-q)	GIT_QUIET=t ;;
 	-f)	no_reuse=--no-reuse-delta ;;
 	-F)	no_reuse=--no-reuse-object ;;
 	-l)	local=--local ;;
+	-b|--write-bitmap-index)
+		write_bitmap=--write-bitmap-index ;;
+	-i|--delta-islands)
+		delta_islands=--delta-islands ;;
+	-g|--geometric)
+		geometric=$2; shift ;;
 	--max-pack-size|--window|--window-memory|--depth)
 		extra="$extra $1=$2"; shift ;;
 	--) shift; break;;
@@ -49,22 +68,98 @@ do
 	shift
 done
 
+if test -n "$cruft"
+then
+	test -z "$unpack_unreachable" ||
+		die "--cruft cannot be used with -A"
+fi
+
+if test -n "$geometric"
+then
+	test -z "$all_into_one" ||
+		die "--geometric cannot be used with -a, -A or --cruft"
+	case "$geometric" in
+	''|*[!0-9]*|0|1)
+		die "--geometric needs an integer factor of at least 2" ;;
+	esac
+fi
+
+# The number of objects in a pack, read off the fan-out table of its
+# .idx (after the 8-byte header of a version 2 index).
+idx_object_count () {
+	if test "$(od -An -tx1 -N4 "$1" | tr -d ' ')" = ff744f63
+	then
+		skip=1028
+	else
+		skip=1020
+	fi
+	od -An -tu1 -j$skip -N4 "$1" |
+	awk '{ print ((($1 * 256 + $2) * 256 + $3) * 256 + $4) }'
+}
+
+# Read "<object count> <pack>" lines sorted by count, and say which
+# packs to "roll" up into a new one and which to "keep" so that each
+# pack left has at least $1 times as many objects as all the smaller
+# ones put together.  It is enough to roll up everything up to the
+# largest pack that breaks this: each pack above it already has
+# enough objects to cover all the smaller ones, rolled up or not.
+geometric_split () {
+	awk -v factor="$1" '
+	{ count[NR] = $1; name[NR] = $2 }
+	END {
+		roll = 0
+		total = 0
+		for (i = 1; i <= NR; i++) {
+			if (count[i] < factor * total)
+				roll = i
+			total += count[i]
+		}
+		for (i = 1; i <= NR; i++)
+			print (i <= roll ? "roll" : "keep"), name[i]
+	}'
+}
+
 case "`git config --bool repack.usedeltabaseoffset || echo true`" in
 true)
 	extra="$extra --delta-base-offset" ;;
 esac
 
+case "$delta_islands,`git config --bool repack.usedeltaislands`" in
+,true)
+	delta_islands=--delta-islands ;;
+esac
+
 PACKDIR="$GIT_OBJECT_DIRECTORY/pack"
 PACKTMP="$PACKDIR/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
 trap 'rm -f "$PACKTMP"-*' 0 1 2 3 15
 
 # There will be more repacking strategies to come...
-case ",$all_into_one," in
-,,)
+case ",$all_into_one,$geometric," in
+,,,)
 	args='--unpacked --incremental'
 	;;
-,t,)
+,,*)
+	# Pack the loose objects and the objects of the small packs,
+	# leaving the large packs alone.
+	args=--keep-unreachable existing=
+	if [ -d "$PACKDIR" ]; then
+		plan=$(
+			for e in `cd "$PACKDIR" && find . -type f -name '*.pack' \
+				| sed -e 's/^\.\///' -e 's/\.pack$//'`
+			do
+				test -e "$PACKDIR/$e.keep" ||
+				echo "$(idx_object_count "$PACKDIR/$e.idx") $e"
+			done | sort -n | geometric_split "$geometric"
+		) || exit
+		existing=$(echo "$plan" | sed -n -e 's/^roll //p')
+		for e in $(echo "$plan" | sed -n -e 's/^keep //p')
+		do
+			args="$args --keep-pack=$e.pack"
+		done
+	fi
+	;;
+,t,*)
 	args= existing=
 	if [ -d "$PACKDIR" ]; then
 		for e in `cd "$PACKDIR" && find . -type f -name '*.pack' \
@@ -92,9 +187,25 @@ esac
 
 mkdir -p "$PACKDIR" || exit
 
-args="$args $local ${GIT_QUIET:+-q} $no_reuse$extra"
+args="$args $local ${GIT_QUIET:+-q} $no_reuse $write_bitmap $delta_islands$extra"
 names=$(git pack-objects --keep-true-parents --honor-pack-keep --non-empty --all --reflog $args </dev/null "$PACKTMP") ||
 	exit 1
+
+# The unreachable objects are those of the packs and loose objects we
+# are about to replace that did not make it into the new pack(s).
+if test -n "$cruft"
+then
+	keep=
+	for name in $names
+	do
+		keep="$keep --keep-pack=${PACKTMP##*/}-$name.pack"
+	done
+	cruft_names=$(git pack-objects --non-empty --cruft $cruft_expiration \
+		$keep ${GIT_QUIET:+-q} $extra "$PACKTMP" </dev/null) ||
+		exit 1
+	names="$names $cruft_names"
+fi
+
 if [ -z "$names" ]; then
 	say Nothing new to pack.
 fi
@@ -108,7 +219,7 @@ rollback=
 failed=
 for name in $names
 do
-	for sfx in pack idx
+	for sfx in pack idx bitmap rev mtimes bloom
 	do
 		file=pack-$name.$sfx
 		test -f "$PACKDIR/$file" || continue
@@ -149,6 +260,10 @@ then
 	exit 1
 fi
 
+# A multi-pack-index covering a pack we are replacing by one of the
+# same name would point into the old one.
+test -z "$rollback" || rm -f "$PACKDIR/multi-pack-index"
+
 # Now the ones with the same name are out of the way...
 fullbases=
 for name in $names
@@ -159,6 +274,13 @@ do
 	mv -f "$PACKTMP-$name.pack" "$PACKDIR/pack-$name.pack" &&
 	mv -f "$PACKTMP-$name.idx"  "$PACKDIR/pack-$name.idx" ||
 	exit
+	for sfx in bitmap rev mtimes bloom
+	do
+		test -f "$PACKTMP-$name.$sfx" || continue
+		chmod a-w "$PACKTMP-$name.$sfx"
+		mv -f "$PACKTMP-$name.$sfx" "$PACKDIR/pack-$name.$sfx" ||
+		exit
+	done
 done
 
 # Remove the "old-" files
@@ -166,6 +288,10 @@ for name in $names
 do
 	rm -f "$PACKDIR/old-pack-$name.idx"
 	rm -f "$PACKDIR/old-pack-$name.pack"
+	rm -f "$PACKDIR/old-pack-$name.bitmap"
+	rm -f "$PACKDIR/old-pack-$name.rev"
+	rm -f "$PACKDIR/old-pack-$name.mtimes"
+	rm -f "$PACKDIR/old-pack-$name.bloom"
 done
 
 # End of pack replacement.
@@ -180,7 +306,10 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.keep" "$e.bitmap" "$e.rev" \
+					"$e.mtimes" "$e.bloom"
+				# it names a pack that is now gone
+				rm -f multi-pack-index ;;
 			esac
 		  done
 		)
@@ -0,0 +1,643 @@
+#include "cache.h"
+#include "midx.h"
+#include "csum-file.h"
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + 6 * MIDX_CHUNKLOOKUP_WIDTH + \
+		       MIDX_FANOUT_SIZE + 20)
+
+static char *get_midx_filename(const char *object_dir)
+{
+	return mkpathdup("%s/pack/multi-pack-index", object_dir);
+}
+
+static struct multi_pack_index *parse_midx(const unsigned char *data,
+					   size_t data_len,
+					   const char *midx_name)
+{
+	const unsigned char *chunk_lookup;
+	const char *name, *names_end = NULL;
+	struct multi_pack_index *m;
+	uint32_t i;
+
+	if (get_be32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index signature %X does not match signature %X",
+		      get_be32(data), MIDX_SIGNATURE);
+		return NULL;
+	}
+	if (data[4] != MIDX_VERSION) {
+		error("multi-pack-index version %X does not match version %X",
+		      data[4], MIDX_VERSION);
+		return NULL;
+	}
+	if (data[5] != MIDX_OID_VERSION) {
+		error("multi-pack-index hash version %X does not match version %X",
+		      data[5], MIDX_OID_VERSION);
+		return NULL;
+	}
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = data;
+	m->data_len = data_len;
+	m->num_chunks = data[6];
+	m->num_packs = get_be32(data + 8);
+
+	if (data_len < MIDX_HEADER_SIZE +
+	    (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH + 20)
+		goto corrupt;
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	for (i = 0; i < m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t next_offset = get_be64(chunk_lookup + 4 +
+						MIDX_CHUNKLOOKUP_WIDTH);
+		const unsigned char *chunk = data + chunk_offset;
+
+		if (chunk_offset > next_offset ||
+		    next_offset > data_len - 20)
+			goto corrupt;
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = chunk;
+			names_end = (const char *)data + next_offset;
+			break;
+		case MIDX_CHUNKID_PACKCHECKSUMS:
+			if (next_offset - chunk_offset != 20 * (uint64_t)m->num_packs)
+				goto corrupt;
+			m->chunk_pack_checksums = chunk;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (next_offset - chunk_offset != MIDX_FANOUT_SIZE)
+				goto corrupt;
+			m->chunk_oid_fanout = chunk;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = chunk;
+			m->num_objects = (next_offset - chunk_offset) / 20;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = chunk;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = chunk;
+			m->large_offsets_len = next_offset - chunk_offset;
+			break;
+		}
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_pack_checksums ||
+	    !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets ||
+	    get_be32(m->chunk_oid_fanout + 4 * 255) != m->num_objects ||
+	    m->chunk_object_offsets +
+	    (size_t)m->num_objects * MIDX_OFFSET_WIDTH >
+	    data + data_len - 20)
+		goto corrupt;
+	for (i = 1; i < 256; i++)
+		if (get_be32(m->chunk_oid_fanout + 4 * (i - 1)) >
+		    get_be32(m->chunk_oid_fanout + 4 * i))
+			goto corrupt;
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const char *end = memchr(name, '\0', names_end - name);
+
+		if (!end || (i && strcmp(m->pack_names[i - 1], name) >= 0))
+			goto corrupt;
+		m->pack_names[i] = name;
+		name = end + 1;
+	}
+
+	return m;
+
+corrupt:
+	error("multi-pack-index file %s is corrupt", midx_name);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+	return NULL;
+}
+
+static struct multi_pack_index *load_midx_file(const char *midx_name)
+{
+	struct multi_pack_index *m;
+	struct stat st;
+	size_t midx_size;
+	void *midx_map;
+	int fd;
+
+	fd = open(midx_name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	midx_size = xsize_t(st.st_size);
+	if (midx_size < MIDX_MIN_SIZE) {
+		close(fd);
+		error("multi-pack-index file %s is too small", midx_name);
+		return NULL;
+	}
+	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = parse_midx(midx_map, midx_size, midx_name);
+	if (!m)
+		munmap(midx_map, midx_size);
+	return m;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	struct multi_pack_index *m = load_midx_file(midx_name);
+
+	free(midx_name);
+	return m;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+int bsearch_midx(const struct multi_pack_index *m, const unsigned char *sha1,
+		 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? get_be32(m->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = get_be32(m->chunk_oid_fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->chunk_oid_lookup + 20 * mi);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	*pos = lo;
+	return 0;
+}
+
+const unsigned char *nth_midxed_object_sha1(const struct multi_pack_index *m,
+					    uint32_t n)
+{
+	return m->chunk_oid_lookup + 20 * (size_t)n;
+}
+
+uint32_t nth_midxed_pack_int_id(const struct multi_pack_index *m, uint32_t n)
+{
+	uint32_t pack_int_id = get_be32(m->chunk_object_offsets +
+					(size_t)MIDX_OFFSET_WIDTH * n);
+
+	if (pack_int_id >= m->num_packs)
+		die("multi-pack-index has an invalid pack-int-id %"PRIu32,
+		    pack_int_id);
+	return pack_int_id;
+}
+
+const unsigned char *nth_midxed_pack_checksum(const struct multi_pack_index *m,
+					      uint32_t pack_int_id)
+{
+	return m->chunk_pack_checksums + 20 * (size_t)pack_int_id;
+}
+
+off_t nth_midxed_offset(const struct multi_pack_index *m, uint32_t n)
+{
+	uint32_t offset = get_be32(m->chunk_object_offsets +
+				   (size_t)MIDX_OFFSET_WIDTH * n + 4);
+
+	if (!(offset & MIDX_LARGE_OFFSET_NEEDED))
+		return offset;
+
+	offset &= ~MIDX_LARGE_OFFSET_NEEDED;
+	if (!m->chunk_large_offsets ||
+	    8 * (size_t)offset + 8 > m->large_offsets_len)
+		die("multi-pack-index has an invalid large offset");
+	return get_be64(m->chunk_large_offsets + 8 * (size_t)offset);
+}
+
+/* compare "pack-X.idx" with ".../pack-X.pack" */
+static int cmp_idx_to_pack_name(const char *idx_name, const char *pack_name)
+{
+	const char *base = strrchr(pack_name, '/');
+	size_t len;
+
+	base = base ? base + 1 : pack_name;
+	len = strlen(base);
+	if (len < 5 || strcmp(base + len - 5, ".pack"))
+		return -1;
+	len -= 5;
+	if (strncmp(idx_name, base, len))
+		return strncmp(idx_name, base, len);
+	return strcmp(idx_name + len, ".idx");
+}
+
+int midx_pack_int_id(const struct multi_pack_index *m, const char *pack_name)
+{
+	uint32_t lo = 0, hi = m->num_packs;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = cmp_idx_to_pack_name(m->pack_names[mi], pack_name);
+
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+int read_midx_summary(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir);
+	uint32_t i;
+
+	if (!m)
+		return error("could not load multi-pack-index in %s",
+			     object_dir);
+
+	printf("header: %08x %d %d %d %"PRIu32"\n",
+	       get_be32(m->data), m->data[4], m->data[5], m->data[6],
+	       m->num_packs);
+	printf("num_objects: %"PRIu32"\n", m->num_objects);
+	printf("chunks:");
+	if (m->chunk_pack_names)
+		printf(" pack_names");
+	if (m->chunk_pack_checksums)
+		printf(" pack_checksums");
+	if (m->chunk_oid_fanout)
+		printf(" oid_fanout");
+	if (m->chunk_oid_lookup)
+		printf(" oid_lookup");
+	if (m->chunk_object_offsets)
+		printf(" object_offsets");
+	if (m->chunk_large_offsets)
+		printf(" large_offsets");
+	printf("\n");
+	printf("packs:\n");
+	for (i = 0; i < m->num_packs; i++)
+		printf("%s\n", m->pack_names[i]);
+
+	close_midx(m);
+	return 0;
+}
+
+/*
+ * Writing
+ */
+
+struct midx_pack {
+	struct packed_git *p;
+	char *name; /* "pack-X.idx" */
+};
+
+struct midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_int_id;
+	int preferred;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+struct midx_writer {
+	struct midx_pack *packs;
+	uint32_t nr_packs, alloc_packs;
+
+	struct midx_entry *entries;
+	uint32_t nr_entries;
+	uint32_t num_large_offsets;
+};
+
+static void add_pack_dir(struct midx_writer *w, const char *object_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/pack", object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		if (errno != ENOENT)
+			error("unable to open object pack directory: %s: %s",
+			      path.buf, strerror(errno));
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!has_extension(de->d_name, ".idx"))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		p = add_packed_git(path.buf, path.len, 1);
+		if (!p)
+			continue;
+		if (open_pack_index(p)) {
+			warning("unable to open pack index %s", path.buf);
+			free(p);
+			continue;
+		}
+		ALLOC_GROW(w->packs, w->nr_packs + 1, w->alloc_packs);
+		w->packs[w->nr_packs].p = p;
+		w->packs[w->nr_packs].name = xstrdup(de->d_name);
+		w->nr_packs++;
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+static int pack_name_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+/*
+ * Sort by object name; among copies of the same object, the one to
+ * keep comes first: the preferred pack, then the newest pack.
+ */
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	if (a->preferred != b->preferred)
+		return b->preferred - a->preferred;
+	if (a->pack_mtime != b->pack_mtime)
+		return a->pack_mtime > b->pack_mtime ? -1 : 1;
+	if (a->pack_int_id != b->pack_int_id)
+		return a->pack_int_id < b->pack_int_id ? -1 : 1;
+	return 0;
+}
+
+static int match_pack_name(const char *idx_name, const char *wanted)
+{
+	size_t len = strlen(idx_name) - 4; /* without ".idx" */
+
+	if (strncmp(idx_name, wanted, len))
+		return 0;
+	return !strcmp(wanted + len, ".idx") ||
+	       !strcmp(wanted + len, ".pack") ||
+	       !wanted[len];
+}
+
+static void collect_entries(struct midx_writer *w, int preferred_id)
+{
+	uint32_t i, j, total = 0, nr = 0;
+
+	for (i = 0; i < w->nr_packs; i++)
+		total += w->packs[i].p->num_objects;
+	w->entries = xmalloc(total * sizeof(*w->entries));
+
+	for (i = 0; i < w->nr_packs; i++) {
+		struct packed_git *p = w->packs[i].p;
+
+		for (j = 0; j < p->num_objects; j++) {
+			struct midx_entry *e = &w->entries[nr++];
+
+			hashcpy(e->sha1, nth_packed_object_sha1(p, j));
+			e->offset = nth_packed_object_offset(p, j);
+			e->pack_int_id = i;
+			e->preferred = (int)i == preferred_id;
+			e->pack_mtime = p->mtime;
+		}
+	}
+	qsort(w->entries, nr, sizeof(*w->entries), midx_entry_cmp);
+
+	/* keep the first copy of each object */
+	w->nr_entries = 0;
+	for (i = 0; i < nr; i++) {
+		if (w->nr_entries &&
+		    !hashcmp(w->entries[w->nr_entries - 1].sha1,
+			     w->entries[i].sha1))
+			continue;
+		if (w->entries[i].offset > 0x7fffffff)
+			w->num_large_offsets++;
+		w->entries[w->nr_entries++] = w->entries[i];
+	}
+}
+
+static size_t pack_names_size(struct midx_writer *w)
+{
+	size_t size = 0;
+	uint32_t i;
+
+	for (i = 0; i < w->nr_packs; i++)
+		size += strlen(w->packs[i].name) + 1;
+	return (size + 3) & ~3; /* padded to a multiple of four */
+}
+
+static void write_midx_chunk_pack_names(struct sha1file *f,
+					struct midx_writer *w)
+{
+	static unsigned char padding[4];
+	size_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < w->nr_packs; i++) {
+		size_t len = strlen(w->packs[i].name) + 1;
+		sha1write(f, w->packs[i].name, len);
+		written += len;
+	}
+	if (pack_names_size(w) != written)
+		sha1write(f, padding, pack_names_size(w) - written);
+}
+
+static void write_midx_chunk_pack_checksums(struct sha1file *f,
+					    struct midx_writer *w)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->nr_packs; i++) {
+		struct packed_git *p = w->packs[i].p;
+		sha1write(f, (unsigned char *)p->index_data + p->index_size - 40,
+			  20);
+	}
+}
+
+static void write_midx_chunk_fanout(struct sha1file *f, struct midx_writer *w)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t v;
+
+		while (count < w->nr_entries &&
+		       w->entries[count].sha1[0] == i)
+			count++;
+		v = htonl(count);
+		sha1write(f, &v, 4);
+	}
+}
+
+static void write_midx_chunk_oids(struct sha1file *f, struct midx_writer *w)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->nr_entries; i++)
+		sha1write(f, w->entries[i].sha1, 20);
+}
+
+static void write_midx_chunk_offsets(struct sha1file *f, struct midx_writer *w)
+{
+	uint32_t i, nr_large = 0;
+
+	for (i = 0; i < w->nr_entries; i++) {
+		unsigned char buf[MIDX_OFFSET_WIDTH];
+		off_t offset = w->entries[i].offset;
+
+		put_be32(buf, w->entries[i].pack_int_id);
+		if (offset > 0x7fffffff)
+			put_be32(buf + 4, MIDX_LARGE_OFFSET_NEEDED | nr_large++);
+		else
+			put_be32(buf + 4, (uint32_t)offset);
+		sha1write(f, buf, sizeof(buf));
+	}
+}
+
+static void write_midx_chunk_large_offsets(struct sha1file *f,
+					   struct midx_writer *w)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->nr_entries; i++) {
+		uint64_t offset = w->entries[i].offset;
+		unsigned char buf[8];
+
+		if (offset <= 0x7fffffff)
+			continue;
+		put_be32(buf, (uint32_t)(offset >> 32));
+		put_be32(buf + 4, (uint32_t)offset);
+		sha1write(f, buf, sizeof(buf));
+	}
+}
+
+static void write_midx(const char *midx_name, struct midx_writer *w)
+{
+	static struct lock_file lock;
+	uint32_t chunk_ids[7];
+	uint64_t chunk_offsets[7];
+	unsigned char header[MIDX_HEADER_SIZE];
+	struct sha1file *f;
+	int num_chunks, i, fd;
+
+	num_chunks = w->num_large_offsets ? 6 : 5;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_PACKCHECKSUMS;
+	chunk_ids[2] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[3] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[4] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[5] = w->num_large_offsets ? MIDX_CHUNKID_LARGEOFFSETS : 0;
+	chunk_ids[6] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE +
+		(num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_names_size(w);
+	chunk_offsets[2] = chunk_offsets[1] + 20 * (uint64_t)w->nr_packs;
+	chunk_offsets[3] = chunk_offsets[2] + MIDX_FANOUT_SIZE;
+	chunk_offsets[4] = chunk_offsets[3] + 20 * (uint64_t)w->nr_entries;
+	chunk_offsets[5] = chunk_offsets[4] +
+		MIDX_OFFSET_WIDTH * (uint64_t)w->nr_entries;
+	chunk_offsets[6] = chunk_offsets[5] + 8 * (uint64_t)w->num_large_offsets;
+
+	fd = hold_lock_file_for_update(&lock, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	put_be32(header, MIDX_SIGNATURE);
+	header[4] = MIDX_VERSION;
+	header[5] = MIDX_OID_VERSION;
+	header[6] = num_chunks;
+	header[7] = 0; /* number of base multi-pack-index files */
+	put_be32(header + 8, w->nr_packs);
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i <= num_chunks; i++) {
+		unsigned char entry[MIDX_CHUNKLOOKUP_WIDTH];
+		put_be32(entry, chunk_ids[i]);
+		put_be32(entry + 4, (uint32_t)(chunk_offsets[i] >> 32));
+		put_be32(entry + 8, (uint32_t)chunk_offsets[i]);
+		sha1write(f, entry, sizeof(entry));
+	}
+
+	write_midx_chunk_pack_names(f, w);
+	write_midx_chunk_pack_checksums(f, w);
+	write_midx_chunk_fanout(f, w);
+	write_midx_chunk_oids(f, w);
+	write_midx_chunk_offsets(f, w);
+	if (w->num_large_offsets)
+		write_midx_chunk_large_offsets(f, w);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		die_errno("unable to write multi-pack-index %s", midx_name);
+}
+
+int write_midx_file(const char *object_dir, const char *preferred_pack)
+{
+	struct midx_writer w;
+	char *midx_name;
+	int preferred_id = -1;
+	uint32_t i;
+
+	memset(&w, 0, sizeof(w));
+	add_pack_dir(&w, object_dir);
+	qsort(w.packs, w.nr_packs, sizeof(*w.packs), pack_name_cmp);
+
+	if (preferred_pack) {
+		for (i = 0; i < w.nr_packs; i++)
+			if (match_pack_name(w.packs[i].name, preferred_pack))
+				preferred_id = i;
+		if (preferred_id < 0)
+			warning("unknown preferred pack: '%s'", preferred_pack);
+	}
+
+	collect_entries(&w, preferred_id);
+
+	midx_name = get_midx_filename(object_dir);
+	write_midx(midx_name, &w);
+	free(midx_name);
+
+	for (i = 0; i < w.nr_packs; i++) {
+		close_pack_index(w.packs[i].p);
+		free(w.packs[i].p);
+		free(w.packs[i].name);
+	}
+	free(w.packs);
+	free(w.entries);
+	return 0;
+}
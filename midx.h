@@ -0,0 +1,91 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * The multi-pack-index ($GIT_OBJECT_DIRECTORY/pack/multi-pack-index)
+ * is a single sorted table of the objects in all the packs of an
+ * object directory, mapping each of them to one (pack, offset) pair.
+ * Looking an object up in it costs one binary search however many
+ * packs there are.  See
+ * Documentation/technical/multi-pack-index-format.txt.
+ */
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OID_VERSION 1 /* SHA-1 */
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_PACKCHECKSUMS 0x5043534d /* "PCSM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+struct packed_git;
+
+struct multi_pack_index {
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const unsigned char *chunk_pack_checksums;
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	size_t large_offsets_len;
+
+	/* the .idx names of the packs, sorted; indexed by pack_int_id */
+	const char **pack_names;
+	/* filled by the caller once it has matched them to packed_git */
+	struct packed_git **packs;
+};
+
+/*
+ * Map the multi-pack-index of "object_dir", or return NULL if there
+ * is none (or it is unusable, in which case an error is shown).
+ */
+struct multi_pack_index *load_multi_pack_index(const char *object_dir);
+void close_midx(struct multi_pack_index *m);
+
+/*
+ * Find "sha1" in the table.  On success store its position in "pos"
+ * and return 1.  When it is not there, "pos" is where it would be
+ * inserted, which is what abbreviation lookups want.
+ */
+int bsearch_midx(const struct multi_pack_index *m, const unsigned char *sha1,
+		 uint32_t *pos);
+const unsigned char *nth_midxed_object_sha1(const struct multi_pack_index *m,
+					    uint32_t n);
+uint32_t nth_midxed_pack_int_id(const struct multi_pack_index *m, uint32_t n);
+/*
+ * The checksum of the pack "pack_int_id" was written for.  A pack
+ * rewritten under the same name since has another one, and the
+ * offsets in the index do not point into it.
+ */
+const unsigned char *nth_midxed_pack_checksum(const struct multi_pack_index *m,
+					      uint32_t pack_int_id);
+off_t nth_midxed_offset(const struct multi_pack_index *m, uint32_t n);
+
+/*
+ * Does the pack whose path is "pack_name" (".../pack-X.pack") appear
+ * in the index?  Returns its pack_int_id, or -1.
+ */
+int midx_pack_int_id(const struct multi_pack_index *m, const char *pack_name);
+
+/*
+ * Write a multi-pack-index covering every pack in "object_dir".  When
+ * an object is in several packs, the copy in "preferred_pack" (a pack
+ * or .idx basename; may be NULL) wins, then the one in the newest
+ * pack.  Returns 0 on success.
+ */
+int write_midx_file(const char *object_dir, const char *preferred_pack);
+
+/* Print a summary of the multi-pack-index of "object_dir" to stdout. */
+int read_midx_summary(const char *object_dir);
+
+#endif
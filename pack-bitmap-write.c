@@ -0,0 +1,451 @@
+#include "cache.h"
+#include "commit.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "csum-file.h"
+#include "decorate.h"
+#include "progress.h"
+#include "sha1-lookup.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+
+/*
+ * Writer for the .bitmap file of a pack; see pack-bitmap.h for the
+ * calling sequence.
+ */
+
+struct bitmapped_object {
+	unsigned char sha1[20];
+	off_t offset;
+	enum object_type type;
+	uint32_t name_hash;
+	uint32_t pos;		/* position in pack (offset) order */
+};
+
+struct bitmapped_commit {
+	struct commit *commit;
+	struct ewah_bitmap *bitmap;
+	struct ewah_bitmap *write_as;
+	int xor_offset;
+};
+
+static struct bitmap_writer {
+	/* every object of the pack; sorted by name once the build starts */
+	struct bitmapped_object *objects;
+	uint32_t nr, alloc;
+
+	struct ewah_bitmap *commits;
+	struct ewah_bitmap *trees;
+	struct ewah_bitmap *blobs;
+	struct ewah_bitmap *tags;
+
+	struct bitmapped_commit *selected;
+	unsigned int selected_nr, selected_alloc;
+	struct decoration selected_by_commit;
+
+	int show_progress;
+	unsigned char pack_checksum[20];
+} writer;
+
+/* how far back we look for a bitmap to XOR against */
+#define MAX_XOR_OFFSET 10
+
+void bitmap_writer_show_progress(int show)
+{
+	writer.show_progress = show;
+}
+
+void bitmap_writer_set_checksum(const unsigned char *sha1)
+{
+	hashcpy(writer.pack_checksum, sha1);
+}
+
+void bitmap_writer_add_object(const unsigned char *sha1, off_t offset,
+			      enum object_type type, uint32_t name_hash)
+{
+	struct bitmapped_object *obj;
+
+	ALLOC_GROW(writer.objects, writer.nr + 1, writer.alloc);
+	obj = &writer.objects[writer.nr++];
+	hashcpy(obj->sha1, sha1);
+	obj->offset = offset;
+	obj->type = type;
+	obj->name_hash = name_hash;
+}
+
+static int offset_cmp(const void *a_, const void *b_)
+{
+	const struct bitmapped_object *a = a_;
+	const struct bitmapped_object *b = b_;
+	return (a->offset < b->offset) ? -1 : (a->offset > b->offset);
+}
+
+static int sha1_cmp(const void *a_, const void *b_)
+{
+	const struct bitmapped_object *a = a_;
+	const struct bitmapped_object *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static const unsigned char *bitmapped_object_sha1_access(size_t index,
+							 void *table)
+{
+	struct bitmapped_object *objects = table;
+	return objects[index].sha1;
+}
+
+/*
+ * Assign every object its position in pack order and record its type
+ * in the type bitmaps; afterwards the objects are kept sorted by name,
+ * which is the order of the .idx file.
+ */
+static void build_type_index(void)
+{
+	uint32_t i;
+
+	writer.commits = ewah_new();
+	writer.trees = ewah_new();
+	writer.blobs = ewah_new();
+	writer.tags = ewah_new();
+
+	qsort(writer.objects, writer.nr, sizeof(*writer.objects), offset_cmp);
+
+	for (i = 0; i < writer.nr; ++i) {
+		struct bitmapped_object *obj = &writer.objects[i];
+
+		obj->pos = i;
+		switch (obj->type) {
+		case OBJ_COMMIT:
+			ewah_set(writer.commits, i);
+			break;
+		case OBJ_TREE:
+			ewah_set(writer.trees, i);
+			break;
+		case OBJ_BLOB:
+			ewah_set(writer.blobs, i);
+			break;
+		case OBJ_TAG:
+			ewah_set(writer.tags, i);
+			break;
+		default:
+			die("Missing type information for %s (%d/%d)",
+			    sha1_to_hex(obj->sha1), (int)obj->type, i);
+		}
+	}
+
+	qsort(writer.objects, writer.nr, sizeof(*writer.objects), sha1_cmp);
+}
+
+static int find_object_index(const unsigned char *sha1)
+{
+	return sha1_pos(sha1, writer.objects, writer.nr,
+			bitmapped_object_sha1_access);
+}
+
+static int find_object_pos(const unsigned char *sha1)
+{
+	int ix = find_object_index(sha1);
+
+	if (ix < 0) {
+		warning("Failed to write bitmap index. Packfile doesn't have "
+			"full closure (object %s is missing)", sha1_to_hex(sha1));
+		return -1;
+	}
+	return writer.objects[ix].pos;
+}
+
+/*
+ * Select the commits that get a bitmap: every one of the most recent
+ * ones, and then a sparser sampling the further back we go in history.
+ */
+static inline unsigned int next_commit_index(unsigned int idx)
+{
+	static const unsigned int MIN_COMMITS = 100;
+	static const unsigned int MAX_COMMITS = 5000;
+
+	static const unsigned int MUST_REGION = 100;
+	static const unsigned int MIN_REGION = 20000;
+
+	unsigned int offset, next;
+
+	if (idx <= MUST_REGION)
+		return 0;
+
+	if (idx <= MIN_REGION) {
+		offset = idx - MUST_REGION;
+		return (offset < MIN_COMMITS) ? offset : MIN_COMMITS;
+	}
+
+	offset = idx - MIN_REGION;
+	next = (offset < MAX_COMMITS) ? offset : MAX_COMMITS;
+
+	return (next > MIN_COMMITS) ? next : MIN_COMMITS;
+}
+
+static int date_compare(const void *a_, const void *b_)
+{
+	struct commit *a = *(struct commit **)a_;
+	struct commit *b = *(struct commit **)b_;
+	return (a->date > b->date) ? -1 : (a->date < b->date);
+}
+
+void bitmap_writer_select_commits(struct commit **indexed_commits,
+				  unsigned int indexed_commits_nr)
+{
+	unsigned int i = 0, next;
+
+	qsort(indexed_commits, indexed_commits_nr, sizeof(*indexed_commits),
+	      date_compare);
+
+	/* select newest-to-oldest, but store oldest first (see below) */
+	while (i < indexed_commits_nr) {
+		ALLOC_GROW(writer.selected, writer.selected_nr + 1,
+			   writer.selected_alloc);
+		memset(&writer.selected[writer.selected_nr], 0,
+		       sizeof(*writer.selected));
+		writer.selected[writer.selected_nr++].commit =
+			indexed_commits[i];
+
+		next = next_commit_index(i);
+		i += next + 1;
+	}
+
+	for (i = 0; i < writer.selected_nr / 2; i++) {
+		struct bitmapped_commit tmp = writer.selected[i];
+		writer.selected[i] = writer.selected[writer.selected_nr - 1 - i];
+		writer.selected[writer.selected_nr - 1 - i] = tmp;
+	}
+}
+
+static int mark_tree(struct bitmap *bitmap, const unsigned char *sha1)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	void *buf;
+	int pos = find_object_pos(sha1);
+
+	if (pos < 0)
+		return -1;
+	if (bitmap_get(bitmap, pos))
+		return 0;
+	bitmap_set(bitmap, pos);
+
+	buf = fill_tree_descriptor(&desc, sha1);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (S_ISDIR(entry.mode)) {
+			if (mark_tree(bitmap, entry.sha1) < 0) {
+				free(buf);
+				return -1;
+			}
+			continue;
+		}
+		pos = find_object_pos(entry.sha1);
+		if (pos < 0) {
+			free(buf);
+			return -1;
+		}
+		bitmap_set(bitmap, pos);
+	}
+	free(buf);
+	return 0;
+}
+
+/*
+ * Fill "bitmap" with everything reachable from the commit, reusing the
+ * bitmaps of the (older) selected commits computed so far.
+ */
+static int fill_bitmap_commit(struct commit *tip, struct bitmap *bitmap)
+{
+	struct commit_list *stack = NULL, *to_mark = NULL;
+	int ret = 0;
+
+	commit_list_insert(tip, &stack);
+	while (stack) {
+		struct commit *commit = pop_commit(&stack);
+		struct bitmapped_commit *stored;
+		struct commit_list *parent;
+		int pos = find_object_pos(commit->object.sha1);
+
+		if (pos < 0) {
+			ret = -1;
+			goto out;
+		}
+		if (bitmap_get(bitmap, pos))
+			continue;
+
+		stored = lookup_decoration(&writer.selected_by_commit,
+					   &commit->object);
+		if (stored && stored->bitmap) {
+			bitmap_or_ewah(bitmap, stored->bitmap);
+			continue;
+		}
+
+		bitmap_set(bitmap, pos);
+		if (parse_commit(commit))
+			die("unable to parse commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		commit_list_insert(commit, &to_mark);
+		for (parent = commit->parents; parent; parent = parent->next)
+			commit_list_insert(parent->item, &stack);
+	}
+
+	while (to_mark) {
+		struct commit *commit = pop_commit(&to_mark);
+		if (mark_tree(bitmap, commit->tree->object.sha1) < 0) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+out:
+	free_commit_list(stack);
+	free_commit_list(to_mark);
+	return ret;
+}
+
+/*
+ * Store each bitmap XORed against one of the few preceding ones when
+ * that makes it smaller; neighbouring commits tend to reach nearly
+ * the same objects.
+ */
+static void compute_xor_offsets(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+		struct ewah_bitmap *best = stored->bitmap;
+		ssize_t best_size = ewah_serialized_size(best);
+
+		stored->xor_offset = 0;
+		for (j = 1; j <= MAX_XOR_OFFSET && j <= i; j++) {
+			struct ewah_bitmap *test = ewah_new();
+			ssize_t test_size;
+
+			ewah_xor(stored->bitmap, writer.selected[i - j].bitmap,
+				 test);
+			test_size = ewah_serialized_size(test);
+			if (test_size < best_size) {
+				if (best != stored->bitmap)
+					ewah_free(best);
+				best = test;
+				best_size = test_size;
+				stored->xor_offset = j;
+			} else
+				ewah_free(test);
+		}
+		stored->write_as = best;
+	}
+}
+
+int bitmap_writer_build(void)
+{
+	struct progress *progress = NULL;
+	unsigned int i;
+
+	build_type_index();
+
+	if (writer.show_progress)
+		progress = start_progress("Building bitmaps",
+					  writer.selected_nr);
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+		struct bitmap *bitmap = bitmap_new();
+
+		if (fill_bitmap_commit(stored->commit, bitmap) < 0) {
+			bitmap_free(bitmap);
+			stop_progress(&progress);
+			return -1;
+		}
+		stored->bitmap = bitmap_to_ewah(bitmap);
+		bitmap_free(bitmap);
+
+		add_decoration(&writer.selected_by_commit,
+			       &stored->commit->object, stored);
+		display_progress(progress, i + 1);
+	}
+	stop_progress(&progress);
+
+	compute_xor_offsets();
+	return 0;
+}
+
+static int sha1write_ewah_helper(void *f, const void *buf, size_t len)
+{
+	/* sha1write will die on error */
+	sha1write(f, (void *)buf, len);
+	return len;
+}
+
+static void dump_bitmap(struct sha1file *f, struct ewah_bitmap *bitmap)
+{
+	if (ewah_serialize_to(bitmap, sha1write_ewah_helper, f) < 0)
+		die("Failed to write bitmap index");
+}
+
+static void write_be16(struct sha1file *f, uint16_t value)
+{
+	value = htons(value);
+	sha1write(f, &value, sizeof(value));
+}
+
+static void write_be32(struct sha1file *f, uint32_t value)
+{
+	value = htonl(value);
+	sha1write(f, &value, sizeof(value));
+}
+
+void bitmap_writer_finish(const char *filename, uint16_t options)
+{
+	char tmp_file[PATH_MAX];
+	struct sha1file *f;
+	unsigned int i;
+	int fd;
+
+	fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_bitmap_XXXXXX");
+	if (fd < 0)
+		die_errno("unable to create '%s'", tmp_file);
+	f = sha1fd(fd, tmp_file);
+
+	sha1write(f, BITMAP_IDX_SIGNATURE, 4);
+	write_be16(f, BITMAP_IDX_VERSION);
+	write_be16(f, options | BITMAP_OPT_FULL_DAG);
+	write_be32(f, writer.selected_nr);
+	sha1write(f, writer.pack_checksum, 20);
+
+	dump_bitmap(f, writer.commits);
+	dump_bitmap(f, writer.trees);
+	dump_bitmap(f, writer.blobs);
+	dump_bitmap(f, writer.tags);
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+		unsigned char entry_flags[2];
+		int commit_idx_pos = find_object_index(stored->commit->object.sha1);
+
+		if (commit_idx_pos < 0)
+			die("BUG: trying to write commit not in index");
+
+		write_be32(f, commit_idx_pos);
+		entry_flags[0] = stored->xor_offset;
+		entry_flags[1] = 0;
+		sha1write(f, entry_flags, 2);
+		dump_bitmap(f, stored->write_as);
+	}
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		for (i = 0; i < writer.nr; i++)
+			write_be32(f, writer.objects[i].name_hash);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file))
+		die_errno("unable to make temporary bitmap file readable");
+
+	if (rename(tmp_file, filename))
+		die_errno("unable to rename temporary bitmap file");
+}
@@ -0,0 +1,796 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "blob.h"
+#include "tree-walk.h"
+#include "diff.h"
+#include "revision.h"
+#include "decorate.h"
+#include "pack.h"
+#include "pack-revindex.h"
+#include "pack-bitmap.h"
+#include "sha1-lookup.h"
+
+/*
+ * A commit that has a bitmap on disk.  The bitmap may be stored
+ * XORed against the bitmap of an earlier entry; it is composed on
+ * first use and cached in "root" from then on.
+ */
+struct stored_bitmap {
+	unsigned char sha1[20];
+	struct ewah_bitmap *root;
+	struct stored_bitmap *xor;
+	int flags;
+};
+
+/*
+ * Objects reachable from the walk that are not in the bitmapped pack
+ * (e.g. loose objects pushed since the last repack) get positions
+ * past the end of the pack in the bitmaps we compute.
+ */
+struct ext_index {
+	struct object **objects;
+	uint32_t *hashes;
+	uint32_t count, alloc;
+	struct decoration positions;
+};
+
+static struct bitmap_index {
+	struct packed_git *pack;
+	struct pack_revindex *reverse_index;
+
+	unsigned char *map;
+	size_t map_size;
+	size_t map_pos;
+
+	/* objects of each type, in pack order */
+	struct ewah_bitmap *commits;
+	struct ewah_bitmap *trees;
+	struct ewah_bitmap *blobs;
+	struct ewah_bitmap *tags;
+
+	/* bitmapped commits, in file order and sorted by object name */
+	struct stored_bitmap *bitmaps;
+	struct stored_bitmap **bitmaps_by_sha1;
+	uint32_t entry_count;
+
+	/* name-hash cache, in .idx order */
+	const unsigned char *hashes;
+
+	struct ext_index ext_index;
+
+	/* result of prepare_bitmap_walk() */
+	struct bitmap *result;
+
+	int loaded;
+} bitmap_git;
+
+static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
+{
+	struct ewah_bitmap *b = ewah_new();
+	ssize_t bitmap_size = ewah_read_mmap(b, index->map + index->map_pos,
+					     index->map_size - index->map_pos);
+
+	if (bitmap_size < 0) {
+		error("failed to load bitmap index (corrupted?)");
+		ewah_free(b);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+	return b;
+}
+
+static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
+{
+	struct ewah_bitmap *parent, *composed;
+
+	if (!st->xor)
+		return st->root;
+
+	composed = ewah_new();
+	parent = lookup_stored_bitmap(st->xor);
+	ewah_xor(st->root, parent, composed);
+
+	ewah_free(st->root);
+	st->root = composed;
+	st->xor = NULL;
+
+	return composed;
+}
+
+static const unsigned char *stored_bitmap_sha1_access(size_t index, void *table)
+{
+	struct stored_bitmap **bitmaps = table;
+	return bitmaps[index]->sha1;
+}
+
+static int stored_bitmap_cmp(const void *a_, const void *b_)
+{
+	const struct stored_bitmap *a = *(const struct stored_bitmap **)a_;
+	const struct stored_bitmap *b = *(const struct stored_bitmap **)b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static struct stored_bitmap *find_stored_bitmap(const unsigned char *sha1)
+{
+	int pos = sha1_pos(sha1, bitmap_git.bitmaps_by_sha1,
+			   bitmap_git.entry_count, stored_bitmap_sha1_access);
+	return pos < 0 ? NULL : bitmap_git.bitmaps_by_sha1[pos];
+}
+
+static int load_bitmap_entries(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	index->bitmaps = xcalloc(index->entry_count, sizeof(*index->bitmaps));
+	index->bitmaps_by_sha1 = xcalloc(index->entry_count,
+					 sizeof(*index->bitmaps_by_sha1));
+
+	for (i = 0; i < index->entry_count; ++i) {
+		struct stored_bitmap *st = &index->bitmaps[i];
+		uint32_t commit_idx_pos;
+		int xor_offset, flags;
+
+		if (index->map_size - index->map_pos < 6)
+			return error("corrupt bitmap index: truncated entry");
+
+		commit_idx_pos = get_be32(index->map + index->map_pos);
+		xor_offset = index->map[index->map_pos + 4];
+		flags = index->map[index->map_pos + 5];
+		index->map_pos += 6;
+
+		if (commit_idx_pos >= index->pack->num_objects)
+			return error("corrupt bitmap index: bad commit position");
+		if (xor_offset > i)
+			return error("corrupt bitmap index: bad XOR offset");
+
+		st->root = read_bitmap_1(index);
+		if (!st->root)
+			return -1;
+		hashcpy(st->sha1, nth_packed_object_sha1(index->pack,
+							 commit_idx_pos));
+		st->xor = xor_offset ? &index->bitmaps[i - xor_offset] : NULL;
+		st->flags = flags;
+		index->bitmaps_by_sha1[i] = st;
+	}
+
+	qsort(index->bitmaps_by_sha1, index->entry_count,
+	      sizeof(*index->bitmaps_by_sha1), stored_bitmap_cmp);
+	return 0;
+}
+
+static int load_bitmap_header(struct bitmap_index *index)
+{
+	const unsigned char *header = index->map;
+	const unsigned char *pack_checksum;
+	uint16_t options;
+
+	if (index->map_size < BITMAP_HEADER_SIZE + 20)
+		return error("corrupted bitmap index (too small)");
+
+	if (memcmp(header, BITMAP_IDX_SIGNATURE, 4))
+		return error("corrupted bitmap index file (wrong header)");
+
+	if (get_be16(header + 4) != BITMAP_IDX_VERSION)
+		return error("unsupported version for bitmap index file (%d)",
+			     get_be16(header + 4));
+
+	options = get_be16(header + 6);
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return error("bitmap index does not cover the full DAG");
+
+	index->entry_count = get_be32(header + 8);
+
+	/* the pack checksum sits right before the .idx checksum */
+	pack_checksum = (const unsigned char *)index->pack->index_data +
+		index->pack->index_size - 40;
+	if (hashcmp(header + 12, pack_checksum))
+		return error("bitmap index does not match %s",
+			     index->pack->pack_name);
+
+	/* the trailing checksum of the .bitmap file is not part of the data */
+	index->map_size -= 20;
+	index->map_pos = BITMAP_HEADER_SIZE;
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		size_t cache_size = (size_t)index->pack->num_objects * 4;
+		if (index->map_size < BITMAP_HEADER_SIZE + cache_size)
+			return error("corrupted bitmap index (truncated hash cache)");
+		index->map_size -= cache_size;
+		index->hashes = index->map + index->map_size;
+	}
+
+	return 0;
+}
+
+static int load_pack_bitmap(struct bitmap_index *index)
+{
+	if (load_bitmap_header(index) < 0)
+		return -1;
+
+	if (!(index->commits = read_bitmap_1(index)) ||
+	    !(index->trees = read_bitmap_1(index)) ||
+	    !(index->blobs = read_bitmap_1(index)) ||
+	    !(index->tags = read_bitmap_1(index)))
+		return -1;
+
+	if (load_bitmap_entries(index) < 0)
+		return -1;
+
+	index->reverse_index = revindex_for_pack(index->pack);
+	return 0;
+}
+
+static char *pack_bitmap_filename(struct packed_git *p)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_add(&sb, p->pack_name, strlen(p->pack_name) - strlen(".pack"));
+	strbuf_addstr(&sb, ".bitmap");
+	return strbuf_detach(&sb, NULL);
+}
+
+static int open_pack_bitmap_1(struct packed_git *packfile)
+{
+	char *idx_name;
+	int fd;
+	struct stat st;
+
+	idx_name = pack_bitmap_filename(packfile);
+	fd = open(idx_name, O_RDONLY);
+	free(idx_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || open_pack_index(packfile)) {
+		close(fd);
+		return -1;
+	}
+
+	if (bitmap_git.pack) {
+		warning("ignoring extra bitmap file: %s", packfile->pack_name);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git.pack = packfile;
+	bitmap_git.map_size = xsize_t(st.st_size);
+	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ,
+			       MAP_PRIVATE, fd, 0);
+	bitmap_git.map_pos = 0;
+	close(fd);
+
+	if (load_pack_bitmap(&bitmap_git) < 0) {
+		munmap(bitmap_git.map, bitmap_git.map_size);
+		bitmap_git.map = NULL;
+		bitmap_git.map_size = 0;
+		bitmap_git.hashes = NULL;
+		bitmap_git.entry_count = 0;
+		bitmap_git.pack = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int prepare_bitmap_git(void)
+{
+	struct packed_git *p;
+	int ret = -1;
+
+	if (bitmap_git.loaded)
+		return bitmap_git.pack ? 0 : -1;
+	bitmap_git.loaded = 1;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		if (open_pack_bitmap_1(p) == 0)
+			ret = 0;
+	}
+	return ret;
+}
+
+static int bitmap_position_extended(const unsigned char *sha1)
+{
+	struct object *object = lookup_object(sha1);
+	void *pos;
+
+	if (!object)
+		return -1;
+	pos = lookup_decoration(&bitmap_git.ext_index.positions, object);
+	if (!pos)
+		return -1;
+	return bitmap_git.pack->num_objects + (int)((intptr_t)pos - 1);
+}
+
+static int bitmap_position_packfile(const unsigned char *sha1)
+{
+	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
+	if (!offset)
+		return -1;
+
+	return find_revindex_position(bitmap_git.reverse_index, offset);
+}
+
+static int bitmap_position(const unsigned char *sha1)
+{
+	int pos = bitmap_position_packfile(sha1);
+	return (pos >= 0) ? pos : bitmap_position_extended(sha1);
+}
+
+static int ext_index_add_object(struct object *object, const char *name)
+{
+	struct ext_index *eindex = &bitmap_git.ext_index;
+	uint32_t ix = eindex->count++;
+
+	ALLOC_GROW(eindex->objects, eindex->count, eindex->alloc);
+	eindex->hashes = xrealloc(eindex->hashes,
+				  eindex->alloc * sizeof(*eindex->hashes));
+	eindex->objects[ix] = object;
+	eindex->hashes[ix] = pack_name_hash(name);
+	add_decoration(&eindex->positions, object, (void *)(intptr_t)(ix + 1));
+
+	return bitmap_git.pack->num_objects + ix;
+}
+
+/*
+ * Mark "sha1" in "base", unless it is already there or in "seen".
+ * Returns 1 if the object was newly marked (and its children need
+ * to be visited), 0 otherwise.
+ */
+static int mark_object(struct bitmap *base, struct bitmap *seen,
+		       const unsigned char *sha1, enum object_type type,
+		       const char *name)
+{
+	int pos = bitmap_position(sha1);
+
+	if (pos < 0) {
+		struct object *object;
+
+		switch (type) {
+		case OBJ_COMMIT:
+			object = &lookup_commit(sha1)->object;
+			break;
+		case OBJ_TREE:
+			object = &lookup_tree(sha1)->object;
+			break;
+		case OBJ_BLOB:
+			object = &lookup_blob(sha1)->object;
+			break;
+		case OBJ_TAG:
+			object = &lookup_tag(sha1)->object;
+			break;
+		default:
+			die("BUG: unknown object type %d for %s",
+			    type, sha1_to_hex(sha1));
+		}
+		pos = ext_index_add_object(object, name);
+	}
+
+	if (bitmap_get(base, pos) || (seen && bitmap_get(seen, pos)))
+		return 0;
+
+	bitmap_set(base, pos);
+	return 1;
+}
+
+static void mark_tree_contents(struct bitmap *base, struct bitmap *seen,
+			       const unsigned char *sha1, struct strbuf *path)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	size_t baselen = path->len;
+	void *buf = fill_tree_descriptor(&desc, sha1);
+
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+
+		strbuf_setlen(path, baselen);
+		if (baselen)
+			strbuf_addch(path, '/');
+		strbuf_add(path, entry.path, tree_entry_len(&entry));
+
+		if (S_ISDIR(entry.mode)) {
+			if (mark_object(base, seen, entry.sha1, OBJ_TREE,
+					path->buf))
+				mark_tree_contents(base, seen, entry.sha1, path);
+		} else
+			mark_object(base, seen, entry.sha1, OBJ_BLOB,
+				    path->buf);
+	}
+
+	strbuf_setlen(path, baselen);
+	free(buf);
+}
+
+static void mark_tree(struct bitmap *base, struct bitmap *seen,
+		      const unsigned char *sha1)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	if (mark_object(base, seen, sha1, OBJ_TREE, ""))
+		mark_tree_contents(base, seen, sha1, &path);
+	strbuf_release(&path);
+}
+
+/*
+ * Compute the bitmap of all objects reachable from "roots", stopping
+ * at objects that are in "seen" (which must be closed under
+ * reachability).  Commits that have a stored bitmap are not walked;
+ * their bitmap is ORed into the result instead.
+ */
+static struct bitmap *find_objects(struct object_array *roots,
+				   struct bitmap *seen)
+{
+	struct bitmap *base = bitmap_new();
+	struct commit_list *stack = NULL, *to_mark = NULL;
+	unsigned int i;
+
+	for (i = 0; i < roots->nr; i++) {
+		struct object *object = roots->objects[i].item;
+
+		while (object->type == OBJ_TAG) {
+			struct tag *tag = (struct tag *)object;
+
+			if (!mark_object(base, seen, object->sha1, OBJ_TAG, NULL))
+				break;
+			if (!tag->tagged)
+				die("bad tag %s", sha1_to_hex(object->sha1));
+			object = parse_object(tag->tagged->sha1);
+			if (!object)
+				die("unable to read %s",
+				    sha1_to_hex(tag->tagged->sha1));
+		}
+
+		switch (object->type) {
+		case OBJ_COMMIT:
+			commit_list_insert((struct commit *)object, &stack);
+			break;
+		case OBJ_TREE:
+			mark_tree(base, seen, object->sha1);
+			break;
+		case OBJ_BLOB:
+			mark_object(base, seen, object->sha1, OBJ_BLOB, NULL);
+			break;
+		default:
+			break;
+		}
+	}
+
+	/*
+	 * Walk the commits first, so that the bitmaps we find along the
+	 * way let us skip as much of the trees as possible afterwards.
+	 */
+	while (stack) {
+		struct commit *commit = pop_commit(&stack);
+		struct stored_bitmap *st;
+		struct commit_list *parent;
+		int pos = bitmap_position(commit->object.sha1);
+
+		if (pos >= 0 &&
+		    (bitmap_get(base, pos) || (seen && bitmap_get(seen, pos))))
+			continue;
+
+		st = find_stored_bitmap(commit->object.sha1);
+		if (st) {
+			bitmap_or_ewah(base, lookup_stored_bitmap(st));
+			continue;
+		}
+
+		mark_object(base, seen, commit->object.sha1, OBJ_COMMIT, NULL);
+		if (parse_commit(commit))
+			die("unable to parse commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		commit_list_insert(commit, &to_mark);
+		for (parent = commit->parents; parent; parent = parent->next)
+			commit_list_insert(parent->item, &stack);
+	}
+
+	while (to_mark) {
+		struct commit *commit = pop_commit(&to_mark);
+		mark_tree(base, seen, commit->tree->object.sha1);
+	}
+
+	return base;
+}
+
+static int can_use_bitmaps(struct rev_info *revs)
+{
+	return !revs->prune &&
+		revs->max_count < 0 &&
+		revs->skip_count < 0 &&
+		revs->max_age == -1 &&
+		revs->min_age == -1 &&
+		!revs->min_parents &&
+		revs->max_parents < 0 &&
+		!revs->first_parent_only &&
+		!revs->ancestry_path &&
+		!revs->left_only &&
+		!revs->right_only &&
+		!revs->cherry_pick &&
+		!revs->cherry_mark &&
+		!revs->unpacked &&
+		!revs->reflog_info &&
+		!revs->grep_filter.pattern_list &&
+		!revs->grep_filter.header_list &&
+		!is_repository_shallow();
+}
+
+int prepare_bitmap_walk(struct rev_info *revs)
+{
+	unsigned int i;
+	struct object_array wants = OBJECT_ARRAY_INIT;
+	struct object_array haves = OBJECT_ARRAY_INIT;
+	struct bitmap *wants_bitmap, *haves_bitmap = NULL;
+
+	if (!can_use_bitmaps(revs))
+		return -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *object = revs->pending.objects[i].item;
+
+		if (object->type == OBJ_NONE) {
+			object = parse_object(object->sha1);
+			if (!object)
+				return -1;
+		}
+
+		if (object->flags & UNINTERESTING)
+			add_object_array(object, NULL, &haves);
+		else
+			add_object_array(object, NULL, &wants);
+	}
+
+	if (!wants.nr || prepare_bitmap_git() < 0) {
+		free(wants.objects);
+		free(haves.objects);
+		return -1;
+	}
+
+	if (haves.nr)
+		haves_bitmap = find_objects(&haves, NULL);
+	wants_bitmap = find_objects(&wants, haves_bitmap);
+
+	if (haves_bitmap) {
+		bitmap_and_not(wants_bitmap, haves_bitmap);
+		bitmap_free(haves_bitmap);
+	}
+
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = wants_bitmap;
+
+	free(wants.objects);
+	free(haves.objects);
+	return 0;
+}
+
+static uint32_t name_hash_at(uint32_t index_pos)
+{
+	if (!bitmap_git.hashes)
+		return 0;
+	return get_be32(bitmap_git.hashes + index_pos * 4);
+}
+
+static void show_objects_for_type(struct bitmap *objects,
+				  struct ewah_bitmap *type_filter,
+				  enum object_type object_type,
+				  show_reachable_fn show_reach)
+{
+	size_t pos = 0, i = 0;
+	struct ewah_iterator it;
+	eword_t filter;
+
+	ewah_iterator_init(&it, type_filter);
+
+	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
+		eword_t word = objects->words[i] & filter;
+
+		while (word) {
+			int offset = ewah_bit_ctz64(word);
+			uint32_t nr = pack_pos_to_index(bitmap_git.reverse_index,
+							pos + offset);
+
+			show_reach(nth_packed_object_sha1(bitmap_git.pack, nr),
+				   object_type, name_hash_at(nr), bitmap_git.pack,
+				   pack_pos_to_offset(bitmap_git.reverse_index,
+						      pos + offset));
+			word &= word - 1;
+		}
+
+		pos += BITS_IN_EWORD;
+		i++;
+	}
+}
+
+static void show_extended_objects(struct bitmap *objects,
+				  show_reachable_fn show_reach)
+{
+	struct ext_index *eindex = &bitmap_git.ext_index;
+	uint32_t i;
+
+	for (i = 0; i < eindex->count; ++i) {
+		struct object *obj;
+
+		if (!bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			continue;
+
+		obj = eindex->objects[i];
+		show_reach(obj->sha1, obj->type, eindex->hashes[i], NULL, 0);
+	}
+}
+
+void traverse_bitmap_commit_list(show_reachable_fn show_reachable)
+{
+	if (!bitmap_git.result)
+		die("BUG: traverse_bitmap_commit_list without a bitmap walk");
+
+	show_objects_for_type(bitmap_git.result, bitmap_git.commits,
+			      OBJ_COMMIT, show_reachable);
+	show_objects_for_type(bitmap_git.result, bitmap_git.trees,
+			      OBJ_TREE, show_reachable);
+	show_objects_for_type(bitmap_git.result, bitmap_git.blobs,
+			      OBJ_BLOB, show_reachable);
+	show_objects_for_type(bitmap_git.result, bitmap_git.tags,
+			      OBJ_TAG, show_reachable);
+
+	show_extended_objects(bitmap_git.result, show_reachable);
+}
+
+static uint32_t count_object_type(struct bitmap *objects,
+				  enum object_type type)
+{
+	struct ext_index *eindex = &bitmap_git.ext_index;
+	struct ewah_bitmap *type_filter;
+	struct ewah_iterator it;
+	eword_t filter;
+	uint32_t i = 0, count = 0;
+
+	switch (type) {
+	case OBJ_COMMIT:
+		type_filter = bitmap_git.commits;
+		break;
+	case OBJ_TREE:
+		type_filter = bitmap_git.trees;
+		break;
+	case OBJ_BLOB:
+		type_filter = bitmap_git.blobs;
+		break;
+	case OBJ_TAG:
+		type_filter = bitmap_git.tags;
+		break;
+	default:
+		return 0;
+	}
+
+	ewah_iterator_init(&it, type_filter);
+	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
+		eword_t word = objects->words[i++] & filter;
+		count += ewah_bit_popcount64(word);
+	}
+
+	for (i = 0; i < eindex->count; ++i) {
+		if (eindex->objects[i]->type == type &&
+		    bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			count++;
+	}
+
+	return count;
+}
+
+void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
+			      uint32_t *blobs, uint32_t *tags)
+{
+	if (!bitmap_git.result)
+		die("BUG: count_bitmap_commit_list without a bitmap walk");
+
+	if (commits)
+		*commits = count_object_type(bitmap_git.result, OBJ_COMMIT);
+	if (trees)
+		*trees = count_object_type(bitmap_git.result, OBJ_TREE);
+	if (blobs)
+		*blobs = count_object_type(bitmap_git.result, OBJ_BLOB);
+	if (tags)
+		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
+}
+
+/*
+ * Can the object at position "pos" of the bitmapped pack be copied as
+ * is?  It can, unless it is a delta whose base we do not copy, too.
+ * Bases come before their deltas in a pack (REF_DELTAs whose base is
+ * further down are simply not reused), so "reuse" already knows about
+ * them.
+ */
+static int can_reuse_object(uint32_t pos, struct bitmap *reuse,
+			    struct pack_window **w_curs)
+{
+	struct packed_git *pack = bitmap_git.pack;
+	off_t offset, header;
+	unsigned long size;
+	int type, base_pos;
+
+	offset = header = pack_pos_to_offset(bitmap_git.reverse_index, pos);
+	type = unpack_object_header(pack, w_curs, &offset, &size);
+	if (type < 0)
+		return 0;
+	if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+		off_t base_offset = get_delta_base(pack, w_curs, &offset,
+						   type, header);
+		if (!base_offset)
+			return 0;
+		base_pos = find_revindex_position(bitmap_git.reverse_index,
+						  base_offset);
+		if (base_pos < 0 || base_pos >= pos ||
+		    !bitmap_get(reuse, base_pos))
+			return 0;
+	}
+	return 1;
+}
+
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out)
+{
+	struct bitmap *result = bitmap_git.result;
+	uint32_t num_objects = bitmap_git.pack->num_objects;
+	struct pack_window *w_curs = NULL;
+	struct bitmap *reuse;
+	size_t i = 0;
+
+	if (!result)
+		die("BUG: reuse_partial_packfile_from_bitmap without a bitmap walk");
+	if (!is_pack_valid(bitmap_git.pack))
+		return -1;
+
+	/* whole words of wanted objects can go without looking at them */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
+	if (i > num_objects / BITS_IN_EWORD)
+		i = num_objects / BITS_IN_EWORD;
+
+	reuse = bitmap_new();
+	if (i) {
+		bitmap_set(reuse, i * BITS_IN_EWORD - 1);
+		memset(reuse->words, 0xff, i * sizeof(eword_t));
+	}
+
+	for (; i < result->word_alloc; i++) {
+		eword_t word = result->words[i];
+		size_t pos = i * BITS_IN_EWORD;
+
+		while (word) {
+			uint32_t bit = pos + ewah_bit_ctz64(word);
+
+			if (bit >= num_objects)
+				goto done;
+			if (can_reuse_object(bit, reuse, &w_curs))
+				bitmap_set(reuse, bit);
+			word &= word - 1;
+		}
+	}
+done:
+	unuse_pack(&w_curs);
+
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
+		return -1;
+	}
+
+	bitmap_and_not(result, reuse);
+	*packfile = bitmap_git.pack;
+	*reuse_out = reuse;
+	return 0;
+}
+
+int bitmap_walk_contains(struct bitmap *bitmap, const unsigned char *sha1)
+{
+	int pos = bitmap_position_packfile(sha1);
+
+	return pos >= 0 && bitmap_get(bitmap, pos);
+}
@@ -0,0 +1,85 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+#include "ewah/ewok.h"
+
+/*
+ * A reachability bitmap index (.bitmap) stored next to a packfile
+ * records, for a selection of commits in the pack, the set of objects
+ * reachable from that commit as a bitmap over the objects of the pack
+ * in pack (offset) order.  See Documentation/technical/bitmap-format.txt.
+ */
+
+#define BITMAP_IDX_SIGNATURE "BITM"
+#define BITMAP_IDX_VERSION 1
+
+/* "options" field in the header */
+#define BITMAP_OPT_FULL_DAG	1	/* the pack is closed under reachability */
+#define BITMAP_OPT_HASH_CACHE	4	/* name-hash of each object follows */
+
+/* size of the fixed header: signature, version, options, count, checksum */
+#define BITMAP_HEADER_SIZE (4 + 2 + 2 + 4 + 20)
+
+typedef void (*show_reachable_fn)(const unsigned char *sha1,
+				  enum object_type type,
+				  uint32_t name_hash,
+				  struct packed_git *found_pack,
+				  off_t found_offset);
+
+struct rev_info;
+
+/*
+ * Compute the set of objects reachable from the positive pending
+ * objects of "revs" minus those reachable from the negative ones,
+ * using the bitmap index of the repository.  Returns -1 (without
+ * touching "revs") if there is no usable bitmap index or "revs" asks
+ * for something a bitmap cannot answer; the caller is then expected to
+ * fall back to a regular revision walk.
+ */
+int prepare_bitmap_walk(struct rev_info *revs);
+
+/*
+ * Call "show_reachable" for every object in the result computed by
+ * prepare_bitmap_walk().  Objects in the bitmapped pack are shown in
+ * pack order, grouped by type.
+ */
+void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
+
+/*
+ * Count the objects of each type in the result computed by
+ * prepare_bitmap_walk(); any of the pointers may be NULL.
+ */
+void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
+			      uint32_t *blobs, uint32_t *tags);
+
+/*
+ * Find the objects of the result computed by prepare_bitmap_walk()
+ * that can be sent by copying their bytes out of the bitmapped pack
+ * as they are: every wanted object that is stored whole, or as a delta
+ * against another such object.  Returns -1 if there are none; else
+ * takes them out of the result, stores the pack, their number and
+ * their bitmap (over pack positions) in the out-parameters and
+ * returns 0.
+ */
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out);
+
+/* Is "sha1" one of the objects of the pack set in "bitmap"? */
+int bitmap_walk_contains(struct bitmap *bitmap, const unsigned char *sha1);
+
+/*
+ * Writing a bitmap index for a freshly written pack: feed every
+ * object of the pack with bitmap_writer_add_object(), pick the commits
+ * that get a bitmap, build them and write the file.
+ */
+void bitmap_writer_show_progress(int show);
+void bitmap_writer_set_checksum(const unsigned char *sha1);
+void bitmap_writer_add_object(const unsigned char *sha1, off_t offset,
+			      enum object_type type, uint32_t name_hash);
+void bitmap_writer_select_commits(struct commit **indexed_commits,
+				  unsigned int indexed_commits_nr);
+int bitmap_writer_build(void);
+void bitmap_writer_finish(const char *filename, uint16_t options);
+
+#endif
@@ -0,0 +1,142 @@
+#include "cache.h"
+#include "pack.h"
+#include "pack-bloom.h"
+
+/*
+ * Object names are uniformly distributed already, so the positions of
+ * the bits of an object are taken from its name, by double hashing over
+ * two of its words (not the first one, which the .idx fan-out uses).
+ */
+static inline uint32_t bloom_pos(const unsigned char *sha1, unsigned i,
+				 uint32_t mask)
+{
+	uint32_t h1 = get_be32(sha1 + 4);
+	uint32_t h2 = get_be32(sha1 + 8) | 1;
+	return (h1 + i * h2) & mask;
+}
+
+unsigned pack_bloom_log2_bits(uint32_t nr)
+{
+	uint64_t want = (uint64_t)nr * PACK_BLOOM_BITS_PER_OBJECT;
+	unsigned log2_bits = 6;
+
+	while (log2_bits < 31 && ((uint64_t)1 << log2_bits) < want)
+		log2_bits++;
+	return log2_bits;
+}
+
+void pack_bloom_add(unsigned char *bits, unsigned log2_bits,
+		    unsigned nr_hashes, const unsigned char *sha1)
+{
+	uint32_t mask = ((uint32_t)1 << log2_bits) - 1;
+	unsigned i;
+
+	for (i = 0; i < nr_hashes; i++) {
+		uint32_t pos = bloom_pos(sha1, i, mask);
+		bits[pos >> 3] |= 1 << (pos & 7);
+	}
+}
+
+static char *pack_bloom_filename(struct packed_git *p)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_add(&sb, p->pack_name, strlen(p->pack_name) - strlen(".pack"));
+	strbuf_addstr(&sb, ".bloom");
+	return strbuf_detach(&sb, NULL);
+}
+
+/*
+ * The filter is matched to its pack through the name of the pack,
+ * which is the hash of the names of the objects in it; unlike the
+ * pack checksum, that can be checked without opening the .idx.
+ */
+static void load_pack_bloom(struct packed_git *p)
+{
+	char *bloom_name;
+	const unsigned char *map;
+	size_t size;
+	struct stat st;
+	unsigned nr_hashes, log2_bits;
+	int fd;
+
+	if (is_null_sha1(p->sha1))
+		return;
+	bloom_name = pack_bloom_filename(p);
+	fd = open(bloom_name, O_RDONLY);
+	if (fd < 0) {
+		free(bloom_name);
+		return;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(bloom_name);
+		return;
+	}
+	size = xsize_t(st.st_size);
+	if (size < PBLM_HEADER_SIZE + 8 + 20 + 20) {
+		close(fd);
+		error("bloom filter %s is too small", bloom_name);
+		free(bloom_name);
+		return;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr_hashes = get_be32(map + 12);
+	log2_bits = get_be32(map + 16);
+	if (get_be32(map) != PBLM_SIGNATURE ||
+	    get_be32(map + 4) != PBLM_VERSION ||
+	    get_be32(map + 8) != 1 ||
+	    !nr_hashes || nr_hashes > 32 ||
+	    log2_bits < 6 || log2_bits > 31 ||
+	    size != PBLM_HEADER_SIZE + ((size_t)1 << (log2_bits - 3)) + 20 + 20) {
+		munmap((void *)map, size);
+		error("bloom filter %s is corrupt", bloom_name);
+		free(bloom_name);
+		return;
+	}
+	if (hashcmp(map + size - 40, p->sha1)) {
+		munmap((void *)map, size);
+		error("bloom filter %s does not match its pack", bloom_name);
+		free(bloom_name);
+		return;
+	}
+
+	p->bloom_map = map;
+	p->bloom_size = size;
+	free(bloom_name);
+}
+
+int pack_bloom_excludes(struct packed_git *p, const unsigned char *sha1)
+{
+	const unsigned char *bits;
+	unsigned nr_hashes, i;
+	uint32_t mask;
+
+	if (!p->bloom_checked) {
+		p->bloom_checked = 1;
+		load_pack_bloom(p);
+	}
+	if (!p->bloom_map)
+		return 0;
+
+	nr_hashes = get_be32(p->bloom_map + 12);
+	mask = ((uint32_t)1 << get_be32(p->bloom_map + 16)) - 1;
+	bits = p->bloom_map + PBLM_HEADER_SIZE;
+	for (i = 0; i < nr_hashes; i++) {
+		uint32_t pos = bloom_pos(sha1, i, mask);
+		if (!(bits[pos >> 3] & (1 << (pos & 7))))
+			return 1;
+	}
+	return 0;
+}
+
+void close_pack_bloom(struct packed_git *p)
+{
+	if (p->bloom_map) {
+		munmap((void *)p->bloom_map, p->bloom_size);
+		p->bloom_map = NULL;
+	}
+	p->bloom_checked = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef PACK_BLOOM_H
+#define PACK_BLOOM_H
+
+/*
+ * A pack may come with a .bloom file, a Bloom filter of the names of
+ * its objects (see Documentation/technical/pack-format.txt).  It lets
+ * find_pack_entry() pass over packs that cannot have the object it
+ * looks for without looking at their .idx, which is what makes asking
+ * for objects we do not have expensive in a repository with many
+ * packs.
+ */
+
+struct packed_git;
+
+#define PACK_BLOOM_HASHES 7
+#define PACK_BLOOM_BITS_PER_OBJECT 10
+
+/* The size of the filter for "nr" objects, as log2 of its bits. */
+unsigned pack_bloom_log2_bits(uint32_t nr);
+
+/* Add "sha1" to the filter "bits" of (1 << log2_bits) bits. */
+void pack_bloom_add(unsigned char *bits, unsigned log2_bits,
+		    unsigned nr_hashes, const unsigned char *sha1);
+
+/*
+ * Returns 1 if the .bloom file of "p" says "sha1" is not in "p", and 0
+ * if it may be, or "p" has no usable .bloom file.
+ */
+int pack_bloom_excludes(struct packed_git *p, const unsigned char *sha1);
+
+void close_pack_bloom(struct packed_git *p);
+
+#endif
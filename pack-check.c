@@ -2,6 +2,8 @@
 #include "pack.h"
 #include "pack-revindex.h"
 #include "progress.h"
+#include "sha1-batch.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -28,7 +30,11 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 
 	do {
 		unsigned long avail;
-		void *data = use_pack(p, w_curs, offset, &avail);
+		void *data;
+
+		obj_read_lock();
+		data = use_pack(p, w_curs, offset, &avail);
+		obj_read_unlock();
 		if (avail > len)
 			avail = len;
 		data_crc = crc32(data_crc, data, avail);
@@ -42,47 +48,355 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
-static int verify_packfile(struct packed_git *p,
-			   struct pack_window **w_curs,
-			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+/*
+ * Unpacked objects wait here until a batch of them can be hashed
+ * together; see sha1-batch.h.
+ */
+struct verify_batch {
+	struct sha1_batch_item items[SHA1_BATCH_NR];
+	struct idx_entry *entries[SHA1_BATCH_NR];
+	enum object_type types[SHA1_BATCH_NR];
+	int nr;
+	unsigned long size;
+};
+
+static void crc_error(struct packed_git *p, struct idx_entry *entry)
+{
+	error("index CRC mismatch for object %s from %s at offset %"PRIuMAX"",
+	      sha1_to_hex(entry->sha1), p->pack_name, (uintmax_t)entry->offset);
+}
+
+static void unpack_error(struct packed_git *p, struct idx_entry *entry)
+{
+	error("cannot unpack %s from %s at offset %"PRIuMAX"",
+	      sha1_to_hex(entry->sha1), p->pack_name,
+	      (uintmax_t)entry->offset);
+}
+
+static void report_object(const unsigned char *sha1, enum object_type type,
+			  unsigned long size, void *data, struct strbuf *out,
+			  verify_fn fn)
+{
+	int eaten = 0;
+
+	if (out->len)
+		fputs(out->buf, stderr);
+	if (fn)
+		fn(sha1, type, size, data, &eaten);
+	if (!eaten)
+		free(data);
+}
+
+static int flush_verify_batch(struct packed_git *p, struct verify_batch *batch,
+			      verify_fn fn, verify_check_fn check)
+{
+	struct strbuf out = STRBUF_INIT;
+	int i, err = 0;
+
+	hash_sha1_batch(batch->items, batch->nr);
+	for (i = 0; i < batch->nr; i++) {
+		struct sha1_batch_item *item = &batch->items[i];
+		const unsigned char *sha1 = batch->entries[i]->sha1;
+		void *data = (void *)item->buf;
+
+		if (hashcmp(sha1, item->sha1)) {
+			err = error("packed %s from %s is corrupt",
+				    sha1_to_hex(sha1), p->pack_name);
+			free(data);
+			continue;
+		}
+		if (check)
+			check(sha1, batch->types[i], item->len, data, &out);
+		report_object(sha1, batch->types[i], item->len, data, &out, fn);
+		strbuf_reset(&out);
+	}
+	strbuf_release(&out);
+	batch->nr = 0;
+	batch->size = 0;
+	return err;
+}
+
+#ifndef NO_PTHREADS
+/*
+ * In threaded mode the objects are verified in rounds: the workers
+ * claim runs of VERIFY_RUN_NR entries in pack order until the round is
+ * full, so that each of them reads its own stretch of the pack, and
+ * once they are done the calling thread reports on what they found in
+ * pack order, so that the output does not depend on the number of
+ * threads.  Meanwhile another thread checks the pack checksum.
+ */
+#define VERIFY_RUN_NR 32
+#define VERIFY_ROUND_NR 4096
+#define VERIFY_ROUND_SIZE (32 * 1024 * 1024)
+
+struct verify_job {
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	unsigned crc_bad:1,
+		 hash_bad:1;
+	struct strbuf out;
+};
 
+struct verify_round {
+	struct packed_git *p;
+	struct idx_entry *entries;
+	struct verify_job *jobs;
+	verify_check_fn check;
+	uint32_t start, next, end;
+	unsigned long size;
+	pthread_mutex_t mutex;
+};
+
+static void verify_job(struct packed_git *p, struct idx_entry *entry,
+		       struct verify_job *job, verify_check_fn check,
+		       struct pack_window **w_curs)
+{
+	unsigned char sha1[20];
+
+	if (p->index_version > 1 &&
+	    check_pack_crc(p, w_curs, entry->offset,
+			   entry[1].offset - entry->offset, entry->nr))
+		job->crc_bad = 1;
+	job->data = unpack_entry(p, entry->offset, &job->type, &job->size);
+	if (!job->data)
+		return;
+	hash_sha1_file(job->data, job->size, typename(job->type), sha1);
+	if (hashcmp(sha1, entry->sha1))
+		job->hash_bad = 1;
+	else if (check)
+		check(entry->sha1, job->type, job->size, job->data, &job->out);
+}
+
+static void *verify_worker(void *data)
+{
+	struct verify_round *round = data;
+	struct pack_window *w_curs = NULL;
+
+	for (;;) {
+		unsigned long size = 0;
+		uint32_t i, end;
+
+		pthread_mutex_lock(&round->mutex);
+		if (round->next == round->end ||
+		    round->size >= VERIFY_ROUND_SIZE) {
+			pthread_mutex_unlock(&round->mutex);
+			break;
+		}
+		i = round->next;
+		end = round->end - i < VERIFY_RUN_NR ?
+		      round->end : i + VERIFY_RUN_NR;
+		round->next = end;
+		pthread_mutex_unlock(&round->mutex);
+
+		for (; i < end; i++) {
+			struct verify_job *job = &round->jobs[i - round->start];
+			verify_job(round->p, &round->entries[i], job,
+				   round->check, &w_curs);
+			size += job->size;
+		}
+
+		pthread_mutex_lock(&round->mutex);
+		round->size += size;
+		pthread_mutex_unlock(&round->mutex);
+	}
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+static int verify_entries_threaded(struct packed_git *p,
+				   struct idx_entry *entries,
+				   uint32_t nr_objects,
+				   verify_fn fn, verify_check_fn check,
+				   int nr_threads,
+				   struct progress *progress,
+				   uint32_t base_count)
+{
+	struct verify_round round;
+	pthread_t *threads;
+	uint32_t i;
+	int t, err = 0;
+
+	memset(&round, 0, sizeof(round));
+	round.p = p;
+	round.entries = entries;
+	round.check = check;
+	round.jobs = xcalloc(VERIFY_ROUND_NR, sizeof(*round.jobs));
+	for (i = 0; i < VERIFY_ROUND_NR; i++)
+		strbuf_init(&round.jobs[i].out, 0);
+	pthread_mutex_init(&round.mutex, NULL);
+	threads = xmalloc(nr_threads * sizeof(*threads));
+
+	i = 0;
+	while (i < nr_objects) {
+		round.start = round.next = i;
+		round.end = i + (nr_objects - i < VERIFY_ROUND_NR ?
+				 nr_objects - i : VERIFY_ROUND_NR);
+		round.size = 0;
+		for (t = 0; t < nr_threads; t++)
+			if (pthread_create(&threads[t], NULL,
+					   verify_worker, &round))
+				die("unable to create thread");
+		for (t = 0; t < nr_threads; t++)
+			pthread_join(threads[t], NULL);
+
+		for (; i < round.next; i++) {
+			struct verify_job *job = &round.jobs[i - round.start];
+			const unsigned char *sha1 = entries[i].sha1;
+
+			if (job->crc_bad) {
+				crc_error(p, &entries[i]);
+				err = -1;
+			}
+			if (!job->data) {
+				unpack_error(p, &entries[i]);
+				err = -1;
+			} else if (job->hash_bad) {
+				err = error("packed %s from %s is corrupt",
+					    sha1_to_hex(sha1), p->pack_name);
+				free(job->data);
+			} else
+				report_object(sha1, job->type, job->size,
+					      job->data, &job->out, fn);
+			job->data = NULL;
+			job->crc_bad = job->hash_bad = 0;
+			strbuf_reset(&job->out);
+			if (((base_count + i) & 1023) == 0)
+				display_progress(progress, base_count + i);
+		}
+	}
+
+	for (i = 0; i < VERIFY_ROUND_NR; i++)
+		strbuf_release(&round.jobs[i].out);
+	free(round.jobs);
+	free(threads);
+	pthread_mutex_destroy(&round.mutex);
+	return err;
+}
+#endif
+
+/*
+ * Hash the whole pack, and compare the result with its trailer and
+ * with the copy of the trailer in the index.  Errors are reported by
+ * report_pack_checksum(), so that the check can run in a thread.
+ */
+#define PACK_CHECKSUM_MISMATCH 01
+#define PACK_CHECKSUM_NOT_IN_INDEX 02
+
+static int check_pack_checksum(struct packed_git *p,
+			       struct pack_window **w_curs)
 {
-	off_t index_size = p->index_size;
 	const unsigned char *index_base = p->index_data;
 	git_SHA_CTX ctx;
 	unsigned char sha1[20], *pack_sig;
-	off_t offset = 0, pack_sig_ofs = 0;
-	uint32_t nr_objects, i;
-	int err = 0;
-	struct idx_entry *entries;
-
-	/* Note that the pack header checks are actually performed by
-	 * use_pack when it first opens the pack file.  If anything
-	 * goes wrong during those checks then the call will die out
-	 * immediately.
-	 */
+	off_t offset = 0, pack_sig_ofs = p->pack_size - 20;
+	int bad = 0;
 
 	git_SHA1_Init(&ctx);
 	do {
 		unsigned long remaining;
-		unsigned char *in = use_pack(p, w_curs, offset, &remaining);
+		unsigned char *in;
+
+		obj_read_lock();
+		in = use_pack(p, w_curs, offset, &remaining);
+		obj_read_unlock();
 		offset += remaining;
-		if (!pack_sig_ofs)
-			pack_sig_ofs = p->pack_size - 20;
 		if (offset > pack_sig_ofs)
 			remaining -= (unsigned int)(offset - pack_sig_ofs);
 		git_SHA1_Update(&ctx, in, remaining);
 	} while (offset < pack_sig_ofs);
 	git_SHA1_Final(sha1, &ctx);
+	obj_read_lock();
 	pack_sig = use_pack(p, w_curs, pack_sig_ofs, NULL);
 	if (hashcmp(sha1, pack_sig))
+		bad |= PACK_CHECKSUM_MISMATCH;
+	if (hashcmp(index_base + p->index_size - 40, pack_sig))
+		bad |= PACK_CHECKSUM_NOT_IN_INDEX;
+	unuse_pack(w_curs);
+	obj_read_unlock();
+	return bad;
+}
+
+static int report_pack_checksum(struct packed_git *p, int bad)
+{
+	int err = 0;
+
+	if (bad & PACK_CHECKSUM_MISMATCH)
 		err = error("%s SHA1 checksum mismatch",
 			    p->pack_name);
-	if (hashcmp(index_base + index_size - 40, pack_sig))
+	if (bad & PACK_CHECKSUM_NOT_IN_INDEX)
 		err = error("%s SHA1 does not match its index",
 			    p->pack_name);
-	unuse_pack(w_curs);
+	return err;
+}
+
+#ifndef NO_PTHREADS
+struct checksum_thread {
+	pthread_t thread;
+	struct packed_git *p;
+	int bad;
+};
+
+static void *verify_checksum(void *data)
+{
+	struct checksum_thread *c = data;
+	struct pack_window *w_curs = NULL;
+
+	c->bad = check_pack_checksum(c->p, &w_curs);
+	return NULL;
+}
+
+/*
+ * The pack checksum is only reported after the objects, as it takes
+ * as long to compute as the objects are to verify.
+ */
+static int verify_packfile_threaded(struct packed_git *p,
+				    struct idx_entry *entries,
+				    verify_fn fn, verify_check_fn check,
+				    int nr_threads,
+				    struct progress *progress,
+				    uint32_t base_count)
+{
+	struct checksum_thread checksum;
+	int err = 0;
+
+	enable_obj_read_lock();
+	checksum.p = p;
+	checksum.bad = 0;
+	if (pthread_create(&checksum.thread, NULL, verify_checksum, &checksum))
+		die("unable to create thread");
+	if (verify_entries_threaded(p, entries, p->num_objects, fn, check,
+				    nr_threads, progress, base_count))
+		err = -1;
+	pthread_join(checksum.thread, NULL);
+	disable_obj_read_lock();
+
+	if (report_pack_checksum(p, checksum.bad))
+		err = -1;
+	display_progress(progress, base_count + p->num_objects);
+	return err;
+}
+#endif
+
+static int verify_packfile(struct packed_git *p,
+			   struct pack_window **w_curs,
+			   verify_fn fn, verify_check_fn check,
+			   int nr_threads,
+			   struct progress *progress, uint32_t base_count)
+
+{
+	uint32_t nr_objects, i;
+	int err = 0;
+	struct idx_entry *entries;
+	struct verify_batch batch;
+
+	/* Note that the pack header checks are actually performed by
+	 * use_pack when it first opens the pack file.  If anything
+	 * goes wrong during those checks then the call will die out
+	 * immediately.
+	 */
 
 	/* Make sure everything reachable from idx is valid.  Since we
 	 * have verified that nr_objects matches between idx and pack,
@@ -90,7 +404,7 @@ static int verify_packfile(struct packed_git *p,
 	 */
 	nr_objects = p->num_objects;
 	entries = xmalloc((nr_objects + 1) * sizeof(*entries));
-	entries[nr_objects].offset = pack_sig_ofs;
+	entries[nr_objects].offset = p->pack_size - 20;
 	/* first sort entries by pack offset, since unpacking them is more efficient that way */
 	for (i = 0; i < nr_objects; i++) {
 		entries[i].sha1 = nth_packed_object_sha1(p, i);
@@ -101,6 +415,20 @@ static int verify_packfile(struct packed_git *p,
 	}
 	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
 
+#ifndef NO_PTHREADS
+	if (nr_threads) {
+		err = verify_packfile_threaded(p, entries, fn, check,
+					       nr_threads, progress,
+					       base_count);
+		free(entries);
+		return err;
+	}
+#endif
+
+	err = report_pack_checksum(p, check_pack_checksum(p, w_curs));
+
+	batch.nr = 0;
+	batch.size = 0;
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
 		enum object_type type;
@@ -110,31 +438,35 @@ static int verify_packfile(struct packed_git *p,
 			off_t offset = entries[i].offset;
 			off_t len = entries[i+1].offset - offset;
 			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    sha1_to_hex(entries[i].sha1),
-					    p->pack_name, (uintmax_t)offset);
+			if (check_pack_crc(p, w_curs, offset, len, nr)) {
+				crc_error(p, &entries[i]);
+				err = -1;
+			}
 		}
 		data = unpack_entry(p, entries[i].offset, &type, &size);
-		if (!data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    sha1_to_hex(entries[i].sha1), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
-			err = error("packed %s from %s is corrupt",
-				    sha1_to_hex(entries[i].sha1), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			fn(entries[i].sha1, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+		if (!data) {
+			unpack_error(p, &entries[i]);
+			err = -1;
+		} else {
+			if (batch.nr && batch.size + size > SHA1_BATCH_SIZE &&
+			    flush_verify_batch(p, &batch, fn, check))
+				err = -1;
+			batch.items[batch.nr].buf = data;
+			batch.items[batch.nr].len = size;
+			batch.items[batch.nr].type = typename(type);
+			batch.entries[batch.nr] = &entries[i];
+			batch.types[batch.nr] = type;
+			batch.nr++;
+			batch.size += size;
+			if (batch.nr == SHA1_BATCH_NR &&
+			    flush_verify_batch(p, &batch, fn, check))
+				err = -1;
 		}
 		if (((base_count + i) & 1023) == 0)
 			display_progress(progress, base_count + i);
-		free(data);
-
 	}
+	if (batch.nr && flush_verify_batch(p, &batch, fn, check))
+		err = -1;
 	display_progress(progress, base_count + i);
 	free(entries);
 
@@ -164,8 +496,8 @@ int verify_pack_index(struct packed_git *p)
 	return err;
 }
 
-int verify_pack(struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+int verify_pack(struct packed_git *p, verify_fn fn, verify_check_fn check,
+		int nr_threads, struct progress *progress, uint32_t base_count)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -174,7 +506,8 @@ int verify_pack(struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(p, &w_curs, fn, check, nr_threads,
+			       progress, base_count);
 	unuse_pack(&w_curs);
 
 	return err;
@@ -0,0 +1,74 @@
+#include "cache.h"
+#include "pack.h"
+#include "pack-mtimes.h"
+
+static char *pack_mtimes_filename(struct packed_git *p)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_add(&sb, p->pack_name, strlen(p->pack_name) - strlen(".pack"));
+	strbuf_addstr(&sb, ".mtimes");
+	return strbuf_detach(&sb, NULL);
+}
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	char *mtimes_name;
+	size_t expect_size;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (p->mtimes_map)
+		return 0;
+	if (!p->is_cruft || open_pack_index(p))
+		return -1;
+
+	mtimes_name = pack_mtimes_filename(p);
+	fd = open(mtimes_name, O_RDONLY);
+	if (fd < 0) {
+		free(mtimes_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(mtimes_name);
+		return -1;
+	}
+
+	expect_size = MTIMES_HEADER_SIZE + 4 * (size_t)p->num_objects + 20 + 20;
+	if (xsize_t(st.st_size) != expect_size) {
+		close(fd);
+		error("mtimes file %s has wrong size", mtimes_name);
+		free(mtimes_name);
+		return -1;
+	}
+	map = xmmap(NULL, expect_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(map) != MTIMES_SIGNATURE ||
+	    get_be32((unsigned char *)map + 4) != MTIMES_VERSION ||
+	    get_be32((unsigned char *)map + 8) != 1 ||
+	    hashcmp((unsigned char *)map + expect_size - 40,
+		    (unsigned char *)p->index_data + p->index_size - 40)) {
+		munmap(map, expect_size);
+		error("mtimes file %s does not match its pack", mtimes_name);
+		free(mtimes_name);
+		return -1;
+	}
+
+	p->mtimes_map = map;
+	p->mtimes_size = expect_size;
+	free(mtimes_name);
+	return 0;
+}
+
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (!p->mtimes_map)
+		die("BUG: nth_packed_mtime without load_pack_mtimes");
+	if (pos >= p->num_objects)
+		die("BUG: mtime of object %"PRIu32" out of %"PRIu32" requested",
+		    pos, p->num_objects);
+	return get_be32(p->mtimes_map + MTIMES_HEADER_SIZE + 4 * (size_t)pos);
+}
@@ -0,0 +1,23 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+/*
+ * A cruft pack holds unreachable objects, and comes with a .mtimes
+ * file giving, for each of its objects, the time it was last known
+ * to be written (see Documentation/technical/pack-format.txt).  This
+ * plays the role the file modification time plays for loose objects
+ * when deciding whether an unreachable object can be expired.
+ */
+
+struct packed_git;
+
+/*
+ * Map the .mtimes file of the cruft pack "p".  Returns -1 if "p" is
+ * not a cruft pack or the file is unusable.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/* The mtime of the object at position "pos" of the .idx of "p". */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+#endif
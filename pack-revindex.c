@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "pack-revindex.h"
+#include "pack.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -14,13 +15,12 @@
  * ordered by offset, so if you know the offset of an object, next offset
  * is where its packed representation ends and the index_nr can be used to
  * get the object sha1 from the main index.
+ *
+ * index-pack and pack-objects store this list next to the pack as a
+ * .rev file; when it is there we map it instead of building and
+ * sorting our own.
  */
 
-struct pack_revindex {
-	struct packed_git *p;
-	struct revindex_entry *revindex;
-};
-
 static struct pack_revindex *pack_revindex;
 static int pack_revindex_hashsz;
 
@@ -111,12 +111,69 @@ static void create_pack_revindex(struct pack_revindex *rix)
 	qsort(rix->revindex, num_ent, sizeof(*rix->revindex), cmp_offset);
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+/*
+ * Map the .rev file written next to the pack by index-pack or
+ * pack-objects, if there is one and it matches the pack; this saves
+ * sorting the offsets ourselves.
+ */
+static int load_pack_rev_file(struct pack_revindex *rix)
+{
+	struct packed_git *p = rix->p;
+	size_t len = strlen(p->pack_name), expect_size;
+	char *rev_name;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (len < 5 || strcmp(p->pack_name + len - 5, ".pack"))
+		return -1;
+	rev_name = xmalloc(len);
+	memcpy(rev_name, p->pack_name, len - 5);
+	strcpy(rev_name + len - 5, ".rev");
+
+	fd = open(rev_name, O_RDONLY);
+	if (fd < 0) {
+		free(rev_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+
+	expect_size = RIDX_HEADER_SIZE + 4 * (size_t)p->num_objects + 20 + 20;
+	if (xsize_t(st.st_size) != expect_size) {
+		close(fd);
+		error("reverse index file %s has wrong size", rev_name);
+		free(rev_name);
+		return -1;
+	}
+	map = xmmap(NULL, expect_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(map) != RIDX_SIGNATURE ||
+	    get_be32((unsigned char *)map + 4) != RIDX_VERSION ||
+	    get_be32((unsigned char *)map + 8) != 1 ||
+	    hashcmp((unsigned char *)map + expect_size - 40,
+		    (unsigned char *)p->index_data + p->index_size - 40)) {
+		munmap(map, expect_size);
+		error("reverse index file %s does not match its pack", rev_name);
+		free(rev_name);
+		return -1;
+	}
+
+	rix->rev_map = map;
+	rix->rev_map_size = expect_size;
+	rix->rev_data = (unsigned char *)map + RIDX_HEADER_SIZE;
+	free(rev_name);
+	return 0;
+}
+
+struct pack_revindex *revindex_for_pack(struct packed_git *p)
 {
 	int num;
-	int lo, hi;
 	struct pack_revindex *rix;
-	struct revindex_entry *revindex;
 
 	if (!pack_revindex_hashsz)
 		init_pack_revindex();
@@ -125,31 +182,67 @@ struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
 		die("internal error: pack revindex fubar");
 
 	rix = &pack_revindex[num];
-	if (!rix->revindex)
-		create_pack_revindex(rix);
-	revindex = rix->revindex;
+	if (!rix->revindex && !rix->rev_data) {
+		if (open_pack_index(p))
+			die("unable to open pack index of %s", p->pack_name);
+		if (load_pack_rev_file(rix))
+			create_pack_revindex(rix);
+	}
+	return rix;
+}
+
+uint32_t pack_pos_to_index(struct pack_revindex *pridx, uint32_t pos)
+{
+	if (pridx->rev_data)
+		return get_be32(pridx->rev_data + 4 * (size_t)pos);
+	return pridx->revindex[pos].nr;
+}
+
+off_t pack_pos_to_offset(struct pack_revindex *pridx, uint32_t pos)
+{
+	struct packed_git *p = pridx->p;
+
+	if (!pridx->rev_data)
+		return pridx->revindex[pos].offset;
+	/* the 20-byte trailer follows immediately after the last object */
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, pack_pos_to_index(pridx, pos));
+}
+
+/*
+ * Return the position of the object at offset "ofs" in the
+ * offset-ordered list of objects, or -1 if there is none.
+ */
+int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
+{
+	int lo = 0;
+	int hi = pridx->p->num_objects + 1;
 
-	lo = 0;
-	hi = p->num_objects + 1;
 	do {
 		int mi = (lo + hi) / 2;
-		if (revindex[mi].offset == ofs) {
-			return revindex + mi;
-		} else if (ofs < revindex[mi].offset)
+		off_t mi_ofs = pack_pos_to_offset(pridx, mi);
+
+		if (mi_ofs == ofs) {
+			return mi;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
-	error("bad offset for revindex");
-	return NULL;
+	return error("bad offset for revindex");
 }
 
 void discard_revindex(void)
 {
 	if (pack_revindex_hashsz) {
 		int i;
-		for (i = 0; i < pack_revindex_hashsz; i++)
+		for (i = 0; i < pack_revindex_hashsz; i++) {
 			free(pack_revindex[i].revindex);
+			if (pack_revindex[i].rev_map)
+				munmap((void *)pack_revindex[i].rev_map,
+				       pack_revindex[i].rev_map_size);
+		}
 		free(pack_revindex);
 		pack_revindex_hashsz = 0;
 	}
@@ -6,7 +6,28 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+struct pack_revindex {
+	struct packed_git *p;
+	/* either computed at runtime ... */
+	struct revindex_entry *revindex;
+	/* ... or mapped from the .rev file */
+	const unsigned char *rev_map;
+	size_t rev_map_size;
+	const unsigned char *rev_data;
+};
+
+struct pack_revindex *revindex_for_pack(struct packed_git *p);
+int find_revindex_position(struct pack_revindex *pridx, off_t ofs);
+
+/*
+ * Translate a position in pack order (as returned by
+ * find_revindex_position) to the position of the object in the .idx,
+ * or to its offset.  The position just past the last object gives the
+ * offset of the pack trailer, i.e. where the last object ends.
+ */
+uint32_t pack_pos_to_index(struct pack_revindex *pridx, uint32_t pos);
+off_t pack_pos_to_offset(struct pack_revindex *pridx, uint32_t pos);
+
 void discard_revindex(void);
 
 #endif
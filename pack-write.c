@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-bloom.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -182,6 +183,175 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+struct rev_entry {
+	off_t offset;
+	uint32_t nr;
+};
+
+static int rev_entry_cmp(const void *a_, const void *b_)
+{
+	const struct rev_entry *a = a_, *b = b_;
+	return (a->offset < b->offset) ? -1 : (a->offset > b->offset);
+}
+
+/*
+ * Write the reverse index of a pack: the positions in the .idx of its
+ * objects, in the order they appear in the pack.  "objects" must be
+ * sorted by SHA1 as write_idx_file() leaves them, and "pack_sha1" is
+ * the checksum at the end of the pack.  Like write_idx_file(), writes
+ * to a temporary file when "rev_name" is NULL, and returns the name
+ * of the file written (or NULL when opts does not ask for it).
+ */
+const char *write_rev_file(const char *rev_name,
+			   struct pack_idx_entry **objects,
+			   uint32_t nr_objects,
+			   const unsigned char *pack_sha1,
+			   const struct pack_idx_option *opts)
+{
+	struct sha1file *f;
+	struct rev_entry *sorted_by_offset;
+	unsigned char header[RIDX_HEADER_SIZE];
+	uint32_t i;
+	int fd;
+
+	if (!(opts->flags & WRITE_REV) || (opts->flags & WRITE_IDX_VERIFY))
+		return NULL;
+
+	sorted_by_offset = xmalloc(nr_objects * sizeof(*sorted_by_offset));
+	for (i = 0; i < nr_objects; i++) {
+		sorted_by_offset[i].offset = objects[i]->offset;
+		sorted_by_offset[i].nr = i;
+	}
+	qsort(sorted_by_offset, nr_objects, sizeof(*sorted_by_offset),
+	      rev_entry_cmp);
+
+	if (!rev_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmp_file);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", rev_name);
+	f = sha1fd(fd, rev_name);
+
+	put_be32(header, RIDX_SIGNATURE);
+	put_be32(header + 4, RIDX_VERSION);
+	put_be32(header + 8, 1); /* SHA-1 */
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t nr = htonl(sorted_by_offset[i].nr);
+		sha1write(f, &nr, 4);
+	}
+	sha1write(f, (void *)pack_sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free(sorted_by_offset);
+	return rev_name;
+}
+
+/*
+ * Write the .mtimes file of a cruft pack: "mtimes" gives the time of
+ * each object in .idx order.  Like write_rev_file(), writes to a
+ * temporary file when "mtimes_name" is NULL, and returns the name of
+ * the file written.
+ */
+const char *write_mtimes_file(const char *mtimes_name,
+			      const uint32_t *mtimes,
+			      uint32_t nr_objects,
+			      const unsigned char *pack_sha1)
+{
+	struct sha1file *f;
+	unsigned char header[MTIMES_HEADER_SIZE];
+	uint32_t i;
+	int fd;
+
+	if (!mtimes_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_mtimes_XXXXXX");
+		mtimes_name = xstrdup(tmp_file);
+	} else {
+		unlink(mtimes_name);
+		fd = open(mtimes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", mtimes_name);
+	f = sha1fd(fd, mtimes_name);
+
+	put_be32(header, MTIMES_SIGNATURE);
+	put_be32(header + 4, MTIMES_VERSION);
+	put_be32(header + 8, 1); /* SHA-1 */
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t mtime = htonl(mtimes[i]);
+		sha1write(f, &mtime, 4);
+	}
+	sha1write(f, (void *)pack_sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+	return mtimes_name;
+}
+
+/*
+ * Write the .bloom filter of the objects of a pack.  "name_sha1" is the
+ * name of the pack, i.e. what write_idx_file() leaves in its "sha1".
+ * Like write_rev_file(), writes to a temporary file when "bloom_name"
+ * is NULL, and returns the name of the file written, or NULL when
+ * WRITE_BLOOM was not asked for.
+ */
+const char *write_bloom_file(const char *bloom_name,
+			     struct pack_idx_entry **objects,
+			     uint32_t nr_objects,
+			     const unsigned char *name_sha1,
+			     const struct pack_idx_option *opts)
+{
+	struct sha1file *f;
+	unsigned char header[PBLM_HEADER_SIZE];
+	unsigned char *bits;
+	unsigned log2_bits;
+	size_t bits_size;
+	uint32_t i;
+	int fd;
+
+	if (!(opts->flags & WRITE_BLOOM) || (opts->flags & WRITE_IDX_VERIFY))
+		return NULL;
+
+	log2_bits = pack_bloom_log2_bits(nr_objects);
+	bits_size = (size_t)1 << (log2_bits - 3);
+	bits = xcalloc(1, bits_size);
+	for (i = 0; i < nr_objects; i++)
+		pack_bloom_add(bits, log2_bits, PACK_BLOOM_HASHES,
+			       objects[i]->sha1);
+
+	if (!bloom_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_bloom_XXXXXX");
+		bloom_name = xstrdup(tmp_file);
+	} else {
+		unlink(bloom_name);
+		fd = open(bloom_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", bloom_name);
+	f = sha1fd(fd, bloom_name);
+
+	put_be32(header, PBLM_SIGNATURE);
+	put_be32(header + 4, PBLM_VERSION);
+	put_be32(header + 8, 1); /* SHA-1 */
+	put_be32(header + 12, PACK_BLOOM_HASHES);
+	put_be32(header + 16, log2_bits);
+	sha1write(f, header, sizeof(header));
+	sha1write(f, bits, bits_size);
+	sha1write(f, (void *)name_sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free(bits);
+	return bloom_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -350,17 +520,29 @@ void finish_tmp_packfile(char *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name, *bloom_tmp_name;
 	char *end_of_name_prefix = strrchr(name_buffer, 0);
+	unsigned char pack_sha1[20];
 
 	if (adjust_shared_perm(pack_tmp_name))
 		die_errno("unable to make temporary pack file readable");
 
+	hashcpy(pack_sha1, sha1);
 	idx_tmp_name = write_idx_file(NULL, written_list, nr_written,
 				      pack_idx_opts, sha1);
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+				      pack_sha1, pack_idx_opts);
+	if (rev_tmp_name && adjust_shared_perm(rev_tmp_name))
+		die_errno("unable to make temporary reverse index file readable");
+
+	bloom_tmp_name = write_bloom_file(NULL, written_list, nr_written,
+					  sha1, pack_idx_opts);
+	if (bloom_tmp_name && adjust_shared_perm(bloom_tmp_name))
+		die_errno("unable to make temporary bloom filter file readable");
+
 	sprintf(end_of_name_prefix, "%s.pack", sha1_to_hex(sha1));
 	free_pack_by_name(name_buffer);
 
@@ -371,5 +553,20 @@ void finish_tmp_packfile(char *name_buffer,
 	if (rename(idx_tmp_name, name_buffer))
 		die_errno("unable to rename temporary index file");
 
+	if (rev_tmp_name) {
+		sprintf(end_of_name_prefix, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer))
+			die_errno("unable to rename temporary reverse index file");
+		free((void *)rev_tmp_name);
+	}
+
+	if (bloom_tmp_name) {
+		sprintf(end_of_name_prefix, "%s.bloom", sha1_to_hex(sha1));
+		if (rename(bloom_tmp_name, name_buffer))
+			die_errno("unable to rename temporary bloom filter file");
+		free((void *)bloom_tmp_name);
+	}
+
 	free((void *)idx_tmp_name);
+	*end_of_name_prefix = '\0';
 }
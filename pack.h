@@ -40,6 +40,8 @@ struct pack_idx_option {
 	/* flag bits */
 #define WRITE_IDX_VERIFY 01 /* verify only, do not write the idx file */
 #define WRITE_IDX_STRICT 02
+#define WRITE_REV 04 /* also write a .rev reverse index */
+#define WRITE_BLOOM 010 /* also write a .bloom filter */
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -55,6 +57,30 @@ struct pack_idx_option {
 
 extern void reset_pack_idx_option(struct pack_idx_option *);
 
+/*
+ * Reverse index (.rev) header; see
+ * Documentation/technical/pack-format.txt.
+ */
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HEADER_SIZE 12
+
+/*
+ * Object modification times of a cruft pack (.mtimes) header; see
+ * Documentation/technical/pack-format.txt.
+ */
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+#define MTIMES_HEADER_SIZE 12
+
+/*
+ * Object name Bloom filter (.bloom) header; see
+ * Documentation/technical/pack-format.txt.
+ */
+#define PBLM_SIGNATURE 0x50424c4d /* "PBLM" */
+#define PBLM_VERSION 1
+#define PBLM_HEADER_SIZE 20
+
 /*
  * Packed object index header
  */
@@ -75,16 +101,49 @@ struct pack_idx_entry {
 
 struct progress;
 typedef int (*verify_fn)(const unsigned char*, enum object_type, unsigned long, void*, int*);
+/*
+ * Called by verify_pack() for every object that matches its name,
+ * before the object is handed to the verify_fn.  With threads it runs
+ * on the worker that unpacked the object, so it must not touch the
+ * object table; what it appends to the strbuf is written to stderr
+ * just before the verify_fn sees the object.
+ */
+typedef void (*verify_check_fn)(const unsigned char*, enum object_type, unsigned long, void*, struct strbuf*);
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, unsigned char *sha1);
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *pack_sha1, const struct pack_idx_option *);
+extern const char *write_bloom_file(const char *bloom_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *name_sha1, const struct pack_idx_option *);
+extern const char *write_mtimes_file(const char *mtimes_name, const uint32_t *mtimes, uint32_t nr_objects, const unsigned char *pack_sha1);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
-extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+extern int verify_pack(struct packed_git *, verify_fn fn, verify_check_fn check, int nr_threads, struct progress *, uint32_t);
 extern off_t write_pack_header(struct sha1file *f, uint32_t);
 extern void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
 extern char *index_pack_lockfile(int fd);
 extern int encode_in_pack_object_header(enum object_type, uintmax_t, unsigned char *);
 
+/*
+ * The name hash groups objects by the trailing part of their path so
+ * that the delta search sees likely candidates next to each other.
+ * This effectively just creates a sortable number from the last
+ * sixteen non-whitespace characters.  Last characters count "most",
+ * so things that end in ".c" sort together.
+ */
+static inline uint32_t pack_name_hash(const char *name)
+{
+	uint32_t c, hash = 0;
+
+	if (!name)
+		return 0;
+
+	while ((c = *name++) != 0) {
+		if (isspace(c))
+			continue;
+		hash = (hash >> 2) + (c << 24);
+	}
+	return hash;
+}
+
 #define PH_ERROR_EOF		(-1)
 #define PH_ERROR_PACK_SIGNATURE	(-2)
 #define PH_ERROR_PROTOCOL	(-3)
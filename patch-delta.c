@@ -84,3 +84,190 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 	*dst_size = out - dst_buf;
 	return dst_buf;
 }
+
+/*
+ * A delta as a list of operations.  "out" is where the operation
+ * starts in the result of the delta; a copy takes "size" bytes at
+ * "src" in the source, an insert the "size" bytes at "insert".
+ */
+struct delta_op {
+	unsigned long out;
+	unsigned long size;
+	unsigned long src;
+	const unsigned char *insert;
+};
+
+struct delta_ops {
+	struct delta_op *op;
+	unsigned long nr, alloc;
+	unsigned long src_size, dst_size;
+};
+
+static void add_delta_op(struct delta_ops *ops, unsigned long size,
+			 unsigned long src, const unsigned char *insert)
+{
+	struct delta_op *last = ops->nr ? &ops->op[ops->nr - 1] : NULL;
+
+	/* merge with the previous operation when they are contiguous */
+	if (last && !insert && !last->insert && last->src + last->size == src) {
+		last->size += size;
+		ops->dst_size += size;
+		return;
+	}
+	if (last && insert && last->insert && last->insert + last->size == insert) {
+		last->size += size;
+		ops->dst_size += size;
+		return;
+	}
+	if (ops->nr == ops->alloc) {
+		ops->alloc = ops->alloc ? ops->alloc * 2 : 64;
+		ops->op = xrealloc(ops->op, ops->alloc * sizeof(*ops->op));
+	}
+	ops->op[ops->nr].out = ops->dst_size;
+	ops->op[ops->nr].size = size;
+	ops->op[ops->nr].src = src;
+	ops->op[ops->nr].insert = insert;
+	ops->nr++;
+	ops->dst_size += size;
+}
+
+/*
+ * Parse a delta with the same checks as patch_delta(), but quietly:
+ * callers fall back to patch_delta() to report the problem.
+ */
+static int parse_delta(const void *delta_buf, unsigned long delta_size,
+		       struct delta_ops *ops)
+{
+	const unsigned char *data, *top;
+	unsigned long size;
+	unsigned char cmd;
+
+	ops->nr = 0;
+	ops->dst_size = 0;
+	if (delta_size < DELTA_SIZE_MIN)
+		return -1;
+
+	data = delta_buf;
+	top = (const unsigned char *) delta_buf + delta_size;
+	ops->src_size = get_delta_hdr_size(&data, top);
+	size = get_delta_hdr_size(&data, top);
+
+	while (data < top) {
+		cmd = *data++;
+		if (cmd & 0x80) {
+			unsigned long cp_off = 0, cp_size = 0;
+			if (cmd & 0x01) cp_off = *data++;
+			if (cmd & 0x02) cp_off |= (*data++ << 8);
+			if (cmd & 0x04) cp_off |= (*data++ << 16);
+			if (cmd & 0x08) cp_off |= ((unsigned) *data++ << 24);
+			if (cmd & 0x10) cp_size = *data++;
+			if (cmd & 0x20) cp_size |= (*data++ << 8);
+			if (cmd & 0x40) cp_size |= (*data++ << 16);
+			if (cp_size == 0) cp_size = 0x10000;
+			if (unsigned_add_overflows(cp_off, cp_size) ||
+			    cp_off + cp_size > ops->src_size ||
+			    cp_size > size - ops->dst_size)
+				return -1;
+			add_delta_op(ops, cp_size, cp_off, NULL);
+		} else if (cmd) {
+			if (cmd > size - ops->dst_size || cmd > top - data)
+				return -1;
+			add_delta_op(ops, cmd, 0, data);
+			data += cmd;
+		} else
+			return -1;
+	}
+	if (data != top || ops->dst_size != size)
+		return -1;
+	return 0;
+}
+
+/*
+ * Rewrite the operations of "outer", whose copies refer to the result
+ * of "inner", into operations on the source of "inner".
+ */
+static int compose_delta_ops(const struct delta_ops *outer,
+			     const struct delta_ops *inner,
+			     struct delta_ops *result)
+{
+	unsigned long i;
+
+	if (outer->src_size != inner->dst_size)
+		return -1;
+	result->nr = 0;
+	result->dst_size = 0;
+	result->src_size = inner->src_size;
+	for (i = 0; i < outer->nr; i++) {
+		const struct delta_op *op = &outer->op[i];
+		unsigned long pos = op->src, left = op->size;
+		unsigned long lo = 0, hi = inner->nr;
+
+		if (op->insert) {
+			add_delta_op(result, op->size, 0, op->insert);
+			continue;
+		}
+		/* find the inner operation producing byte "pos" */
+		while (hi - lo > 1) {
+			unsigned long mi = lo + (hi - lo) / 2;
+			if (inner->op[mi].out <= pos)
+				lo = mi;
+			else
+				hi = mi;
+		}
+		for (; left; lo++) {
+			const struct delta_op *in = &inner->op[lo];
+			unsigned long skip = pos - in->out;
+			unsigned long n = in->size - skip;
+
+			if (n > left)
+				n = left;
+			if (in->insert)
+				add_delta_op(result, n, 0, in->insert + skip);
+			else
+				add_delta_op(result, n, in->src + skip, NULL);
+			pos += n;
+			left -= n;
+		}
+	}
+	return 0;
+}
+
+void *patch_delta_chain(const void *src_buf, unsigned long src_size,
+			void **delta_bufs, unsigned long *delta_sizes,
+			int nr, unsigned long *dst_size)
+{
+	struct delta_ops ops = { NULL }, inner = { NULL }, next = { NULL };
+	unsigned char *dst_buf = NULL, *out;
+	unsigned long i;
+
+	if (nr < 1 || parse_delta(delta_bufs[nr - 1], delta_sizes[nr - 1], &ops))
+		goto done;
+	while (--nr) {
+		struct delta_ops tmp;
+
+		if (parse_delta(delta_bufs[nr - 1], delta_sizes[nr - 1], &inner) ||
+		    compose_delta_ops(&ops, &inner, &next))
+			goto done;
+		tmp = ops;
+		ops = next;
+		next = tmp;
+	}
+	if (ops.src_size != src_size)
+		goto done;
+
+	dst_buf = xmallocz(ops.dst_size);
+	out = dst_buf;
+	for (i = 0; i < ops.nr; i++) {
+		const struct delta_op *op = &ops.op[i];
+		memcpy(out, op->insert ? op->insert :
+		       (const unsigned char *)src_buf + op->src, op->size);
+		out += op->size;
+	}
+	*dst_size = ops.dst_size;
+
+done:
+	free(ops.op);
+	free(inner.op);
+	free(next.op);
+	return dst_buf;
+}
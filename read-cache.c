@@ -572,7 +572,8 @@ static void record_intent_to_add(struct cache_entry *ce)
 	hashcpy(ce->sha1, sha1);
 }
 
-int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
+static int add_to_index_1(struct index_state *istate, const char *path,
+			  struct stat *st, const unsigned char *sha1, int flags)
 {
 	int size, namelen, was_same;
 	mode_t st_mode = st->st_mode;
@@ -646,11 +647,12 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 		alias->ce_flags |= CE_ADDED;
 		return 0;
 	}
-	if (!intent_only) {
-		if (index_path(ce->sha1, path, st, HASH_WRITE_OBJECT))
-			return error("unable to index file %s", path);
-	} else
+	if (intent_only)
 		record_intent_to_add(ce);
+	else if (sha1)
+		hashcpy(ce->sha1, sha1);
+	else if (index_path(ce->sha1, path, st, HASH_WRITE_OBJECT))
+		return error("unable to index file %s", path);
 
 	if (ignore_case && alias && different_name(ce, alias))
 		ce = create_alias_ce(ce, alias);
@@ -671,6 +673,18 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 	return 0;
 }
 
+int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
+{
+	return add_to_index_1(istate, path, st, NULL, flags);
+}
+
+/* Like add_to_index(), for a path whose contents are already stored. */
+int add_hashed_to_index(struct index_state *istate, const char *path,
+			struct stat *st, const unsigned char *sha1, int flags)
+{
+	return add_to_index_1(istate, path, st, sha1, flags);
+}
+
 int add_file_to_index(struct index_state *istate, const char *path, int flags)
 {
 	struct stat st;
@@ -0,0 +1,255 @@
+#include "cache.h"
+#include "sha1-batch.h"
+
+static void hash_sha1_one(struct sha1_batch_item *item)
+{
+	git_SHA_CTX c;
+
+	if (item->type) {
+		hash_sha1_file(item->buf, item->len, item->type, item->sha1);
+		return;
+	}
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, item->buf, item->len);
+	git_SHA1_Final(item->sha1, &c);
+}
+
+/*
+ * The lanes are written with the vector extensions of GCC and clang, so
+ * that the compiler maps them to whatever the CPU has (SSE2, AVX2,
+ * NEON...).  They are only worth it against the portable block-sha1
+ * code; the SHA-1 instructions of a CPU beat them easily.
+ */
+#if defined(git_SHA1_Name) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+
+#define SHA1_LANES 8
+
+typedef uint32_t sha1_lanes_t __attribute__((vector_size(SHA1_LANES * 4)));
+
+#define LANES_ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define LANES_ROUND(t, fn, constant) do { \
+	if ((t) >= 16) \
+		w[(t) & 15] = LANES_ROL(w[((t) + 13) & 15] ^ w[((t) + 8) & 15] ^ \
+					w[((t) + 2) & 15] ^ w[(t) & 15], 1); \
+	tmp = LANES_ROL(a, 5) + (fn) + e + (constant) + w[(t) & 15]; \
+	e = d; \
+	d = c; \
+	c = LANES_ROL(b, 30); \
+	b = a; \
+	a = tmp; } while (0)
+
+/* One block of each lane; H[i][lane] is the state, W[t][lane] the input. */
+static inline __attribute__((always_inline))
+void sha1_lanes_block(uint32_t H[5][SHA1_LANES], uint32_t W[16][SHA1_LANES])
+{
+	sha1_lanes_t a, b, c, d, e, tmp, w[16];
+	int t;
+
+	memcpy(&a, H[0], sizeof(a));
+	memcpy(&b, H[1], sizeof(b));
+	memcpy(&c, H[2], sizeof(c));
+	memcpy(&d, H[3], sizeof(d));
+	memcpy(&e, H[4], sizeof(e));
+	for (t = 0; t < 16; t++)
+		memcpy(&w[t], W[t], sizeof(w[t]));
+
+	for (t = 0; t < 20; t++)
+		LANES_ROUND(t, ((c ^ d) & b) ^ d, 0x5a827999);
+	for (; t < 40; t++)
+		LANES_ROUND(t, b ^ c ^ d, 0x6ed9eba1);
+	for (; t < 60; t++)
+		LANES_ROUND(t, (b & c) | (d & (b | c)), 0x8f1bbcdc);
+	for (; t < 80; t++)
+		LANES_ROUND(t, b ^ c ^ d, 0xca62c1d6);
+
+	memcpy(&tmp, H[0], sizeof(tmp)); tmp += a; memcpy(H[0], &tmp, sizeof(tmp));
+	memcpy(&tmp, H[1], sizeof(tmp)); tmp += b; memcpy(H[1], &tmp, sizeof(tmp));
+	memcpy(&tmp, H[2], sizeof(tmp)); tmp += c; memcpy(H[2], &tmp, sizeof(tmp));
+	memcpy(&tmp, H[3], sizeof(tmp)); tmp += d; memcpy(H[3], &tmp, sizeof(tmp));
+	memcpy(&tmp, H[4], sizeof(tmp)); tmp += e; memcpy(H[4], &tmp, sizeof(tmp));
+}
+
+typedef void (*sha1_lanes_fn)(uint32_t H[5][SHA1_LANES],
+			      uint32_t W[16][SHA1_LANES]);
+
+static void sha1_lanes_block_generic(uint32_t H[5][SHA1_LANES],
+				     uint32_t W[16][SHA1_LANES])
+{
+	sha1_lanes_block(H, W);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* the same code, with eight lanes in one register instead of two */
+__attribute__((target("avx2")))
+static void sha1_lanes_block_avx2(uint32_t H[5][SHA1_LANES],
+				  uint32_t W[16][SHA1_LANES])
+{
+	sha1_lanes_block(H, W);
+}
+#endif
+
+static sha1_lanes_fn pick_sha1_lanes_block(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return sha1_lanes_block_avx2;
+#endif
+	return sha1_lanes_block_generic;
+}
+
+/* A message being hashed in a lane: the object header, then the data. */
+struct sha1_lane {
+	struct sha1_batch_item *item;
+	char hdr[32];
+	unsigned long hdrlen;
+	unsigned long block, nr_blocks;
+};
+
+static void start_lane(struct sha1_lane *lane, struct sha1_batch_item *item,
+		       uint32_t H[5][SHA1_LANES], int l)
+{
+	lane->item = item;
+	lane->hdrlen = item->type ?
+		sprintf(lane->hdr, "%s %lu", item->type, item->len) + 1 : 0;
+	/* room for the 0x80 byte and the 64-bit length */
+	lane->nr_blocks = (lane->hdrlen + item->len + 8) / 64 + 1;
+	lane->block = 0;
+
+	H[0][l] = 0x67452301;
+	H[1][l] = 0xefcdab89;
+	H[2][l] = 0x98badcfe;
+	H[3][l] = 0x10325476;
+	H[4][l] = 0xc3d2e1f0;
+}
+
+/* Copy the next padded block of the message of "lane" into W. */
+static void fill_lane(struct sha1_lane *lane, uint32_t W[16][SHA1_LANES], int l)
+{
+	unsigned char buf[64];
+	const unsigned char *block = buf;
+	unsigned long total = lane->hdrlen + lane->item->len;
+	unsigned long pos = lane->block * 64, n = 0;
+	int t;
+
+	/* most blocks of longer objects are read in place */
+	if (pos >= lane->hdrlen && pos + 64 <= total) {
+		block = (const unsigned char *)lane->item->buf +
+			(pos - lane->hdrlen);
+		n = 64;
+	}
+	while (n < 64) {
+		unsigned long at = pos + n, len;
+
+		if (at < lane->hdrlen) {
+			len = lane->hdrlen - at;
+			if (len > 64 - n)
+				len = 64 - n;
+			memcpy(buf + n, lane->hdr + at, len);
+		} else if (at < total) {
+			len = total - at;
+			if (len > 64 - n)
+				len = 64 - n;
+			memcpy(buf + n, (const char *)lane->item->buf +
+			       (at - lane->hdrlen), len);
+		} else {
+			len = 64 - n;
+			memset(buf + n, 0, len);
+			if (at == total)
+				buf[n] = 0x80;
+		}
+		n += len;
+	}
+	if (lane->block == lane->nr_blocks - 1) {
+		uint64_t bits = (uint64_t)total << 3;
+		for (t = 0; t < 8; t++)
+			buf[63 - t] = bits >> (8 * t);
+	}
+
+	for (t = 0; t < 16; t++)
+		W[t][l] = ((uint32_t)block[4 * t] << 24) |
+			  ((uint32_t)block[4 * t + 1] << 16) |
+			  ((uint32_t)block[4 * t + 2] << 8) |
+			  (uint32_t)block[4 * t + 3];
+}
+
+static void finish_lane(struct sha1_lane *lane, uint32_t H[5][SHA1_LANES], int l)
+{
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		lane->item->sha1[4 * i] = H[i][l] >> 24;
+		lane->item->sha1[4 * i + 1] = H[i][l] >> 16;
+		lane->item->sha1[4 * i + 2] = H[i][l] >> 8;
+		lane->item->sha1[4 * i + 3] = H[i][l];
+	}
+	lane->item = NULL;
+}
+
+/*
+ * Feed one block of every busy lane at a time; a lane that is done with
+ * its message takes the next one, so that long and short objects mix.
+ */
+static void hash_sha1_lanes(struct sha1_batch_item *items, int nr)
+{
+	static sha1_lanes_fn block_fn;
+	struct sha1_lane lanes[SHA1_LANES];
+	uint32_t H[5][SHA1_LANES], W[16][SHA1_LANES];
+	int next = 0, busy = 0, l;
+
+	if (!block_fn)
+		block_fn = pick_sha1_lanes_block();
+
+	memset(H, 0, sizeof(H));
+	memset(W, 0, sizeof(W));
+	for (l = 0; l < SHA1_LANES; l++) {
+		lanes[l].item = NULL;
+		if (next < nr) {
+			start_lane(&lanes[l], &items[next++], H, l);
+			busy++;
+		}
+	}
+
+	while (busy) {
+		for (l = 0; l < SHA1_LANES; l++)
+			if (lanes[l].item)
+				fill_lane(&lanes[l], W, l);
+		block_fn(H, W);
+		for (l = 0; l < SHA1_LANES; l++) {
+			if (!lanes[l].item ||
+			    ++lanes[l].block < lanes[l].nr_blocks)
+				continue;
+			finish_lane(&lanes[l], H, l);
+			busy--;
+			if (next < nr) {
+				start_lane(&lanes[l], &items[next++], H, l);
+				busy++;
+			}
+		}
+	}
+}
+
+static int use_sha1_lanes(int nr)
+{
+	/* with too few objects, most lanes would spin for nothing */
+	return nr >= SHA1_LANES / 2 && !strcmp(git_SHA1_Name(), "portable");
+}
+
+#else
+#define use_sha1_lanes(nr)		0
+#define hash_sha1_lanes(items, nr)	(void)0
+#endif
+
+void hash_sha1_batch(struct sha1_batch_item *items, int nr)
+{
+	int i;
+
+	if (use_sha1_lanes(nr)) {
+		hash_sha1_lanes(items, nr);
+		return;
+	}
+	for (i = 0; i < nr; i++)
+		hash_sha1_one(&items[i]);
+}
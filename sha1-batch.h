@@ -0,0 +1,25 @@
+#ifndef SHA1_BATCH_H
+#define SHA1_BATCH_H
+
+/*
+ * Compute the names of many independent objects at once.  Small
+ * objects take only a few blocks to hash, and hashing them one at a
+ * time leaves most of the CPU idle; with the portable SHA-1 code (see
+ * block-sha1/), the batch goes through the compression function
+ * eight objects at a time, side by side in SIMD lanes.  Otherwise the
+ * objects are simply hashed in turn.
+ */
+struct sha1_batch_item {
+	const void *buf;
+	unsigned long len;
+	const char *type;	/* as in hash_sha1_file(); NULL hashes "buf" alone */
+	unsigned char sha1[20];	/* result */
+};
+
+/* Callers collecting objects for a batch stop at either limit. */
+#define SHA1_BATCH_NR		16
+#define SHA1_BATCH_SIZE		(1024 * 1024)
+
+extern void hash_sha1_batch(struct sha1_batch_item *items, int nr);
+
+#endif
@@ -22,6 +22,11 @@
 #include "bulk-checkin.h"
 #include "streaming.h"
 #include "dir.h"
+#include "midx.h"
+#include "pack-bloom.h"
+#include "sha1-array.h"
+#include "thread-utils.h"
+#include "sha1-batch.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -175,9 +180,8 @@ static void fill_sha1_path(char *pathbuf, const unsigned char *sha1)
  * DB_ENVIRONMENT environment variable if it is not found in
  * the primary object database.
  */
-char *sha1_file_name(const unsigned char *sha1)
+static void fill_sha1_file_name(char *buf, const unsigned char *sha1)
 {
-	static char buf[PATH_MAX];
 	const char *objdir;
 	int len;
 
@@ -192,6 +196,13 @@ char *sha1_file_name(const unsigned char *sha1)
 	buf[len+3] = '/';
 	buf[len+42] = '\0';
 	fill_sha1_path(buf + len + 1, sha1);
+}
+
+char *sha1_file_name(const unsigned char *sha1)
+{
+	static char buf[PATH_MAX];
+
+	fill_sha1_file_name(buf, sha1);
 	return buf;
 }
 
@@ -283,6 +294,7 @@ static int link_alt_odb_entry(const char *entry, const char *relative_base, int
 
 	entlen = pfxlen + 43; /* '/' + 2 hex + '/' + 38 hex + NUL */
 	ent = xmalloc(sizeof(*ent) + entlen);
+	ent->loose_objects = NULL;
 	memcpy(ent->base, pathbuf.buf, pfxlen);
 	strbuf_release(&pathbuf);
 
@@ -423,9 +435,110 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+/*
+ * With core.looseObjectCache, asking whether a loose object exists
+ * reads the whole fan-out directory it would be in, once, instead of
+ * calling access() on its path; this is a big win when a process
+ * checks many objects against an object store on a slow (e.g. network)
+ * filesystem.  Objects this process writes are added as it goes, but
+ * ones other processes create or remove meanwhile go unnoticed until
+ * the next reprepare_packed_git().
+ */
+struct loose_object_cache {
+	uint32_t subdir_seen[8]; /* one bit per fan-out directory */
+	struct sha1_array subdir[256];
+};
+
+static struct loose_object_cache *local_loose_objects;
+
+static void read_loose_object_subdir(struct sha1_array *array,
+				     const char *objdir, int objdir_len,
+				     int subdir_nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	unsigned char sha1[20];
+	char hex[41];
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_add(&path, objdir, objdir_len);
+	strbuf_addf(&path, "/%02x", subdir_nr);
+	dir = opendir(path.buf);
+	strbuf_release(&path);
+	if (!dir)
+		return;
+
+	sprintf(hex, "%02x", subdir_nr);
+	while ((de = readdir(dir)) != NULL) {
+		if (strlen(de->d_name) != 38)
+			continue;
+		memcpy(hex + 2, de->d_name, 38);
+		hex[40] = '\0';
+		if (!get_sha1_hex(hex, sha1))
+			sha1_array_append(array, sha1);
+	}
+	closedir(dir);
+}
+
+static int loose_object_cache_has(struct loose_object_cache **cachep,
+				  const char *objdir, int objdir_len,
+				  const unsigned char *sha1)
+{
+	struct loose_object_cache *cache = *cachep;
+	int subdir_nr = sha1[0];
+
+	if (!cache)
+		cache = *cachep = xcalloc(1, sizeof(*cache));
+	if (!(cache->subdir_seen[subdir_nr >> 5] & (1u << (subdir_nr & 31)))) {
+		read_loose_object_subdir(&cache->subdir[subdir_nr],
+					 objdir, objdir_len, subdir_nr);
+		cache->subdir_seen[subdir_nr >> 5] |= 1u << (subdir_nr & 31);
+	}
+	return sha1_array_lookup(&cache->subdir[subdir_nr], sha1) >= 0;
+}
+
+static void loose_object_cache_add(struct loose_object_cache *cache,
+				   const unsigned char *sha1)
+{
+	int subdir_nr = sha1[0];
+
+	if (cache &&
+	    (cache->subdir_seen[subdir_nr >> 5] & (1u << (subdir_nr & 31))))
+		sha1_array_append(&cache->subdir[subdir_nr], sha1);
+}
+
+static void loose_object_cache_clear(struct loose_object_cache **cachep)
+{
+	struct loose_object_cache *cache = *cachep;
+	int i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < ARRAY_SIZE(cache->subdir); i++)
+		sha1_array_clear(&cache->subdir[i]);
+	free(cache);
+	*cachep = NULL;
+}
+
+static void clear_loose_object_caches(void)
+{
+	struct alternate_object_database *alt;
+
+	loose_object_cache_clear(&local_loose_objects);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		loose_object_cache_clear(&alt->loose_objects);
+}
+
 static int has_loose_object_local(const unsigned char *sha1)
 {
-	char *name = sha1_file_name(sha1);
+	char *name;
+
+	if (core_loose_object_cache) {
+		const char *objdir = get_object_directory();
+		return loose_object_cache_has(&local_loose_objects,
+					      objdir, strlen(objdir), sha1);
+	}
+	name = sha1_file_name(sha1);
 	return !access(name, F_OK);
 }
 
@@ -434,6 +547,15 @@ int has_loose_object_nonlocal(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache) {
+			/* alt->name[-1] is the slash after the directory */
+			if (loose_object_cache_has(&alt->loose_objects,
+						   alt->base,
+						   alt->name - 1 - alt->base,
+						   sha1))
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (!access(alt->base, F_OK))
 			return 1;
@@ -699,6 +821,18 @@ void close_pack_index(struct packed_git *p)
 	}
 }
 
+struct multi_pack_index *multi_pack_index;
+
+static void clear_multi_pack_index(void)
+{
+	struct packed_git *p;
+
+	close_midx(multi_pack_index);
+	multi_pack_index = NULL;
+	for (p = packed_git; p; p = p->next)
+		p->multi_pack_index = 0;
+}
+
 /*
  * This is used by git-repack in case a newly created pack happens to
  * contain the same set of objects as an existing one.  In that case
@@ -723,7 +857,12 @@ void free_pack_by_name(const char *pack_name)
 				pack_open_fds--;
 			}
 			close_pack_index(p);
+			if (p->mtimes_map)
+				munmap((void *)p->mtimes_map, p->mtimes_size);
+			close_pack_bloom(p);
 			free(p->bad_object_sha1);
+			if (p->multi_pack_index)
+				clear_multi_pack_index();
 			*pp = p->next;
 			if (last_found_pack == p)
 				last_found_pack = NULL;
@@ -942,11 +1081,12 @@ static void try_to_free_pack_memory(size_t size)
 	release_pack_memory(size, -1);
 }
 
+static int have_set_try_to_free_routine;
+
 struct packed_git *add_packed_git(const char *path, int path_len, int local)
 {
-	static int have_set_try_to_free_routine;
 	struct stat st;
-	struct packed_git *p = alloc_packed_git(path_len + 2);
+	struct packed_git *p = alloc_packed_git(path_len + 4);
 
 	if (!have_set_try_to_free_routine) {
 		have_set_try_to_free_routine = 1;
@@ -968,6 +1108,10 @@ struct packed_git *add_packed_git(const char *path, int path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_keep = 1;
 
+	strcpy(p->pack_name + path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	strcpy(p->pack_name + path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -1126,8 +1270,14 @@ static void prepare_packed_git_one(char *objdir, int local)
 
 		if (has_extension(de->d_name, ".idx") ||
 		    has_extension(de->d_name, ".pack") ||
+		    has_extension(de->d_name, ".bitmap") ||
+		    has_extension(de->d_name, ".rev") ||
+		    has_extension(de->d_name, ".mtimes") ||
+		    has_extension(de->d_name, ".bloom") ||
 		    has_extension(de->d_name, ".keep"))
 			string_list_append(&garbage, path);
+		else if (!strcmp(de->d_name, "multi-pack-index"))
+			; /* not a pack file, but ours */
 		else
 			report_garbage("garbage found", path);
 	}
@@ -1190,6 +1340,48 @@ static void rearrange_packed_git(void)
 	free(ary);
 }
 
+/*
+ * (Re)load the multi-pack-index of the local object directory and
+ * match the packs it names to the ones in packed_git.  If one of them
+ * is gone, or was rewritten under the same name, it was written
+ * before a repack and is of no use.
+ */
+static void prepare_multi_pack_index(void)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	uint32_t i;
+
+	clear_multi_pack_index();
+	if (!core_multi_pack_index)
+		return;
+	m = load_multi_pack_index(get_object_directory());
+	if (!m)
+		return;
+
+	for (p = packed_git; p; p = p->next) {
+		int pack_int_id;
+
+		if (!p->pack_local)
+			continue;
+		pack_int_id = midx_pack_int_id(m, p->pack_name);
+		if (pack_int_id >= 0)
+			m->packs[pack_int_id] = p;
+	}
+	for (i = 0; i < m->num_packs; i++) {
+		p = m->packs[i];
+		if (!p || open_pack_index(p) ||
+		    hashcmp(nth_midxed_pack_checksum(m, i),
+			    (unsigned char *)p->index_data + p->index_size - 40)) {
+			close_midx(m);
+			return;
+		}
+	}
+	for (i = 0; i < m->num_packs; i++)
+		m->packs[i]->multi_pack_index = 1;
+	multi_pack_index = m;
+}
+
 static int prepare_packed_git_run_once = 0;
 void prepare_packed_git(void)
 {
@@ -1205,11 +1397,13 @@ void prepare_packed_git(void)
 		alt->name[-1] = '/';
 	}
 	rearrange_packed_git();
+	prepare_multi_pack_index();
 	prepare_packed_git_run_once = 1;
 }
 
 void reprepare_packed_git(void)
 {
+	clear_loose_object_caches();
 	discard_revindex();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
@@ -1612,11 +1806,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1679,13 +1873,14 @@ int unpack_object_header(struct packed_git *p,
 
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
-	int type;
-	struct revindex_entry *revidx;
+	int type, pos;
+	struct pack_revindex *revidx;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	revidx = revindex_for_pack(p);
+	pos = find_revindex_position(revidx, obj_offset);
+	if (pos < 0)
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, pack_pos_to_index(revidx, pos));
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -1788,6 +1983,75 @@ unwind:
 	goto out;
 }
 
+#ifndef NO_PTHREADS
+static pthread_mutex_t obj_read_mutex;
+static int obj_read_use_lock;
+static try_to_free_t old_try_to_free_routine;
+
+/*
+ * A failed allocation in a thread that does not hold the lock (while
+ * inflating, say) must not unmap windows behind the back of another.
+ */
+static void try_to_free_pack_memory_locked(size_t size)
+{
+	obj_read_lock();
+	release_pack_memory(size, -1);
+	obj_read_unlock();
+}
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock++)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+	old_try_to_free_routine =
+		set_try_to_free_routine(try_to_free_pack_memory_locked);
+	if (!have_set_try_to_free_routine) {
+		/* what add_packed_git() would have installed */
+		have_set_try_to_free_routine = 1;
+		old_try_to_free_routine = try_to_free_pack_memory;
+	}
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		die("BUG: unbalanced disable_obj_read_lock()");
+	if (--obj_read_use_lock)
+		return;
+	set_try_to_free_routine(old_try_to_free_routine);
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#else
+void enable_obj_read_lock(void)
+{
+}
+
+void disable_obj_read_lock(void)
+{
+}
+
+void obj_read_lock(void)
+{
+}
+
+void obj_read_unlock(void)
+{
+}
+#endif
+
 static void *unpack_compressed_entry(struct packed_git *p,
 				    struct pack_window **w_curs,
 				    off_t curpos,
@@ -1806,7 +2070,10 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/* the window stays mapped as long as we hold it */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1820,23 +2087,63 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
+/*
+ * Recently unpacked delta bases, so that walking several deltas
+ * against the same base (or down the same chain) does not inflate
+ * it over and over.  Entries are hashed by (pack, offset) and kept
+ * on an LRU list; the least recently used ones go first when there
+ * are more than core.deltaBaseCacheSlots of them, or they take more
+ * than core.deltaBaseCacheLimit bytes (blobs being dropped before
+ * anything else in that case, as they are the least likely to be
+ * bases again).
+ */
 static size_t delta_base_cached;
+static unsigned int delta_base_cache_nr;
+static unsigned int delta_base_cache_hits;
+static unsigned int delta_base_cache_misses;
+static unsigned int delta_base_cache_evictions;
 
 static struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *prev;
 	struct delta_base_cache_lru_list *next;
 } delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
 
-static struct delta_base_cache_entry {
+struct delta_base_cache_entry {
 	struct delta_base_cache_lru_list lru;
+	struct delta_base_cache_entry *next; /* in the same hash bucket */
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct delta_base_cache_entry **delta_base_cache;
+static unsigned int delta_base_cache_buckets;
+
+static void report_delta_base_cache(void)
+{
+	trace_printf("delta base cache: %u hits, %u misses, %u evictions; "
+		     "%u/%u entries, %lu/%lu bytes\n",
+		     delta_base_cache_hits, delta_base_cache_misses,
+		     delta_base_cache_evictions,
+		     delta_base_cache_nr, delta_base_cache_slots,
+		     (unsigned long)delta_base_cached,
+		     (unsigned long)delta_base_cache_limit);
+}
+
+static void init_delta_base_cache(void)
+{
+	if (!delta_base_cache_slots)
+		delta_base_cache_slots = 1;
+	delta_base_cache_buckets = 16;
+	while (delta_base_cache_buckets < delta_base_cache_slots)
+		delta_base_cache_buckets <<= 1;
+	delta_base_cache = xcalloc(delta_base_cache_buckets,
+				   sizeof(*delta_base_cache));
+	if (trace_want("GIT_TRACE"))
+		atexit(report_delta_base_cache);
+}
 
 static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
@@ -1844,37 +2151,56 @@ static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash & (delta_base_cache_buckets - 1);
 }
 
 static struct delta_base_cache_entry *
 get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	return delta_base_cache + hash;
-}
+	struct delta_base_cache_entry *ent;
 
-static int eq_delta_base_cache_entry(struct delta_base_cache_entry *ent,
-				     struct packed_git *p, off_t base_offset)
-{
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	if (!delta_base_cache)
+		return NULL;
+	ent = delta_base_cache[pack_entry_hash(p, base_offset)];
+	while (ent && (ent->p != p || ent->base_offset != base_offset))
+		ent = ent->next;
+	return ent;
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	struct delta_base_cache_entry *ent;
-	ent = get_delta_base_cache_entry(p, base_offset);
-	return eq_delta_base_cache_entry(ent, p, base_offset);
+	return !!get_delta_base_cache_entry(p, base_offset);
 }
 
-static void clear_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+/*
+ * Remove the entry from the cache and free it, but not its data,
+ * which now belongs to the caller.
+ */
+static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 {
-	ent->data = NULL;
+	struct delta_base_cache_entry **pp;
+
+	pp = &delta_base_cache[pack_entry_hash(ent->p, ent->base_offset)];
+	while (*pp != ent)
+		pp = &(*pp)->next;
+	*pp = ent->next;
 	ent->lru.next->prev = ent->lru.prev;
 	ent->lru.prev->next = ent->lru.next;
 	delta_base_cached -= ent->size;
+	delta_base_cache_nr--;
+	free(ent);
 }
 
+static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+{
+	free(ent->data);
+	detach_delta_base_cache_entry(ent);
+}
+
+static void *unpack_entry_1(struct packed_git *p, off_t obj_offset,
+			    enum object_type *final_type,
+			    unsigned long *final_size);
+
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
@@ -1883,69 +2209,75 @@ static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 
 	ent = get_delta_base_cache_entry(p, base_offset);
 
-	if (!eq_delta_base_cache_entry(ent, p, base_offset))
-		return unpack_entry(p, base_offset, type, base_size);
+	if (!ent)
+		return unpack_entry_1(p, base_offset, type, base_size);
 
-	ret = ent->data;
-
-	if (!keep_cache)
-		clear_delta_base_cache_entry(ent);
-	else
-		ret = xmemdupz(ent->data, ent->size);
+	delta_base_cache_hits++;
 	*type = ent->type;
 	*base_size = ent->size;
+	if (!keep_cache) {
+		ret = ent->data;
+		detach_delta_base_cache_entry(ent);
+	} else
+		ret = xmemdupz(ent->data, ent->size);
 	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
-{
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
-}
-
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	while (delta_base_cache_lru.next != &delta_base_cache_lru)
+		release_delta_base_cache((void *)delta_base_cache_lru.next);
 }
 
-static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+static void evict_delta_base_cache(int blobs_only)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
-
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
+	struct delta_base_cache_lru_list *lru, *next;
 
 	for (lru = delta_base_cache_lru.next;
 	     delta_base_cached > delta_base_cache_limit
 	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
+	     lru = next) {
 		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
+		next = lru->next;
+		if (!blobs_only || f->type == OBJ_BLOB) {
 			release_delta_base_cache(f);
+			delta_base_cache_evictions++;
+		}
 	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
+}
+
+static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
+	void *base, unsigned long base_size, enum object_type type)
+{
+	struct delta_base_cache_entry *ent;
+	unsigned long hash;
+
+	if (!delta_base_cache)
+		init_delta_base_cache();
+
+	/* another thread may have unpacked the same base meanwhile */
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (ent)
+		release_delta_base_cache(ent);
+
+	delta_base_cached += base_size;
+	evict_delta_base_cache(1);
+	evict_delta_base_cache(0);
+	while (delta_base_cache_nr >= delta_base_cache_slots) {
+		release_delta_base_cache((void *)delta_base_cache_lru.next);
+		delta_base_cache_evictions++;
 	}
 
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	hash = pack_entry_hash(p, base_offset);
+	ent->next = delta_base_cache[hash];
+	delta_base_cache[hash] = ent;
+	delta_base_cache_nr++;
 	ent->lru.next = &delta_base_cache_lru;
 	ent->lru.prev = delta_base_cache_lru.prev;
 	delta_base_cache_lru.prev->next = &ent->lru;
@@ -1989,8 +2321,62 @@ struct unpack_entry_stack_ent {
 	unsigned long size;
 };
 
-void *unpack_entry(struct packed_git *p, off_t obj_offset,
-		   enum object_type *final_type, unsigned long *final_size)
+/*
+ * Build the parent of the requested object from its base in one go:
+ * the deltas from delta_stack[*delta_stack_nr - 1] down to delta_stack[1]
+ * are merged by patch_delta_chain() rather than applied one after the
+ * other, so none of the objects in between is allocated.  The base
+ * goes to the delta base cache as usual, and *delta_stack_nr drops to 1.
+ * If any delta cannot be read or applied, "base" is returned untouched
+ * and the caller goes through the deltas one at a time, which knows how
+ * to report and recover from that.
+ */
+static void *unpack_delta_chain(struct packed_git *p,
+				struct pack_window **w_curs,
+				void *base, unsigned long *size,
+				enum object_type type, off_t *obj_offset,
+				struct unpack_entry_stack_ent *delta_stack,
+				int *delta_stack_nr)
+{
+	int nr = *delta_stack_nr - 1, i;
+	void **delta_bufs = xcalloc(nr, sizeof(*delta_bufs));
+	unsigned long *delta_sizes = xcalloc(nr, sizeof(*delta_sizes));
+	unsigned long data_size;
+	void *data = NULL;
+
+	for (i = 0; i < nr; i++) {
+		struct unpack_entry_stack_ent *ent =
+			&delta_stack[*delta_stack_nr - 1 - i];
+		delta_sizes[i] = ent->size;
+		delta_bufs[i] = unpack_compressed_entry(p, w_curs, ent->curpos,
+							ent->size);
+		if (!delta_bufs[i])
+			goto out;
+	}
+
+	/* all the buffers are ours alone */
+	obj_read_unlock();
+	data = patch_delta_chain(base, *size, delta_bufs, delta_sizes, nr,
+				 &data_size);
+	obj_read_lock();
+	if (data) {
+		add_delta_base_cache(p, *obj_offset, base, *size, type);
+		*obj_offset = delta_stack[1].obj_offset;
+		*size = data_size;
+		*delta_stack_nr = 1;
+	}
+
+out:
+	for (i = 0; i < nr; i++)
+		free(delta_bufs[i]);
+	free(delta_bufs);
+	free(delta_sizes);
+	return data ? data : base;
+}
+
+static void *unpack_entry_1(struct packed_git *p, off_t obj_offset,
+			    enum object_type *final_type,
+			    unsigned long *final_size)
 {
 	struct pack_window *w_curs = NULL;
 	off_t curpos = obj_offset;
@@ -2012,11 +2398,20 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		struct delta_base_cache_entry *ent;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			unsigned long len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			struct pack_revindex *revidx = revindex_for_pack(p);
+			int pos = find_revindex_position(revidx, obj_offset);
+			unsigned long len;
+			uint32_t nr;
+
+			if (pos < 0) {
+				unuse_pack(&w_curs);
+				return NULL;
+			}
+			len = pack_pos_to_offset(revidx, pos + 1) - obj_offset;
+			nr = pack_pos_to_index(revidx, pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, nr);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -2026,14 +2421,16 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		}
 
 		ent = get_delta_base_cache_entry(p, curpos);
-		if (eq_delta_base_cache_entry(ent, p, curpos)) {
+		if (ent) {
+			delta_base_cache_hits++;
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
-			clear_delta_base_cache_entry(ent);
+			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
 			break;
 		}
+		delta_base_cache_misses++;
 
 		type = unpack_object_header(p, &w_curs, &curpos, &size);
 		if (type != OBJ_OFS_DELTA && type != OBJ_REF_DELTA)
@@ -2087,6 +2484,17 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		      type, (uintmax_t)obj_offset, p->pack_name);
 	}
 
+	/*
+	 * PHASE 3a: with more than two deltas to go, build the parent of
+	 * the requested object without the objects in between.  Walking
+	 * down a chain object by object still finds that parent in the
+	 * cache next time.
+	 */
+	if (data && delta_stack_nr > 2)
+		data = unpack_delta_chain(p, &w_curs, data, &size, type,
+					  &obj_offset, delta_stack,
+					  &delta_stack_nr);
+
 	/* PHASE 3: apply deltas in order */
 
 	/* invariants:
@@ -2095,14 +2503,13 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	while (delta_stack_nr) {
 		void *delta_data;
 		void *base = data;
+		off_t base_offset = obj_offset;
 		unsigned long delta_size, base_size = size;
+		int base_cacheable = !!base;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -2110,11 +2517,14 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			struct pack_revindex *revidx;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			int pos;
+			revidx = revindex_for_pack(p);
+			pos = find_revindex_position(revidx, obj_offset);
+			if (pos >= 0) {
+				base_sha1 = nth_packed_object_sha1(p,
+						pack_pos_to_index(revidx, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
@@ -2139,25 +2549,37 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
-			continue;
-		}
+		} else {
+			/*
+			 * "base" is still ours alone (it only goes to the
+			 * cache below), so no lock is needed to apply the
+			 * delta to it.
+			 */
+			obj_read_unlock();
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+			obj_read_lock();
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+			/*
+			 * We could not apply the delta; warn the user, but
+			 * keep going.  Our failure will be noticed either in
+			 * the next iteration of the loop, or if this is the
+			 * final delta, in the caller when we return NULL.
+			 * Those code paths will take care of making a more
+			 * explicit warning and retrying with another copy of
+			 * the object.
+			 */
+			if (!data)
+				error("failed to apply delta");
 
-		/*
-		 * We could not apply the delta; warn the user, but keep going.
-		 * Our failure will be noticed either in the next iteration of
-		 * the loop, or if this is the final delta, in the caller when
-		 * we return NULL. Those code paths will take care of making
-		 * a more explicit warning and retrying with another copy of
-		 * the object.
-		 */
-		if (!data)
-			error("failed to apply delta");
+			free(delta_data);
+		}
 
-		free(delta_data);
+		if (base_cacheable)
+			add_delta_base_cache(p, base_offset, base, base_size, type);
+		else
+			free(base);
 	}
 
 	*final_type = type;
@@ -2167,6 +2589,17 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	return data;
 }
 
+void *unpack_entry(struct packed_git *p, off_t obj_offset,
+		   enum object_type *final_type, unsigned long *final_size)
+{
+	void *data;
+
+	obj_read_lock();
+	data = unpack_entry_1(p, obj_offset, final_type, final_size);
+	obj_read_unlock();
+	return data;
+}
+
 const unsigned char *nth_packed_object_sha1(struct packed_git *p,
 					    uint32_t n)
 {
@@ -2302,6 +2735,9 @@ static int fill_pack_entry(const unsigned char *sha1,
 				return 0;
 	}
 
+	if (pack_bloom_excludes(p, sha1))
+		return 0;
+
 	offset = find_pack_entry_one(sha1, p);
 	if (!offset)
 		return 0;
@@ -2323,9 +2759,41 @@ static int fill_pack_entry(const unsigned char *sha1,
 	return 1;
 }
 
+/*
+ * Returns 1 if the multi-pack-index gave us a usable entry, 0 if the
+ * object is not in it (so it is in none of the packs it covers), and
+ * -1 if it is there but the pack cannot be used for it.
+ */
+static int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct multi_pack_index *m = multi_pack_index;
+	struct packed_git *p;
+	uint32_t pos;
+
+	if (!bsearch_midx(m, sha1, &pos))
+		return 0;
+	p = m->packs[nth_midxed_pack_int_id(m, pos)];
+
+	if (p->num_bad_objects) {
+		unsigned i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+				return -1;
+	}
+	if (!is_pack_valid(p)) {
+		warning("packfile %s cannot be accessed", p->pack_name);
+		return -1;
+	}
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct packed_git *p;
+	int skip_midx_packs = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
@@ -2334,7 +2802,18 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
+	if (multi_pack_index) {
+		int ret = fill_midx_entry(sha1, e);
+		if (ret > 0) {
+			last_found_pack = e->p;
+			return 1;
+		}
+		skip_midx_packs = !ret;
+	}
+
 	for (p = packed_git; p; p = p->next) {
+		if (skip_midx_packs && p->multi_pack_index)
+			continue;
 		if (p == last_found_pack || !fill_pack_entry(sha1, e, p))
 			continue;
 
@@ -2380,8 +2859,7 @@ static int sha1_loose_object_info(const unsigned char *sha1, unsigned long *size
 	return status;
 }
 
-/* returns enum object_type or negative */
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
+static int sha1_object_info_1(const unsigned char *sha1, struct object_info *oi)
 {
 	struct cached_object *co;
 	struct pack_entry e;
@@ -2412,7 +2890,7 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
 	status = packed_object_info(e.p, e.offset, oi->sizep, &rtype);
 	if (status < 0) {
 		mark_bad_packed_object(e.p, sha1);
-		status = sha1_object_info_extended(sha1, oi);
+		status = sha1_object_info_1(sha1, oi);
 	} else if (in_delta_base_cache(e.p, e.offset)) {
 		oi->whence = OI_DBCACHED;
 	} else {
@@ -2426,6 +2904,17 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
 	return status;
 }
 
+/* returns enum object_type or negative */
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
+{
+	int status;
+
+	obj_read_lock();
+	status = sha1_object_info_1(sha1, oi);
+	obj_read_unlock();
+	return status;
+}
+
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
 	struct object_info oi;
@@ -2500,8 +2989,11 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	map = map_sha1_file(sha1, &mapsize);
 	if (map) {
+		/* the mapping is ours; inflate it without the lock */
+		obj_read_unlock();
 		buf = unpack_sha1_file(map, mapsize, type, size, sha1);
 		munmap(map, mapsize);
+		obj_read_lock();
 		return buf;
 	}
 	reprepare_packed_git();
@@ -2521,13 +3013,17 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	void *data;
 	char *path;
 	const struct packed_git *p;
-	const unsigned char *repl = (flag & READ_SHA1_FILE_REPLACE)
-		? lookup_replace_object(sha1) : sha1;
+	const unsigned char *repl;
+
+	obj_read_lock();
+	repl = (flag & READ_SHA1_FILE_REPLACE) ? lookup_replace_object(sha1) : sha1;
 
 	errno = 0;
 	data = read_object(repl, type, size);
-	if (data)
+	if (data) {
+		obj_read_unlock();
 		return data;
+	}
 
 	if (errno && errno != ENOENT)
 		die_errno("failed to read object %s", sha1_to_hex(sha1));
@@ -2547,6 +3043,7 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 		die("packed object %s (stored in %s) is corrupt",
 		    sha1_to_hex(repl), p->pack_name);
 
+	obj_read_unlock();
 	return NULL;
 }
 
@@ -2716,7 +3213,8 @@ static int create_tmpfile(char *buffer, size_t bufsiz, const char *filename)
 		/* Make sure the directory exists */
 		memcpy(buffer, filename, dirlen);
 		buffer[dirlen-1] = 0;
-		if (mkdir(buffer, 0777) || adjust_shared_perm(buffer))
+		if ((mkdir(buffer, 0777) && errno != EEXIST) ||
+		    adjust_shared_perm(buffer))
 			return -1;
 
 		/* Try again */
@@ -2734,10 +3232,11 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 	git_zstream stream;
 	git_SHA_CTX c;
 	unsigned char parano_sha1[20];
-	char *filename;
-	static char tmp_file[PATH_MAX];
+	/* not static: several threads may write objects at once */
+	char filename[PATH_MAX];
+	char tmp_file[PATH_MAX];
 
-	filename = sha1_file_name(sha1);
+	fill_sha1_file_name(filename, sha1);
 	fd = create_tmpfile(tmp_file, sizeof(tmp_file), filename);
 	if (fd < 0) {
 		if (errno == EACCES)
@@ -2793,7 +3292,12 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return move_temp_to_file(tmp_file, filename);
+	if (move_temp_to_file(tmp_file, filename))
+		return -1;
+	obj_read_lock();
+	loose_object_cache_add(local_loose_objects, sha1);
+	obj_read_unlock();
+	return 0;
 }
 
 int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *returnsha1)
@@ -2851,10 +3355,12 @@ int has_sha1_pack(const unsigned char *sha1)
 int has_sha1_file(const unsigned char *sha1)
 {
 	struct pack_entry e;
+	int found;
 
-	if (find_pack_entry(sha1, &e))
-		return 1;
-	return has_loose_object(sha1);
+	obj_read_lock();
+	found = find_pack_entry(sha1, &e) || has_loose_object(sha1);
+	obj_read_unlock();
+	return found;
 }
 
 static void check_tree(const void *buf, size_t size)
@@ -2885,37 +3391,46 @@ static void check_tag(const void *buf, size_t size)
 		die("corrupt tag");
 }
 
-static int index_mem(unsigned char *sha1, void *buf, size_t size,
-		     enum object_type type,
-		     const char *path, unsigned flags)
+/*
+ * Convert a blob to git internal format and check the format of other
+ * objects.  Returns 1 if "*buf" was replaced with a new allocation.
+ */
+static int index_mem_prepare(void **buf, size_t *size, enum object_type type,
+			     const char *path, unsigned flags)
 {
-	int ret, re_allocated = 0;
 	int write_object = flags & HASH_WRITE_OBJECT;
+	int re_allocated = 0;
 
-	if (!type)
-		type = OBJ_BLOB;
-
-	/*
-	 * Convert blobs to git internal format
-	 */
 	if ((type == OBJ_BLOB) && path) {
 		struct strbuf nbuf = STRBUF_INIT;
-		if (convert_to_git(path, buf, size, &nbuf,
+		if (convert_to_git(path, *buf, *size, &nbuf,
 				   write_object ? safe_crlf : SAFE_CRLF_FALSE)) {
-			buf = strbuf_detach(&nbuf, &size);
+			*buf = strbuf_detach(&nbuf, size);
 			re_allocated = 1;
 		}
 	}
 	if (flags & HASH_FORMAT_CHECK) {
 		if (type == OBJ_TREE)
-			check_tree(buf, size);
+			check_tree(*buf, *size);
 		if (type == OBJ_COMMIT)
-			check_commit(buf, size);
+			check_commit(*buf, *size);
 		if (type == OBJ_TAG)
-			check_tag(buf, size);
+			check_tag(*buf, *size);
 	}
+	return re_allocated;
+}
+
+static int index_mem(unsigned char *sha1, void *buf, size_t size,
+		     enum object_type type,
+		     const char *path, unsigned flags)
+{
+	int ret, re_allocated;
 
-	if (write_object)
+	if (!type)
+		type = OBJ_BLOB;
+
+	re_allocated = index_mem_prepare(&buf, &size, type, path, flags);
+	if (flags & HASH_WRITE_OBJECT)
 		ret = write_sha1_file(buf, size, typename(type), sha1);
 	else
 		ret = hash_sha1_file(buf, size, typename(type), sha1);
@@ -3002,6 +3517,56 @@ int index_fd(unsigned char *sha1, int fd, struct stat *st,
 	return ret;
 }
 
+/*
+ * Like index_fd() on each item in turn, but small regular files that
+ * are only hashed have their names computed together.
+ */
+void index_fds(struct index_fd_item *items, int nr, enum object_type type,
+	       unsigned flags)
+{
+	struct sha1_batch_item batch[SHA1_BATCH_NR];
+	struct index_fd_item *batched[SHA1_BATCH_NR];
+	int i, batch_nr = 0;
+
+	if (!type)
+		type = OBJ_BLOB;
+
+	for (i = 0; i < nr; i++) {
+		struct index_fd_item *item = &items[i];
+		size_t size = xsize_t(item->st.st_size);
+		void *buf, *orig;
+
+		if ((flags & HASH_WRITE_OBJECT) || batch_nr == SHA1_BATCH_NR ||
+		    !S_ISREG(item->st.st_mode) || size > SMALL_FILE_SIZE) {
+			item->ret = index_fd(item->sha1, item->fd, &item->st,
+					     type, item->path, flags);
+			continue;
+		}
+		buf = orig = xmalloc(size);
+		if (size != read_in_full(item->fd, buf, size)) {
+			item->ret = error("short read %s", strerror(errno));
+			free(buf);
+			close(item->fd);
+			continue;
+		}
+		close(item->fd);
+		if (index_mem_prepare(&buf, &size, type, item->path, flags))
+			free(orig);
+		batch[batch_nr].buf = buf;
+		batch[batch_nr].len = size;
+		batch[batch_nr].type = typename(type);
+		batched[batch_nr] = item;
+		batch_nr++;
+	}
+
+	hash_sha1_batch(batch, batch_nr);
+	for (i = 0; i < batch_nr; i++) {
+		hashcpy(batched[i]->sha1, batch[i].sha1);
+		batched[i]->ret = 0;
+		free((void *)batch[i].buf);
+	}
+}
+
 int index_path(unsigned char *sha1, const char *path, struct stat *st, unsigned flags)
 {
 	int fd;
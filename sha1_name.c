@@ -6,6 +6,7 @@
 #include "tree-walk.h"
 #include "refs.h"
 #include "remote.h"
+#include "midx.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -89,6 +90,7 @@ static void find_short_object_filename(int len, const char *hex_pfx, struct disa
 		int objdir_len = strlen(objdir);
 		int entlen = objdir_len + 43;
 		fakeent = xmalloc(sizeof(*fakeent) + entlen);
+		fakeent->loose_objects = NULL;
 		memcpy(fakeent->base, objdir, objdir_len);
 		fakeent->name = fakeent->base + objdir_len + 1;
 		fakeent->name[-1] = '/';
@@ -176,14 +178,35 @@ static void unique_in_pack(int len,
 	}
 }
 
+static void unique_in_midx(int len,
+			   const unsigned char *bin_pfx,
+			   struct multi_pack_index *m,
+			   struct disambiguate_state *ds)
+{
+	uint32_t i, first;
+
+	bsearch_midx(m, bin_pfx, &first);
+	for (i = first; i < m->num_objects && !ds->ambiguous; i++) {
+		const unsigned char *current = nth_midxed_object_sha1(m, i);
+		if (!match_sha(len, bin_pfx, current))
+			break;
+		update_candidates(ds, current);
+	}
+}
+
 static void find_short_packed_object(int len, const unsigned char *bin_pfx,
 				     struct disambiguate_state *ds)
 {
 	struct packed_git *p;
 
 	prepare_packed_git();
-	for (p = packed_git; p && !ds->ambiguous; p = p->next)
+	if (multi_pack_index)
+		unique_in_midx(len, bin_pfx, multi_pack_index, ds);
+	for (p = packed_git; p && !ds->ambiguous; p = p->next) {
+		if (p->multi_pack_index)
+			continue;
 		unique_in_pack(len, bin_pfx, p, ds);
+	}
 }
 
 #define SHORT_NAME_NOT_FOUND (-1)
@@ -8,7 +8,8 @@ enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +42,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +51,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -88,6 +91,24 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct {
+			struct packed_git *pack;
+			off_t delta_start; /* of the deflated delta data */
+			off_t pos;
+			off_t base_offset;
+			struct git_istream *base;
+			unsigned long base_size;
+			unsigned long base_pos; /* bytes read from "base" */
+			unsigned char *window; /* the last bytes of them */
+			unsigned long window_size, window_used;
+			int spool_fd; /* or all of them, when not -1 */
+			char *spool_name;
+			unsigned char *delta; /* inflated delta data */
+			unsigned long delta_ptr, delta_end;
+			unsigned long cp_off, cp_left, insert_left;
+			unsigned long out_pos;
+		} in_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -121,8 +142,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -450,6 +471,456 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ * The delta is inflated a little at a time and applied as it goes.
+ * The base is read through a stream of its own (itself a delta stream
+ * when the base is a delta), and never read twice.
+ *
+ * Before anything is output, the delta is inflated once on its own to
+ * see how far back behind the furthest byte already copied its copies
+ * reach.  The last bytes read from the base are kept in a window just
+ * large enough for that, so that copies are served from memory while
+ * the base is read ahead.  The windows of all the deltas in the chain
+ * share core.deltaStreamWindow; a delta whose copies jump around more
+ * than what is left of it copies its base to a temporary file as it
+ * is read, and reads the copies from there.
+ *
+ *****************************************************************/
+
+#define DELTA_STREAM_BUFFER (16 * 1024)
+#define DELTA_BASE_CHUNK (64 * 1024)
+
+static int open_pack_delta(struct git_istream *st, struct packed_git *pack,
+			   off_t obj_offset, enum object_type *type,
+			   unsigned long *budget);
+
+static struct git_istream *open_pack_base(struct packed_git *pack,
+					  off_t offset,
+					  enum object_type *type,
+					  unsigned long *budget)
+{
+	struct git_istream *st = xmalloc(sizeof(*st));
+	struct object_info oi;
+
+	oi.u.packed.pack = pack;
+	oi.u.packed.offset = offset;
+	if (open_istream_pack_non_delta(st, &oi, NULL, type) &&
+	    open_pack_delta(st, pack, offset, type, budget)) {
+		free(st);
+		return NULL;
+	}
+	return st;
+}
+
+/* Inflate more of the delta; returns 0 at its end, -1 on error. */
+static int fill_delta(struct git_istream *st)
+{
+	struct pack_window *window = NULL;
+
+	st->u.in_delta.delta_ptr = st->u.in_delta.delta_end = 0;
+	while (st->z_state == z_used) {
+		unsigned char *mapped;
+		unsigned long avail;
+		int status;
+
+		mapped = use_pack(st->u.in_delta.pack, &window,
+				  st->u.in_delta.pos, &avail);
+		st->z.next_in = mapped;
+		st->z.avail_in = avail;
+		st->z.next_out = st->u.in_delta.delta;
+		st->z.avail_out = DELTA_STREAM_BUFFER;
+		status = git_inflate(&st->z, Z_FINISH);
+		st->u.in_delta.pos += st->z.next_in - mapped;
+		st->u.in_delta.delta_end = st->z.next_out - st->u.in_delta.delta;
+
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+		} else if ((status != Z_OK && status != Z_BUF_ERROR) ||
+			   (!st->u.in_delta.delta_end && st->z.next_in == mapped)) {
+			unuse_pack(&window);
+			return -1;
+		}
+		if (st->u.in_delta.delta_end)
+			break;
+	}
+	unuse_pack(&window);
+	return st->u.in_delta.delta_end ? 1 : 0;
+}
+
+static int next_delta_byte(struct git_istream *st)
+{
+	if (st->u.in_delta.delta_ptr == st->u.in_delta.delta_end &&
+	    fill_delta(st) <= 0)
+		return -1;
+	return st->u.in_delta.delta[st->u.in_delta.delta_ptr++];
+}
+
+static int read_delta_size(struct git_istream *st, unsigned long *size)
+{
+	int c, shift = 0;
+
+	*size = 0;
+	do {
+		c = next_delta_byte(st);
+		if (c < 0)
+			return -1;
+		*size |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+/*
+ * (Re)start inflating the delta from its beginning, and read the base
+ * size and the result size from its header.
+ */
+static int start_delta(struct git_istream *st, unsigned long *base_size)
+{
+	close_deflated_stream(st);
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->z_state = z_used;
+	st->u.in_delta.pos = st->u.in_delta.delta_start;
+	st->u.in_delta.delta_ptr = st->u.in_delta.delta_end = 0;
+	st->u.in_delta.cp_left = st->u.in_delta.insert_left = 0;
+	st->u.in_delta.out_pos = 0;
+
+	return read_delta_size(st, base_size) ||
+	       read_delta_size(st, &st->size) ? -1 : 0;
+}
+
+/* Parse the next copy or insert instruction of the delta. */
+static int next_delta_op(struct git_istream *st)
+{
+	unsigned long left = st->size - st->u.in_delta.out_pos;
+	int cmd = next_delta_byte(st);
+
+	if (cmd < 0)
+		return -1;
+	if (cmd & 0x80) {
+		unsigned long cp_off = 0, cp_size = 0;
+		int i, c;
+
+		for (i = 0; i < 7; i++) {
+			if (!(cmd & (1 << i)))
+				continue;
+			c = next_delta_byte(st);
+			if (c < 0)
+				return -1;
+			if (i < 4)
+				cp_off |= (unsigned long)c << (8 * i);
+			else
+				cp_size |= (unsigned long)c << (8 * (i - 4));
+		}
+		if (!cp_size)
+			cp_size = 0x10000;
+		if (unsigned_add_overflows(cp_off, cp_size) ||
+		    cp_off + cp_size > st->u.in_delta.base_size ||
+		    cp_size > left)
+			return -1;
+		st->u.in_delta.cp_off = cp_off;
+		st->u.in_delta.cp_left = cp_size;
+	} else if (cmd) {
+		if (cmd > left)
+			return -1;
+		st->u.in_delta.insert_left = cmd;
+	} else
+		return -1; /* reserved opcode */
+	return 0;
+}
+
+/*
+ * Go through the whole delta without applying it, checking it like
+ * patch_delta() would, and find how far before the end of the part of
+ * the base copied so far its copies start.
+ */
+static int plan_delta(struct git_istream *st, unsigned long *reach)
+{
+	unsigned long copied_to = 0;
+
+	*reach = 0;
+	while (st->u.in_delta.out_pos < st->size) {
+		if (next_delta_op(st))
+			return -1;
+		while (st->u.in_delta.insert_left) {
+			unsigned long n = st->u.in_delta.insert_left;
+
+			if (st->u.in_delta.delta_ptr == st->u.in_delta.delta_end &&
+			    fill_delta(st) <= 0)
+				return -1;
+			if (n > st->u.in_delta.delta_end - st->u.in_delta.delta_ptr)
+				n = st->u.in_delta.delta_end - st->u.in_delta.delta_ptr;
+			st->u.in_delta.delta_ptr += n;
+			st->u.in_delta.insert_left -= n;
+			st->u.in_delta.out_pos += n;
+		}
+		if (st->u.in_delta.cp_left) {
+			unsigned long off = st->u.in_delta.cp_off;
+			unsigned long end = off + st->u.in_delta.cp_left;
+
+			if (off < copied_to && *reach < copied_to - off)
+				*reach = copied_to - off;
+			if (copied_to < end)
+				copied_to = end;
+			st->u.in_delta.out_pos += st->u.in_delta.cp_left;
+			st->u.in_delta.cp_left = 0;
+		}
+	}
+	if (st->u.in_delta.delta_ptr != st->u.in_delta.delta_end ||
+	    fill_delta(st))
+		return -1;
+	return 0;
+}
+
+/* Read more of the base into the window, up to one chunk. */
+static int read_base_chunk(struct git_istream *st)
+{
+	unsigned long wsize = st->u.in_delta.window_size;
+	unsigned long at = st->u.in_delta.base_pos % wsize;
+	unsigned long n = wsize - at;
+	ssize_t got;
+
+	if (n > DELTA_BASE_CHUNK)
+		n = DELTA_BASE_CHUNK;
+	got = read_istream(st->u.in_delta.base, st->u.in_delta.window + at, n);
+	if (got <= 0)
+		return -1;
+	st->u.in_delta.base_pos += got;
+	st->u.in_delta.window_used += got;
+	if (st->u.in_delta.window_used > wsize)
+		st->u.in_delta.window_used = wsize;
+	return 0;
+}
+
+/* Copy "len" bytes of the base at "off" to "buf" through the spool file. */
+static int read_spooled_base(struct git_istream *st, char *buf,
+			     unsigned long off, unsigned long len)
+{
+	while (st->u.in_delta.base_pos < off + len) {
+		ssize_t got = read_istream(st->u.in_delta.base,
+					   st->u.in_delta.window,
+					   DELTA_BASE_CHUNK);
+		if (got <= 0 ||
+		    write_in_full(st->u.in_delta.spool_fd,
+				  st->u.in_delta.window, got) != got)
+			return -1;
+		st->u.in_delta.base_pos += got;
+	}
+	while (len) {
+		ssize_t got = pread(st->u.in_delta.spool_fd, buf, len, off);
+
+		if (got < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (got <= 0)
+			return -1;
+		buf += got;
+		off += got;
+		len -= got;
+	}
+	return 0;
+}
+
+/* Copy "len" bytes of the base at "off" to "buf". */
+static int read_delta_base(struct git_istream *st, char *buf,
+			   unsigned long off, unsigned long len)
+{
+	unsigned long wsize = st->u.in_delta.window_size;
+	unsigned char *window = st->u.in_delta.window;
+
+	if (st->u.in_delta.spool_fd >= 0)
+		return read_spooled_base(st, buf, off, len);
+
+	while (len) {
+		unsigned long at, n;
+
+		if (off >= st->u.in_delta.base_pos) {
+			if (read_base_chunk(st))
+				return -1;
+			continue;
+		}
+		/* plan_delta() made the window large enough for this */
+		if (st->u.in_delta.base_pos - off > st->u.in_delta.window_used)
+			return -1;
+		at = off % wsize;
+		n = st->u.in_delta.base_pos - off;
+		if (n > wsize - at)
+			n = wsize - at;
+		if (n > len)
+			n = len;
+		memcpy(buf, window + at, n);
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static read_method_decl(pack_delta)
+{
+	size_t total_read = 0;
+
+	if (st->z_state == z_error)
+		return -1;
+
+	while (total_read < sz && st->u.in_delta.out_pos < st->size) {
+		unsigned long n = sz - total_read;
+
+		if (st->u.in_delta.insert_left) {
+			if (st->u.in_delta.delta_ptr == st->u.in_delta.delta_end &&
+			    fill_delta(st) <= 0)
+				goto error;
+			if (n > st->u.in_delta.insert_left)
+				n = st->u.in_delta.insert_left;
+			if (n > st->u.in_delta.delta_end - st->u.in_delta.delta_ptr)
+				n = st->u.in_delta.delta_end - st->u.in_delta.delta_ptr;
+			memcpy(buf + total_read,
+			       st->u.in_delta.delta + st->u.in_delta.delta_ptr, n);
+			st->u.in_delta.delta_ptr += n;
+			st->u.in_delta.insert_left -= n;
+		} else if (st->u.in_delta.cp_left) {
+			if (n > st->u.in_delta.cp_left)
+				n = st->u.in_delta.cp_left;
+			if (read_delta_base(st, buf + total_read,
+					    st->u.in_delta.cp_off, n))
+				goto error;
+			st->u.in_delta.cp_off += n;
+			st->u.in_delta.cp_left -= n;
+		} else {
+			if (next_delta_op(st))
+				goto error;
+			continue;
+		}
+		total_read += n;
+		st->u.in_delta.out_pos += n;
+	}
+	return total_read;
+
+error:
+	close_deflated_stream(st);
+	st->z_state = z_error;
+	return -1;
+}
+
+static close_method_decl(pack_delta)
+{
+	close_deflated_stream(st);
+	if (st->u.in_delta.base)
+		close_istream(st->u.in_delta.base);
+	if (st->u.in_delta.spool_fd >= 0) {
+		close(st->u.in_delta.spool_fd);
+		unlink_or_warn(st->u.in_delta.spool_name);
+	}
+	free(st->u.in_delta.spool_name);
+	free(st->u.in_delta.window);
+	free(st->u.in_delta.delta);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+/*
+ * Size the window for a delta whose copies reach "reach" bytes back,
+ * taking it out of "budget", or set up a spool file when the budget
+ * does not have that much left.
+ */
+static int setup_delta_window(struct git_istream *st, unsigned long reach,
+			      unsigned long *budget)
+{
+	unsigned long wsize = DELTA_BASE_CHUNK;
+
+	st->u.in_delta.spool_fd = -1;
+	if (reach) {
+		/* read at most one chunk past what is copied */
+		wsize = reach + DELTA_BASE_CHUNK;
+		if (wsize < reach || wsize > st->u.in_delta.base_size)
+			wsize = st->u.in_delta.base_size;
+		if (wsize > *budget) {
+			char path[PATH_MAX];
+			int fd = git_mkstemp(path, sizeof(path),
+					     "git-delta-base-XXXXXX");
+			if (fd < 0)
+				return -1;
+			st->u.in_delta.spool_fd = fd;
+			st->u.in_delta.spool_name = xstrdup(path);
+			wsize = DELTA_BASE_CHUNK;
+		} else
+			*budget -= wsize;
+	}
+	if (wsize > st->u.in_delta.base_size)
+		wsize = st->u.in_delta.base_size;
+	if (!wsize)
+		wsize = 1;
+	st->u.in_delta.window_size = wsize;
+	st->u.in_delta.window = xmalloc(wsize);
+	st->u.in_delta.window_used = 0;
+	return 0;
+}
+
+static int open_pack_delta(struct git_istream *st, struct packed_git *pack,
+			   off_t obj_offset, enum object_type *type,
+			   unsigned long *budget)
+{
+	struct pack_window *window = NULL;
+	enum object_type in_pack_type;
+	off_t pos = obj_offset;
+	unsigned long delta_size, reach;
+
+	in_pack_type = unpack_object_header(pack, &window, &pos, &delta_size);
+	if (in_pack_type != OBJ_OFS_DELTA && in_pack_type != OBJ_REF_DELTA) {
+		unuse_pack(&window);
+		return -1;
+	}
+	st->u.in_delta.base_offset = get_delta_base(pack, &window, &pos,
+						    in_pack_type, obj_offset);
+	unuse_pack(&window);
+	if (!st->u.in_delta.base_offset)
+		return -1;
+
+	st->u.in_delta.pack = pack;
+	st->u.in_delta.delta_start = pos;
+	st->u.in_delta.base = NULL;
+	st->u.in_delta.base_pos = 0;
+	st->u.in_delta.window = NULL;
+	st->u.in_delta.spool_fd = -1;
+	st->u.in_delta.spool_name = NULL;
+	st->u.in_delta.delta = xmalloc(DELTA_STREAM_BUFFER);
+	st->z_state = z_unused;
+	st->vtbl = &pack_delta_vtbl;
+
+	if (start_delta(st, &st->u.in_delta.base_size) ||
+	    plan_delta(st, &reach) ||
+	    setup_delta_window(st, reach, budget) ||
+	    start_delta(st, &st->u.in_delta.base_size))
+		goto error;
+
+	st->u.in_delta.base = open_pack_base(pack, st->u.in_delta.base_offset,
+					     type, budget);
+	if (!st->u.in_delta.base ||
+	    st->u.in_delta.base->size != st->u.in_delta.base_size)
+		goto error;
+	return 0;
+
+error:
+	close_istream_pack_delta(st);
+	return -1;
+}
+
+static open_method_decl(pack_delta)
+{
+	unsigned long budget = delta_stream_window;
+
+	return open_pack_delta(st, oi->u.packed.pack, oi->u.packed.offset,
+			       type, &budget);
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -0,0 +1,55 @@
+#!/bin/sh
+
+test_description="Tests delta generation performance"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup synthetic data' '
+	test-genrandom base 8000000 >base &&
+	perl -e "
+		local \$/;
+		\$_ = <STDIN>;
+		for (\$i = 500; \$i < length; \$i += 997) {
+			substr(\$_, \$i, 1) = chr((ord(substr(\$_, \$i, 1)) + 1) & 255);
+		}
+		print;
+	" <base >sparse &&
+	perl -e "
+		local \$/;
+		\$_ = <STDIN>;
+		for (\$i = 500; \$i < length; \$i += 65000) {
+			substr(\$_, \$i, 3) = q(xyz);
+		}
+		print;
+	" <base >few
+'
+
+test_expect_success 'setup versions of the largest file' '
+	path=$(git ls-tree -r -l HEAD |
+	       sort -n -k 4 |
+	       sed -n "\$s/^[^	]*	//p") &&
+	old=$(git rev-list -n 2 HEAD -- "$path" | sed -n 2p) &&
+	git cat-file blob "HEAD:$path" >new &&
+	if test -n "$old"
+	then
+		git cat-file blob "$old:$path" >old
+	else
+		cp new old
+	fi
+'
+
+test_perf 'delta of a buffer changed every kilobyte' '
+	test-delta -d base sparse delta
+'
+
+test_perf 'delta of a buffer changed every 64 kilobytes' '
+	test-delta -d base few delta
+'
+
+test_perf 'delta between versions of the largest file' '
+	test-delta -d old new delta
+'
+
+test_done
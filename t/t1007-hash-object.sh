@@ -175,6 +175,23 @@ test_expect_success "hash two files with names on stdin" '
 	test "$sha1s" = "$(echo_without_newline "$filenames" | git hash-object --stdin-paths)"
 '
 
+test_expect_success PIPE "hash each name on stdin before reading the next one" '
+	rm -f backflow &&
+	mkfifo backflow &&
+	(
+		exec <backflow &&
+		echo hello &&
+		read sha1 &&
+		echo $sha1 >actual &&
+		echo example &&
+		read sha1 &&
+		echo $sha1 >>actual
+	) |
+	git hash-object --stdin-paths >backflow &&
+	echo "$sha1s" >expect &&
+	test_cmp expect actual
+'
+
 for args in "-w --stdin-paths" "--stdin-paths -w"; do
 	push_repo
 
@@ -188,6 +205,31 @@ for args in "-w --stdin-paths" "--stdin-paths -w"; do
 	pop_repo
 done
 
+test_expect_success 'hash many files of mixed sizes with names on stdin' '
+	mkdir many &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		test-genrandom "$i" $(($i * $i * 97)) >many/$i || return 1
+	done &&
+	test-genrandom big 40000 >many/big &&
+	: >many/empty &&
+	ls many/* >paths &&
+	for f in $(cat paths)
+	do
+		git hash-object "$f" || return 1
+	done >expect &&
+	git hash-object --stdin-paths <paths >actual &&
+	test_cmp expect actual &&
+	git hash-object --stdin-paths --no-filters <paths >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'hashing files on stdin reports an unreadable file' '
+	{ cat paths && echo many/missing; } >paths-missing &&
+	test_must_fail git hash-object --stdin-paths <paths-missing >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'corrupt tree' '
 	echo abc >malformed-tree &&
 	test_must_fail git hash-object -t tree malformed-tree
@@ -151,6 +151,100 @@ test_expect_success 'pack-objects with large loose object' '
 	cmp huge actual
 '
 
+test_expect_success 'setup a large deltified file' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		test-genrandom delta 2000000 >file &&
+		git add file &&
+		git commit -q -m base &&
+		# move the second half in front, so that the delta copies
+		# from both ends of the base
+		dd if=file of=head bs=1000 count=1000 2>/dev/null &&
+		dd if=file of=tail bs=1000 skip=1000 2>/dev/null &&
+		echo changed >file &&
+		cat tail head >>file &&
+		cp file expect &&
+		git add file &&
+		git commit -q -m reordered &&
+		(
+			sane_unset GIT_ALLOC_LIMIT &&
+			git -c core.bigfilethreshold=10m repack -adf -q &&
+			git verify-pack -v .git/objects/pack/pack-*.idx >verify
+		) &&
+		grep "chain length = 1: 1 object" verify
+	)
+'
+
+test_expect_success 'cat-file streams a large deltified file' '
+	(
+		cd delta &&
+		git -c core.deltastreamwindow=64k cat-file blob HEAD:file >actual &&
+		cmp expect actual &&
+		git -c core.deltastreamwindow=1k cat-file blob HEAD:file >actual &&
+		cmp expect actual
+	)
+'
+
+test_expect_success 'checkout streams a large deltified file' '
+	(
+		cd delta &&
+		rm file &&
+		git -c core.deltastreamwindow=64k checkout file &&
+		cmp expect file
+	)
+'
+
+test_expect_success 'setup a large file deltified with its blocks shuffled' '
+	test_create_repo shuffled &&
+	(
+		cd shuffled &&
+		test-genrandom shuffled 2000000 >file &&
+		cp file expect.old &&
+		git add file &&
+		git commit -q -m base &&
+		# every 4k block copied from somewhere else in the base
+		"$PERL_PATH" -e "
+			local \$/;
+			my @b = unpack(q{(a4096)*}, <STDIN>);
+			print \$b[\$_ * 263 % @b] for 0..\$#b;
+		" <expect.old >file &&
+		cp file expect.new &&
+		git add file &&
+		git commit -q -m shuffled &&
+		(
+			sane_unset GIT_ALLOC_LIMIT &&
+			git -c core.bigfilethreshold=10m repack -adf -q &&
+			git verify-pack -v .git/objects/pack/pack-*.idx >verify
+		) &&
+		grep "chain length = 1: 1 object" verify
+	)
+'
+
+test_expect_success 'stream a delta with many out-of-order copies' '
+	(
+		cd shuffled &&
+		mkdir tmp &&
+		for window in 64k 1m
+		do
+			TMPDIR="$(pwd)/tmp" git -c core.deltastreamwindow=$window \
+				cat-file blob HEAD^:file >actual &&
+			cmp expect.old actual &&
+			TMPDIR="$(pwd)/tmp" git -c core.deltastreamwindow=$window \
+				cat-file blob HEAD:file >actual &&
+			cmp expect.new actual || return 1
+		done &&
+		(
+			sane_unset GIT_ALLOC_LIMIT &&
+			git -c core.deltastreamwindow=4m cat-file blob HEAD^:file >actual &&
+			cmp expect.old actual
+		) &&
+		# the spooled copies of the base are gone
+		ls tmp >leftover &&
+		test_must_be_empty leftover
+	)
+'
+
 test_expect_success 'tar achiving' '
 	git archive --format=tar HEAD >/dev/null
 '
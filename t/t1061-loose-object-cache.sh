@@ -0,0 +1,67 @@
+#!/bin/sh
+
+test_description='core.looseObjectCache'
+. ./test-lib.sh
+
+test_expect_success 'setup repositories with loose objects' '
+	test_commit one &&
+	test_commit two &&
+	git clone -s . borrower &&
+	(
+		cd borrower &&
+		test_commit three &&
+		test_commit four
+	)
+'
+
+test_expect_success 'fetch with the cache' '
+	git init fetcher &&
+	(
+		cd fetcher &&
+		git -c core.looseObjectCache=true fetch .. master:one &&
+		git -c core.looseObjectCache=true fetch ../borrower master:four &&
+		git fsck
+	)
+'
+
+test_expect_success '--local skips objects loose in alternates with the cache' '
+	(
+		cd borrower &&
+		git rev-list --objects HEAD >objs &&
+		git pack-objects --local --stdout <objs >without.pack &&
+		git -c core.looseObjectCache=true \
+			pack-objects --local --stdout <objs >with.pack &&
+		test_cmp without.pack with.pack &&
+		git index-pack -o with.idx with.pack &&
+		git show-index <with.idx >packed &&
+		test_line_count = 6 packed &&
+		git rev-list --objects two >shared &&
+		while read sha1 path
+		do
+			! grep $sha1 packed || return 1
+		done <shared
+	)
+'
+
+test_expect_success 'index-pack checks loose objects through the cache' '
+	(
+		cd borrower &&
+		git rev-list --objects HEAD |
+		git pack-objects --stdout >all.pack &&
+		git -c core.looseObjectCache=true index-pack --stdin <all.pack
+	)
+'
+
+test_expect_success 'objects written by the same process are seen' '
+	(
+		cd borrower &&
+		echo content >file-a &&
+		echo content >file-b &&
+		printf "file-a\nfile-b\n" |
+		git -c core.looseObjectCache=true hash-object -w --stdin-paths >out &&
+		test $(sort -u out | wc -l) = 1 &&
+		git cat-file -e $(head -n 1 out)
+	)
+'
+
+test_done
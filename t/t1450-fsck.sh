@@ -268,4 +268,46 @@ test_expect_success 'fsck notices ".git" in trees' '
 	)
 '
 
+test_expect_success 'fsck with threads reports the same as without' '
+	(
+		git init threads &&
+		cd threads &&
+		test_commit one &&
+		blob=$(echo foo | git hash-object -w --stdin) &&
+		tab=$(printf "\\t") &&
+		tree=$(echo "100644 blob $blob$tab.git" | git mktree) &&
+		commit=$(git commit-tree -p HEAD -m packed $tree) &&
+		git update-ref refs/heads/packed $commit &&
+		git repack -a -d &&
+		echo "100644 blob $blob$tab.." | git mktree >/dev/null &&
+		sha=$(echo bar | git hash-object -w --stdin) &&
+		other=$(echo baz | git hash-object -w --stdin) &&
+		file=.git/objects/$(echo $sha | sed -e "s|^..|&/|") &&
+		chmod u+w $file &&
+		cp .git/objects/$(echo $other | sed -e "s|^..|&/|") $file &&
+		test_must_fail git fsck --threads=1 >expect 2>&1 &&
+		grep "warning.*\\.git" expect &&
+		grep "warning.*\\.\\." expect &&
+		grep "sha1 mismatch $sha" expect &&
+		test_must_fail env GIT_FORCE_THREADS=1 \
+			git fsck --threads=1 >actual 2>&1 &&
+		test_cmp expect actual &&
+		test_must_fail git fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'fsck with threads notices a corrupt pack checksum' '
+	(
+		cd threads &&
+		pack=$(echo .git/objects/pack/*.pack) &&
+		chmod u+w $pack &&
+		l=$(wc -c <$pack) &&
+		printf "\\377" |
+		dd of=$pack count=1 bs=1 conv=notrunc seek=$(($l - 21)) &&
+		test_must_fail git fsck --threads=4 2>out &&
+		grep "SHA1 checksum mismatch" out
+	)
+'
+
 test_done
@@ -307,4 +307,44 @@ test_expect_success 'git add --dry-run --ignore-missing of non-existing file out
 	test_i18ncmp expect.err actual.err
 '
 
+test_expect_success 'add.packLimit writes the new files to one pack' '
+	test_create_repo packlimit &&
+	(
+		cd packlimit &&
+		for i in $(test_seq 1 50)
+		do
+			echo $i >file-$i || return 1
+		done &&
+		echo 1 >same-as-file-1 &&
+		printf "a\r\nb\r\n" >crlf.txt &&
+		echo "*.txt text" >.gitattributes &&
+		git add . &&
+		git ls-files -s >../expect &&
+		rm -rf .git/index .git/objects/?? &&
+		git -c add.packLimit=10 -c pack.threads=4 add . &&
+		git ls-files -s >../actual &&
+		test_cmp ../expect ../actual &&
+		git count-objects -v >../count &&
+		grep "^count: 0" ../count &&
+		grep "^in-pack: 52" ../count &&
+		git fsck --full
+	)
+'
+
+test_expect_success 'add.packLimit writes the changed files to one pack' '
+	(
+		cd packlimit &&
+		for i in $(test_seq 1 50)
+		do
+			echo changed >>file-$i || return 1
+		done &&
+		git -c add.packLimit=10 -c pack.threads=4 add -u &&
+		git diff-files --exit-code &&
+		git count-objects -v >../count &&
+		grep "^count: 0" ../count &&
+		test 2 = $(ls .git/objects/pack/*.pack | wc -l) &&
+		git fsck --full
+	)
+'
+
 test_done
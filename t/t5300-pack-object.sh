@@ -261,6 +261,21 @@ test_expect_success \
      else :;
      fi'
 
+test_expect_success 'verify-pack with threads' '
+	GIT_FORCE_THREADS=1 git -c pack.threads=2 verify-pack \
+		test-1-${packname_1}.idx test-2-${packname_2}.idx
+'
+
+test_expect_success 'verify-pack with threads catches a corrupted pack trailer' '
+	cat test-1-${packname_1}.idx >test-3.idx &&
+	cat test-1-${packname_1}.pack >test-3.pack &&
+	l=$(wc -c <test-3.pack) &&
+	printf "%20s" "" |
+	dd of=test-3.pack count=20 bs=1 conv=notrunc seek=$(($l - 20)) &&
+	test_must_fail env GIT_FORCE_THREADS=1 \
+		git -c pack.threads=2 verify-pack test-3.idx
+'
+
 test_expect_success \
     'build pack index for an existing pack' \
     'cat test-1-${packname_1}.pack >test-3.pack &&
@@ -400,6 +415,119 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'set up repository with many packed and loose objects' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 200)
+		do
+			echo $i >file-$((i % 17)) &&
+			echo $i >blob-$i &&
+			git add . &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -a -d &&
+		for i in $(test_seq 201 300)
+		do
+			echo $i >blob-$i &&
+			git add . &&
+			git commit -q -m $i || return 1
+		done
+	)
+'
+
+for opts in "" --local --incremental --no-reuse-delta
+do
+	test_expect_success "counting objects with threads gives the same pack ($opts)" '
+		(
+			cd threads &&
+			echo HEAD >revs &&
+			git pack-objects --revs $opts --window=0 --threads=1 \
+				--stdout <revs >one.pack &&
+			git pack-objects --revs $opts --window=0 --threads=4 \
+				--stdout <revs >four.pack &&
+			test_cmp one.pack four.pack
+		)
+	'
+done
+
+test_expect_success 'deflating objects with threads gives the same pack' '
+	(
+		cd threads &&
+		echo HEAD >revs &&
+		git pack-objects --revs --no-reuse-object --delta-base-offset \
+			--window=0 --threads=1 --stdout <revs >one.pack &&
+		git pack-objects --revs --no-reuse-object --delta-base-offset \
+			--window=0 --threads=4 --stdout <revs >four.pack &&
+		test_cmp one.pack four.pack
+	)
+'
+
+test_expect_success 'deflating deltas with threads gives a valid pack' '
+	(
+		cd threads &&
+		echo HEAD >revs &&
+		name=$(git pack-objects --revs --no-reuse-object --threads=4 \
+			deltas <revs) &&
+		git verify-pack -v deltas-$name.pack >verify &&
+		grep "chain length = 1:" verify
+	)
+'
+
+test_expect_success 'indexing with threads gives the same index' '
+	(
+		cd threads &&
+		git pack-objects --revs --all --stdout <revs >all.pack &&
+		git index-pack --strict --threads=1 -o one.idx all.pack &&
+		git index-pack --strict --threads=4 -o four.idx all.pack &&
+		test_cmp one.idx four.idx
+	)
+'
+
+test_expect_success 'unpacking with threads writes the same objects' '
+	(
+		cd threads &&
+		git pack-objects --revs --all --stdout <revs >ref.pack &&
+		git pack-objects --revs --all --delta-base-offset --stdout \
+			<revs >ofs.pack &&
+		for pack in ref ofs
+		do
+			for n in 1 4
+			do
+				rm -rf unpack-$n &&
+				git init -q unpack-$n &&
+				(
+					cd unpack-$n &&
+					git unpack-objects -q --threads=$n \
+						<../$pack.pack &&
+					find .git/objects -type f | sort >../objects-$n &&
+					git fsck --full
+				) || return 1
+			done &&
+			test_cmp objects-1 objects-4 || return 1
+		done
+	)
+'
+
+test_expect_success 'unpacking a thin pack with threads' '
+	(
+		cd threads &&
+		head=$(git rev-parse HEAD) &&
+		echo HEAD~100 | git pack-objects --revs --stdout >old.pack &&
+		printf "HEAD\n^HEAD~100\n" |
+		git pack-objects --revs --thin --stdout >thin.pack &&
+		rm -rf thin &&
+		git init -q thin &&
+		(
+			cd thin &&
+			git unpack-objects -q --threads=1 <../old.pack &&
+			git unpack-objects -q --threads=4 <../thin.pack &&
+			git update-ref HEAD $head &&
+			git fsck --full
+		)
+	)
+'
+
 #
 # WARNING!
 #
@@ -418,6 +546,11 @@ test_expect_success \
     'test_must_fail git index-pack -o bad.idx test-3.pack 2>msg &&
      test_i18ngrep "SHA1 COLLISION FOUND" msg'
 
+test_expect_success \
+    'make sure index-pack detects the SHA1 collision with threads' \
+    'test_must_fail git index-pack --threads=4 -o bad.idx test-3.pack 2>msg &&
+     test_i18ngrep "SHA1 COLLISION FOUND" msg'
+
 test_expect_success \
     'make sure index-pack detects the SHA1 collision (large blobs)' \
     'test_must_fail git -c core.bigfilethreshold=1 index-pack -o bad.idx test-3.pack 2>msg &&
@@ -57,4 +57,57 @@ test_expect_success \
      git config --unset core.packedGitLimit &&
      git verify-pack -v "$pack2"'
 
+test_expect_success 'reading deltas with a one-slot delta base cache' '
+	for i in a b c d
+	do
+		git cat-file blob HEAD:$i >expect.$i &&
+		git -c core.deltaBaseCacheSlots=1 \
+			-c core.deltaBaseCacheLimit=1 \
+			cat-file blob HEAD:$i >actual.$i &&
+		test_cmp expect.$i actual.$i || return 1
+	done &&
+	git -c core.deltaBaseCacheSlots=1 verify-pack "$pack2"
+'
+
+test_expect_success 'GIT_TRACE reports delta base cache statistics' '
+	GIT_TRACE="$(pwd)/trace" git log -p >/dev/null &&
+	grep "delta base cache: .* hits, .* misses, .* evictions" trace
+'
+
+test_expect_success 'setup deep delta chains' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		# each version is closest to the one before
+		test_seq 2000 | sed -e "1,$(($i * 100))s/\$/ changed/" >chain &&
+		cp chain chain.$i &&
+		git update-index --add chain &&
+		tree=$(git write-tree) &&
+		commit=$(git commit-tree $tree -p HEAD </dev/null) &&
+		git update-ref HEAD $commit &&
+		git rev-parse HEAD:chain >>chain-blobs || return 1
+	done &&
+	git repack -a -d -f --depth=50 --window=50 &&
+	git verify-pack -v .git/objects/pack/*.idx >verify &&
+	grep "chain length = [3-9]" verify
+'
+
+test_expect_success 'reading objects at the end of deep delta chains' '
+	i=0 &&
+	for blob in $(cat chain-blobs)
+	do
+		i=$(($i + 1)) &&
+		git cat-file blob $blob >actual &&
+		test_cmp chain.$i actual &&
+		git -c core.deltaBaseCacheSlots=1 \
+			-c core.deltaBaseCacheLimit=1 \
+			cat-file blob $blob >actual &&
+		test_cmp chain.$i actual || return 1
+	done &&
+	git fsck --full
+'
+
+test_expect_success 'core.deltaBaseCacheSlots must be positive' '
+	test_must_fail git -c core.deltaBaseCacheSlots=0 cat-file blob HEAD:d
+'
+
 test_done
@@ -0,0 +1,163 @@
+#!/bin/sh
+
+test_description='exercise basic bitmap functionality'
+. ./test-lib.sh
+
+test_expect_success 'setup repo with moderate-sized history' '
+	for i in $(test_seq 1 10)
+	do
+		test_commit $i
+	done &&
+	git checkout -b other HEAD~5 &&
+	for i in $(test_seq 1 10)
+	do
+		test_commit side-$i
+	done &&
+	git checkout master &&
+	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob &&
+	git tag -a -m annotated annotated HEAD~2
+'
+
+test_expect_success 'full repack creates bitmaps' '
+	git repack -ad --write-bitmap-index &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+rev_list_tests() {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting partial commits via bitmap ($state)" '
+		git rev-list --count HEAD~5..HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD~5..HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting commits of all refs via bitmap ($state)" '
+		git rev-list --count --all ^other >expect &&
+		git rev-list --use-bitmap-index --count --all ^other >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD >tmp &&
+		cut -d" " -f1 <tmp >tmp2 &&
+		sort <tmp2 >actual &&
+		git rev-list --objects HEAD >tmp &&
+		cut -d" " -f1 <tmp >tmp2 &&
+		sort <tmp2 >expect &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "bitmap --objects handles non-commit objects ($state)" '
+		git rev-list --objects --use-bitmap-index --all >actual &&
+		grep $blob actual
+	'
+}
+
+rev_list_tests 'full bitmap'
+
+test_expect_success 'clone from bitmapped repository' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'setup further non-bitmapped commits' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit further-$i
+	done
+'
+
+rev_list_tests 'partial bitmap'
+
+test_expect_success 'fetch (partial bitmap)' '
+	git --git-dir=clone.git fetch origin master:master &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'pack-objects --stdout with bitmaps matches a regular walk' '
+	git rev-parse HEAD other >revs &&
+	git pack-objects --stdout --revs --no-use-bitmap-index <revs >plain.pack &&
+	git pack-objects --stdout --revs <revs >bitmap.pack &&
+	git index-pack -o plain.idx plain.pack &&
+	git index-pack -o bitmap.idx bitmap.pack &&
+	git show-index <plain.idx | cut -d" " -f2 | sort >expect &&
+	git show-index <bitmap.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incremental repack does not write bitmaps' '
+	git repack -d --write-bitmap-index &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'full repack replaces the bitmap' '
+	git repack -ad --write-bitmap-index &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+rev_list_tests 'full bitmap, rewritten'
+
+test_expect_success 'pack of everything is a copy of the bitmapped pack' '
+	git pack-objects --stdout --revs --all --delta-base-offset \
+		</dev/null >all.pack &&
+	cmp .git/objects/pack/pack-*.pack all.pack
+'
+
+test_expect_success 'partial pack reuse patches delta offsets' '
+	echo other >revs &&
+	git pack-objects --stdout --revs --delta-base-offset --progress \
+		<revs >reuse.pack 2>stderr &&
+	grep "pack-reused [1-9]" stderr &&
+	git pack-objects --stdout --revs --no-use-bitmap-index <revs >plain.pack &&
+	rm -rf reuse.git &&
+	git init --bare reuse.git &&
+	git --git-dir=reuse.git index-pack --strict --stdin <reuse.pack &&
+	git index-pack -o plain.idx plain.pack &&
+	git show-index <plain.idx | cut -d" " -f2 | sort >expect &&
+	idx=$(echo reuse.git/objects/pack/pack-*.idx) &&
+	git show-index <$idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack.allowPackReuse=false disables pack reuse' '
+	git -c pack.allowPackReuse=false pack-objects --stdout --revs \
+		--delta-base-offset --progress <revs >/dev/null 2>stderr &&
+	grep "pack-reused 0" stderr
+'
+
+test_expect_success 'pack.writebitmaps config option' '
+	rm -f .git/objects/pack/*.bitmap &&
+	git -c pack.writebitmaps=true repack -ad &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'truncated bitmap fails gracefully' '
+	git rev-list --use-bitmap-index --count --all >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "rm -f $bitmap" &&
+	head -c 512 <$bitmap >$bitmap.tmp &&
+	mv -f $bitmap.tmp $bitmap &&
+	git rev-list --use-bitmap-index --count --all >actual 2>stderr &&
+	test_cmp expect actual &&
+	test_i18ngrep corrupt stderr
+'
+
+test_done
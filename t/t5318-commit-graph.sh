@@ -0,0 +1,143 @@
+#!/bin/sh
+
+test_description='commit graph'
+. ./test-lib.sh
+
+test_expect_success 'setup full repo' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i || return 1
+	done &&
+	git checkout -b side HEAD~2 &&
+	for i in $(test_seq 1 3)
+	do
+		test_commit side-$i || return 1
+	done &&
+	git checkout -b other master~3 &&
+	test_commit other &&
+	git checkout master &&
+	git merge side &&
+	git tag merge &&
+	tree=$(git rev-parse HEAD^{tree}) &&
+	octopus=$(echo octopus |
+		  git commit-tree $tree -p HEAD -p side~1 -p other) &&
+	child=$(echo child | git commit-tree $tree -p $octopus) &&
+	git update-ref refs/heads/octopus $child
+'
+
+test_expect_success 'reading a missing graph fails' '
+	test_must_fail git commit-graph read
+'
+
+graph_git_behavior () {
+	state=$1
+	test_expect_success "history walks agree ($state)" '
+		git -c core.commitGraph=false rev-list --parents --date-order \
+			octopus side other >expect &&
+		git rev-list --parents --date-order octopus side other >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false rev-list --topo-order \
+			--objects master..octopus >expect &&
+		git rev-list --topo-order --objects master..octopus >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "merge-base agrees ($state)" '
+		git -c core.commitGraph=false merge-base --all side other >expect &&
+		git merge-base --all side other >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "reachability queries agree ($state)" '
+		for pair in "side other" "other side" "side~2 octopus" \
+			    "octopus side~2" "other master" "master~3 other"
+		do
+			set -- $pair &&
+			if git -c core.commitGraph=false merge-base --is-ancestor $1 $2
+			then
+				git merge-base --is-ancestor $1 $2
+			else
+				test_must_fail git merge-base --is-ancestor $1 $2
+			fi || return 1
+		done &&
+		git -c core.commitGraph=false tag --contains side~1 >expect &&
+		git tag --contains side~1 >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false branch --contains other >expect &&
+		git branch --contains other >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "log --graph agrees ($state)" '
+		git -c core.commitGraph=false log --graph --oneline octopus >expect &&
+		git log --graph --oneline octopus >actual &&
+		test_cmp expect actual
+	'
+}
+
+graph_git_behavior 'no graph'
+
+test_expect_success 'write graph' '
+	git commit-graph write &&
+	test_path_is_file .git/objects/info/commit-graph &&
+	git commit-graph read >output &&
+	cat >expect <<-\EOF &&
+	header: 43475048 1 1 4 0
+	num_commits: 12
+	chunks: oid_fanout oid_lookup commit_metadata large_edges
+	EOF
+	test_cmp expect output
+'
+
+graph_git_behavior 'full graph'
+
+test_expect_success 'commits outside the graph are parsed normally' '
+	git checkout -b new master &&
+	test_commit new-1 &&
+	test_commit new-2 &&
+	git checkout master
+'
+
+graph_git_behavior 'partial graph'
+
+test_expect_success 'grafts disable the graph' '
+	test_when_finished "rm -f .git/info/grafts" &&
+	mkdir -p .git/info &&
+	git rev-parse side >.git/info/grafts &&
+	git rev-list side >expect &&
+	test_line_count = 1 expect &&
+	test_must_fail git commit-graph write 2>err &&
+	test_i18ngrep grafts err
+'
+
+test_expect_success 'corrupt graph is ignored' '
+	cp .git/objects/info/commit-graph graph.bak &&
+	test_when_finished "mv -f graph.bak .git/objects/info/commit-graph" &&
+	chmod u+w .git/objects/info/commit-graph &&
+	printf "XXXX" | dd of=.git/objects/info/commit-graph \
+		bs=1 count=4 conv=notrunc 2>/dev/null &&
+	git -c core.commitGraph=false rev-list --parents octopus >expect &&
+	git rev-list --parents octopus >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep signature err
+'
+
+test_expect_success 'gc.writeCommitGraph' '
+	rm -f .git/objects/info/commit-graph &&
+	git -c gc.writeCommitGraph=true gc &&
+	git commit-graph read >output &&
+	grep "num_commits: 14" output
+'
+
+test_expect_success 'fetch.writeCommitGraph' '
+	git clone --no-local . clone &&
+	(
+		cd clone &&
+		test_path_is_missing .git/objects/info/commit-graph &&
+		git -c fetch.writeCommitGraph=true fetch origin &&
+		git commit-graph read >output &&
+		grep "num_commits: 14" output
+	)
+'
+
+test_done
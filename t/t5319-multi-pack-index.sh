@@ -0,0 +1,154 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+. ./test-lib.sh
+
+midx_read_expect () {
+	num_packs=$1
+	num_objects=$2
+	cat >expect <<-EOF &&
+	header: 4d494458 1 1 5 $num_packs
+	num_objects: $num_objects
+	chunks: pack_names pack_checksums oid_fanout oid_lookup object_offsets
+	EOF
+	git multi-pack-index read >actual &&
+	sed -n 1,3p actual >actual.head &&
+	test_cmp expect actual.head
+}
+
+objects_agree () {
+	git rev-list --objects --all | cut -d" " -f1 | sort >objects &&
+	git -c core.multiPackIndex=false cat-file --batch-check <objects >expect &&
+	git cat-file --batch-check <objects >actual &&
+	test_cmp expect actual &&
+	git -c core.multiPackIndex=false cat-file --batch <objects >expect &&
+	git cat-file --batch <objects >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i &&
+		git repack -q &&
+		git prune-packed || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 5 packs
+'
+
+test_expect_success 'reading a missing multi-pack-index fails' '
+	test_must_fail git multi-pack-index read
+'
+
+test_expect_success 'write multi-pack-index' '
+	git multi-pack-index write &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	midx_read_expect 5 15
+'
+
+test_expect_success 'objects are read through the multi-pack-index' '
+	objects_agree &&
+	git fsck
+'
+
+test_expect_success 'multi-pack-index is not garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'abbreviated names are resolved' '
+	for obj in $(cat objects)
+	do
+		short=$(git rev-parse --short=7 $obj) &&
+		test $(git rev-parse $short) = $obj || return 1
+	done &&
+	git -c core.multiPackIndex=false log --oneline --raw >expect &&
+	git log --oneline --raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects in several packs' '
+	git rev-list --objects HEAD~2 | git pack-objects .git/objects/pack/pack &&
+	git multi-pack-index write &&
+	midx_read_expect 6 15 &&
+	objects_agree
+'
+
+test_expect_success 'preferred pack' '
+	pack=$(ls .git/objects/pack/*.idx | sed -n 2p) &&
+	git multi-pack-index write --preferred-pack=$(basename $pack) &&
+	objects_agree
+'
+
+test_expect_success 'packs added after the multi-pack-index' '
+	test_commit 6 &&
+	git repack -q &&
+	git prune-packed &&
+	objects_agree &&
+	git rev-parse --short HEAD
+'
+
+test_expect_success 'multi-pack-index naming a missing pack is ignored' '
+	cp -r .git/objects/pack pack.bak &&
+	test_when_finished "rm -rf .git/objects/pack && mv pack.bak .git/objects/pack" &&
+	git multi-pack-index write &&
+	git repack -a &&
+	for p in $(ls .git/objects/pack/*.pack | sed -n 1p)
+	do
+		rm -f $p ${p%.pack}.idx
+	done &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	objects_agree
+'
+
+test_expect_success 'corrupt multi-pack-index is ignored' '
+	git multi-pack-index write &&
+	cp .git/objects/pack/multi-pack-index midx.bak &&
+	test_when_finished "mv -f midx.bak .git/objects/pack/multi-pack-index" &&
+	chmod u+w .git/objects/pack/multi-pack-index &&
+	printf "XXXX" | dd of=.git/objects/pack/multi-pack-index \
+		bs=1 count=4 conv=notrunc 2>/dev/null &&
+	git -c core.multiPackIndex=false cat-file -p HEAD >expect &&
+	git cat-file -p HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep signature err
+'
+
+test_expect_success 'repack -d removes a stale multi-pack-index' '
+	git multi-pack-index write &&
+	git repack -a -d &&
+	test_path_is_missing .git/objects/pack/multi-pack-index &&
+	objects_agree
+'
+
+test_expect_success 'multi-pack-index of a pack rewritten under the same name is ignored' '
+	git repack -a -d &&
+	git multi-pack-index write &&
+	idx=$(ls .git/objects/pack/pack-*.idx) &&
+	git show-index <$idx | cut -d" " -f2 >list &&
+	name=$(git pack-objects --window=0 rewritten <list) &&
+	test .git/objects/pack/pack-$name.idx = $idx &&
+	! cmp rewritten-$name.pack ${idx%.idx}.pack &&
+	for ext in pack idx rev
+	do
+		chmod u+w ${idx%.idx}.$ext &&
+		mv rewritten-$name.$ext ${idx%.idx}.$ext || return 1
+	done &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	objects_agree
+'
+
+test_expect_success 'repack -a -d -f drops the multi-pack-index of a rewritten pack' '
+	git multi-pack-index write &&
+	git repack -a -d -f &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 1 packs &&
+	test_path_is_missing .git/objects/pack/multi-pack-index &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check <objects >out &&
+	! grep missing out &&
+	objects_agree
+'
+
+test_done
@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='exercise delta islands in pack-objects'
+. ./test-lib.sh
+
+# Print the delta base of object $2 in pack index $1, if any.
+delta_base () {
+	git verify-pack -v "$1" |
+	while read sha1 type size size_in_pack offset depth base
+	do
+		if test "$sha1" = "$2"
+		then
+			echo "$base"
+		fi
+	done
+}
+
+# Make blobs in two forks that are excellent delta bases for each
+# other, and that are reachable from one fork only.
+test_expect_success 'setup' '
+	test-genrandom base 10000 >base &&
+	{ cat base && echo one; } >file &&
+	git add file &&
+	test_tick &&
+	git commit -m one &&
+	one=$(git rev-parse HEAD:file) &&
+	git update-ref refs/virtual/one/heads/master HEAD &&
+	git checkout --orphan two &&
+	{ cat base && echo two; } >file &&
+	git add file &&
+	test_tick &&
+	git commit -m two &&
+	two=$(git rev-parse HEAD:file) &&
+	git update-ref refs/virtual/two/heads/master HEAD &&
+	git checkout master &&
+	git branch -D two
+'
+
+repack () {
+	git repack -adf "$@" &&
+	pack=$(echo .git/objects/pack/pack-*.idx)
+}
+
+test_expect_success 'without islands, one blob is a delta of the other' '
+	repack &&
+	test -n "$(delta_base $pack $one)$(delta_base $pack $two)"
+'
+
+test_expect_success 'with islands, neither blob is a delta of the other' '
+	git config pack.island "refs/virtual/([^/]+)/" &&
+	repack -i &&
+	test -z "$(delta_base $pack $one)" &&
+	test -z "$(delta_base $pack $two)"
+'
+
+test_expect_success 'repack.useDeltaIslands implies -i' '
+	test_config repack.useDeltaIslands true &&
+	repack &&
+	test -z "$(delta_base $pack $one)" &&
+	test -z "$(delta_base $pack $two)"
+'
+
+test_expect_success 'islands are named by the capture groups of the regex' '
+	git config pack.island "refs/virtual/(o|t)[a-z]*/" &&
+	repack -i &&
+	test -z "$(delta_base $pack $one)" &&
+	test -z "$(delta_base $pack $two)" &&
+	git config pack.island "refs/virtual/[a-z]+/" &&
+	repack -i &&
+	test -n "$(delta_base $pack $one)$(delta_base $pack $two)"
+'
+
+test_expect_success 'an object in both islands can be a base for either' '
+	git config pack.island "refs/virtual/([^/]+)/" &&
+	git update-ref refs/virtual/one/heads/shared \
+		refs/virtual/two/heads/master &&
+	repack -i &&
+	test "$(delta_base $pack $one)" = $two &&
+	git update-ref -d refs/virtual/one/heads/shared
+'
+
+test_expect_success 'on-disk deltas across islands are not reused' '
+	git config --unset pack.island &&
+	repack &&
+	test -n "$(delta_base $pack $one)$(delta_base $pack $two)" &&
+	git config pack.island "refs/virtual/([^/]+)/" &&
+	git pack-objects --all --delta-islands --window=0 \
+		.git/objects/pack/pack </dev/null >name &&
+	new=.git/objects/pack/pack-$(cat name).idx &&
+	test -z "$(delta_base $new $one)" &&
+	test -z "$(delta_base $new $two)"
+'
+
+test_expect_success '--delta-islands needs --revs' '
+	echo $one | test_must_fail git pack-objects --delta-islands \
+		--stdout >/dev/null
+'
+
+test_done
@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 10)
+	do
+		test_seq $i 100 >file &&
+		git add file &&
+		test_commit $i || return 1
+	done
+'
+
+test_expect_success 'repack writes a reverse index' '
+	git repack -a -d &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	rev=${pack%.pack}.rev &&
+	test_path_is_file $rev &&
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'pack.writeReverseIndex=false' '
+	git -c pack.writeReverseIndex=false repack -a -d &&
+	test_path_is_missing $rev &&
+	git repack -a -d &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'index-pack writes a reverse index' '
+	cp $pack test-1.pack &&
+	git index-pack test-1.pack &&
+	test_path_is_file test-1.rev &&
+	test_cmp $rev test-1.rev &&
+	git index-pack --stdin <$pack &&
+	git -c pack.writeReverseIndex=false index-pack -o test-2.idx $pack &&
+	test_path_is_missing test-2.rev
+'
+
+test_expect_success 'index-pack --verify does not write one' '
+	rm -f test-1.rev &&
+	git index-pack --verify test-1.pack &&
+	test_path_is_missing test-1.rev
+'
+
+test_expect_success 'reading through the reverse index' '
+	git verify-pack -v $pack >expect.verify &&
+	git pack-objects --stdout --all --delta-base-offset </dev/null >expect.pack &&
+	mv $rev rev.bak &&
+	git verify-pack -v $pack >actual.verify &&
+	git pack-objects --stdout --all --delta-base-offset </dev/null >actual.pack &&
+	mv rev.bak $rev &&
+	test_cmp expect.verify actual.verify &&
+	test_cmp expect.pack actual.pack
+'
+
+test_expect_success 'reverse index that does not match the pack is ignored' '
+	cp $rev rev.bak &&
+	test_when_finished "mv -f rev.bak $rev" &&
+	chmod u+w $rev &&
+	printf "XXXXXXXXXXXXXXXXXXXX" |
+	dd of=$rev bs=1 seek=$(($(wc -c <$rev) - 40)) count=20 \
+		conv=notrunc 2>/dev/null &&
+	git pack-objects --stdout --all --delta-base-offset \
+		</dev/null >actual.pack 2>err &&
+	test_cmp expect.pack actual.pack &&
+	test_i18ngrep "does not match" err
+'
+
+test_done
@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='per-pack Bloom filter of object names'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 10)
+	do
+		test_seq $i 100 >file &&
+		git add file &&
+		test_commit $i || return 1
+	done
+'
+
+test_expect_success 'repack writes a bloom filter when asked' '
+	git repack -a -d &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	bloom=${pack%.pack}.bloom &&
+	test_path_is_missing $bloom &&
+	git -c pack.writeBloomFilter=true repack -a -d &&
+	test_path_is_file $bloom &&
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'index-pack writes a bloom filter' '
+	cp $pack test-1.pack &&
+	git -c pack.writeBloomFilter=true index-pack test-1.pack &&
+	test_path_is_file test-1.bloom &&
+	test_cmp $bloom test-1.bloom &&
+	git index-pack -o test-2.idx $pack &&
+	test_path_is_missing test-2.bloom
+'
+
+test_expect_success 'index-pack --verify does not write one' '
+	rm -f test-1.bloom &&
+	git -c pack.writeBloomFilter=true index-pack --verify test-1.pack &&
+	test_path_is_missing test-1.bloom
+'
+
+test_expect_success 'every object of the pack is found' '
+	git show-index <${pack%.pack}.idx | cut -d" " -f2 | sort >objects &&
+	git cat-file --batch-check <objects | cut -d" " -f1 >found &&
+	test_cmp objects found
+'
+
+test_expect_success 'missing objects are not looked for in the pack' '
+	missing=0123456789abcdef0123456789abcdef01234567 &&
+	mv $bloom bloom.bak &&
+	test_must_fail env GIT_DEBUG_LOOKUP=1 git cat-file -e $missing >out &&
+	mv bloom.bak $bloom &&
+	test -s out &&
+	test_must_fail env GIT_DEBUG_LOOKUP=1 git cat-file -e $missing >out &&
+	test_must_be_empty out
+'
+
+test_expect_success 'bloom filter that does not match the pack is ignored' '
+	cp $bloom bloom.bak &&
+	test_when_finished "mv -f bloom.bak $bloom" &&
+	chmod u+w $bloom &&
+	printf "XXXXXXXXXXXXXXXXXXXX" |
+	dd of=$bloom bs=1 seek=$(($(wc -c <$bloom) - 40)) count=20 \
+		conv=notrunc 2>/dev/null &&
+	git cat-file --batch-check <objects >batch 2>err &&
+	cut -d" " -f1 <batch >found &&
+	test_cmp objects found &&
+	test_i18ngrep "does not match" err
+'
+
+test_done
@@ -0,0 +1,87 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects'
+. ./test-lib.sh
+
+loose_path () {
+	echo .git/objects/$(echo "$1" | sed -e "s|^..|&/|")
+}
+
+cruft_objects () {
+	mtimes=$(ls .git/objects/pack/*.mtimes) &&
+	idx=${mtimes%.mtimes}.idx &&
+	git show-index <$idx | cut -d" " -f2 | sort
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git repack -ad &&
+	git checkout -b gone &&
+	test_commit gone &&
+	gone=$(git rev-parse HEAD) &&
+	git repack -d &&
+	git checkout master &&
+	git branch -D gone &&
+	git tag -d gone &&
+	git reflog expire --expire=all --all &&
+	old=$(echo old | git hash-object -w --stdin) &&
+	test-chmtime =-2592000 $(loose_path $old) &&
+	recent=$(echo recent | git hash-object -w --stdin)
+'
+
+test_expect_success 'repack --cruft packs unreachable objects' '
+	git repack -d --cruft &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 2 packs &&
+	ls .git/objects/pack/*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	git rev-list --objects $gone --not master | cut -d" " -f1 >expect &&
+	echo $old >>expect &&
+	echo $recent >>expect &&
+	sort -o expect expect &&
+	cruft_objects >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'cruft objects keep their times across repacks' '
+	git repack -d --cruft --cruft-expiration=2.weeks.ago &&
+	test_must_fail git cat-file -e $old &&
+	git cat-file -e $recent &&
+	git cat-file -e $gone
+'
+
+test_expect_success 'objects that become reachable leave the cruft pack' '
+	git branch back $gone &&
+	git repack -d --cruft &&
+	echo $recent >expect &&
+	cruft_objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc.cruftPacks avoids exploding unreachable objects' '
+	git branch -D back &&
+	git reflog expire --expire=all --all &&
+	git -c gc.cruftPacks=true gc &&
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	ls .git/objects/pack/*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	git cat-file -e $gone &&
+	git cat-file -e $recent
+'
+
+test_expect_success 'gc --cruft --prune=now drops all unreachable objects' '
+	git gc --cruft --prune=now &&
+	test_must_fail git cat-file -e $gone &&
+	test_must_fail git cat-file -e $recent
+'
+
+test_expect_success '--cruft is incompatible with --stdout and --revs' '
+	test_must_fail git pack-objects --cruft --stdout </dev/null &&
+	test_must_fail git pack-objects --cruft --revs pack </dev/null
+'
+
+test_done
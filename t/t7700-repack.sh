@@ -164,5 +164,99 @@ test_expect_success 'objects made unreachable by grafts only are kept' '
 	git cat-file -t $H1
 	'
 
+test_expect_success 'setup packs of very different sizes' '
+	git init geometric &&
+	(
+		cd geometric &&
+		for i in $(test_seq 1 20)
+		do
+			echo $i >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m big &&
+		git repack -d &&
+		for i in 1 2
+		do
+			echo small$i >small$i &&
+			git add small$i &&
+			git commit -m small$i &&
+			git repack -d || return 1
+		done &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 3 packs
+	)
+'
+
+test_expect_success '--geometric rolls up only the small packs' '
+	(
+		cd geometric &&
+		big=$(ls -S .git/objects/pack/*.pack | head -n 1) &&
+		unreachable=$(echo unreachable | git hash-object -w --stdin) &&
+		echo $unreachable | git pack-objects .git/objects/pack/pack &&
+		git prune-packed &&
+		echo loose >loose &&
+		git add loose &&
+		git commit -m loose &&
+		git repack -d --geometric=2 &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		test -f $big &&
+		git count-objects -v >count &&
+		grep "^count: 0" count &&
+		git cat-file -e $unreachable &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric leaves a geometric progression alone' '
+	(
+		cd geometric &&
+		ls .git/objects/pack/*.pack >before &&
+		git repack -d --geometric=2 &&
+		ls .git/objects/pack/*.pack >after &&
+		test_cmp before after
+	)
+'
+
+test_expect_success '--geometric compares each pack with all the smaller ones' '
+	git init geometric-sum &&
+	(
+		cd geometric-sum &&
+		# packs of 1, 2, 4 and 16 objects: each has twice as many
+		# as the next smaller one, but 4 < 2 * (1 + 2)
+		n=0 &&
+		for size in 1 2 4 16
+		do
+			for i in $(test_seq 1 $size)
+			do
+				n=$(($n + 1)) &&
+				echo blob$n | git hash-object -w --stdin || return 1
+			done >objects &&
+			git pack-objects .git/objects/pack/pack <objects >name &&
+			git prune-packed || return 1
+		done &&
+		big=.git/objects/pack/pack-$(cat name).pack &&
+		git repack -d --geometric=2 &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		test -f $big &&
+		for i in $(test_seq 1 $n)
+		do
+			echo blob$i | git hash-object --stdin || return 1
+		done | git cat-file --batch-check >out &&
+		! grep missing out
+	)
+'
+
+test_expect_success '--geometric cannot be used with -a' '
+	(
+		cd geometric &&
+		test_must_fail git repack -a --geometric=2 2>err &&
+		grep "cannot be used with" err &&
+		test_must_fail git repack --geometric=1 2>err &&
+		grep "at least 2" err
+	)
+'
+
 test_done
 
@@ -1,4 +1,103 @@
 #include "cache.h"
+#include "sha1-batch.h"
+#include "blob.h"
+
+#ifndef git_SHA1_Name
+/* OpenSSL and CommonCrypto pick their implementation themselves */
+#define git_SHA1_Name()		"default"
+#define git_SHA1_Select(name)	(strcmp((name), "default") ? -1 : 0)
+#endif
+
+static const char usage_str[] =
+	"test-sha1 [--impl=<name>] (--bench[=<megabytes>] | --bench-batch[=<bytes>] | [<bufsz-in-megabytes>])";
+
+/* Hash "mb" megabytes from memory and report the throughput. */
+static void bench(unsigned long mb)
+{
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	unsigned long i, bufsz = 1024 * 1024;
+	unsigned char *buffer = xmalloc(bufsz);
+	struct timeval start, end;
+	double elapsed;
+
+	for (i = 0; i < bufsz; i++)
+		buffer[i] = i * 2654435761u >> 24;
+
+	gettimeofday(&start, NULL);
+	git_SHA1_Init(&ctx);
+	for (i = 0; i < mb; i++)
+		git_SHA1_Update(&ctx, buffer, bufsz);
+	git_SHA1_Final(sha1, &ctx);
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%s: %lu MB in %.3f s, %.1f MB/s (%s)\n", git_SHA1_Name(),
+	       mb, elapsed, elapsed > 0 ? mb / elapsed : 0.0,
+	       sha1_to_hex(sha1));
+	free(buffer);
+}
+
+static double elapsed_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) +
+	       (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * Hash blobs of 0 to 2 * "size" bytes one at a time, then in batches,
+ * and report the throughput of both; dies if the results differ.
+ */
+static void bench_batch(unsigned long size)
+{
+	int nr = 65536, i, j;
+	struct sha1_batch_item *items = xcalloc(nr, sizeof(*items));
+	unsigned char (*expect)[20] = xcalloc(nr, 20);
+	unsigned char *data = xmalloc(2 * size + 1);
+	unsigned long total = 0;
+	struct timeval start;
+	double serial, batched;
+
+	for (i = 0; i < 2 * size + 1; i++)
+		data[i] = i * 2654435761u >> 24;
+	for (i = 0; i < nr; i++) {
+		items[i].len = (i * 2654435761u) % (2 * size + 1);
+		items[i].buf = data + (2 * size - items[i].len);
+		items[i].type = blob_type;
+		total += items[i].len;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i++)
+		hash_sha1_file(items[i].buf, items[i].len, blob_type, expect[i]);
+	serial = elapsed_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i += SHA1_BATCH_NR)
+		hash_sha1_batch(items + i, nr - i < SHA1_BATCH_NR ?
+				nr - i : SHA1_BATCH_NR);
+	batched = elapsed_since(&start);
+
+	for (i = 0; i < nr; i++)
+		if (hashcmp(items[i].sha1, expect[i]))
+			die("batch gives %s for object %d, expected %s",
+			    sha1_to_hex(items[i].sha1), i,
+			    sha1_to_hex(expect[i]));
+
+	j = total / nr;
+	printf("%s: %d objects of %d bytes on average, "
+	       "%.0f objects/s one at a time, %.0f objects/s in batches\n",
+	       git_SHA1_Name(), nr, j,
+	       serial > 0 ? nr / serial : 0.0,
+	       batched > 0 ? nr / batched : 0.0);
+	free(items);
+	free(expect);
+	free(data);
+}
 
 int main(int ac, char **av)
 {
@@ -7,6 +106,31 @@ int main(int ac, char **av)
 	unsigned bufsz = 8192;
 	char *buffer;
 
+	while (ac > 1 && !prefixcmp(av[1], "--")) {
+		const char *arg = av[1];
+
+		if (!prefixcmp(arg, "--impl=")) {
+			if (git_SHA1_Select(arg + 7))
+				die("SHA-1 implementation '%s' is not available",
+				    arg + 7);
+		} else if (!strcmp(arg, "--bench")) {
+			bench(256);
+			exit(0);
+		} else if (!prefixcmp(arg, "--bench=")) {
+			bench(strtoul(arg + 8, NULL, 10));
+			exit(0);
+		} else if (!strcmp(arg, "--bench-batch")) {
+			bench_batch(256);
+			exit(0);
+		} else if (!prefixcmp(arg, "--bench-batch=")) {
+			bench_batch(strtoul(arg + 14, NULL, 10));
+			exit(0);
+		} else
+			usage(usage_str);
+		ac--;
+		av++;
+	}
+
 	if (ac == 2)
 		bufsz = strtoul(av[1], NULL, 10) * 1024 * 1024;
 
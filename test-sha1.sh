@@ -1,7 +1,14 @@
 #!/bin/sh
 
-dd if=/dev/zero bs=1048576 count=100 2>/dev/null |
-/usr/bin/time ./test-sha1 >/dev/null
+# check every implementation that can run here
+for impl in default portable x86-sha armv8-crypto
+do
+	./test-sha1 --impl=$impl </dev/null >/dev/null 2>&1 || continue
+	./test-sha1 --impl=$impl --bench
+	for size in 0 100 1000
+	do
+		./test-sha1 --impl=$impl --bench-batch=$size || exit 1
+	done
 
 while read expect cnt pfx
 do
@@ -11,13 +18,13 @@ do
 			test -z "$pfx" || echo "$pfx"
 			dd if=/dev/zero bs=1048576 count=$cnt 2>/dev/null |
 			perl -pe 'y/\000/g/'
-		} | ./test-sha1 $cnt
+		} | ./test-sha1 --impl=$impl $cnt
 	`
 	if test "$expect" = "$actual"
 	then
-		echo "OK: $expect $cnt $pfx"
+		echo "OK: $impl $expect $cnt $pfx"
 	else
-		echo >&2 "OOPS: $cnt"
+		echo >&2 "OOPS: $impl $cnt"
 		echo >&2 "expect: $expect"
 		echo >&2 "actual: $actual"
 		exit 1
@@ -43,6 +50,7 @@ b095bd837a371593048136e429e9ac4b476e1bb3 512 frotz
 e33a291f42c30a159733dd98b8b3e4ff34158ca0 4090 4G
 #a3bf783bc20caa958f6cb24dd140a7b21984838d 9999 nitfol
 EOF
+done
 
 exit
 